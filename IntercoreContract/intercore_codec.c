@@ -0,0 +1,276 @@
+#include "intercore_codec.h"
+
+#include <string.h>
+
+// Wire size of each optional field, indexed by bitmap bit
+static const uint8_t field_size[] = {2, 2, 2, 1, 4, 2, 2, 2, 1, 1};
+
+#define KNOWN_FIELDS ((1u << (sizeof(field_size) / sizeof(field_size[0]))) - 1)
+
+static void put_u16(uint8_t *p, uint16_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t value)
+{
+	put_u16(p, (uint16_t)value);
+	put_u16(p + 2, (uint16_t)(value >> 16));
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+// Scale a whole unit value to fixed point, saturating at the limits of the wire field
+static int32_t to_fixed(int value, int scale, int32_t low, int32_t high)
+{
+	int64_t fixed = (int64_t)value * scale;
+	return fixed < low ? low : fixed > high ? high : (int32_t)fixed;
+}
+
+int intercore_encode(const INTERCORE_RECORD *record, uint8_t *buf, size_t size)
+{
+	uint16_t fields = record->fields & KNOWN_FIELDS;
+	size_t length = INTERCORE_WIRE_HEADER_SIZE;
+	uint8_t *p;
+
+	for (unsigned bit = 0; bit < sizeof(field_size); bit++) {
+		if (fields & (1u << bit)) {
+			length += field_size[bit];
+		}
+	}
+
+	if (length > size || (unsigned)record->cmd > UINT8_MAX) {
+		return -1;
+	}
+
+	buf[0] = INTERCORE_WIRE_MAGIC;
+	buf[1] = INTERCORE_WIRE_VERSION;
+	buf[2] = (uint8_t)length;
+	buf[3] = (uint8_t)record->cmd;
+	put_u16(buf + 4, fields);
+	p = buf + INTERCORE_WIRE_HEADER_SIZE;
+
+	if (fields & IC_FIELD_TEMPERATURE) {
+		put_u16(p, (uint16_t)record->temperature_centi);
+		p += 2;
+	}
+	if (fields & IC_FIELD_PRESSURE) {
+		put_u16(p, record->pressure_deci);
+		p += 2;
+	}
+	if (fields & IC_FIELD_HUMIDITY) {
+		put_u16(p, record->humidity_centi);
+		p += 2;
+	}
+	if (fields & IC_FIELD_OPERATING_MODE) {
+		*p++ = (uint8_t)record->operating_mode;
+	}
+	if (fields & IC_FIELD_SAMPLE_RATE) {
+		put_u32(p, record->sample_rate_ms);
+		p += 4;
+	}
+	if (fields & IC_FIELD_REQUEST_ID) {
+		put_u16(p, record->request_id);
+		p += 2;
+	}
+	if (fields & IC_FIELD_VERSION) {
+		put_u16(p, record->version);
+		p += 2;
+	}
+	if (fields & IC_FIELD_CREDITS) {
+		put_u16(p, record->credits);
+		p += 2;
+	}
+	if (fields & IC_FIELD_FLOW_POLICY) {
+		*p++ = (uint8_t)record->flow_policy;
+	}
+	if (fields & IC_FIELD_PACKED) {
+		*p++ = record->packed_frames;
+	}
+
+	return (int)length;
+}
+
+int intercore_decode(const uint8_t *buf, size_t size, INTERCORE_RECORD *record)
+{
+	const uint8_t *p = buf + INTERCORE_WIRE_HEADER_SIZE;
+	size_t length;
+	size_t known = INTERCORE_WIRE_HEADER_SIZE;
+	uint16_t fields;
+
+	if (size < INTERCORE_WIRE_HEADER_SIZE || buf[0] != INTERCORE_WIRE_MAGIC || buf[1] != INTERCORE_WIRE_VERSION) {
+		return -1;
+	}
+
+	length = buf[2];
+	if (length < INTERCORE_WIRE_HEADER_SIZE || length > size) {
+		return -1;
+	}
+
+	fields = get_u16(buf + 4);
+
+	// Fields are laid out in bit order, so the known ones always come first
+	for (unsigned bit = 0; bit < sizeof(field_size); bit++) {
+		if (fields & (1u << bit)) {
+			known += field_size[bit];
+		}
+	}
+
+	if (known > length) {
+		return -1;
+	}
+
+	*record = (INTERCORE_RECORD){0};
+	record->cmd = (INTERCORE_CMD)buf[3];
+	record->fields = fields & KNOWN_FIELDS;
+
+	if (fields & IC_FIELD_TEMPERATURE) {
+		record->temperature_centi = (int16_t)get_u16(p);
+		p += 2;
+	}
+	if (fields & IC_FIELD_PRESSURE) {
+		record->pressure_deci = get_u16(p);
+		p += 2;
+	}
+	if (fields & IC_FIELD_HUMIDITY) {
+		record->humidity_centi = get_u16(p);
+		p += 2;
+	}
+	if (fields & IC_FIELD_OPERATING_MODE) {
+		record->operating_mode = (HVAC_OPERATING_MODE)*p++;
+	}
+	if (fields & IC_FIELD_SAMPLE_RATE) {
+		record->sample_rate_ms = get_u32(p);
+		p += 4;
+	}
+	if (fields & IC_FIELD_REQUEST_ID) {
+		record->request_id = get_u16(p);
+		p += 2;
+	}
+	if (fields & IC_FIELD_VERSION) {
+		record->version = get_u16(p);
+		p += 2;
+	}
+	if (fields & IC_FIELD_CREDITS) {
+		record->credits = get_u16(p);
+		p += 2;
+	}
+	if (fields & IC_FIELD_FLOW_POLICY) {
+		record->flow_policy = (INTERCORE_FLOW_POLICY)*p++;
+	}
+	if (fields & IC_FIELD_PACKED) {
+		record->packed_frames = *p++;
+	}
+
+	return (int)length;
+}
+
+bool intercore_is_compact(const void *buf, size_t size)
+{
+	return size >= INTERCORE_WIRE_HEADER_SIZE && ((const uint8_t *)buf)[0] == INTERCORE_WIRE_MAGIC;
+}
+
+bool intercore_is_control(const void *buf, size_t size)
+{
+	INTERCORE_CMD cmd;
+
+	if (intercore_is_compact(buf, size)) {
+		cmd = (INTERCORE_CMD)((const uint8_t *)buf)[3];
+	} else if (size >= sizeof(cmd)) {
+		memcpy(&cmd, buf, sizeof(cmd));
+	} else {
+		return false;
+	}
+
+	switch (cmd) {
+	case IC_TARGET_TEMPERATURE:
+	case IC_SUBSCRIBE_SENSOR:
+	case IC_UNSUBSCRIBE_SENSOR:
+	case IC_GRANT_CREDIT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void intercore_record_from_block(const INTERCORE_BLOCK *block, INTERCORE_RECORD *record)
+{
+	*record = (INTERCORE_RECORD){0};
+	record->cmd = block->cmd;
+
+	switch (block->cmd) {
+	case IC_READ_SENSOR:
+		record->fields = IC_FIELD_TEMPERATURE | IC_FIELD_PRESSURE | IC_FIELD_HUMIDITY | IC_FIELD_OPERATING_MODE;
+		record->temperature_centi = (int16_t)to_fixed(block->temperature, 100, INT16_MIN, INT16_MAX);
+		record->pressure_deci = (uint16_t)to_fixed(block->pressure, 10, 0, UINT16_MAX);
+		record->humidity_centi = (uint16_t)to_fixed(block->humidity, 100, 0, UINT16_MAX);
+		record->operating_mode = block->operating_mode;
+		break;
+	case IC_TARGET_TEMPERATURE:
+		record->fields = IC_FIELD_TEMPERATURE;
+		record->temperature_centi = (int16_t)to_fixed(block->temperature, 100, INT16_MIN, INT16_MAX);
+		break;
+	default:
+		break;
+	}
+}
+
+void intercore_record_to_block(const INTERCORE_RECORD *record, INTERCORE_BLOCK *block)
+{
+	*block = (INTERCORE_BLOCK){0};
+	block->cmd = record->cmd;
+
+	// Round the fixed point values to the whole units INTERCORE_BLOCK carries
+	if (record->fields & IC_FIELD_TEMPERATURE) {
+		block->temperature = (record->temperature_centi + (record->temperature_centi < 0 ? -50 : 50)) / 100;
+	}
+	if (record->fields & IC_FIELD_PRESSURE) {
+		block->pressure = (record->pressure_deci + 5) / 10;
+	}
+	if (record->fields & IC_FIELD_HUMIDITY) {
+		block->humidity = (record->humidity_centi + 50) / 100;
+	}
+	if (record->fields & IC_FIELD_OPERATING_MODE) {
+		block->operating_mode = record->operating_mode;
+	}
+}
+
+void intercore_record_from_subscribe(const INTERCORE_SUBSCRIBE *subscribe, INTERCORE_RECORD *record)
+{
+	*record = (INTERCORE_RECORD){0};
+	record->cmd = subscribe->cmd;
+
+	if (subscribe->cmd == IC_SUBSCRIBE_SENSOR) {
+		record->fields = IC_FIELD_SAMPLE_RATE;
+		record->sample_rate_ms = subscribe->sample_rate_ms < 0 ? 0 : (uint32_t)subscribe->sample_rate_ms;
+
+		if (subscribe->flow_policy != INTERCORE_FLOW_NONE) {
+			record->fields |= IC_FIELD_FLOW_POLICY | IC_FIELD_CREDITS;
+			record->flow_policy = subscribe->flow_policy;
+			record->credits = (uint16_t)to_fixed(subscribe->credits, 1, 0, UINT16_MAX);
+		}
+		if (subscribe->packed_frames) {
+			record->fields |= IC_FIELD_PACKED;
+			record->packed_frames = 1;
+		}
+	}
+}
+
+void intercore_record_to_subscribe(const INTERCORE_RECORD *record, INTERCORE_SUBSCRIBE *subscribe)
+{
+	subscribe->cmd = record->cmd;
+	// An absent or out of range rate is passed on as 0, which subscribers reject
+	subscribe->sample_rate_ms = (record->fields & IC_FIELD_SAMPLE_RATE) && record->sample_rate_ms <= INT32_MAX ? (int)record->sample_rate_ms : 0;
+	subscribe->flow_policy = (record->fields & IC_FIELD_FLOW_POLICY) ? record->flow_policy : INTERCORE_FLOW_NONE;
+	subscribe->credits = (record->fields & IC_FIELD_CREDITS) ? record->credits : 0;
+	subscribe->packed_frames = (record->fields & IC_FIELD_PACKED) ? record->packed_frames : 0;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "intercore_contract.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Compact intercore wire format, shared by the real-time and high-level apps.
+//
+// A record is a 6 byte header followed by the fields flagged in its bitmap, in bit order.
+// All values are little endian with explicit widths, so the layout does not depend on the
+// compiler. Records are self delimiting, a message may hold several back to back.
+//
+//   byte 0     INTERCORE_WIRE_MAGIC, never a valid first byte of a legacy INTERCORE_BLOCK
+//   byte 1     INTERCORE_WIRE_VERSION, bumped only for incompatible changes
+//   byte 2     record length in bytes, header included
+//   byte 3     INTERCORE_CMD
+//   byte 4-5   field bitmap, IC_FIELD_*
+//
+// New fields are added at new bitmap bits. Decoders skip fields they do not know by using the
+// record length, so either core can be updated without redeploying the other.
+
+#define INTERCORE_WIRE_MAGIC 0xC5
+#define INTERCORE_WIRE_VERSION 1
+#define INTERCORE_WIRE_HEADER_SIZE 6
+#define INTERCORE_WIRE_MAX_RECORD_SIZE 32
+
+// Optional fields, the comment gives the wire encoding
+#define IC_FIELD_TEMPERATURE (1u << 0)		// int16, hundredths of a degree C
+#define IC_FIELD_PRESSURE (1u << 1)			// uint16, tenths of a hPa
+#define IC_FIELD_HUMIDITY (1u << 2)			// uint16, hundredths of a percent
+#define IC_FIELD_OPERATING_MODE (1u << 3)	// uint8, HVAC_OPERATING_MODE
+#define IC_FIELD_SAMPLE_RATE (1u << 4)		// uint32, milliseconds
+#define IC_FIELD_REQUEST_ID (1u << 5)		// uint16, echoed in the reply, see intercore_rpc.h
+#define IC_FIELD_VERSION (1u << 6)			// uint16, sample number of a reading, wraps
+#define IC_FIELD_CREDITS (1u << 7)			// uint16, credit granted, see intercore_flow.h
+#define IC_FIELD_FLOW_POLICY (1u << 8)		// uint8, INTERCORE_FLOW_POLICY
+#define IC_FIELD_PACKED (1u << 9)			// uint8, 1 asks for delta packed frames, see intercore_pack.h
+
+typedef struct
+{
+	INTERCORE_CMD cmd;
+	uint16_t fields;				// IC_FIELD_* present in this record
+	int16_t temperature_centi;		// fixed point, 2150 = 21.50 C
+	uint16_t pressure_deci;			// fixed point, 10132 = 1013.2 hPa
+	uint16_t humidity_centi;		// fixed point, 4550 = 45.50 %
+	HVAC_OPERATING_MODE operating_mode;
+	uint32_t sample_rate_ms;
+	uint16_t request_id;			// 0 for unsolicited records
+	uint16_t version;				// bumped for every new reading, repeats mean the same reading
+	uint16_t credits;				// initial credit on IC_SUBSCRIBE_SENSOR, a grant on any other command
+	INTERCORE_FLOW_POLICY flow_policy;
+	uint8_t packed_frames;			// on IC_SUBSCRIBE_SENSOR, send batches of readings as packed frames
+} INTERCORE_RECORD;
+
+/// <summary>
+/// Encode a record into buf.
+/// </summary>
+/// <returns>Bytes written, or -1 if buf is too small</returns>
+int intercore_encode(const INTERCORE_RECORD *record, uint8_t *buf, size_t size);
+
+/// <summary>
+/// Decode the record at the start of buf. Fields the decoder does not know are skipped.
+/// </summary>
+/// <returns>Bytes consumed, the offset of the next record, or -1 if buf does not start with a
+/// valid record</returns>
+int intercore_decode(const uint8_t *buf, size_t size, INTERCORE_RECORD *record);
+
+/// <summary>
+/// True if the message starts with a compact record rather than a legacy INTERCORE_BLOCK.
+/// </summary>
+bool intercore_is_compact(const void *buf, size_t size);
+
+/// <summary>
+/// True if the message starts with a control lane command, in either format.
+/// Control commands change how the real-time app behaves (setpoint, subscription) and are handled
+/// ahead of queued sensor polls and bulk data.
+/// </summary>
+bool intercore_is_control(const void *buf, size_t size);
+
+// Conversions to and from the legacy INTERCORE_BLOCK and INTERCORE_SUBSCRIBE layouts
+void intercore_record_from_block(const INTERCORE_BLOCK *block, INTERCORE_RECORD *record);
+void intercore_record_to_block(const INTERCORE_RECORD *record, INTERCORE_BLOCK *block);
+void intercore_record_from_subscribe(const INTERCORE_SUBSCRIBE *subscribe, INTERCORE_RECORD *record);
+void intercore_record_to_subscribe(const INTERCORE_RECORD *record, INTERCORE_SUBSCRIBE *subscribe);
@@ -4,7 +4,14 @@ typedef enum
 {
 	IC_UNKNOWN,
 	IC_READ_SENSOR,
-	IC_TARGET_TEMPERATURE
+	IC_TARGET_TEMPERATURE,
+	IC_BATCH,
+	IC_SUBSCRIBE_SENSOR,
+	IC_UNSUBSCRIBE_SENSOR,
+	IC_READ_STATS,
+	IC_GRANT_CREDIT,
+	IC_READ_LOAD,
+	IC_READ_MEMORY
 } INTERCORE_CMD;
 
 typedef enum
@@ -23,3 +30,127 @@ typedef struct
 	int humidity;
 	HVAC_OPERATING_MODE operating_mode;	
 } INTERCORE_BLOCK;
+
+// What the real-time app does with a pushed reading when the subscriber has no credit left,
+// see intercore_flow.h
+typedef enum
+{
+	INTERCORE_FLOW_NONE,		// no flow control, readings are sent until the ring is full
+	INTERCORE_FLOW_BLOCK,		// stop sampling until credit arrives, no reading is lost
+	INTERCORE_FLOW_COALESCE,	// keep sampling, send only the latest reading once credit arrives
+	INTERCORE_FLOW_DOWNSAMPLE	// halve the rate while credit is low, skip readings without credit
+} INTERCORE_FLOW_POLICY;
+
+// Sent by the high-level app to have readings pushed as soon as they are sampled,
+// instead of polling with IC_READ_SENSOR. Pushed readings arrive as IC_READ_SENSOR blocks.
+// Older high-level apps send only cmd and sample_rate_ms, the rest reads as 0, no flow control.
+typedef struct
+{
+	INTERCORE_CMD cmd;	// IC_SUBSCRIBE_SENSOR or IC_UNSUBSCRIBE_SENSOR
+	int sample_rate_ms;
+	INTERCORE_FLOW_POLICY flow_policy;
+	int credits;		// readings the subscriber can take before it grants more
+	int packed_frames;	// nonzero to have batches sent as intercore_pack.h frames, compact peers only
+} INTERCORE_SUBSCRIBE;
+
+// Sent by the high-level app as it drains pushed readings, lets the real-time app send that many more
+typedef struct
+{
+	INTERCORE_CMD cmd;	// IC_GRANT_CREDIT
+	int credits;
+} INTERCORE_CREDIT;
+
+// Reply to IC_READ_STATS, totals since the real-time app started.
+// Latency is measured from the frame being committed to the high-level side reading it.
+// Bucket i counts latencies under 2^i ms, except the last bucket which counts everything longer.
+#define INTERCORE_LATENCY_BUCKETS 12
+
+typedef struct
+{
+	INTERCORE_CMD cmd;			// IC_READ_STATS
+	unsigned int records;		// records sent
+	unsigned int frames;		// frames committed to the outbound ring
+	unsigned int dropped;		// records discarded because the outbound ring was full
+	unsigned int oversize;		// reservations larger than the outbound ring can ever hold
+	unsigned int wraps;			// frames split around the end of the outbound ring
+	unsigned int high_water;	// most bytes waiting in the outbound ring
+	unsigned int buffer_size;	// outbound ring size in bytes
+	unsigned int latency_ms[INTERCORE_LATENCY_BUCKETS];
+	unsigned int request_id;	// request_id of the compact IC_READ_STATS request, 0 if it had none
+	unsigned int throttled;		// readings held back, coalesced or skipped for lack of credit
+	unsigned int sample_latency_avg_us;	// sample timer expiry to the sample starting, 0 if not measured
+	unsigned int sample_jitter_us;		// spread of that latency
+} INTERCORE_STATS;
+
+// Reply to IC_READ_LOAD, CPU time since the real-time app started, see intercore_load.h.
+// Times are milliseconds that wrap, the high-level app works out the load over an interval from
+// the difference between two replies. Threads are ThreadX threads, or jobs in the bare-metal app.
+#define INTERCORE_LOAD_MAX_THREADS 6
+#define INTERCORE_LOAD_NAME_SIZE 12
+
+typedef struct
+{
+	char name[INTERCORE_LOAD_NAME_SIZE];	// truncated, always terminated
+	unsigned int run_ms;
+} INTERCORE_THREAD_LOAD;
+
+typedef struct
+{
+	INTERCORE_CMD cmd;			// IC_READ_LOAD
+	unsigned int request_id;	// request_id of the compact IC_READ_LOAD request, 0 if it had none
+	unsigned int elapsed_ms;	// time accounted for
+	unsigned int idle_ms;		// time no thread was running
+	unsigned int thread_count;
+	INTERCORE_THREAD_LOAD threads[INTERCORE_LOAD_MAX_THREADS];
+} INTERCORE_LOAD;
+
+// Reply to IC_READ_MEMORY, high-water marks since the real-time app started, see intercore_memory.h.
+// Stacks are ThreadX thread stacks, or the one stack of the bare-metal app. The heap is what malloc
+// allocates from and the pool is the ThreadX byte pool thread stacks are carved from, both are 0 in
+// apps that have none.
+#define INTERCORE_MEMORY_MAX_STACKS 6
+#define INTERCORE_MEMORY_NAME_SIZE 12
+
+typedef struct
+{
+	char name[INTERCORE_MEMORY_NAME_SIZE];	// truncated, always terminated
+	unsigned int size;						// bytes
+	unsigned int peak;						// most bytes ever used
+} INTERCORE_STACK_USAGE;
+
+typedef struct
+{
+	INTERCORE_CMD cmd;			// IC_READ_MEMORY
+	unsigned int request_id;	// request_id of the compact IC_READ_MEMORY request, 0 if it had none
+	unsigned int heap_size;
+	unsigned int heap_free;
+	unsigned int heap_min_free;	// least heap ever free
+	unsigned int heap_failures;	// allocations the heap could not serve
+	unsigned int pool_size;
+	unsigned int pool_free;
+	unsigned int pool_min_free;	// least pool free when sampled
+	unsigned int stack_count;
+	INTERCORE_STACK_USAGE stacks[INTERCORE_MEMORY_MAX_STACKS];
+} INTERCORE_MEMORY;
+
+// A batch frame carries several records behind a single mailbox doorbell.
+// The frame is an INTERCORE_BATCH_HEADER followed by count INTERCORE_BLOCK records.
+// 32 records keep the frame well inside the 1024 byte intercore message limit.
+#define INTERCORE_BATCH_MAX_RECORDS 32
+#define INTERCORE_BATCH_FRAME_SIZE(count) (sizeof(INTERCORE_BATCH_HEADER) + (count) * sizeof(INTERCORE_BLOCK))
+
+typedef struct
+{
+	INTERCORE_CMD cmd;	// IC_BATCH
+	int count;
+} INTERCORE_BATCH_HEADER;
+
+typedef union
+{
+	INTERCORE_BLOCK block;
+	INTERCORE_BATCH_HEADER batch;
+	INTERCORE_STATS stats;
+	INTERCORE_LOAD load;
+	INTERCORE_MEMORY memory;
+	unsigned char frame[INTERCORE_BATCH_FRAME_SIZE(INTERCORE_BATCH_MAX_RECORDS)];
+} INTERCORE_FRAME;
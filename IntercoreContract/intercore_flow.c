@@ -0,0 +1,92 @@
+#include "intercore_flow.h"
+
+void intercore_flow_start(INTERCORE_FLOW *flow, INTERCORE_FLOW_POLICY policy, uint32_t credits)
+{
+	flow->policy = credits == 0 ? INTERCORE_FLOW_NONE : policy;
+	flow->credits = credits;
+	flow->window = credits;
+	flow->offered = 0;
+	flow->held = false;
+}
+
+bool intercore_flow_grant(INTERCORE_FLOW *flow, uint32_t credits)
+{
+	if (flow->policy == INTERCORE_FLOW_NONE) {
+		return false;
+	}
+
+	// A grant never takes the sender past the window, grants for readings sent before a
+	// resubscribe must not inflate it
+	flow->credits = (credits > flow->window - flow->credits) ? flow->window : flow->credits + credits;
+
+	return flow->held && flow->credits > 0;
+}
+
+bool intercore_flow_offer(INTERCORE_FLOW *flow)
+{
+	switch (flow->policy) {
+	case INTERCORE_FLOW_BLOCK:
+	case INTERCORE_FLOW_COALESCE:
+		if (flow->credits == 0) {
+			// A second reading while one is held replaces it, only BLOCK stops that happening
+			flow->throttled++;
+			flow->held = true;
+			return false;
+		}
+		flow->held = false;
+		break;
+
+	case INTERCORE_FLOW_DOWNSAMPLE:
+		// Half rate once half the window is in flight, nothing at all without credit
+		if (flow->credits == 0 || (flow->credits <= flow->window / 2 && (flow->offered++ & 1))) {
+			flow->throttled++;
+			return false;
+		}
+		break;
+
+	default:
+		return true;
+	}
+
+	flow->credits--;
+	return true;
+}
+
+bool intercore_flow_paused(const INTERCORE_FLOW *flow)
+{
+	return flow->policy == INTERCORE_FLOW_BLOCK && flow->held;
+}
+
+void intercore_flow_grant_start(INTERCORE_FLOW_GRANT *grant, uint32_t window)
+{
+	grant->window = window;
+	grant->drained = 0;
+}
+
+uint32_t intercore_flow_drained(INTERCORE_FLOW_GRANT *grant, uint32_t readings)
+{
+	uint32_t credits;
+
+	if (grant->window == 0) {
+		return 0;
+	}
+
+	grant->drained += readings;
+
+	// Granting in halves keeps the sender busy without a grant for every reading
+	if (grant->drained < (grant->window + 1) / 2) {
+		return 0;
+	}
+
+	credits = grant->drained;
+	grant->drained = 0;
+	return credits;
+}
+
+uint32_t intercore_flow_take(INTERCORE_FLOW_GRANT *grant)
+{
+	uint32_t credits = grant->drained;
+
+	grant->drained = 0;
+	return credits;
+}
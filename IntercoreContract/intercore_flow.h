@@ -0,0 +1,73 @@
+#pragma once
+
+#include "intercore_contract.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Credit based flow control for the pushed sensor stream.
+//
+// The subscriber grants the real-time app a number of credits when it subscribes, one per reading
+// it can take. Each reading sent uses one. As the subscriber drains readings it grants credits
+// back, piggybacked as IC_FIELD_CREDITS on its next compact command or as IC_GRANT_CREDIT.
+// When the real-time app runs out, the INTERCORE_FLOW_POLICY chosen at subscribe time decides
+// what happens to new readings, instead of them being dropped when the ring fills.
+//
+// Producer and consumer state are plain structs, owned by the one thread that uses them.
+
+// Producer side, kept by the real-time app for its subscriber
+typedef struct
+{
+	INTERCORE_FLOW_POLICY policy;
+	uint32_t credits;		// readings that may be sent before more credit arrives
+	uint32_t window;		// credit granted at subscribe time
+	uint32_t offered;		// readings offered, every other one is skipped when downsampling
+	bool held;				// a reading is waiting for credit, BLOCK and COALESCE
+	uint32_t throttled;		// readings held back, coalesced or skipped, total since startup
+} INTERCORE_FLOW;
+
+// Consumer side, kept by the high-level app
+typedef struct
+{
+	uint32_t window;		// credit granted at subscribe time
+	uint32_t drained;		// readings taken since the last grant
+} INTERCORE_FLOW_GRANT;
+
+/// <summary>
+/// Start, or restart, flow control for a new subscription. INTERCORE_FLOW_NONE or a window of 0
+/// turns it off, readings are then always sent.
+/// </summary>
+void intercore_flow_start(INTERCORE_FLOW *flow, INTERCORE_FLOW_POLICY policy, uint32_t credits);
+
+/// <summary>
+/// Add credit granted by the subscriber.
+/// </summary>
+/// <returns>true if a held reading should now be sent, call intercore_flow_offer for it</returns>
+bool intercore_flow_grant(INTERCORE_FLOW *flow, uint32_t credits);
+
+/// <summary>
+/// A new reading is ready, or a held one may go now. Uses a credit if the reading is to be sent.
+/// </summary>
+/// <returns>true to send the reading, false if the policy holds or skips it</returns>
+bool intercore_flow_offer(INTERCORE_FLOW *flow);
+
+/// <summary>
+/// True while a BLOCK subscriber has no credit, the producer should not take new samples.
+/// </summary>
+bool intercore_flow_paused(const INTERCORE_FLOW *flow);
+
+/// <summary>
+/// Start granting credit for a new subscription of window readings.
+/// </summary>
+void intercore_flow_grant_start(INTERCORE_FLOW_GRANT *grant, uint32_t window);
+
+/// <summary>
+/// Count readings the consumer has taken.
+/// </summary>
+/// <returns>Credit to grant now, 0 until half the window has been drained</returns>
+uint32_t intercore_flow_drained(INTERCORE_FLOW_GRANT *grant, uint32_t readings);
+
+/// <summary>
+/// Take whatever credit has been drained so far, to piggyback on a command about to be sent.
+/// </summary>
+uint32_t intercore_flow_take(INTERCORE_FLOW_GRANT *grant);
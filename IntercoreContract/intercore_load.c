@@ -0,0 +1,138 @@
+#include "intercore_load.h"
+
+#include <stddef.h>
+#include <string.h>
+
+typedef struct
+{
+	const void *owner;
+	uint64_t ticks;
+} LOAD_SLOT;
+
+static INTERCORE_LOAD_CLOCK read_clock;
+static uint32_t ticks_per_second;
+static uint32_t last_count;
+static uint64_t elapsed_ticks, idle_ticks;
+static LOAD_SLOT slots[INTERCORE_LOAD_MAX_THREADS];
+static char slot_names[INTERCORE_LOAD_MAX_THREADS][INTERCORE_LOAD_NAME_SIZE];
+static int slot_count;
+static LOAD_SLOT *running;	// NULL while idle
+
+static unsigned int ticks_to_ms(uint64_t ticks)
+{
+	// Wraps like the counter the high-level app differences
+	return (unsigned int)(ticks * 1000 / ticks_per_second);
+}
+
+static void charge(void)
+{
+	uint32_t now = read_clock();
+	uint32_t ticks = now - last_count;
+
+	last_count = now;
+	elapsed_ticks += ticks;
+
+	if (running) {
+		running->ticks += ticks;
+	} else {
+		idle_ticks += ticks;
+	}
+}
+
+static LOAD_SLOT *find_slot(const void *owner, const char *name)
+{
+	for (int i = 0; i < slot_count; i++) {
+		if (slots[i].owner == owner) {
+			return &slots[i];
+		}
+	}
+
+	if (slot_count == INTERCORE_LOAD_MAX_THREADS - 1) {
+		slots[slot_count].owner = NULL;
+		strncpy(slot_names[slot_count], "other", INTERCORE_LOAD_NAME_SIZE - 1);
+		slot_count++;
+	}
+	if (slot_count == INTERCORE_LOAD_MAX_THREADS) {
+		return &slots[INTERCORE_LOAD_MAX_THREADS - 1];
+	}
+
+	slots[slot_count].owner = owner;
+	slots[slot_count].ticks = 0;
+	strncpy(slot_names[slot_count], name ? name : "", INTERCORE_LOAD_NAME_SIZE - 1);
+	return &slots[slot_count++];
+}
+
+void intercore_load_init(INTERCORE_LOAD_CLOCK clock, uint32_t clock_hz)
+{
+	read_clock = clock;
+	ticks_per_second = clock_hz;
+	last_count = clock();
+	elapsed_ticks = idle_ticks = 0;
+	slot_count = 0;
+	running = NULL;
+	memset(slot_names, 0, sizeof(slot_names));
+}
+
+void intercore_load_switch(const void *owner, const char *name)
+{
+	if (read_clock == NULL) {
+		return;
+	}
+
+	charge();
+	running = owner ? find_slot(owner, name) : NULL;
+}
+
+void intercore_load_read(INTERCORE_LOAD *load)
+{
+	load->cmd = IC_READ_LOAD;
+	load->elapsed_ms = load->idle_ms = load->thread_count = 0;
+
+	if (read_clock == NULL) {
+		return;
+	}
+
+	charge();
+	load->elapsed_ms = ticks_to_ms(elapsed_ticks);
+	load->idle_ms = ticks_to_ms(idle_ticks);
+	load->thread_count = (unsigned int)slot_count;
+
+	for (int i = 0; i < slot_count; i++) {
+		memcpy(load->threads[i].name, slot_names[i], INTERCORE_LOAD_NAME_SIZE);
+		load->threads[i].run_ms = ticks_to_ms(slots[i].ticks);
+	}
+}
+
+static const INTERCORE_THREAD_LOAD *find_thread(const INTERCORE_LOAD *load, const char *name)
+{
+	for (unsigned int i = 0; i < load->thread_count && i < INTERCORE_LOAD_MAX_THREADS; i++) {
+		if (strncmp(load->threads[i].name, name, INTERCORE_LOAD_NAME_SIZE) == 0) {
+			return &load->threads[i];
+		}
+	}
+	return NULL;
+}
+
+int intercore_load_percent(const INTERCORE_LOAD *earlier, const INTERCORE_LOAD *later)
+{
+	unsigned int elapsed = later->elapsed_ms - earlier->elapsed_ms;
+	unsigned int idle = later->idle_ms - earlier->idle_ms;
+
+	if (elapsed == 0 || idle > elapsed) {
+		return -1;
+	}
+	return (int)((uint64_t)(elapsed - idle) * 100 / elapsed);
+}
+
+int intercore_load_thread_percent(const INTERCORE_LOAD *earlier, const INTERCORE_LOAD *later, const char *name)
+{
+	const INTERCORE_THREAD_LOAD *before = find_thread(earlier, name), *after = find_thread(later, name);
+	unsigned int elapsed = later->elapsed_ms - earlier->elapsed_ms;
+
+	if (after == NULL || elapsed == 0) {
+		return -1;
+	}
+
+	// Threads are only ever added, one missing from the earlier reply had not run yet
+	return (int)((uint64_t)(after->run_ms - (before ? before->run_ms : 0)) * 100 / elapsed);
+}
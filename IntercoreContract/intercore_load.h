@@ -0,0 +1,46 @@
+#pragma once
+
+#include "intercore_contract.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// CPU time accounting for the real-time apps, reported by IC_READ_LOAD.
+//
+// The app calls intercore_load_switch whenever the CPU moves to another thread, or job, or goes
+// idle. The time since the last switch is charged to whatever was running, read from a
+// free-running hardware counter, so the totals add up to the time the counter has run however
+// short each slice is. Interrupt handlers are charged to whatever they interrupted.
+//
+// Nothing here locks, intercore_load_read must not run in the middle of a switch. A ThreadX thread
+// calls it with interrupts disabled, the bare-metal app switches and reads from its one loop.
+
+// Reads the free-running counter, which may wrap
+typedef uint32_t (*INTERCORE_LOAD_CLOCK)(void);
+
+/// <summary>
+/// Start accounting, charging time to idle until the first switch.
+/// </summary>
+void intercore_load_init(INTERCORE_LOAD_CLOCK clock, uint32_t clock_hz);
+
+/// <summary>
+/// Charge the time since the last switch and start charging owner, NULL for idle.
+/// Owners beyond INTERCORE_LOAD_MAX_THREADS - 1 share the last slot, named "other".
+/// </summary>
+void intercore_load_switch(const void *owner, const char *name);
+
+/// <summary>
+/// Totals so far, including the slice that is running.
+/// </summary>
+void intercore_load_read(INTERCORE_LOAD *load);
+
+/// <summary>
+/// Busy share of the time between two replies from the same real-time app, in percent.
+/// </summary>
+/// <returns>-1 if no time passed between them</returns>
+int intercore_load_percent(const INTERCORE_LOAD *earlier, const INTERCORE_LOAD *later);
+
+/// <summary>
+/// A thread's share of the time between two replies, in percent, -1 if the later one lacks it.
+/// </summary>
+int intercore_load_thread_percent(const INTERCORE_LOAD *earlier, const INTERCORE_LOAD *later, const char *name);
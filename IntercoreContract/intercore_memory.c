@@ -0,0 +1,39 @@
+#include "intercore_memory.h"
+
+#include <string.h>
+
+void intercore_memory_paint(void *start, size_t size)
+{
+	uint32_t *word = start;
+
+	for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+		word[i] = INTERCORE_STACK_FILL;
+	}
+}
+
+unsigned int intercore_memory_stack_peak(const void *start, size_t size)
+{
+	const uint32_t *word = start;
+	size_t words = size / sizeof(uint32_t), untouched = 0;
+
+	while (untouched < words && word[untouched] == INTERCORE_STACK_FILL) {
+		untouched++;
+	}
+
+	return (unsigned int)(size - untouched * sizeof(uint32_t));
+}
+
+void intercore_memory_add_stack(INTERCORE_MEMORY *memory, const char *name, const void *start, size_t size)
+{
+	INTERCORE_STACK_USAGE *stack;
+
+	if (memory->stack_count >= INTERCORE_MEMORY_MAX_STACKS) {
+		return;
+	}
+
+	stack = &memory->stacks[memory->stack_count++];
+	memset(stack->name, 0, sizeof(stack->name));
+	strncpy(stack->name, name ? name : "", INTERCORE_MEMORY_NAME_SIZE - 1);
+	stack->size = (unsigned int)size;
+	stack->peak = intercore_memory_stack_peak(start, size);
+}
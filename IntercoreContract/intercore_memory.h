@@ -0,0 +1,34 @@
+#pragma once
+
+#include "intercore_contract.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Stack high-water marks for the real-time apps, reported by IC_READ_MEMORY.
+//
+// A stack is filled with INTERCORE_STACK_FILL before it is used. Stacks grow down, so the words at
+// the bottom that still hold the fill have never been touched, everything above the lowest word
+// that does not is the most the stack has used. The mark can be low by a few bytes if a value
+// pushed happened to equal the fill, it is never high.
+//
+// ThreadX fills its thread stacks with this pattern itself, the bare-metal app paints its one stack
+// with intercore_memory_paint at startup.
+
+// ThreadX's TX_STACK_FILL
+#define INTERCORE_STACK_FILL 0xEFEFEFEFu
+
+/// <summary>
+/// Fill a stack region that is not in use yet.
+/// </summary>
+void intercore_memory_paint(void *start, size_t size);
+
+/// <summary>
+/// Most bytes ever used of a descending stack from start to start + size, painted beforehand.
+/// </summary>
+unsigned int intercore_memory_stack_peak(const void *start, size_t size);
+
+/// <summary>
+/// Add a stack and its high-water mark to a reply, stacks beyond INTERCORE_MEMORY_MAX_STACKS are left out.
+/// </summary>
+void intercore_memory_add_stack(INTERCORE_MEMORY *memory, const char *name, const void *start, size_t size);
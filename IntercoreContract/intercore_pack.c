@@ -0,0 +1,291 @@
+#include "intercore_pack.h"
+
+// Most varint bytes a delta of each field can take, indexed by bitmap bit. A delta of two 16 bit
+// values needs 17 bits, 3 varint bytes, a delta of two 8 bit values 2 bytes.
+static const uint8_t column_bound[] = {3, 3, 3, 2, 5, 3, 3, 3, 2, 2};
+
+#define KNOWN_FIELDS ((1u << (sizeof(column_bound) / sizeof(column_bound[0]))) - 1)
+
+static uint32_t zigzag(int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static uint8_t *put_varint(uint8_t *p, const uint8_t *end, uint32_t value)
+{
+	while (p < end) {
+		if (value < 0x80) {
+			*p++ = (uint8_t)value;
+			return p;
+		}
+		*p++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	return NULL;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint32_t *value)
+{
+	uint32_t result = 0;
+
+	// Almost every delta is a single byte, so that case skips the loop
+	if (p < end && *p < 0x80) {
+		*value = *p;
+		return p + 1;
+	}
+
+	for (unsigned shift = 0; p < end && shift < 35; shift += 7) {
+		result |= (uint32_t)(*p & 0x7F) << shift;
+		if (*p++ < 0x80) {
+			*value = result;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+// Column values are widened to 32 bits, signed fields sign extended
+static uint32_t get_field(const INTERCORE_RECORD *record, unsigned bit)
+{
+	switch (1u << bit) {
+	case IC_FIELD_TEMPERATURE:
+		return (uint32_t)(int32_t)record->temperature_centi;
+	case IC_FIELD_PRESSURE:
+		return record->pressure_deci;
+	case IC_FIELD_HUMIDITY:
+		return record->humidity_centi;
+	case IC_FIELD_OPERATING_MODE:
+		return (uint8_t)record->operating_mode;
+	case IC_FIELD_SAMPLE_RATE:
+		return record->sample_rate_ms;
+	case IC_FIELD_REQUEST_ID:
+		return record->request_id;
+	case IC_FIELD_VERSION:
+		return record->version;
+	case IC_FIELD_CREDITS:
+		return record->credits;
+	case IC_FIELD_FLOW_POLICY:
+		return (uint8_t)record->flow_policy;
+	case IC_FIELD_PACKED:
+		return record->packed_frames;
+	default:
+		return 0;
+	}
+}
+
+static void set_field(INTERCORE_RECORD *record, unsigned bit, uint32_t value)
+{
+	switch (1u << bit) {
+	case IC_FIELD_TEMPERATURE:
+		record->temperature_centi = (int16_t)value;
+		break;
+	case IC_FIELD_PRESSURE:
+		record->pressure_deci = (uint16_t)value;
+		break;
+	case IC_FIELD_HUMIDITY:
+		record->humidity_centi = (uint16_t)value;
+		break;
+	case IC_FIELD_OPERATING_MODE:
+		record->operating_mode = (HVAC_OPERATING_MODE)(uint8_t)value;
+		break;
+	case IC_FIELD_SAMPLE_RATE:
+		record->sample_rate_ms = value;
+		break;
+	case IC_FIELD_REQUEST_ID:
+		record->request_id = (uint16_t)value;
+		break;
+	case IC_FIELD_VERSION:
+		record->version = (uint16_t)value;
+		break;
+	case IC_FIELD_CREDITS:
+		record->credits = (uint16_t)value;
+		break;
+	case IC_FIELD_FLOW_POLICY:
+		record->flow_policy = (INTERCORE_FLOW_POLICY)(uint8_t)value;
+		break;
+	case IC_FIELD_PACKED:
+		record->packed_frames = (uint8_t)value;
+		break;
+	default:
+		break;
+	}
+}
+
+size_t intercore_pack_bound(uint16_t fields, int count)
+{
+	size_t record_bound = 0;
+
+	for (unsigned bit = 0; bit < sizeof(column_bound); bit++) {
+		if (fields & (1u << bit)) {
+			record_bound += column_bound[bit];
+		}
+	}
+
+	return INTERCORE_PACK_HEADER_SIZE + record_bound * (size_t)(count < 0 ? 0 : count);
+}
+
+int intercore_pack_records(const INTERCORE_RECORD *records, int count, uint8_t *buf, size_t size)
+{
+	uint16_t fields;
+	uint8_t *p = buf + INTERCORE_PACK_HEADER_SIZE;
+	const uint8_t *end = buf + size;
+
+	if (count <= 0 || count > INTERCORE_PACK_MAX_RECORDS || size < INTERCORE_PACK_HEADER_SIZE || (unsigned)records[0].cmd > UINT8_MAX) {
+		return -1;
+	}
+
+	fields = records[0].fields & KNOWN_FIELDS;
+
+	for (int i = 1; i < count; i++) {
+		if (records[i].cmd != records[0].cmd || (records[i].fields & KNOWN_FIELDS) != fields) {
+			return -1;
+		}
+	}
+
+	buf[0] = INTERCORE_PACK_MAGIC;
+	buf[1] = INTERCORE_PACK_VERSION;
+	buf[2] = (uint8_t)records[0].cmd;
+	buf[3] = (uint8_t)count;
+	buf[4] = (uint8_t)fields;
+	buf[5] = (uint8_t)(fields >> 8);
+
+	for (unsigned bit = 0; bit < sizeof(column_bound); bit++) {
+		uint32_t previous = 0;
+
+		if (!(fields & (1u << bit))) {
+			continue;
+		}
+
+		for (int i = 0; i < count; i++) {
+			uint32_t value = get_field(&records[i], bit);
+
+			if ((p = put_varint(p, end, zigzag((int32_t)(value - previous)))) == NULL) {
+				return -1;
+			}
+			previous = value;
+		}
+	}
+
+	return (int)(p - buf);
+}
+
+int intercore_unpack_records(const uint8_t *buf, size_t size, INTERCORE_RECORD *records, int max_count)
+{
+	const uint8_t *p = buf + INTERCORE_PACK_HEADER_SIZE;
+	const uint8_t *end = buf + size;
+	uint16_t fields;
+	int count;
+
+	if (!intercore_is_packed(buf, size) || buf[1] != INTERCORE_PACK_VERSION) {
+		return -1;
+	}
+
+	count = buf[3];
+	fields = (uint16_t)(buf[4] | (buf[5] << 8));
+
+	if (count > max_count) {
+		return -1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		records[i] = (INTERCORE_RECORD){.cmd = (INTERCORE_CMD)buf[2], .fields = fields & KNOWN_FIELDS};
+	}
+
+	// Unknown fields are still walked, their values are discarded
+	for (unsigned bit = 0; bit < 16; bit++) {
+		uint32_t value = 0, delta;
+
+		if (!(fields & (1u << bit))) {
+			continue;
+		}
+
+		for (int i = 0; i < count; i++) {
+			if ((p = get_varint(p, end, &delta)) == NULL) {
+				return -1;
+			}
+			value += (uint32_t)unzigzag(delta);
+			set_field(&records[i], bit, value);
+		}
+	}
+
+	return count;
+}
+
+bool intercore_is_packed(const void *buf, size_t size)
+{
+	return size >= INTERCORE_PACK_HEADER_SIZE && ((const uint8_t *)buf)[0] == INTERCORE_PACK_MAGIC;
+}
+
+int intercore_pack_i16(const int16_t *samples, size_t count, size_t channels, uint8_t *buf, size_t size)
+{
+	uint8_t *p = buf;
+	const uint8_t *end = buf + size;
+
+	for (size_t i = 0; i < count; i++) {
+		int32_t previous = i < channels ? 0 : samples[i - channels];
+
+		if ((p = put_varint(p, end, zigzag(samples[i] - previous))) == NULL) {
+			return -1;
+		}
+	}
+
+	return (int)(p - buf);
+}
+
+int intercore_unpack_i16(const uint8_t *buf, size_t size, int16_t *samples, size_t count, size_t channels)
+{
+	const uint8_t *p = buf;
+	const uint8_t *end = buf + size;
+	uint32_t delta;
+
+	for (size_t i = 0; i < count; i++) {
+		int32_t previous = i < channels ? 0 : samples[i - channels];
+
+		if ((p = get_varint(p, end, &delta)) == NULL) {
+			return -1;
+		}
+		samples[i] = (int16_t)(previous + unzigzag(delta));
+	}
+
+	return (int)(p - buf);
+}
+
+int intercore_pack_i32(const int32_t *samples, size_t count, size_t channels, uint8_t *buf, size_t size)
+{
+	uint8_t *p = buf;
+	const uint8_t *end = buf + size;
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t previous = i < channels ? 0 : (uint32_t)samples[i - channels];
+
+		// Deltas wrap around, unpack wraps them back
+		if ((p = put_varint(p, end, zigzag((int32_t)((uint32_t)samples[i] - previous)))) == NULL) {
+			return -1;
+		}
+	}
+
+	return (int)(p - buf);
+}
+
+int intercore_unpack_i32(const uint8_t *buf, size_t size, int32_t *samples, size_t count, size_t channels)
+{
+	const uint8_t *p = buf;
+	const uint8_t *end = buf + size;
+	uint32_t delta;
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t previous = i < channels ? 0 : (uint32_t)samples[i - channels];
+
+		if ((p = get_varint(p, end, &delta)) == NULL) {
+			return -1;
+		}
+		samples[i] = (int32_t)(previous + (uint32_t)unzigzag(delta));
+	}
+
+	return (int)(p - buf);
+}
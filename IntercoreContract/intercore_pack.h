@@ -0,0 +1,60 @@
+#pragma once
+
+#include "intercore_codec.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Delta packed intercore frames, for batches of readings that change little from one to the next.
+//
+// Each value is stored as the zig-zag encoded difference from the value before it, as a varint.
+// Small changes, positive or negative, take a single byte. A packed frame holds several compact
+// records with the same field bitmap, stored a column per field rather than a record at a time,
+// so each column's deltas come from one kind of value.
+//
+//   byte 0     INTERCORE_PACK_MAGIC, never a valid first byte of a legacy or compact message
+//   byte 1     INTERCORE_PACK_VERSION, bumped only for incompatible changes
+//   byte 2     INTERCORE_CMD of every record
+//   byte 3     record count
+//   byte 4-5   field bitmap, IC_FIELD_*, of every record
+//   then       a column of count varints per field in the bitmap, in bit order
+//
+// The first value of a column is a delta from 0. Varints delimit themselves, so decoders skip the
+// columns of fields they do not know. Packed frames are used only when the high-level app asks for
+// them on IC_SUBSCRIBE_SENSOR, with IC_FIELD_PACKED.
+
+#define INTERCORE_PACK_MAGIC 0xC6
+#define INTERCORE_PACK_VERSION 1
+#define INTERCORE_PACK_HEADER_SIZE 6
+#define INTERCORE_PACK_MAX_RECORDS 255
+
+/// <summary>
+/// Most bytes a packed frame of count records with these fields can take, whatever the values.
+/// </summary>
+size_t intercore_pack_bound(uint16_t fields, int count);
+
+/// <summary>
+/// Pack records into buf as a single frame. Every record must have the cmd and fields of the first.
+/// </summary>
+/// <returns>Bytes written, or -1 if buf is too small or the records differ</returns>
+int intercore_pack_records(const INTERCORE_RECORD *records, int count, uint8_t *buf, size_t size);
+
+/// <summary>
+/// Unpack a frame into records.
+/// </summary>
+/// <returns>Records unpacked, or -1 if buf is not a valid frame or holds more than max_count records</returns>
+int intercore_unpack_records(const uint8_t *buf, size_t size, INTERCORE_RECORD *records, int max_count);
+
+/// <summary>
+/// True if the message is a packed frame.
+/// </summary>
+bool intercore_is_packed(const void *buf, size_t size);
+
+// Sample arrays, for bulk data such as accelerometer readings. Samples are interleaved channels,
+// x y z x y z for a three axis sensor, and each sample is a delta from the one channels before it.
+// Pack returns the bytes written, unpack the bytes consumed, both -1 if buf is too short.
+int intercore_pack_i16(const int16_t *samples, size_t count, size_t channels, uint8_t *buf, size_t size);
+int intercore_unpack_i16(const uint8_t *buf, size_t size, int16_t *samples, size_t count, size_t channels);
+int intercore_pack_i32(const int32_t *samples, size_t count, size_t channels, uint8_t *buf, size_t size);
+int intercore_unpack_i32(const uint8_t *buf, size_t size, int32_t *samples, size_t count, size_t channels);
@@ -0,0 +1,150 @@
+#include "intercore_rpc.h"
+
+typedef struct
+{
+	bool active;
+	uint16_t id;
+	INTERCORE_CMD cmd;
+	int64_t deadline_ms;
+	INTERCORE_RPC_CALLBACK callback;
+	void *context;
+} PENDING_REQUEST;
+
+static PENDING_REQUEST pending[INTERCORE_RPC_WINDOW];
+static INTERCORE_RPC_SEND send_request;
+static uint16_t last_id;
+
+void intercore_rpc_init(INTERCORE_RPC_SEND send)
+{
+	send_request = send;
+}
+
+static PENDING_REQUEST *find_pending(uint16_t id)
+{
+	for (int i = 0; i < INTERCORE_RPC_WINDOW; i++) {
+		if (pending[i].active && pending[i].id == id) {
+			return &pending[i];
+		}
+	}
+	return NULL;
+}
+
+// Release the slot before the callback runs, so the callback may issue the next request
+static void finish(PENDING_REQUEST *request, INTERCORE_RPC_REPLY *reply)
+{
+	INTERCORE_RPC_CALLBACK callback = request->callback;
+	void *context = request->context;
+
+	reply->cmd = request->cmd;
+	request->active = false;
+
+	if (callback) {
+		callback(reply, context);
+	}
+}
+
+int intercore_rpc_call(const INTERCORE_RECORD *request, int64_t now_ms, int timeout_ms, INTERCORE_RPC_CALLBACK callback, void *context)
+{
+	uint8_t wire[INTERCORE_WIRE_MAX_RECORD_SIZE];
+	INTERCORE_RECORD record = *request;
+	PENDING_REQUEST *slot = NULL;
+	int length;
+
+	for (int i = 0; i < INTERCORE_RPC_WINDOW && !slot; i++) {
+		if (!pending[i].active) {
+			slot = &pending[i];
+		}
+	}
+
+	if (!slot || !send_request) {
+		return -1;
+	}
+
+	// Skip 0, it marks unsolicited records, and any id still outstanding after wrapping
+	do {
+		last_id++;
+	} while (last_id == 0 || find_pending(last_id));
+
+	record.request_id = last_id;
+	record.fields |= IC_FIELD_REQUEST_ID;
+
+	if ((length = intercore_encode(&record, wire, sizeof(wire))) < 0 || !send_request(wire, (size_t)length)) {
+		return -1;
+	}
+
+	*slot = (PENDING_REQUEST){
+		.active = true, .id = last_id, .cmd = request->cmd, .deadline_ms = now_ms + timeout_ms, .callback = callback, .context = context};
+
+	return last_id;
+}
+
+bool intercore_rpc_complete(const INTERCORE_RECORD *reply)
+{
+	PENDING_REQUEST *request;
+	INTERCORE_RPC_REPLY result = {.status = INTERCORE_RPC_OK};
+
+	if (!(reply->fields & IC_FIELD_REQUEST_ID) || !(request = find_pending(reply->request_id))) {
+		return false;
+	}
+
+	result.record = *reply;
+	finish(request, &result);
+	return true;
+}
+
+// Legacy replies carry the request id as an unsigned int
+static bool complete_legacy(INTERCORE_CMD cmd, unsigned int request_id, INTERCORE_RPC_REPLY *result)
+{
+	PENDING_REQUEST *request;
+
+	if (request_id == 0 || request_id > UINT16_MAX || !(request = find_pending((uint16_t)request_id))) {
+		return false;
+	}
+
+	result->record.cmd = cmd;
+	result->record.request_id = (uint16_t)request_id;
+	finish(request, result);
+	return true;
+}
+
+bool intercore_rpc_complete_stats(const INTERCORE_STATS *stats)
+{
+	INTERCORE_RPC_REPLY result = {.status = INTERCORE_RPC_OK, .stats = stats};
+
+	return complete_legacy(IC_READ_STATS, stats->request_id, &result);
+}
+
+bool intercore_rpc_complete_load(const INTERCORE_LOAD *load)
+{
+	INTERCORE_RPC_REPLY result = {.status = INTERCORE_RPC_OK, .load = load};
+
+	return complete_legacy(IC_READ_LOAD, load->request_id, &result);
+}
+
+bool intercore_rpc_complete_memory(const INTERCORE_MEMORY *memory)
+{
+	INTERCORE_RPC_REPLY result = {.status = INTERCORE_RPC_OK, .memory = memory};
+
+	return complete_legacy(IC_READ_MEMORY, memory->request_id, &result);
+}
+
+void intercore_rpc_expire(int64_t now_ms)
+{
+	INTERCORE_RPC_REPLY result = {.status = INTERCORE_RPC_TIMEOUT};
+
+	for (int i = 0; i < INTERCORE_RPC_WINDOW; i++) {
+		if (pending[i].active && now_ms - pending[i].deadline_ms >= 0) {
+			finish(&pending[i], &result);
+		}
+	}
+}
+
+int intercore_rpc_outstanding(void)
+{
+	int count = 0;
+
+	for (int i = 0; i < INTERCORE_RPC_WINDOW; i++) {
+		count += pending[i].active;
+	}
+	return count;
+}
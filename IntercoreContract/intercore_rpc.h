@@ -0,0 +1,76 @@
+#pragma once
+
+#include "intercore_codec.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Request/response calls to the real-time app, for the high-level app.
+//
+// Each request is a compact record carrying IC_FIELD_REQUEST_ID. The real-time app echoes the id in
+// its reply, so several requests can be outstanding at once and each reply completes the right one.
+// Requests that are not answered within their timeout complete with INTERCORE_RPC_TIMEOUT.
+//
+// Request ids need the compact format. Real-time apps that only speak the legacy structs never
+// answer, callers should fall back to fire and forget messages when intercore_rpc_call fails.
+
+// Outstanding requests, a call fails while the window is full
+#define INTERCORE_RPC_WINDOW 8
+
+typedef enum
+{
+	INTERCORE_RPC_OK,
+	INTERCORE_RPC_TIMEOUT
+} INTERCORE_RPC_STATUS;
+
+typedef struct
+{
+	INTERCORE_RPC_STATUS status;
+	INTERCORE_CMD cmd;				// command of the request
+	INTERCORE_RECORD record;		// compact reply, valid when status is INTERCORE_RPC_OK
+	const INTERCORE_STATS *stats;	// reply to IC_READ_STATS, NULL for other commands
+	const INTERCORE_LOAD *load;		// reply to IC_READ_LOAD, NULL for other commands
+	const INTERCORE_MEMORY *memory;	// reply to IC_READ_MEMORY, NULL for other commands
+} INTERCORE_RPC_REPLY;
+
+typedef void (*INTERCORE_RPC_CALLBACK)(const INTERCORE_RPC_REPLY *reply, void *context);
+
+// Sends an encoded request to the real-time app, returns false if it could not be sent
+typedef bool (*INTERCORE_RPC_SEND)(const void *message, size_t length);
+
+void intercore_rpc_init(INTERCORE_RPC_SEND send);
+
+/// <summary>
+/// Send a request and call callback once it is answered or times out.
+/// </summary>
+/// <returns>The request id, or -1 if the window is full or the request could not be sent</returns>
+int intercore_rpc_call(const INTERCORE_RECORD *request, int64_t now_ms, int timeout_ms, INTERCORE_RPC_CALLBACK callback, void *context);
+
+/// <summary>
+/// Complete the request a compact reply answers.
+/// </summary>
+/// <returns>false if the reply has no request id or answers no outstanding request</returns>
+bool intercore_rpc_complete(const INTERCORE_RECORD *reply);
+
+/// <summary>
+/// Complete the IC_READ_STATS request a statistics reply answers.
+/// </summary>
+bool intercore_rpc_complete_stats(const INTERCORE_STATS *stats);
+
+/// <summary>
+/// Complete the IC_READ_LOAD request a load reply answers.
+/// </summary>
+bool intercore_rpc_complete_load(const INTERCORE_LOAD *load);
+
+/// <summary>
+/// Complete the IC_READ_MEMORY request a memory reply answers.
+/// </summary>
+bool intercore_rpc_complete_memory(const INTERCORE_MEMORY *memory);
+
+/// <summary>
+/// Time out every request whose deadline has passed, call periodically.
+/// </summary>
+void intercore_rpc_expire(int64_t now_ms);
+
+int intercore_rpc_outstanding(void);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "intercore_contract.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+// Latest environment reading, shared between the sensor writer and the intercore reader without a lock.
+//
+// A sequence counted pair of slots (a seqlock "latch"). The single writer always updates the slot readers
+// are not directed to, so it never waits and a reader that preempts it mid update still sees a whole
+// reading. Readers retry only if a publish completed while they were copying, the sensor thread
+// publishes at most once per sample so a retry is rare and never repeats while the writer is idle.
+//
+// Only one context may publish. Any number of contexts may read.
+
+typedef struct
+{
+	_Atomic uint32_t sequence;	// readers use slot[sequence & 1]
+	INTERCORE_BLOCK slot[2];
+} INTERCORE_SNAPSHOT;
+
+/// <summary>
+/// Publish a new reading. Must only be called from the single writer.
+/// </summary>
+static inline void intercore_snapshot_publish(INTERCORE_SNAPSHOT *snapshot, const INTERCORE_BLOCK *block)
+{
+	uint32_t sequence = atomic_load_explicit(&snapshot->sequence, memory_order_relaxed);
+
+	// Point readers at the other slot before touching this one
+	atomic_store_explicit(&snapshot->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&snapshot->slot[sequence & 1], block, sizeof(*block));
+
+	// Then point them back at the fresh copy and bring the other slot up to date
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&snapshot->sequence, sequence + 2, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&snapshot->slot[(sequence + 1) & 1], block, sizeof(*block));
+}
+
+/// <summary>
+/// Copy the latest whole reading, never blocks the writer.
+/// </summary>
+/// <returns>Version of the reading, one more for every publish, 0 before the first</returns>
+static inline uint32_t intercore_snapshot_read(INTERCORE_SNAPSHOT *snapshot, INTERCORE_BLOCK *block)
+{
+	uint32_t sequence;
+
+	do {
+		sequence = atomic_load_explicit(&snapshot->sequence, memory_order_acquire);
+		memcpy(block, &snapshot->slot[sequence & 1], sizeof(*block));
+		atomic_thread_fence(memory_order_acquire);
+	} while (atomic_load_explicit(&snapshot->sequence, memory_order_relaxed) != sequence);
+
+	// Each publish moves the sequence on by two, while it is odd readers still get the previous reading
+	return sequence / 2;
+}
@@ -0,0 +1,323 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// The ThreadX app's fixed-block allocator under a random allocate and free workload, see
+// block_alloc.h.
+//
+// Every live block is filled with a pattern that must still be there when it is freed, so blocks
+// that overlap or are handed out twice fail the run, as do misaligned blocks, class and byte
+// counters that disagree with the workload and failed allocations while a class still has free
+// blocks. Each operation is timed, the p99.9 and worst case are reported alongside the same
+// workload on the host malloc.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "block_alloc.h"
+
+#define MAX_LIVE 64 // more than the blocks there are, so classes run dry
+#define HISTOGRAM_NS 1024
+#define MAX_REQUEST 600 // some requests are larger than every class and must fail
+
+typedef struct {
+    uint8_t *ptr;
+    size_t size;
+    uint8_t pattern;
+    int class_index; // -1 for host malloc
+} LIVE_BLOCK;
+
+typedef struct {
+    uint64_t ops;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t histogram[HISTOGRAM_NS]; // 1 ns buckets, the last one holds everything longer
+} OP_TIMES;
+
+static BLOCK_CLASS classes[] = {
+    {.blockSize = 16, .blockCount = 16},
+    {.blockSize = 32, .blockCount = 16},
+    {.blockSize = 64, .blockCount = 8},
+    {.blockSize = 128, .blockCount = 8},
+    {.blockSize = 512, .blockCount = 4},
+};
+#define CLASS_COUNT ((int)(sizeof(classes) / sizeof(classes[0])))
+
+static uint32_t expected_in_use[CLASS_COUNT];
+static uint32_t expected_failures[CLASS_COUNT];
+static uint32_t failures;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void record_time(OP_TIMES *times, uint64_t ns)
+{
+    times->ops++;
+    times->total_ns += ns;
+    if (ns > times->max_ns) {
+        times->max_ns = ns;
+    }
+    times->histogram[ns < HISTOGRAM_NS ? ns : HISTOGRAM_NS - 1]++;
+}
+
+static uint64_t percentile_ns(const OP_TIMES *times, double percentile)
+{
+    uint64_t target = (uint64_t)(times->ops * percentile / 100), seen = 0;
+
+    for (int ns = 0; ns < HISTOGRAM_NS; ns++) {
+        seen += times->histogram[ns];
+        if (seen > target) {
+            return (uint64_t)ns;
+        }
+    }
+    return HISTOGRAM_NS;
+}
+
+static int best_class(size_t size)
+{
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        if (size <= classes[i].blockSize) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool pattern_intact(const LIVE_BLOCK *block)
+{
+    for (size_t i = 0; i < block->size; i++) {
+        if (block->ptr[i] != block->pattern) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void check_counters(const BLOCK_ALLOC *alloc)
+{
+    uint32_t bytes_in_use = 0;
+
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        bytes_in_use += expected_in_use[i] * classes[i].blockSize;
+
+        if (classes[i].inUse != expected_in_use[i] || classes[i].failures != expected_failures[i] ||
+            classes[i].peak < classes[i].inUse || classes[i].peak > classes[i].blockCount) {
+            printf("class %u: in use %u peak %u failures %u, expected in use %u failures %u\n",
+                   classes[i].blockSize, classes[i].inUse, classes[i].peak, classes[i].failures,
+                   expected_in_use[i], expected_failures[i]);
+            failures++;
+        }
+    }
+
+    if (alloc->bytesInUse != bytes_in_use || alloc->peakBytes < alloc->bytesInUse) {
+        printf("heap bytes in use %u peak %u, expected in use %u\n", alloc->bytesInUse, alloc->peakBytes, bytes_in_use);
+        failures++;
+    }
+}
+
+/// <summary>
+/// Random allocations and frees against the block allocator, checking every block.
+/// </summary>
+static void run_block_alloc(BLOCK_ALLOC *alloc, uint64_t operations, OP_TIMES *alloc_times, OP_TIMES *free_times)
+{
+    LIVE_BLOCK live[MAX_LIVE];
+    int live_count = 0;
+
+    for (uint64_t op = 0; op < operations; op++) {
+        // Grow towards MAX_LIVE and shrink back, so classes run dry and recover
+        bool allocate = live_count == 0 || (live_count < MAX_LIVE && rand() % 100 < ((op / 5000) % 2 ? 40 : 60));
+
+        if (allocate) {
+            // Mostly small requests, as the C library makes
+            size_t size = rand() % 4 ? 1 + (size_t)rand() % 48 : 1 + (size_t)rand() % MAX_REQUEST;
+            int expected_class = best_class(size);
+            uint64_t start = now_ns();
+            uint8_t *ptr = block_alloc(alloc, size);
+            record_time(alloc_times, now_ns() - start);
+
+            if (expected_class < 0) {
+                if (ptr != NULL) {
+                    printf("%zu bytes fit no class but were allocated\n", size);
+                    failures++;
+                }
+                continue;
+            }
+
+            if (ptr == NULL) {
+                if (expected_in_use[expected_class] < classes[expected_class].blockCount) {
+                    printf("%zu bytes failed with class %u not full\n", size, classes[expected_class].blockSize);
+                    failures++;
+                }
+                expected_failures[expected_class]++;
+                continue;
+            }
+
+            if ((uintptr_t)ptr % BLOCK_ALLOC_ALIGNMENT != 0) {
+                printf("block %p misaligned\n", (void *)ptr);
+                failures++;
+            }
+
+            expected_in_use[expected_class]++;
+            live[live_count] = (LIVE_BLOCK){ptr, size, (uint8_t)rand(), expected_class};
+            memset(ptr, live[live_count].pattern, size);
+            live_count++;
+        } else {
+            int index = rand() % live_count;
+            LIVE_BLOCK block = live[index];
+
+            live[index] = live[--live_count];
+
+            if (!pattern_intact(&block)) {
+                printf("block %p of %zu bytes was overwritten\n", (void *)block.ptr, block.size);
+                failures++;
+            }
+
+            uint64_t start = now_ns();
+            bool freed = block_free(alloc, block.ptr);
+            record_time(free_times, now_ns() - start);
+
+            if (!freed) {
+                printf("block %p not recognised on free\n", (void *)block.ptr);
+                failures++;
+            }
+            expected_in_use[block.class_index]--;
+        }
+
+        if (op % 1000 == 0) {
+            check_counters(alloc);
+        }
+    }
+
+    while (live_count > 0) {
+        LIVE_BLOCK block = live[--live_count];
+        failures += !pattern_intact(&block) || !block_free(alloc, block.ptr);
+        expected_in_use[block.class_index]--;
+    }
+    check_counters(alloc);
+
+    // Pointers that are not blocks are refused
+    uint8_t outside;
+    if (block_free(alloc, &outside) || block_free(alloc, classes[0].region + 1)) {
+        printf("a pointer that is not a block was accepted\n");
+        failures++;
+    }
+}
+
+/// <summary>
+/// The same workload on the host malloc, for the timings only.
+/// </summary>
+static void run_host_malloc(uint64_t operations, OP_TIMES *alloc_times, OP_TIMES *free_times)
+{
+    LIVE_BLOCK live[MAX_LIVE];
+    int live_count = 0;
+
+    for (uint64_t op = 0; op < operations; op++) {
+        bool allocate = live_count == 0 || (live_count < MAX_LIVE && rand() % 100 < ((op / 5000) % 2 ? 40 : 60));
+
+        if (allocate) {
+            size_t size = rand() % 4 ? 1 + (size_t)rand() % 48 : 1 + (size_t)rand() % MAX_REQUEST;
+            uint64_t start = now_ns();
+            uint8_t *ptr = malloc(size);
+            record_time(alloc_times, now_ns() - start);
+
+            live[live_count++] = (LIVE_BLOCK){ptr, size, 0, -1};
+        } else {
+            int index = rand() % live_count;
+            uint8_t *ptr = live[index].ptr;
+
+            live[index] = live[--live_count];
+
+            uint64_t start = now_ns();
+            free(ptr);
+            record_time(free_times, now_ns() - start);
+        }
+    }
+
+    while (live_count > 0) {
+        free(live[--live_count].ptr);
+    }
+}
+
+static void print_times(const char *name, const OP_TIMES *alloc_times, const OP_TIMES *free_times)
+{
+    printf("%-12s %9.1f %8llu %8llu %9.1f %8llu %8llu\n", name, (double)alloc_times->total_ns / alloc_times->ops,
+           (unsigned long long)percentile_ns(alloc_times, 99.9), (unsigned long long)alloc_times->max_ns,
+           (double)free_times->total_ns / free_times->ops, (unsigned long long)percentile_ns(free_times, 99.9),
+           (unsigned long long)free_times->max_ns);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-n operations]\n"
+            "  -n  allocations and frees to run (default 1000000)\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t operations = 1000000;
+    static OP_TIMES block_alloc_times, block_free_times;
+    static OP_TIMES host_alloc_times, host_free_times;
+    BLOCK_ALLOC alloc;
+    void *memory;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            operations = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (operations == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Too little memory is refused rather than half carved
+    memory = malloc(block_alloc_size(classes, CLASS_COUNT) + BLOCK_ALLOC_ALIGNMENT);
+    if (block_alloc_init(&alloc, classes, CLASS_COUNT, memory, block_alloc_size(classes, CLASS_COUNT) - 1) ||
+        block_alloc(&alloc, 1) != NULL) {
+        printf("init accepted too little memory\n");
+        failures++;
+    }
+
+    // Misaligned on purpose, init aligns the blocks itself
+    if (!block_alloc_init(&alloc, classes, CLASS_COUNT, (uint8_t *)memory + 1,
+                          block_alloc_size(classes, CLASS_COUNT) + BLOCK_ALLOC_ALIGNMENT - 1)) {
+        printf("init refused enough memory\n");
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+    run_block_alloc(&alloc, operations, &block_alloc_times, &block_free_times);
+    srand(1);
+    run_host_malloc(operations, &host_alloc_times, &host_free_times);
+
+    // Times include reading the clock, the maximums mostly measure the host preempting the run
+    printf("%-12s %9s %8s %8s %9s %8s %8s\n", "allocator", "alloc ns", "p99.9", "max", "free ns", "p99.9", "max");
+    print_times("block_alloc", &block_alloc_times, &block_free_times);
+    print_times("host malloc", &host_alloc_times, &host_free_times);
+
+    printf("\n%-8s %8s %8s %8s\n", "class", "blocks", "peak", "failures");
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        printf("%-8u %8u %8u %8u\n", classes[i].blockSize, classes[i].blockCount, classes[i].peak,
+               classes[i].failures);
+    }
+
+    printf("%s\n", failures == 0 ? "all blocks intact" : "FAILED");
+    free(memory);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
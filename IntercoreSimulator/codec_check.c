@@ -0,0 +1,344 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// The compact intercore wire format, see intercore_codec.h.
+//
+// Three checks. Every combination of the known field bitmap bits, with random values, must encode
+// and decode back unchanged, and must not encode into a buffer one byte short. Records from a
+// newer encoder, with unknown bitmap bits and their bytes after the known fields, must decode to
+// the known fields and hand back the full record length, so the record after them is found. And
+// random byte strings must never make intercore_decode read past the end of its input or write past
+// the record. The input and the record sit against inaccessible guard pages, first at the end of a
+// page and then at the start, so any access outside them stops the run.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "intercore_codec.h"
+
+// Bitmap bits intercore_codec.c knows, IC_FIELD_TEMPERATURE to IC_FIELD_PACKED
+#define KNOWN_BITS 10
+#define KNOWN_FIELDS ((1u << KNOWN_BITS) - 1)
+
+#define MAX_FUZZ_SIZE 64
+
+// A page each for the input and the record, between inaccessible pages
+typedef struct {
+    uint8_t *pages;
+    size_t page_size;
+} GUARDED;
+
+static bool guarded_create(GUARDED *guarded)
+{
+    guarded->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    guarded->pages = mmap(NULL, 5 * guarded->page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (guarded->pages == MAP_FAILED) {
+        return false;
+    }
+
+    // guard, input, guard, record, guard
+    return mprotect(guarded->pages, guarded->page_size, PROT_NONE) == 0 &&
+           mprotect(guarded->pages + 2 * guarded->page_size, guarded->page_size, PROT_NONE) == 0 &&
+           mprotect(guarded->pages + 4 * guarded->page_size, guarded->page_size, PROT_NONE) == 0;
+}
+
+// Input of size bytes, against the guard page after it or the one before it
+static uint8_t *guarded_input(const GUARDED *guarded, size_t size, bool at_end)
+{
+    uint8_t *page = guarded->pages + guarded->page_size;
+    return at_end ? page + guarded->page_size - size : page;
+}
+
+static INTERCORE_RECORD *guarded_record(const GUARDED *guarded, bool at_end)
+{
+    uint8_t *page = guarded->pages + 3 * guarded->page_size;
+    return (INTERCORE_RECORD *)(at_end ? page + guarded->page_size - sizeof(INTERCORE_RECORD) : page);
+}
+
+static size_t wire_length(uint16_t fields)
+{
+    static const uint8_t field_size[KNOWN_BITS] = {2, 2, 2, 1, 4, 2, 2, 2, 1, 1};
+    size_t length = INTERCORE_WIRE_HEADER_SIZE;
+
+    for (unsigned bit = 0; bit < KNOWN_BITS; bit++) {
+        if (fields & (1u << bit)) {
+            length += field_size[bit];
+        }
+    }
+    return length;
+}
+
+// Random values in the fields the bitmap has, and garbage in the ones it has not
+static void random_record(INTERCORE_RECORD *record, uint16_t fields)
+{
+    record->cmd = (INTERCORE_CMD)(rand() % 256);
+    record->fields = fields;
+    record->temperature_centi = (int16_t)rand();
+    record->pressure_deci = (uint16_t)rand();
+    record->humidity_centi = (uint16_t)rand();
+    record->operating_mode = (HVAC_OPERATING_MODE)(rand() % 256);
+    record->sample_rate_ms = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+    record->request_id = (uint16_t)rand();
+    record->version = (uint16_t)rand();
+    record->credits = (uint16_t)rand();
+    record->flow_policy = (INTERCORE_FLOW_POLICY)(rand() % 256);
+    record->packed_frames = (uint8_t)rand();
+}
+
+// The record decode should give back, the fields not in the bitmap zero
+static INTERCORE_RECORD expected_record(const INTERCORE_RECORD *sent)
+{
+    INTERCORE_RECORD expected = {0};
+    uint16_t fields = sent->fields & KNOWN_FIELDS;
+
+    expected.cmd = sent->cmd;
+    expected.fields = fields;
+    if (fields & IC_FIELD_TEMPERATURE) {
+        expected.temperature_centi = sent->temperature_centi;
+    }
+    if (fields & IC_FIELD_PRESSURE) {
+        expected.pressure_deci = sent->pressure_deci;
+    }
+    if (fields & IC_FIELD_HUMIDITY) {
+        expected.humidity_centi = sent->humidity_centi;
+    }
+    if (fields & IC_FIELD_OPERATING_MODE) {
+        expected.operating_mode = sent->operating_mode;
+    }
+    if (fields & IC_FIELD_SAMPLE_RATE) {
+        expected.sample_rate_ms = sent->sample_rate_ms;
+    }
+    if (fields & IC_FIELD_REQUEST_ID) {
+        expected.request_id = sent->request_id;
+    }
+    if (fields & IC_FIELD_VERSION) {
+        expected.version = sent->version;
+    }
+    if (fields & IC_FIELD_CREDITS) {
+        expected.credits = sent->credits;
+    }
+    if (fields & IC_FIELD_FLOW_POLICY) {
+        expected.flow_policy = sent->flow_policy;
+    }
+    if (fields & IC_FIELD_PACKED) {
+        expected.packed_frames = sent->packed_frames;
+    }
+    return expected;
+}
+
+static bool same_record(const INTERCORE_RECORD *a, const INTERCORE_RECORD *b)
+{
+    return a->cmd == b->cmd && a->fields == b->fields && a->temperature_centi == b->temperature_centi &&
+           a->pressure_deci == b->pressure_deci && a->humidity_centi == b->humidity_centi &&
+           a->operating_mode == b->operating_mode && a->sample_rate_ms == b->sample_rate_ms &&
+           a->request_id == b->request_id && a->version == b->version && a->credits == b->credits &&
+           a->flow_policy == b->flow_policy && a->packed_frames == b->packed_frames;
+}
+
+/// <summary>
+/// Encode and decode every bitmap, values times each, unknown bits set on the way in half the time.
+/// </summary>
+/// <returns>Records that failed</returns>
+static uint32_t check_round_trip(uint32_t values, uint32_t *cases)
+{
+    uint8_t buf[INTERCORE_WIRE_MAX_RECORD_SIZE + 1];
+    uint32_t failures = 0;
+
+    *cases = 0;
+    for (uint32_t fields = 0; fields <= KNOWN_FIELDS; fields++) {
+        for (uint32_t i = 0; i < values; i++) {
+            INTERCORE_RECORD sent;
+            INTERCORE_RECORD expected;
+            INTERCORE_RECORD decoded;
+            // An encoder drops bits it does not know
+            uint16_t unknown = rand() % 2 ? (uint16_t)(rand() << KNOWN_BITS) : 0;
+            size_t length = wire_length((uint16_t)fields);
+            int encoded;
+
+            random_record(&sent, (uint16_t)(fields | unknown));
+            expected = expected_record(&sent);
+            (*cases)++;
+
+            if (length > INTERCORE_WIRE_MAX_RECORD_SIZE || intercore_encode(&sent, buf, length - 1) != -1) {
+                failures++;
+                continue;
+            }
+
+            memset(buf, 0xA5, sizeof(buf));
+            encoded = intercore_encode(&sent, buf, length);
+            if (encoded != (int)length || buf[length] != 0xA5 || !intercore_is_compact(buf, length) ||
+                intercore_decode(buf, length, &decoded) != encoded || !same_record(&decoded, &expected)) {
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+/// <summary>
+/// Decode records from a newer encoder, with extra bitmap bits and bytes, each followed by a
+/// current record.
+/// </summary>
+/// <returns>Records that failed</returns>
+static uint32_t check_unknown_fields(uint32_t count, uint32_t *cases)
+{
+    uint8_t buf[2 * 255];
+    uint32_t failures = 0;
+
+    *cases = count;
+    for (uint32_t i = 0; i < count; i++) {
+        INTERCORE_RECORD sent;
+        INTERCORE_RECORD next;
+        INTERCORE_RECORD expected;
+        INTERCORE_RECORD decoded;
+        uint16_t fields = (uint16_t)(rand() & KNOWN_FIELDS);
+        uint16_t unknown = (uint16_t)(rand() << KNOWN_BITS) | (uint16_t)(1u << (KNOWN_BITS + rand() % (16 - KNOWN_BITS)));
+        size_t known = wire_length(fields);
+        size_t length = known + 1 + (size_t)rand() % (255 - known);
+        size_t total;
+        int consumed;
+        int encoded;
+
+        random_record(&sent, fields);
+        random_record(&next, (uint16_t)(rand() & KNOWN_FIELDS));
+
+        // The newer encoder's record is today's with its extra fields after the known ones
+        encoded = intercore_encode(&sent, buf, sizeof(buf));
+        for (size_t b = (size_t)encoded; b < length; b++) {
+            buf[b] = (uint8_t)rand();
+        }
+        buf[2] = (uint8_t)length;
+        buf[4] = (uint8_t)(fields | unknown);
+        buf[5] = (uint8_t)((fields | unknown) >> 8);
+        total = length + (size_t)intercore_encode(&next, buf + length, sizeof(buf) - length);
+
+        // Decoded as the high-level app does, record after record
+        expected = expected_record(&sent);
+        consumed = intercore_decode(buf, total, &decoded);
+        if (consumed != (int)length || !same_record(&decoded, &expected)) {
+            failures++;
+            continue;
+        }
+        expected = expected_record(&next);
+        consumed = intercore_decode(buf + length, total - length, &decoded);
+        if (consumed != (int)(total - length) || !same_record(&decoded, &expected)) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+/// <summary>
+/// Decode random byte strings against the guard pages. Half start with a valid header, so they
+/// get as far as the fields.
+/// </summary>
+/// <returns>Decodes that returned something other than -1 or a length within the input</returns>
+static uint32_t check_fuzz(const GUARDED *guarded, uint32_t count, uint32_t *cases, uint32_t *accepted)
+{
+    uint32_t failures = 0;
+
+    *cases = count;
+    *accepted = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        size_t size = (size_t)rand() % (MAX_FUZZ_SIZE + 1);
+        bool at_end = i % 2 == 0;
+        uint8_t *input = guarded_input(guarded, size, at_end);
+        INTERCORE_RECORD *record = guarded_record(guarded, !at_end);
+        int consumed;
+
+        for (size_t b = 0; b < size; b++) {
+            input[b] = (uint8_t)rand();
+        }
+        if (rand() % 2 && size >= 2) {
+            input[0] = INTERCORE_WIRE_MAGIC;
+            input[1] = INTERCORE_WIRE_VERSION;
+            if (size >= 3) {
+                input[2] = (uint8_t)(rand() % (MAX_FUZZ_SIZE + 8));
+            }
+        }
+
+        consumed = intercore_decode(input, size, record);
+        if (consumed == -1) {
+            continue;
+        }
+        if (consumed < INTERCORE_WIRE_HEADER_SIZE || (size_t)consumed > size || (record->fields & ~KNOWN_FIELDS) != 0) {
+            failures++;
+        }
+        (*accepted)++;
+    }
+    return failures;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-v values] [-n records] [-f strings] [-r seed]\n"
+            "  -v  random records per field bitmap (default 100)\n"
+            "  -n  records from a newer encoder (default 100000)\n"
+            "  -f  random byte strings to decode (default 1000000)\n"
+            "  -r  random seed (default 1)\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t values = 100;
+    uint32_t unknown_count = 100000;
+    uint32_t fuzz_count = 1000000;
+    unsigned seed = 1;
+    uint32_t cases;
+    uint32_t accepted;
+    uint32_t failures;
+    bool ok = true;
+    GUARDED guarded;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v:n:f:r:h")) != -1) {
+        switch (opt) {
+        case 'v':
+            values = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            unknown_count = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            fuzz_count = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            seed = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!guarded_create(&guarded)) {
+        fprintf(stderr, "cannot map guard pages\n");
+        return EXIT_FAILURE;
+    }
+
+    srand(seed);
+    printf("%-16s %10s %10s\n", "check", "cases", "failed");
+
+    failures = check_round_trip(values, &cases);
+    printf("%-16s %10u %10u  %s\n", "round trip", cases, failures, failures == 0 ? "ok" : "FAILED");
+    ok = ok && failures == 0;
+
+    failures = check_unknown_fields(unknown_count, &cases);
+    printf("%-16s %10u %10u  %s\n", "unknown fields", cases, failures, failures == 0 ? "ok" : "FAILED");
+    ok = ok && failures == 0;
+
+    // Reaching the end at all means no access went outside the input or the record
+    failures = check_fuzz(&guarded, fuzz_count, &cases, &accepted);
+    printf("%-16s %10u %10u  %s, %u decoded\n", "random bytes", cases, failures, failures == 0 ? "ok" : "FAILED",
+           accepted);
+    ok = ok && failures == 0;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,185 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Copy path microbenchmark for the intercore ring.
+//
+// Messages are written into the ring and read straight back in one process, with the mailbox
+// registers stubbed out, so only the ring bookkeeping and the payload copies are timed. Each
+// message size runs with the byte copy the ring used to have, with the aligned word copy, and
+// with the aligned word copy plus wrap padding (INTERCORE_CAP_* in mt3620-intercore.h).
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "intercore_sim.h"
+
+#define MAX_SWEEP 16
+#define MAX_BUFFER_SIZE 65536
+
+typedef struct {
+    const char *name;
+    uint32_t capabilities;
+} COPY_MODE;
+
+static const COPY_MODE modes[] = {
+    {"memcpy", 0},
+    {"aligned", INTERCORE_CAP_ALIGNED_COPY},
+    {"aligned+pad", INTERCORE_CAP_ALIGNED_COPY | INTERCORE_CAP_WRAP_PADDING},
+};
+
+// Both buffers, header then data area, as the Azure Sphere OS lays them out.
+static _Alignas(64) uint8_t writeBuffer[sizeof(BufferHeader) + MAX_BUFFER_SIZE];
+static _Alignas(64) uint8_t readBuffer[sizeof(BufferHeader) + MAX_BUFFER_SIZE];
+static _Alignas(16) uint8_t message[MAX_BUFFER_SIZE];
+static _Alignas(16) uint8_t received[MAX_BUFFER_SIZE];
+
+// No mailbox in this benchmark, the peer is the same process.
+uint32_t ReadReg32(uintptr_t baseAddr, size_t offset)
+{
+    return 0;
+}
+
+void WriteReg32(uintptr_t baseAddr, size_t offset, uint32_t value)
+{
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int parse_list(const char *arg, uint32_t *list)
+{
+    int count = 0;
+    char *copy = strdup(arg);
+
+    for (char *item = strtok(copy, ","); item != NULL && count < MAX_SWEEP;
+         item = strtok(NULL, ",")) {
+        list[count++] = (uint32_t)strtoul(item, NULL, 0);
+    }
+
+    free(copy);
+    return count;
+}
+
+/// <summary>
+/// Write count messages into the ring and read each one back.
+/// </summary>
+/// <returns>Nanoseconds per message, or -1 if a message came back wrong.</returns>
+static double run_one(const COPY_MODE *mode, uint32_t bufSize, uint32_t messageSize,
+                      uint32_t count)
+{
+    // The writer's outbound buffer is the reader's inbound buffer, and the other way round.
+    BufferHeader *writerOutbound = (BufferHeader *)writeBuffer;
+    BufferHeader *writerInbound = (BufferHeader *)readBuffer;
+    IntercoreBlockView view;
+
+    memset(writeBuffer, 0, sizeof(BufferHeader));
+    memset(readBuffer, 0, sizeof(BufferHeader));
+    SetIntercoreCapabilities(mode->capabilities);
+
+    uint64_t start = now_ns();
+
+    for (uint32_t sequence = 0; sequence < count; sequence++) {
+        memcpy(message, &sequence, sizeof(sequence));
+
+        if (ReserveData(writerInbound, writerOutbound, bufSize, messageSize, &view) == -1) {
+            return -1;
+        }
+        WriteBlockView(&view, 0, message, messageSize);
+        CommitData(writerOutbound, bufSize, &view);
+
+        if (PeekData(writerInbound, writerOutbound, bufSize, &view) == -1 ||
+            view.blockSize != messageSize) {
+            return -1;
+        }
+        ReadBlockView(&view, 0, received, messageSize);
+        ReleaseData(writerInbound, bufSize, &view);
+
+        if (memcmp(received, &sequence, sizeof(sequence)) != 0) {
+            return -1;
+        }
+    }
+
+    return (double)(now_ns() - start) / count;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-n messages] [-b buffer size] [-m message sizes]\n"
+            "  -n  messages per run (default 1000000)\n"
+            "  -b  shared buffer data area in bytes, a multiple of %d (default 4096)\n"
+            "  -m  comma separated message sizes in bytes (default 37,40,64,256,1024)\n",
+            name, RINGBUFFER_ALIGNMENT);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t count = 1000000;
+    uint32_t bufSize = 4096;
+    uint32_t messageSizes[MAX_SWEEP] = {37, 40, 64, 256, 1024};
+    int messageCount = 5;
+    int failures = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:m:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            bufSize = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            messageCount = parse_list(optarg, messageSizes);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (count == 0 || bufSize == 0 || bufSize > MAX_BUFFER_SIZE ||
+        bufSize % RINGBUFFER_ALIGNMENT != 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-12s %8s %8s %10s %10s %10s\n", "copy", "buffer", "message", "ns/msg", "wraps",
+           "padded");
+
+    for (int m = 0; m < messageCount; m++) {
+        uint32_t messageSize = messageSizes[m];
+
+        // Same space check as ReserveData, a message that can never fit is skipped.
+        if (messageSize < sizeof(uint32_t) ||
+            sizeof(uint32_t) + messageSize + RINGBUFFER_ALIGNMENT > bufSize) {
+            printf("%-12s %8u %8u %10s\n", "-", bufSize, messageSize, "skipped");
+            continue;
+        }
+
+        for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+            IntercoreStats before = *GetIntercoreStats();
+            double nsPerMessage = run_one(&modes[i], bufSize, messageSize, count);
+            const IntercoreStats *after = GetIntercoreStats();
+
+            if (nsPerMessage < 0) {
+                printf("%-12s %8u %8u %10s\n", modes[i].name, bufSize, messageSize, "failed");
+                failures++;
+                continue;
+            }
+
+            printf("%-12s %8u %8u %10.1f %10u %10u\n", modes[i].name, bufSize, messageSize,
+                   nsPerMessage, after->wraps - before.wraps, after->padded - before.padded);
+        }
+    }
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,356 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Credit based flow control of the pushed sensor stream, see intercore_flow.h.
+//
+// Each policy runs on a simulated millisecond clock. The real-time side samples every period and
+// pushes readings as the apps do: a BLOCK subscriber out of credit defers the next sample until a
+// grant, and a grant that frees a held reading sends the latest one. The high-level side takes
+// readings off the ring, quicker than they are sampled for a while and then slower, and its grants
+// take a few milliseconds to arrive. A grant left over from before the subscription arrives
+// ahead of its first reading, and must not take the credit past the window.
+//
+// For every policy but NONE, the readings in flight never exceed the window, and the credit, the
+// readings in flight, the readings drained but not yet granted and the grants on their way always
+// add up to the window. BLOCK must deliver every reading, in order. COALESCE must deliver readings
+// in order, and a held reading must go out on the grant that frees it. DOWNSAMPLE must deliver in order,
+// send every reading while over half the window is free, and every other one below that. The stream
+// must never stall for more than a second. NONE sends every reading.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intercore_flow.h"
+
+#define RING_SLOTS 4096
+#define MAX_GRANTS 64
+#define MAX_STALL_MS 1000
+
+typedef struct {
+    int64_t arrive_ms;
+    uint32_t credits;
+} GRANT;
+
+typedef struct {
+    const char *name;
+    INTERCORE_FLOW_POLICY policy;
+} POLICY;
+
+typedef struct {
+    uint32_t sampled;
+    uint32_t sent;
+    uint32_t delivered;
+    uint32_t throttled;
+    uint32_t max_in_flight;
+    int64_t longest_gap_ms;
+    uint32_t errors;
+} RESULT;
+
+// Real-time side
+static INTERCORE_FLOW flow;
+static bool sample_deferred;
+static uint32_t latest;         // sequence number of the latest sample, from 1
+static bool low_credit_last;    // DOWNSAMPLE, whether the last offer below half the window was sent
+static bool low_credit_seen;
+
+// The outbound ring, sequence numbers in order
+static uint32_t ring[RING_SLOTS];
+static uint32_t ring_head;
+static uint32_t ring_tail;
+
+// High-level side
+static INTERCORE_FLOW_GRANT grant;
+static GRANT grants[MAX_GRANTS];
+static int grant_count;
+static GRANT stale;
+
+static RESULT result;
+static int64_t now_ms;
+
+static void fail(const char *what)
+{
+    if (result.errors++ < 10) {
+        printf("at %lld ms: %s\n", (long long)now_ms, what);
+    }
+}
+
+static uint32_t in_flight(void)
+{
+    return ring_tail - ring_head;
+}
+
+static void send_reading(uint32_t sequence)
+{
+    if (in_flight() == RING_SLOTS) {
+        fail("ring full");
+        return;
+    }
+    ring[ring_tail++ % RING_SLOTS] = sequence;
+    result.sent++;
+
+    if (in_flight() > result.max_in_flight) {
+        result.max_in_flight = in_flight();
+    }
+}
+
+// push_sensor_reading, checking the policy against the credit it was offered with
+static void push_reading(void)
+{
+    uint32_t credits = flow.credits;
+    bool low = flow.policy == INTERCORE_FLOW_DOWNSAMPLE && credits > 0 && credits <= flow.window / 2;
+    bool sent = intercore_flow_offer(&flow);
+
+    if (sent) {
+        send_reading(latest);
+    }
+
+    switch (flow.policy) {
+    case INTERCORE_FLOW_NONE:
+        if (!sent) {
+            fail("NONE held a reading back");
+        }
+        break;
+    case INTERCORE_FLOW_BLOCK:
+    case INTERCORE_FLOW_COALESCE:
+        if (sent != (credits > 0)) {
+            fail(sent ? "sent without credit" : "held with credit left");
+        }
+        break;
+    case INTERCORE_FLOW_DOWNSAMPLE:
+        if (credits == 0 && sent) {
+            fail("sent without credit");
+        } else if (credits > flow.window / 2 && !sent) {
+            fail("skipped with over half the window free");
+        } else if (low) {
+            if (low_credit_seen && sent == low_credit_last) {
+                fail("did not alternate below half the window");
+            }
+            low_credit_last = sent;
+            low_credit_seen = true;
+        }
+        break;
+    }
+}
+
+// sensor_job_expired and the sensor thread
+static void sample(void)
+{
+    if (intercore_flow_paused(&flow)) {
+        sample_deferred = true;
+        return;
+    }
+
+    latest++;
+    result.sampled++;
+    push_reading();
+}
+
+// grant_sensor_credit
+static void receive_grant(uint32_t credits)
+{
+    bool held = flow.held;
+    bool release = intercore_flow_grant(&flow, credits);
+
+    if (release != (held && flow.credits > 0)) {
+        fail(release ? "released a reading that was not held" : "kept a reading held with credit");
+    }
+    if (release) {
+        push_reading();
+    }
+    if (flow.credits > flow.window) {
+        fail("credit over the window");
+    }
+
+    if (sample_deferred && !intercore_flow_paused(&flow)) {
+        sample_deferred = false;
+        sample();
+    }
+}
+
+// The high-level app's receive handler, one message of readings
+static void drain(uint32_t count, INTERCORE_FLOW_POLICY policy, uint32_t *last_delivered, int64_t *last_delivery_ms)
+{
+    uint32_t drained = 0;
+    uint32_t credits;
+
+    while (drained < count && in_flight() > 0) {
+        uint32_t sequence = ring[ring_head++ % RING_SLOTS];
+
+        if (policy == INTERCORE_FLOW_BLOCK || policy == INTERCORE_FLOW_NONE) {
+            if (sequence != *last_delivered + 1) {
+                fail("a reading was lost");
+            }
+        } else if (sequence <= *last_delivered) {
+            fail("readings out of order");
+        }
+
+        if (now_ms - *last_delivery_ms > result.longest_gap_ms) {
+            result.longest_gap_ms = now_ms - *last_delivery_ms;
+        }
+        *last_delivered = sequence;
+        *last_delivery_ms = now_ms;
+        result.delivered++;
+        drained++;
+    }
+
+    if ((credits = intercore_flow_drained(&grant, drained)) > 0) {
+        if (grant_count == MAX_GRANTS) {
+            fail("too many grants on their way");
+            return;
+        }
+        grants[grant_count++] = (GRANT){.arrive_ms = now_ms + 1 + rand() % 5, .credits = credits};
+    }
+}
+
+static RESULT run_one(INTERCORE_FLOW_POLICY policy, uint32_t window, uint32_t period_ms, uint32_t seconds)
+{
+    uint32_t last_delivered = 0;
+    int64_t last_delivery_ms = 0;
+    int64_t next_sample_ms = 0;
+    int64_t next_drain_ms = 0;
+    int64_t phase_end_ms = 0;
+    uint32_t drain_ms = 1;
+
+    memset(&result, 0, sizeof(result));
+    ring_head = ring_tail = 0;
+    grant_count = 0;
+    latest = 0;
+    sample_deferred = false;
+    low_credit_seen = false;
+
+    // The subscriber's window starts with the subscription, a grant from before it follows
+    intercore_flow_start(&flow, policy, policy == INTERCORE_FLOW_NONE ? 0 : window);
+    intercore_flow_grant_start(&grant, policy == INTERCORE_FLOW_NONE ? 0 : window);
+    stale = (GRANT){.arrive_ms = 0, .credits = window};
+
+    for (now_ms = 0; now_ms < (int64_t)seconds * 1000; now_ms++) {
+        uint32_t transit = 0;
+
+        // The consumer keeps up for a while, then falls behind
+        if (now_ms >= phase_end_ms) {
+            drain_ms = rand() % 2 ? 1 + rand() % (period_ms / 2 + 1) : period_ms * (2 + rand() % 4);
+            phase_end_ms = now_ms + 500 + rand() % 2500;
+        }
+
+        if (stale.credits > 0 && now_ms >= stale.arrive_ms) {
+            receive_grant(stale.credits);
+            stale.credits = 0;
+        }
+        for (int i = 0; i < grant_count;) {
+            if (now_ms >= grants[i].arrive_ms) {
+                uint32_t credits = grants[i].credits;
+
+                grants[i] = grants[--grant_count];
+                receive_grant(credits);
+            } else {
+                i++;
+            }
+        }
+
+        if (now_ms >= next_sample_ms) {
+            sample();
+            next_sample_ms += period_ms;
+        }
+        if (now_ms >= next_drain_ms) {
+            drain(1 + rand() % 3, policy, &last_delivered, &last_delivery_ms);
+            next_drain_ms = now_ms + drain_ms;
+        }
+
+        if (policy == INTERCORE_FLOW_NONE) {
+            continue;
+        }
+
+        for (int i = 0; i < grant_count; i++) {
+            transit += grants[i].credits;
+        }
+        if (in_flight() > window) {
+            fail("more readings in flight than the window");
+        }
+        if (flow.credits + in_flight() + grant.drained + transit != window) {
+            fail("credit lost or made up");
+        }
+    }
+
+    if (now_ms - last_delivery_ms > result.longest_gap_ms) {
+        result.longest_gap_ms = now_ms - last_delivery_ms;
+    }
+    if (result.longest_gap_ms > MAX_STALL_MS) {
+        fail("the stream stalled");
+    }
+    if (policy == INTERCORE_FLOW_NONE && result.sent != result.sampled) {
+        fail("NONE held a reading back");
+    }
+
+    result.throttled = flow.throttled;
+    return result;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-s seconds] [-w window] [-p period] [-r seed]\n"
+            "  -s  simulated seconds per policy (default 600)\n"
+            "  -w  credit window, readings (default 8, as Lab 6 subscribes)\n"
+            "  -p  sample period in milliseconds, at least 2 (default 10)\n"
+            "  -r  random seed (default 1)\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    static const POLICY policies[] = {
+        {"none", INTERCORE_FLOW_NONE},
+        {"block", INTERCORE_FLOW_BLOCK},
+        {"coalesce", INTERCORE_FLOW_COALESCE},
+        {"downsample", INTERCORE_FLOW_DOWNSAMPLE},
+    };
+    uint32_t seconds = 600;
+    uint32_t window = 8;
+    uint32_t period_ms = 10;
+    unsigned seed = 1;
+    bool ok = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:w:p:r:h")) != -1) {
+        switch (opt) {
+        case 's':
+            seconds = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            window = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            period_ms = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            seed = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (seconds == 0 || window == 0 || window > RING_SLOTS || period_ms < 2 || period_ms > 1000) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    srand(seed);
+    printf("%-12s %10s %10s %10s %10s %10s %10s\n", "policy", "sampled", "delivered", "throttled", "in flight",
+           "gap ms", "errors");
+
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        RESULT run = run_one(policies[i].policy, window, period_ms, seconds);
+
+        printf("%-12s %10u %10u %10u %10u %10lld %10u  %s\n", policies[i].name, run.sampled, run.delivered,
+               run.throttled, run.max_in_flight, (long long)run.longest_gap_ms, run.errors,
+               run.errors == 0 ? "ok" : "FAILED");
+        ok = ok && run.errors == 0;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
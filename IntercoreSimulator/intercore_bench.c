@@ -0,0 +1,478 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Intercore transport throughput and latency benchmark.
+//
+// The real-time side runs in a child process and streams messages to the high-level side
+// through the shared ring, the same direction the telemetry takes on the device. Each
+// message carries the time it was enqueued, so the high-level side can measure the
+// enqueue to dequeue latency.
+//
+// With -c the benchmark instead measures command-to-action latency in the other direction:
+// the high-level side sends commands at random intervals and the real-time side either polls
+// the ring on a fixed tick, as the ThreadX app used to, or sleeps until the mailbox SW
+// interrupt, and reports how long each command waited before it was acted on.
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "intercore_sim.h"
+
+#define MAX_SWEEP 16
+#define MAX_MESSAGE_SIZE 65536
+
+// Command latency mode
+#define COMMAND_MESSAGE_SIZE 40      // 20 byte component id + INTERCORE_BLOCK
+#define COMMAND_BUFFER_SIZE 1024
+#define COMMAND_MEAN_GAP_MS 50       // commands are sent 0 to 100ms apart
+#define COMMAND_POLL_MS 250          // old intercore_thread tick
+
+/// <summary>Header written into the start of every benchmark message.</summary>
+typedef struct {
+    uint64_t timestamp;
+    uint32_t sequence;
+} BENCH_STAMP;
+
+typedef struct {
+    double messagesPerSecond;
+    double bytesPerSecond;
+    double p50Us;
+    double p99Us;
+} BENCH_RESULT;
+
+static uint8_t messageBuffer[MAX_MESSAGE_SIZE];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline)
+{
+    struct timespec ts = {.tv_sec = (time_t)(deadline / 1000000000ull),
+                          .tv_nsec = (long)(deadline % 1000000000ull)};
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+        // interrupted, sleep again
+    }
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int parse_list(const char *arg, uint32_t *list)
+{
+    int count = 0;
+    char *copy = strdup(arg);
+
+    for (char *item = strtok(copy, ","); item != NULL && count < MAX_SWEEP;
+         item = strtok(NULL, ",")) {
+        list[count++] = (uint32_t)strtoul(item, NULL, 0);
+    }
+
+    free(copy);
+    return count;
+}
+
+/// <summary>
+/// Real-time side, enqueue count messages of messageSize bytes then exit.
+/// </summary>
+static void run_real_time(uint32_t count, uint32_t messageSize)
+{
+    BufferHeader *outbound, *inbound;
+    uint32_t bufSize;
+
+    Sim_SetRole(SIM_ROLE_REAL_TIME);
+
+    if (GetIntercoreBuffers(&outbound, &inbound, &bufSize) == -1) {
+        _exit(EXIT_FAILURE);
+    }
+
+    memset(messageBuffer, 0xA5, messageSize);
+
+    for (uint32_t sequence = 0; sequence < count; sequence++) {
+        BENCH_STAMP stamp = {.sequence = sequence};
+
+        while (true) {
+            stamp.timestamp = now_ns();
+            memcpy(messageBuffer, &stamp, sizeof(stamp));
+
+            if (EnqueueData(inbound, outbound, bufSize, messageBuffer, messageSize) == 0) {
+                break;
+            }
+
+            // Ring is full, sleep until the high-level side releases a block.
+            Sim_WaitForDoorbell(SIM_DOORBELL_RECEIVED, -1);
+        }
+    }
+
+    _exit(EXIT_SUCCESS);
+}
+
+/// <summary>
+/// High-level side, dequeue count messages and collect their latencies.
+/// </summary>
+static int run_high_level(uint32_t count, uint32_t messageSize, uint64_t *latency,
+                          BENCH_RESULT *result)
+{
+    BufferHeader *outbound, *inbound;
+    uint32_t bufSize;
+    uint64_t start = 0, end = 0;
+
+    Sim_SetRole(SIM_ROLE_HIGH_LEVEL);
+    Sim_PublishBuffers(&outbound, &inbound, &bufSize);
+
+    for (uint32_t received = 0; received < count;) {
+        uint32_t dataSize = sizeof(messageBuffer);
+
+        if (DequeueData(outbound, inbound, bufSize, messageBuffer, &dataSize) == -1) {
+            // Ring is empty, or the message is bigger than the buffer.
+            if (dataSize > sizeof(messageBuffer)) {
+                fprintf(stderr, "intercore_bench: message of %u bytes too large\n", dataSize);
+                return -1;
+            }
+
+            if (Sim_WaitForDoorbell(SIM_DOORBELL_SENT, 5000) == 0) {
+                fprintf(stderr, "intercore_bench: timed out after %u messages\n", received);
+                return -1;
+            }
+            continue;
+        }
+
+        end = now_ns();
+
+        BENCH_STAMP stamp;
+        memcpy(&stamp, messageBuffer, sizeof(stamp));
+
+        if (dataSize != messageSize || stamp.sequence != received) {
+            fprintf(stderr, "intercore_bench: message %u corrupt (sequence %u, %u bytes)\n",
+                    received, stamp.sequence, dataSize);
+            return -1;
+        }
+
+        if (received == 0) {
+            start = stamp.timestamp;
+        }
+
+        latency[received++] = end - stamp.timestamp;
+    }
+
+    qsort(latency, count, sizeof(latency[0]), compare_u64);
+
+    double seconds = (double)(end - start) / 1e9;
+    result->messagesPerSecond = count / seconds;
+    result->bytesPerSecond = (double)count * messageSize / seconds;
+    result->p50Us = latency[(count - 1) * 50 / 100] / 1e3;
+    result->p99Us = latency[(count - 1) * 99 / 100] / 1e3;
+
+    return 0;
+}
+
+/// <summary>
+/// Real-time side of the command latency test. Wakes every pollMs, or on the SENT doorbell when
+/// pollMs is 0, and answers each command with the time it waited before being read.
+/// </summary>
+static void run_real_time_commands(uint32_t count, int pollMs)
+{
+    BufferHeader *outbound, *inbound;
+    uint32_t bufSize;
+    uint64_t nextTick = now_ns();
+    uint32_t received = 0;
+
+    Sim_SetRole(SIM_ROLE_REAL_TIME);
+
+    if (GetIntercoreBuffers(&outbound, &inbound, &bufSize) == -1) {
+        _exit(EXIT_FAILURE);
+    }
+
+    while (received < count) {
+        if (pollMs > 0) {
+            nextTick += (uint64_t)pollMs * 1000000ull;
+            sleep_until_ns(nextTick);
+        } else {
+            Sim_WaitForDoorbell(SIM_DOORBELL_SENT, -1);
+        }
+
+        uint32_t dataSize = sizeof(messageBuffer);
+        while (DequeueData(outbound, inbound, bufSize, messageBuffer, &dataSize) == 0) {
+            BENCH_STAMP stamp;
+            memcpy(&stamp, messageBuffer, sizeof(stamp));
+
+            // Reply with the command-to-action time in place of the send time
+            stamp.timestamp = now_ns() - stamp.timestamp;
+            memcpy(messageBuffer, &stamp, sizeof(stamp));
+
+            while (EnqueueData(inbound, outbound, bufSize, messageBuffer, dataSize) == -1) {
+                Sim_WaitForDoorbell(SIM_DOORBELL_RECEIVED, -1);
+            }
+
+            received++;
+            dataSize = sizeof(messageBuffer);
+        }
+    }
+
+    _exit(EXIT_SUCCESS);
+}
+
+/// <summary>
+/// High-level side of the command latency test, sends count commands at random intervals and
+/// collects the real-time side's measurements.
+/// </summary>
+static int run_high_level_commands(uint32_t count, uint64_t *latency)
+{
+    BufferHeader *outbound, *inbound;
+    uint32_t bufSize;
+    uint32_t sent = 0, answered = 0;
+    unsigned int seed = 1;
+    uint64_t nextSend = now_ns();
+
+    Sim_SetRole(SIM_ROLE_HIGH_LEVEL);
+    Sim_PublishBuffers(&outbound, &inbound, &bufSize);
+
+    memset(messageBuffer, 0, COMMAND_MESSAGE_SIZE);
+
+    while (answered < count) {
+        if (sent < count && now_ns() >= nextSend) {
+            BENCH_STAMP stamp = {.timestamp = now_ns(), .sequence = sent};
+            memcpy(messageBuffer, &stamp, sizeof(stamp));
+
+            if (EnqueueData(inbound, outbound, bufSize, messageBuffer, COMMAND_MESSAGE_SIZE) == 0) {
+                sent++;
+                nextSend += (uint64_t)(rand_r(&seed) % (2 * COMMAND_MEAN_GAP_MS + 1)) * 1000000ull;
+            }
+        }
+
+        uint32_t dataSize = sizeof(messageBuffer);
+        while (DequeueData(outbound, inbound, bufSize, messageBuffer, &dataSize) == 0) {
+            BENCH_STAMP stamp;
+            memcpy(&stamp, messageBuffer, sizeof(stamp));
+            latency[answered++] = stamp.timestamp;
+            dataSize = sizeof(messageBuffer);
+        }
+
+        if (answered == count) {
+            break;
+        }
+
+        // Sleep until the next command is due or a reply arrives
+        int64_t waitMs = sent < count ? (int64_t)(nextSend - now_ns()) / 1000000 : 5000;
+        if (waitMs > 0 && Sim_WaitForDoorbell(SIM_DOORBELL_SENT, (int)waitMs) == 0 && sent == count) {
+            fprintf(stderr, "intercore_bench: timed out after %u replies\n", answered);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Runs the command latency test with the real-time side polling every pollMs, or woken by the
+/// mailbox interrupt when pollMs is 0, and prints the result.
+/// </summary>
+static int run_commands(uint32_t count, int pollMs, uint64_t *latency)
+{
+    if (Sim_CreateRegion(COMMAND_BUFFER_SIZE) == -1) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("intercore_bench: fork");
+        Sim_DestroyRegion();
+        return -1;
+    }
+
+    if (pid == 0) {
+        run_real_time_commands(count, pollMs);
+    }
+
+    int rc = run_high_level_commands(count, latency);
+
+    if (rc == -1) {
+        kill(pid, SIGKILL);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        rc = -1;
+    }
+
+    Sim_DestroyRegion();
+
+    if (rc == 0) {
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            total += latency[i];
+        }
+
+        qsort(latency, count, sizeof(latency[0]), compare_u64);
+
+        char wake[32];
+        snprintf(wake, sizeof(wake), pollMs > 0 ? "poll %dms" : "mailbox irq", pollMs);
+        printf("%-12s %8u %12.3f %12.3f %12.3f\n", wake, count, total / 1e6 / count,
+               latency[(count - 1) * 50 / 100] / 1e6, latency[(count - 1) * 99 / 100] / 1e6);
+        fflush(stdout);
+    }
+
+    return rc;
+}
+
+static int run_one(uint32_t bufferSize, uint32_t messageSize, uint32_t count, uint64_t *latency,
+                   BENCH_RESULT *result)
+{
+    if (Sim_CreateRegion(bufferSize) == -1) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("intercore_bench: fork");
+        Sim_DestroyRegion();
+        return -1;
+    }
+
+    if (pid == 0) {
+        run_real_time(count, messageSize);
+    }
+
+    int rc = run_high_level(count, messageSize, latency, result);
+
+    if (rc == -1) {
+        kill(pid, SIGKILL);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        rc = -1;
+    }
+
+    Sim_DestroyRegion();
+    return rc;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-n messages] [-b buffer sizes] [-m message sizes]\n"
+            "       %s -c commands\n"
+            "  -n  messages per run (default 200000)\n"
+            "  -b  comma separated shared buffer sizes, powers of two (default 1024,4096,16384)\n"
+            "  -m  comma separated message sizes in bytes (default 40,64,256,1024)\n"
+            "  -c  measure command-to-action latency over this many commands, polling vs interrupt\n",
+            name, name);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t count = 200000;
+    uint32_t bufferSizes[MAX_SWEEP] = {1024, 4096, 16384};
+    uint32_t messageSizes[MAX_SWEEP] = {40, 64, 256, 1024};
+    int bufferCount = 3;
+    int messageCount = 4;
+    uint32_t commandCount = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:m:c:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            commandCount = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            count = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            bufferCount = parse_list(optarg, bufferSizes);
+            break;
+        case 'm':
+            messageCount = parse_list(optarg, messageSizes);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (count == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (commandCount > 0) {
+        uint64_t *commandLatency = malloc(commandCount * sizeof(uint64_t));
+        if (commandLatency == NULL) {
+            perror("intercore_bench: malloc");
+            return EXIT_FAILURE;
+        }
+
+        printf("%-12s %8s %12s %12s %12s\n", "wake", "commands", "avg ms", "p50 ms", "p99 ms");
+        fflush(stdout);
+
+        int rc = run_commands(commandCount, COMMAND_POLL_MS, commandLatency);
+        if (rc == 0) {
+            rc = run_commands(commandCount, 0, commandLatency);
+        }
+
+        free(commandLatency);
+        return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    uint64_t *latency = malloc(count * sizeof(uint64_t));
+    if (latency == NULL) {
+        perror("intercore_bench: malloc");
+        return EXIT_FAILURE;
+    }
+
+    printf("%5s %8s %8s %12s %12s %10s %10s\n", "align", "buffer", "message", "msgs/s", "MB/s",
+           "p50 us", "p99 us");
+    fflush(stdout);
+
+    int failures = 0;
+
+    for (int b = 0; b < bufferCount; b++) {
+        for (int m = 0; m < messageCount; m++) {
+            uint32_t bufferSize = bufferSizes[b];
+            uint32_t messageSize = messageSizes[m];
+            BENCH_RESULT result;
+
+            // Same space check as ReserveData, a message that can never fit is skipped.
+            if (messageSize < sizeof(BENCH_STAMP) || messageSize > MAX_MESSAGE_SIZE ||
+                bufferSize <= sizeof(BufferHeader) ||
+                sizeof(uint32_t) + messageSize + RINGBUFFER_ALIGNMENT >=
+                    bufferSize - sizeof(BufferHeader)) {
+                printf("%5d %8u %8u %12s\n", RINGBUFFER_ALIGNMENT, bufferSize, messageSize,
+                       "skipped");
+                continue;
+            }
+
+            if (run_one(bufferSize, messageSize, count, latency, &result) == -1) {
+                printf("%5d %8u %8u %12s\n", RINGBUFFER_ALIGNMENT, bufferSize, messageSize,
+                       "failed");
+                failures++;
+                continue;
+            }
+
+            printf("%5d %8u %8u %12.0f %12.2f %10.2f %10.2f\n", RINGBUFFER_ALIGNMENT, bufferSize,
+                   messageSize, result.messagesPerSecond, result.bytesPerSecond / 1e6,
+                   result.p50Us, result.p99Us);
+            fflush(stdout);
+        }
+    }
+
+    free(latency);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
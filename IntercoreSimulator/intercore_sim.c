@@ -0,0 +1,289 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "intercore_sim.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/// <summary>Mailbox register bank, must match MAILBOX_BASE in mt3620-intercore.c.</summary>
+#define SIM_MAILBOX_BASE 0x21050000
+
+/// <summary>
+/// The region is mapped below 4GB because the mailbox carries buffer addresses as 32-bit
+/// values, see GetBufferHeader in mt3620-intercore.c.
+/// </summary>
+#define SIM_REGION_ADDRESS ((void *)0x10000000)
+
+#define SIM_CONTROL_SIZE 4096
+#define SIM_MBOX_FIFO_DEPTH 16
+
+/// <summary>Mailbox command FIFO, from the high-level side to the real-time side.</summary>
+typedef struct {
+    uint32_t cmd[SIM_MBOX_FIFO_DEPTH];
+    uint32_t data[SIM_MBOX_FIFO_DEPTH];
+    _Atomic uint32_t pushCount;
+    _Atomic uint32_t popCount;
+} SimMailboxFifo;
+
+typedef struct {
+    SimMailboxFifo fifo;
+} SimControl;
+
+static uint8_t *region;
+static size_t regionSize;
+static uint32_t bufferSize;
+static SimRole role;
+
+// doorbells[role][bit] is rung by the peer of role, bit 0 = sent and bit 1 = received.
+static int doorbells[2][2] = {{-1, -1}, {-1, -1}};
+// Signalled when the high-level side pushes to the mailbox FIFO.
+static int fifoEvent = -1;
+
+static SimControl *GetControl(void)
+{
+    return (SimControl *)region;
+}
+
+// Buffer the real-time side writes to.
+static BufferHeader *GetRealTimeOutbound(void)
+{
+    return (BufferHeader *)(region + SIM_CONTROL_SIZE);
+}
+
+// Buffer the high-level side writes to.
+static BufferHeader *GetRealTimeInbound(void)
+{
+    return (BufferHeader *)(region + SIM_CONTROL_SIZE + bufferSize);
+}
+
+static uint32_t EncodeBuffer(BufferHeader *header)
+{
+    // Address in the upper bits, log2 of the buffer size in the lower five bits.
+    return (uint32_t)(uintptr_t)header | (uint32_t)__builtin_ctz(bufferSize);
+}
+
+static void RingEvent(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("intercore_sim: doorbell");
+    }
+}
+
+static void PushMailbox(uint32_t cmd, uint32_t data)
+{
+    SimMailboxFifo *fifo = &GetControl()->fifo;
+    uint32_t push = atomic_load(&fifo->pushCount);
+
+    fifo->cmd[push % SIM_MBOX_FIFO_DEPTH] = cmd;
+    fifo->data[push % SIM_MBOX_FIFO_DEPTH] = data;
+    atomic_store(&fifo->pushCount, push + 1);
+
+    RingEvent(fifoEvent);
+}
+
+int Sim_CreateRegion(uint32_t size)
+{
+    if ((size & (size - 1)) != 0 || size <= sizeof(BufferHeader)) {
+        fprintf(stderr, "intercore_sim: buffer size %u is not a usable power of two\n", size);
+        return -1;
+    }
+
+    bufferSize = size;
+    regionSize = SIM_CONTROL_SIZE + 2 * (size_t)size;
+
+    int fd = memfd_create("intercore-sim", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("intercore_sim: memfd_create");
+        return -1;
+    }
+
+    if (ftruncate(fd, (off_t)regionSize) == -1) {
+        perror("intercore_sim: ftruncate");
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(SIM_REGION_ADDRESS, regionSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        perror("intercore_sim: mmap");
+        return -1;
+    }
+
+    // Kernels without MAP_FIXED_NOREPLACE treat the address as a hint.
+    if (map != SIM_REGION_ADDRESS) {
+        fprintf(stderr, "intercore_sim: region not mapped at %p\n", SIM_REGION_ADDRESS);
+        munmap(map, regionSize);
+        return -1;
+    }
+
+    region = map;
+
+    for (int r = 0; r < 2; r++) {
+        for (int bit = 0; bit < 2; bit++) {
+            doorbells[r][bit] = eventfd(0, EFD_NONBLOCK);
+        }
+    }
+    fifoEvent = eventfd(0, EFD_NONBLOCK);
+
+    for (int r = 0; r < 2; r++) {
+        for (int bit = 0; bit < 2; bit++) {
+            if (doorbells[r][bit] == -1) {
+                perror("intercore_sim: eventfd");
+                Sim_DestroyRegion();
+                return -1;
+            }
+        }
+    }
+
+    if (fifoEvent == -1) {
+        perror("intercore_sim: eventfd");
+        Sim_DestroyRegion();
+        return -1;
+    }
+
+    return 0;
+}
+
+void Sim_DestroyRegion(void)
+{
+    for (int r = 0; r < 2; r++) {
+        for (int bit = 0; bit < 2; bit++) {
+            if (doorbells[r][bit] != -1) {
+                close(doorbells[r][bit]);
+                doorbells[r][bit] = -1;
+            }
+        }
+    }
+
+    if (fifoEvent != -1) {
+        close(fifoEvent);
+        fifoEvent = -1;
+    }
+
+    if (region != NULL) {
+        munmap(region, regionSize);
+        region = NULL;
+    }
+}
+
+void Sim_SetRole(SimRole newRole)
+{
+    role = newRole;
+}
+
+void Sim_PublishBuffers(BufferHeader **outbound, BufferHeader **inbound, uint32_t *bufSize)
+{
+    // Same sequence the real-time side waits for in GetIntercoreBuffers.
+    PushMailbox(0xba5e0001, EncodeBuffer(GetRealTimeOutbound()));
+    PushMailbox(0xba5e0002, EncodeBuffer(GetRealTimeInbound()));
+    PushMailbox(0xba5e0003, 0);
+
+    *outbound = GetRealTimeInbound();
+    *inbound = GetRealTimeOutbound();
+    *bufSize = bufferSize - sizeof(BufferHeader);
+}
+
+uint32_t Sim_WaitForDoorbell(uint32_t mask, int timeoutMs)
+{
+    struct pollfd fds[2];
+    uint32_t bits[2];
+    nfds_t count = 0;
+
+    for (int bit = 0; bit < 2; bit++) {
+        if (mask & (1U << bit)) {
+            fds[count].fd = doorbells[role][bit];
+            fds[count].events = POLLIN;
+            bits[count] = 1U << bit;
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    int ready;
+    do {
+        ready = poll(fds, count, timeoutMs);
+    } while (ready == -1 && errno == EINTR);
+
+    uint32_t pending = 0;
+    for (nfds_t i = 0; ready > 0 && i < count; i++) {
+        uint64_t value;
+        if ((fds[i].revents & POLLIN) && read(fds[i].fd, &value, sizeof(value)) == sizeof(value)) {
+            pending |= bits[i];
+        }
+    }
+
+    return pending;
+}
+
+uint32_t ReadReg32(uintptr_t baseAddr, size_t offset)
+{
+    if (baseAddr != SIM_MAILBOX_BASE) {
+        return 0;
+    }
+
+    SimMailboxFifo *fifo = &GetControl()->fifo;
+    uint32_t pop = atomic_load(&fifo->popCount);
+
+    switch (offset) {
+    case 0x58: {
+        // FIFO_POP_CNT. Callers spin on this, so sleep until something is pushed.
+        uint32_t available;
+        while ((available = atomic_load(&fifo->pushCount) - pop) == 0) {
+            struct pollfd pfd = {.fd = fifoEvent, .events = POLLIN};
+            uint64_t value;
+
+            if (poll(&pfd, 1, -1) > 0) {
+                // Clear the event, the FIFO counters are checked again either way.
+                ssize_t cleared = read(fifoEvent, &value, sizeof(value));
+                (void)cleared;
+            }
+        }
+        return available;
+    }
+    case 0x54:
+        // DATA_POP0, read before CMD_POP0.
+        return fifo->data[pop % SIM_MBOX_FIFO_DEPTH];
+    case 0x50: {
+        // CMD_POP0, reading it pops the entry.
+        uint32_t cmd = fifo->cmd[pop % SIM_MBOX_FIFO_DEPTH];
+        atomic_store(&fifo->popCount, pop + 1);
+        return cmd;
+    }
+    default:
+        return 0;
+    }
+}
+
+void WriteReg32(uintptr_t baseAddr, size_t offset, uint32_t value)
+{
+    // SW_TX_INT_PORT, each bit raises the matching SW interrupt on the other core.
+    if (baseAddr != SIM_MAILBOX_BASE || offset != 0x14) {
+        return;
+    }
+
+    SimRole peer = (role == SIM_ROLE_REAL_TIME) ? SIM_ROLE_HIGH_LEVEL : SIM_ROLE_REAL_TIME;
+
+    for (int bit = 0; bit < 2; bit++) {
+        if (value & (1U << bit)) {
+            RingEvent(doorbells[peer][bit]);
+        }
+    }
+}
@@ -0,0 +1,70 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef INTERCORE_SIM_H
+#define INTERCORE_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mt3620-intercore.h"
+
+/// <summary>
+/// <para>Host (Linux) stand-in for the MT3620 mailbox and shared memory, so the intercore
+/// transport in mt3620-intercore.c can be built and measured off-device.</para>
+/// <para>The shared buffers live in a memfd region mapped at the same low address in both
+/// processes, so the 32-bit buffer descriptors sent through the mailbox stay valid. The
+/// mailbox command FIFO lives in the same region and the SW interrupts are eventfds.</para>
+/// </summary>
+
+/// <summary>Which end of the transport the calling process plays.</summary>
+typedef enum {
+    SIM_ROLE_REAL_TIME = 0,
+    SIM_ROLE_HIGH_LEVEL = 1
+} SimRole;
+
+/// <summary>SW interrupt raised by CommitData, the peer has sent a message.</summary>
+#define SIM_DOORBELL_SENT (1U << 0)
+/// <summary>SW interrupt raised by ReleaseData, the peer has freed space.</summary>
+#define SIM_DOORBELL_RECEIVED (1U << 1)
+
+/// <summary>
+/// Creates the shared region and the doorbells. Call once before fork(), both processes
+/// inherit the mapping at the same address.
+/// </summary>
+/// <param name="bufferSize">Size of each shared buffer including its header. Must be a power
+/// of two.</param>
+/// <returns>0 on success, -1 on failure.</returns>
+int Sim_CreateRegion(uint32_t bufferSize);
+
+/// <summary>Unmaps the shared region and closes the doorbells.</summary>
+void Sim_DestroyRegion(void);
+
+/// <summary>Sets the role of the calling process, which decides who a doorbell rings.</summary>
+void Sim_SetRole(SimRole role);
+
+/// <summary>
+/// <para>High-level side: posts the buffer descriptors to the real-time mailbox FIFO, as the
+/// Azure Sphere OS does when the real-time app starts. GetIntercoreBuffers on the real-time
+/// side returns once it has seen them.</para>
+/// <para>Also returns the high-level view of the buffers, which is the real-time view with
+/// inbound and outbound swapped, ready for EnqueueData and DequeueData.</para>
+/// </summary>
+void Sim_PublishBuffers(BufferHeader **outbound, BufferHeader **inbound, uint32_t *bufSize);
+
+/// <summary>
+/// Blocks until one of the requested doorbells has been rung by the peer.
+/// </summary>
+/// <param name="mask">SIM_DOORBELL_SENT and/or SIM_DOORBELL_RECEIVED.</param>
+/// <param name="timeoutMs">Milliseconds to wait, or -1 to wait forever.</param>
+/// <returns>The doorbells which were pending, 0 on timeout.</returns>
+uint32_t Sim_WaitForDoorbell(uint32_t mask, int timeoutMs);
+
+/// <summary>Emulated register read, only the mailbox FIFO registers are implemented.</summary>
+uint32_t ReadReg32(uintptr_t baseAddr, size_t offset);
+
+/// <summary>Emulated register write, only the mailbox SW interrupt register is
+/// implemented.</summary>
+void WriteReg32(uintptr_t baseAddr, size_t offset, uint32_t value);
+
+#endif /* INTERCORE_SIM_H */
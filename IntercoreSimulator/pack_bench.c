@@ -0,0 +1,287 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Compression ratio and cost of the delta packed intercore frames, see intercore_pack.h.
+//
+// Each trace is packed and unpacked in frames, the unpacked values must match the originals.
+// Accelerometer and gyroscope traces are raw LSM6DSO output register samples, x y z int16 as the
+// OUTX_L_A and OUTX_L_G registers hold them. Pass a recording with -f, without one synthetic
+// traces are generated with the noise of a resting LSM6DSO at 104 Hz, +-2 g and 250 dps.
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "intercore_pack.h"
+
+#define AXES 3
+#define DEFAULT_SAMPLES 4096
+#define FRAME_RECORDS 32
+
+// Raw counts, 0.061 mg and 8.75 mdps per LSB
+#define ACCEL_1G 16393
+#define ACCEL_NOISE 12
+#define GYRO_NOISE 8
+
+typedef struct {
+    const char *name;
+    int16_t *samples;
+    size_t count; // int16 values, AXES per sample
+} TRACE;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Roughly normal noise, the sum of uniform values
+static int noise(int amplitude)
+{
+    int sum = 0;
+
+    for (int i = 0; i < 4; i++) {
+        sum += rand() % (2 * amplitude + 1) - amplitude;
+    }
+    return sum / 2;
+}
+
+static TRACE synthetic_accel(size_t samples, bool moving)
+{
+    TRACE trace = {moving ? "accel moving" : "accel resting", malloc(samples * AXES * sizeof(int16_t)),
+                   samples * AXES};
+
+    for (size_t i = 0; i < samples; i++) {
+        // A 2 Hz sway of a quarter g while moving, sampled at 104 Hz
+        double sway = moving ? 0.25 * ACCEL_1G * sin(2 * M_PI * 2 * i / 104.0) : 0;
+
+        trace.samples[i * AXES + 0] = (int16_t)(sway + noise(ACCEL_NOISE));
+        trace.samples[i * AXES + 1] = (int16_t)(sway / 2 + noise(ACCEL_NOISE));
+        trace.samples[i * AXES + 2] = (int16_t)(ACCEL_1G + noise(ACCEL_NOISE));
+    }
+    return trace;
+}
+
+static TRACE synthetic_gyro(size_t samples)
+{
+    TRACE trace = {"gyro resting", malloc(samples * AXES * sizeof(int16_t)), samples * AXES};
+
+    for (size_t i = 0; i < samples * AXES; i++) {
+        trace.samples[i] = (int16_t)noise(GYRO_NOISE);
+    }
+    return trace;
+}
+
+static bool load_trace(const char *path, TRACE *trace)
+{
+    FILE *file = fopen(path, "rb");
+    long size;
+
+    if (file == NULL || fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < AXES * 2) {
+        if (file) {
+            fclose(file);
+        }
+        return false;
+    }
+
+    rewind(file);
+    trace->name = path;
+    trace->count = (size_t)size / (AXES * sizeof(int16_t)) * AXES;
+    trace->samples = malloc(trace->count * sizeof(int16_t));
+
+    // Registers are little endian, as is the host this runs on
+    bool ok = fread(trace->samples, sizeof(int16_t), trace->count, file) == trace->count;
+    fclose(file);
+    return ok;
+}
+
+/// <summary>
+/// Pack and unpack a trace in frames of frame samples, checking every value comes back.
+/// </summary>
+/// <returns>false if a value came back wrong</returns>
+static bool run_trace(const TRACE *trace, size_t frame)
+{
+    size_t values = frame * AXES;
+    size_t bound = values * 3;
+    uint8_t *packed = malloc(bound);
+    int16_t *unpacked = malloc(values * sizeof(int16_t));
+    uint64_t encode_ns = 0, decode_ns = 0, start;
+    size_t packed_bytes = 0;
+    bool ok = true;
+
+    for (size_t offset = 0; offset + values <= trace->count && ok; offset += values) {
+        int length;
+
+        start = now_ns();
+        length = intercore_pack_i16(trace->samples + offset, values, AXES, packed, bound);
+        encode_ns += now_ns() - start;
+
+        start = now_ns();
+        ok = length > 0 && intercore_unpack_i16(packed, (size_t)length, unpacked, values, AXES) == length;
+        decode_ns += now_ns() - start;
+
+        ok = ok && memcmp(unpacked, trace->samples + offset, values * sizeof(int16_t)) == 0;
+        packed_bytes += (size_t)length;
+    }
+
+    size_t raw_bytes = trace->count / values * values * sizeof(int16_t);
+    size_t total = raw_bytes / sizeof(int16_t);
+
+    if (!ok || total == 0) {
+        printf("%-16s %6zu %10s\n", trace->name, frame, "failed");
+    } else {
+        printf("%-16s %6zu %10zu %10zu %7.2fx %10.2f %10.2f\n", trace->name, frame, raw_bytes,
+               packed_bytes, (double)raw_bytes / packed_bytes, (double)encode_ns / total,
+               (double)decode_ns / total);
+    }
+
+    free(packed);
+    free(unpacked);
+    return ok && total > 0;
+}
+
+// Compared field by field, struct padding is not copied reliably
+static bool same_record(const INTERCORE_RECORD *a, const INTERCORE_RECORD *b)
+{
+    return a->cmd == b->cmd && a->fields == b->fields && a->temperature_centi == b->temperature_centi &&
+           a->pressure_deci == b->pressure_deci && a->humidity_centi == b->humidity_centi &&
+           a->operating_mode == b->operating_mode && a->version == b->version;
+}
+
+/// <summary>
+/// Environment readings as the real-time apps push them, compact records against packed frames.
+/// </summary>
+static bool run_environment(int frames)
+{
+    INTERCORE_RECORD records[FRAME_RECORDS], unpacked[FRAME_RECORDS];
+    uint8_t buf[INTERCORE_WIRE_MAX_RECORD_SIZE * FRAME_RECORDS];
+    size_t compact_bytes = 0, packed_bytes = 0;
+    uint64_t encode_ns = 0, decode_ns = 0, start;
+    double temperature = 2150, pressure = 10132, humidity = 4550;
+    uint16_t version = 0;
+    bool ok = true;
+
+    for (int f = 0; f < frames && ok; f++) {
+        int length;
+
+        for (int i = 0; i < FRAME_RECORDS; i++) {
+            temperature += noise(3);
+            pressure += noise(2);
+            humidity += noise(5);
+
+            records[i] = (INTERCORE_RECORD){
+                .cmd = IC_READ_SENSOR,
+                .fields = IC_FIELD_TEMPERATURE | IC_FIELD_PRESSURE | IC_FIELD_HUMIDITY |
+                          IC_FIELD_OPERATING_MODE | IC_FIELD_VERSION,
+                .temperature_centi = (int16_t)temperature,
+                .pressure_deci = (uint16_t)pressure,
+                .humidity_centi = (uint16_t)humidity,
+                .operating_mode = HVAC_MODE_GREEN,
+                .version = version++};
+            compact_bytes += (size_t)intercore_encode(&records[i], buf, sizeof(buf));
+        }
+
+        start = now_ns();
+        length = intercore_pack_records(records, FRAME_RECORDS, buf, sizeof(buf));
+        encode_ns += now_ns() - start;
+
+        start = now_ns();
+        ok = length > 0 &&
+             intercore_unpack_records(buf, (size_t)length, unpacked, FRAME_RECORDS) == FRAME_RECORDS;
+        decode_ns += now_ns() - start;
+
+        for (int i = 0; i < FRAME_RECORDS && ok; i++) {
+            ok = same_record(&unpacked[i], &records[i]);
+        }
+        packed_bytes += (size_t)length;
+    }
+
+    if (!ok) {
+        printf("%-16s %6d %10s\n", "environment", FRAME_RECORDS, "failed");
+        return false;
+    }
+
+    int total = frames * FRAME_RECORDS;
+    printf("%-16s %6d %10zu %10zu %7.2fx %10.2f %10.2f\n", "environment", FRAME_RECORDS,
+           compact_bytes, packed_bytes, (double)compact_bytes / packed_bytes,
+           (double)encode_ns / total, (double)decode_ns / total);
+    return true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-f recording] [-n samples] [-s frame samples]\n"
+            "  -f  raw LSM6DSO samples, x y z int16 little endian, instead of synthetic traces\n"
+            "  -n  samples per synthetic trace (default %d)\n"
+            "  -s  samples per packed frame (default 8,32,128)\n",
+            name, DEFAULT_SAMPLES);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t samples = DEFAULT_SAMPLES;
+    size_t frames[] = {8, 32, 128};
+    size_t frame_count = sizeof(frames) / sizeof(frames[0]);
+    const char *recording = NULL;
+    TRACE traces[3];
+    int trace_count = 0;
+    int failures = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:n:s:h")) != -1) {
+        switch (opt) {
+        case 'f':
+            recording = optarg;
+            break;
+        case 'n':
+            samples = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            frames[0] = strtoul(optarg, NULL, 0);
+            frame_count = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (samples == 0 || frames[0] == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+
+    if (recording) {
+        if (!load_trace(recording, &traces[trace_count++])) {
+            fprintf(stderr, "cannot read %s\n", recording);
+            return EXIT_FAILURE;
+        }
+    } else {
+        traces[trace_count++] = synthetic_accel(samples, false);
+        traces[trace_count++] = synthetic_accel(samples, true);
+        traces[trace_count++] = synthetic_gyro(samples);
+    }
+
+    printf("%-16s %6s %10s %10s %8s %10s %10s\n", "trace", "frame", "raw", "packed", "ratio",
+           "enc ns", "dec ns");
+
+    for (int t = 0; t < trace_count; t++) {
+        for (size_t f = 0; f < frame_count; f++) {
+            failures += !run_trace(&traces[t], frames[f]);
+        }
+        free(traces[t].samples);
+    }
+
+    // Raw here is the compact records the frame replaces, ns are per record
+    failures += !run_environment((int)(samples / FRAME_RECORDS) + 1);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
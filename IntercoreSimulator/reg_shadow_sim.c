@@ -0,0 +1,397 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Lab 4's LSM6DSO and LPS22HH register shadow against simulated sensors, see reg_shadow.h.
+//
+// Each scenario runs twice on its own simulated sensor, once through a plain driver context and
+// once with a shadow, and counts the I2C transactions each takes. The sensors keep a register file
+// per bank, reset on the reset bits, hold those bits for a couple of reads while resetting, and
+// have a status register that changes on every read and a bit that clears itself once read.
+//
+// The first two scenarios are the app's: lp_imu_initialize's configuration, and the register
+// traffic of one LPS22HH register read through the sensor hub, which the pressure reading made
+// before the hub streamed it. The others are a random mix of reads, read-modify-writes, bank
+// switches, resets and held writes. Every value read must match between the two runs, and so must
+// both sensors' registers at the end, or the run fails.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lsm6dso_reg.h"
+#include "lps22hh_reg.h"
+#include "reg_shadow.h"
+
+#define SENSOR_BANKS 4
+#define SENSOR_REGS 128
+
+// What the simulated sensor does by itself, from the datasheets
+typedef struct {
+    const char *name;
+    const stmdev_shadow_map_t *map;
+    uint16_t burst_max;
+    uint8_t bank_reg;      // 0 for no banks
+    uint8_t reset_reg;
+    uint8_t reset_mask;
+    uint8_t reset_value;   // reset_reg after a reset, the address increment on
+    uint8_t id_reg;
+    uint8_t id;
+    uint8_t status_reg;    // changes on every read
+    uint8_t self_clear_reg;
+    uint8_t self_clear_mask;
+} SENSOR_MODEL;
+
+typedef struct {
+    const SENSOR_MODEL *model;
+    uint8_t regs[SENSOR_BANKS][SENSOR_REGS];
+    uint8_t bank_value;
+    int resetting; // reads of reset_reg left still showing the reset bits
+    uint8_t status_reads;
+    uint32_t transactions;
+} SENSOR;
+
+static const SENSOR_MODEL lsm6dso = {
+    .name = "LSM6DSO",
+    .map = &lsm6dso_shadow_map,
+    .burst_max = 7, // I2C_QUEUE_WRITE_MAX
+    .bank_reg = LSM6DSO_FUNC_CFG_ACCESS,
+    .reset_reg = LSM6DSO_CTRL3_C,
+    .reset_mask = 0x81,
+    .reset_value = 0x04,
+    .id_reg = LSM6DSO_WHO_AM_I,
+    .id = LSM6DSO_ID,
+    .status_reg = LSM6DSO_STATUS_REG,
+    .self_clear_reg = LSM6DSO_COUNTER_BDR_REG1,
+    .self_clear_mask = 0x40,
+};
+
+static const SENSOR_MODEL lps22hh = {
+    .name = "LPS22HH",
+    .map = &lps22hh_shadow_map,
+    .burst_max = 1, // written a register at a time through the sensor hub
+    .reset_reg = LPS22HH_CTRL_REG2,
+    .reset_mask = 0x84,
+    .reset_value = 0x10,
+    .id_reg = LPS22HH_WHO_AM_I,
+    .id = LPS22HH_ID,
+    .status_reg = LPS22HH_STATUS,
+    .self_clear_reg = LPS22HH_CTRL_REG2,
+    .self_clear_mask = 0x01,
+};
+
+static void power_on(SENSOR *sensor)
+{
+    const SENSOR_MODEL *model = sensor->model;
+
+    memset(sensor->regs, 0, sizeof(sensor->regs));
+    sensor->bank_value = 0;
+    sensor->regs[0][model->reset_reg] = model->reset_value;
+    sensor->regs[0][model->id_reg] = model->id;
+}
+
+static uint8_t *reg_at(SENSOR *sensor, uint16_t reg)
+{
+    if (sensor->model->bank_reg != 0 && reg == sensor->model->bank_reg) {
+        return &sensor->bank_value;
+    }
+    return &sensor->regs[sensor->bank_value >> 6][reg % SENSOR_REGS];
+}
+
+static bool in_first_bank(const SENSOR *sensor, uint16_t reg, uint8_t want)
+{
+    return (sensor->bank_value >> 6) == 0 && reg == want;
+}
+
+static int32_t sensor_read(void *handle, uint8_t reg, uint8_t *data, uint16_t len)
+{
+    SENSOR *sensor = handle;
+    const SENSOR_MODEL *model = sensor->model;
+
+    sensor->transactions++;
+    for (uint16_t i = 0; i < len; i++) {
+        uint16_t r = reg + i;
+        uint8_t *value = reg_at(sensor, r);
+
+        if (in_first_bank(sensor, r, model->status_reg)) {
+            // Data ready, and a sample count standing in for everything else that changes
+            data[i] = (uint8_t)(0x07 | (sensor->status_reads++ << 3));
+        } else if (in_first_bank(sensor, r, model->reset_reg) && sensor->resetting > 0) {
+            sensor->resetting--;
+            data[i] = *value | model->reset_mask;
+        } else {
+            data[i] = *value;
+            if (in_first_bank(sensor, r, model->self_clear_reg)) {
+                *value &= (uint8_t)~model->self_clear_mask;
+            }
+        }
+    }
+    return 0;
+}
+
+static int32_t sensor_write(void *handle, uint8_t reg, uint8_t *data, uint16_t len)
+{
+    SENSOR *sensor = handle;
+    const SENSOR_MODEL *model = sensor->model;
+
+    sensor->transactions++;
+    for (uint16_t i = 0; i < len; i++) {
+        uint16_t r = reg + i;
+
+        if (in_first_bank(sensor, r, model->reset_reg) && (data[i] & model->reset_mask) != 0) {
+            power_on(sensor);
+            sensor->resetting = 2;
+        } else if (in_first_bank(sensor, r, model->reset_reg)) {
+            // Written over before the reset finished, the app never does this
+            *reg_at(sensor, r) = data[i];
+            sensor->resetting = 0;
+        } else if (!in_first_bank(sensor, r, model->id_reg) && !in_first_bank(sensor, r, model->status_reg)) {
+            *reg_at(sensor, r) = data[i];
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    SENSOR sensor;
+    stmdev_shadow_t shadow;
+    stmdev_ctx_t ctx;
+} SIDE;
+
+static void side_init(SIDE *side, const SENSOR_MODEL *model, bool shadowed)
+{
+    memset(side, 0, sizeof(*side));
+    side->sensor.model = model;
+    power_on(&side->sensor);
+
+    side->ctx.read_reg = sensor_read;
+    side->ctx.write_reg = sensor_write;
+    side->ctx.handle = &side->sensor;
+    if (shadowed) {
+        stmdev_shadow_init(&side->shadow, model->map, model->burst_max);
+        side->ctx.shadow = &side->shadow;
+    }
+}
+
+// lp_imu_initialize
+static void imu_initialize(stmdev_ctx_t *ctx)
+{
+    uint8_t id, rst;
+
+    lsm6dso_device_id_get(ctx, &id);
+    lsm6dso_reset_set(ctx, PROPERTY_ENABLE);
+    do {
+        lsm6dso_reset_get(ctx, &rst);
+    } while (rst);
+
+    stmdev_shadow_defer(ctx);
+    lsm6dso_i3c_disable_set(ctx, LSM6DSO_I3C_DISABLE);
+    lsm6dso_block_data_update_set(ctx, PROPERTY_ENABLE);
+    lsm6dso_xl_data_rate_set(ctx, LSM6DSO_XL_ODR_12Hz5);
+    lsm6dso_gy_data_rate_set(ctx, LSM6DSO_GY_ODR_12Hz5);
+    lsm6dso_xl_full_scale_set(ctx, LSM6DSO_2g);
+    lsm6dso_gy_full_scale_set(ctx, LSM6DSO_2000dps);
+    lsm6dso_xl_hp_path_on_out_set(ctx, LSM6DSO_LP_ODR_DIV_100);
+    lsm6dso_xl_filter_lp2_set(ctx, PROPERTY_ENABLE);
+    stmdev_shadow_flush(ctx);
+}
+
+// lsm6dso_read_lps22hh_cx for one register, the sensor answers at once so nothing loops
+static void hub_read(stmdev_ctx_t *ctx)
+{
+    lsm6dso_sh_cfg_read_t cfg = {.slv_add = 0x5C, .slv_subadd = 0x28, .slv_len = 3};
+    lsm6dso_status_master_t master_status;
+    uint8_t raw[6], drdy;
+
+    lsm6dso_xl_data_rate_set(ctx, LSM6DSO_XL_ODR_OFF);
+    lsm6dso_sh_slv0_cfg_read(ctx, &cfg);
+    lsm6dso_sh_slave_connected_set(ctx, LSM6DSO_SLV_0);
+    lsm6dso_sh_master_set(ctx, PROPERTY_ENABLE);
+    lsm6dso_xl_data_rate_set(ctx, LSM6DSO_XL_ODR_104Hz);
+    lsm6dso_acceleration_raw_get(ctx, raw);
+    lsm6dso_xl_flag_data_ready_get(ctx, &drdy);
+    lsm6dso_sh_status_get(ctx, &master_status);
+    lsm6dso_sh_master_set(ctx, PROPERTY_DISABLE);
+    lsm6dso_xl_data_rate_set(ctx, LSM6DSO_XL_ODR_OFF);
+    lsm6dso_sh_read_data_raw_get(ctx, raw, 3);
+}
+
+static bool same_registers(SIDE *plain, SIDE *shadowed)
+{
+    return plain->sensor.bank_value == shadowed->sensor.bank_value &&
+           memcmp(plain->sensor.regs, shadowed->sensor.regs, sizeof(plain->sensor.regs)) == 0;
+}
+
+static bool report(const char *name, SIDE *plain, SIDE *shadowed, bool ok)
+{
+    ok = ok && same_registers(plain, shadowed);
+
+    printf("%-22s %10u %10u %8.0f%%  %s\n", name, plain->sensor.transactions, shadowed->sensor.transactions,
+           100.0 * (1.0 - (double)shadowed->sensor.transactions / plain->sensor.transactions), ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static bool run_initialize(void)
+{
+    SIDE plain, shadowed;
+
+    side_init(&plain, &lsm6dso, false);
+    side_init(&shadowed, &lsm6dso, true);
+    imu_initialize(&plain.ctx);
+    imu_initialize(&shadowed.ctx);
+
+    return report("LSM6DSO initialize", &plain, &shadowed, true);
+}
+
+static bool run_hub_reads(uint32_t reads)
+{
+    SIDE plain, shadowed;
+
+    side_init(&plain, &lsm6dso, false);
+    side_init(&shadowed, &lsm6dso, true);
+    imu_initialize(&plain.ctx);
+    imu_initialize(&shadowed.ctx);
+    plain.sensor.transactions = shadowed.sensor.transactions = 0;
+
+    for (uint32_t i = 0; i < reads; i++) {
+        hub_read(&plain.ctx);
+        hub_read(&shadowed.ctx);
+    }
+
+    return report("LSM6DSO hub reads", &plain, &shadowed, true);
+}
+
+// A random access, the same on both sides. Reads must agree.
+static bool random_step(SIDE *plain, SIDE *shadowed, const SENSOR_MODEL *model)
+{
+    uint8_t a[8], b[8], data[8];
+    uint8_t reg = (uint8_t)(rand() % SENSOR_REGS);
+    uint16_t len = (uint16_t)(1 + rand() % 6);
+    int op = rand() % 100;
+
+    if (reg + len > SENSOR_REGS) {
+        len = (uint16_t)(SENSOR_REGS - reg);
+    }
+
+    if (op < 35) {
+        // A setter, read-modify-write of one register, now and then resetting
+        uint8_t bits = (uint8_t)rand();
+
+        if (reg == model->reset_reg && rand() % 4 != 0) {
+            bits &= (uint8_t)~model->reset_mask;
+        }
+        if (model->bank_reg != 0 && reg == model->bank_reg) {
+            bits &= 0xC0; // the other bits must stay 0
+        }
+        lsm6dso_read_reg(&plain->ctx, reg, a, 1);
+        lsm6dso_read_reg(&shadowed->ctx, reg, b, 1);
+        if (a[0] != b[0]) {
+            return false;
+        }
+        a[0] ^= bits;
+        if (reg == model->reset_reg && (bits & model->reset_mask) == 0) {
+            a[0] &= (uint8_t)~model->reset_mask;
+        }
+        lsm6dso_write_reg(&plain->ctx, reg, a, 1);
+        lsm6dso_write_reg(&shadowed->ctx, reg, a, 1);
+    } else if (op < 45 && model->bank_reg != 0) {
+        // lsm6dso_mem_bank_set, sometimes to the bank the LSM6DSO does not have
+        lsm6dso_reg_access_t bank = (lsm6dso_reg_access_t)(rand() % 4);
+        lsm6dso_mem_bank_set(&plain->ctx, bank);
+        lsm6dso_mem_bank_set(&shadowed->ctx, bank);
+    } else if (op < 75) {
+        lsm6dso_read_reg(&plain->ctx, reg, a, len);
+        lsm6dso_read_reg(&shadowed->ctx, reg, b, len);
+        if (memcmp(a, b, len) != 0) {
+            return false;
+        }
+    } else if (op < 90) {
+        // A burst of unrelated values, never resetting or switching banks
+        for (uint16_t i = 0; i < len; i++) {
+            data[i] = (uint8_t)rand();
+            if (reg + i == model->reset_reg) {
+                data[i] &= (uint8_t)~model->reset_mask;
+            }
+            if (model->bank_reg != 0 && reg + i == model->bank_reg) {
+                len = i;
+                break;
+            }
+        }
+        if (len > 0) {
+            lsm6dso_write_reg(&plain->ctx, reg, data, len);
+            lsm6dso_write_reg(&shadowed->ctx, reg, data, len);
+        }
+    } else if (op < 95) {
+        stmdev_shadow_defer(&shadowed->ctx);
+    } else {
+        stmdev_shadow_flush(&shadowed->ctx);
+    }
+    return true;
+}
+
+static bool run_random(const SENSOR_MODEL *model, uint32_t steps, unsigned seed)
+{
+    SIDE plain, shadowed;
+    char name[32];
+    bool ok = true;
+
+    side_init(&plain, model, false);
+    side_init(&shadowed, model, true);
+    srand(seed);
+
+    for (uint32_t i = 0; i < steps && ok; i++) {
+        ok = random_step(&plain, &shadowed, model);
+        if (!ok) {
+            printf("%s: reads differ at step %u\n", model->name, i);
+        }
+    }
+    stmdev_shadow_flush(&shadowed.ctx);
+
+    snprintf(name, sizeof(name), "%s random", model->name);
+    return report(name, &plain, &shadowed, ok);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-n steps] [-r seed]\n"
+            "  -n  random accesses per sensor (default 100000)\n"
+            "  -r  random seed (default 1)\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t steps = 100000;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            steps = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            seed = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (steps == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-22s %10s %10s %9s\n", "scenario", "plain", "shadowed", "saved");
+
+    bool ok = run_initialize();
+    ok = run_hub_reads(100) && ok;
+    ok = run_random(&lsm6dso, steps, seed) && ok;
+    ok = run_random(&lps22hh, steps, seed) && ok;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,471 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// The intercore ring's zero-copy API against the EnqueueData and DequeueData it replaced.
+//
+// Three rings replay the same random sequence of enqueues and dequeues, with random message
+// sizes and receive buffers, some too small or too large. One runs the copying EnqueueData and
+// DequeueData as they were before ReserveData, kept below as the reference. One runs today's
+// EnqueueData and DequeueData, which wrap the views. One builds each message in place with
+// ReserveData, WriteBlockView in random pieces and CommitData, and takes it apart with PeekData,
+// ReadBlockView in random pieces and ReleaseData. After every operation the results, the read and
+// write positions and every byte of both shared buffers must match the reference, or the run
+// fails.
+//
+// Wrap padding changes what is written, so it stays off. Each buffer size runs with the byte copy
+// and with the aligned word copy.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intercore_sim.h"
+
+#define MAX_SWEEP 16
+#define MAX_BUFFER_SIZE 16384
+
+typedef enum {
+    API_REFERENCE,
+    API_WRAPPERS,
+    API_VIEWS,
+    API_COUNT
+} RING_API;
+
+// A writer's two buffers, header then data area, as the Azure Sphere OS lays them out.
+// The writer's outbound buffer is the reader's inbound buffer, and the other way round.
+typedef struct {
+    _Alignas(64) uint8_t outbound[sizeof(BufferHeader) + MAX_BUFFER_SIZE];
+    _Alignas(64) uint8_t inbound[sizeof(BufferHeader) + MAX_BUFFER_SIZE];
+} RING;
+
+static RING rings[API_COUNT];
+static _Alignas(16) uint8_t message[MAX_BUFFER_SIZE + 64];
+static _Alignas(16) uint8_t received[API_COUNT][MAX_BUFFER_SIZE + 64];
+// Splits the views' copies into pieces, apart from the sequence every API replays.
+static unsigned pieceSeed;
+
+// No mailbox in this check, the peer is the same process.
+uint32_t ReadReg32(uintptr_t baseAddr, size_t offset)
+{
+    return 0;
+}
+
+void WriteReg32(uintptr_t baseAddr, size_t offset, uint32_t value)
+{
+}
+
+static int parse_list(const char *arg, uint32_t *list)
+{
+    int count = 0;
+    char *copy = strdup(arg);
+
+    for (char *item = strtok(copy, ","); item != NULL && count < MAX_SWEEP;
+         item = strtok(NULL, ",")) {
+        list[count++] = (uint32_t)strtoul(item, NULL, 0);
+    }
+
+    free(copy);
+    return count;
+}
+
+/***********************************************************************************************
+ * EnqueueData and DequeueData before the zero-copy API, less the doorbells and commented out logs.
+ **********************************************************************************************/
+
+static uint8_t *DataAreaOffset8(BufferHeader *header, size_t offset)
+{
+    // Data storage area following header in buffer.
+    uint8_t *dataStart = (uint8_t *)(header + 1);
+
+    // Offset within data storage area.
+    return dataStart + offset;
+}
+
+static uint32_t *DataAreaOffset32(BufferHeader *header, size_t offset)
+{
+    return (uint32_t *)DataAreaOffset8(header, offset);
+}
+
+static uint32_t RoundUp(uint32_t value, uint32_t alignment)
+{
+    // alignment must be a power of two.
+
+    return (value + (alignment - 1)) & ~(alignment - 1);
+}
+
+static int ReferenceEnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
+                                const void *src, uint32_t dataSize)
+{
+    uint32_t remoteReadPosition = inbound->readPosition;
+    uint32_t localWritePosition = outbound->writePosition;
+
+    if (remoteReadPosition >= bufSize) {
+        return -1;
+    }
+
+    // If the read pointer is behind the write pointer, then the free space wraps around.
+    uint32_t availSpace;
+    if (remoteReadPosition <= localWritePosition) {
+        availSpace = remoteReadPosition - localWritePosition + bufSize;
+    } else {
+        availSpace = remoteReadPosition - localWritePosition;
+    }
+
+    // If there isn't enough space to enqueue a block, then abort the operation.
+    if (availSpace < sizeof(uint32_t) + dataSize + RINGBUFFER_ALIGNMENT) {
+        return -1;
+    }
+
+    // Write up to end of buffer. If the block ends before then, only write up to the end of the
+    // block.
+    uint32_t dataToEnd = bufSize - localWritePosition;
+
+    // There must be enough space between the write pointer and the end of the buffer to store the
+    // block size as a contiguous 4-byte value. The remainder of message can wrap around.
+    if (dataToEnd < sizeof(uint32_t)) {
+        return -1;
+    }
+
+    uint32_t writeToEnd = sizeof(uint32_t) + dataSize;
+    if (dataToEnd < writeToEnd) {
+        writeToEnd = dataToEnd;
+    }
+
+    // Write block size to first word in block.
+    *DataAreaOffset32(outbound, localWritePosition) = dataSize;
+    writeToEnd -= sizeof(uint32_t);
+
+    const uint8_t *src8 = src;
+    uint8_t *dest8 = DataAreaOffset8(outbound, localWritePosition + sizeof(uint32_t));
+
+    __builtin_memcpy(dest8, src8, writeToEnd);
+    __builtin_memcpy(DataAreaOffset8(outbound, 0), src8 + writeToEnd, dataSize - writeToEnd);
+
+    // Advance write position.
+    localWritePosition =
+        RoundUp(localWritePosition + sizeof(uint32_t) + dataSize, RINGBUFFER_ALIGNMENT);
+    if (localWritePosition >= bufSize) {
+        localWritePosition -= bufSize;
+    }
+    outbound->writePosition = localWritePosition;
+
+    return 0;
+}
+
+static int ReferenceDequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
+                                void *dest, uint32_t *dataSize)
+{
+    uint32_t remoteWritePosition = inbound->writePosition;
+    uint32_t localReadPosition = outbound->readPosition;
+
+    if (remoteWritePosition >= bufSize) {
+        return -1;
+    }
+
+    size_t availData;
+    // If data is contiguous in buffer then difference between write and read positions...
+    if (remoteWritePosition >= localReadPosition) {
+        availData = remoteWritePosition - localReadPosition;
+    }
+    // ...else data wraps around end and resumes at start of buffer
+    else {
+        availData = remoteWritePosition - localReadPosition + bufSize;
+    }
+
+    // There must be at least four contiguous bytes to hold the block size.
+    if (availData < sizeof(uint32_t)) {
+        return -1;
+    }
+
+    size_t dataToEnd = bufSize - localReadPosition;
+    if (dataToEnd < sizeof(uint32_t)) {
+        return -1;
+    }
+
+    uint32_t blockSize = *DataAreaOffset32(inbound, localReadPosition);
+
+    // Ensure the block size is no greater than the available data.
+    if (blockSize + sizeof(uint32_t) > availData) {
+        return -1;
+    }
+
+    // Abort if the caller-supplied buffer is not large enough to hold the message.
+    if (blockSize > *dataSize) {
+        *dataSize = blockSize;
+        return -1;
+    }
+
+    // Tell the caller the actual block size.
+    *dataSize = blockSize;
+
+    // Read up to the end of the buffer. If the block ends before then, only read up to the end
+    // of the block.
+    uint32_t readFromEnd = dataToEnd - sizeof(uint32_t);
+    if (blockSize < readFromEnd) {
+        readFromEnd = blockSize;
+    }
+
+    const uint8_t *src8 = DataAreaOffset8(inbound, localReadPosition + sizeof(uint32_t));
+    uint8_t *dest8 = dest;
+    __builtin_memcpy(dest8, src8, readFromEnd);
+    // If block wrapped around the end of the buffer, then read remainder from start.
+    __builtin_memcpy(dest8 + readFromEnd, DataAreaOffset8(inbound, 0), blockSize - readFromEnd);
+
+    // Round read position to next aligned block, and wraparound end of buffer if required.
+    localReadPosition =
+        RoundUp(localReadPosition + sizeof(uint32_t) + blockSize, RINGBUFFER_ALIGNMENT);
+    if (localReadPosition >= bufSize) {
+        localReadPosition -= bufSize;
+    }
+
+    outbound->readPosition = localReadPosition;
+
+    return 0;
+}
+
+/***********************************************************************************************
+ * The zero-copy API, a message at a time in random pieces.
+ **********************************************************************************************/
+
+static int ViewEnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
+                           const void *src, uint32_t dataSize)
+{
+    IntercoreBlockView view;
+    uint32_t offset = 0;
+
+    if (ReserveData(inbound, outbound, bufSize, dataSize, &view) == -1) {
+        return -1;
+    }
+
+    while (offset < dataSize) {
+        uint32_t length = 1 + (uint32_t)rand_r(&pieceSeed) % (dataSize - offset);
+
+        if (WriteBlockView(&view, offset, (const uint8_t *)src + offset, length) == -1) {
+            return -1;
+        }
+        offset += length;
+    }
+
+    return CommitData(outbound, bufSize, &view);
+}
+
+static int ViewDequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
+                           void *dest, uint32_t *dataSize)
+{
+    IntercoreBlockView view;
+    uint32_t offset = 0;
+
+    if (PeekData(outbound, inbound, bufSize, &view) == -1) {
+        return -1;
+    }
+
+    // Left in the ring, as DequeueData leaves a block too large for the caller.
+    if (view.blockSize > *dataSize) {
+        *dataSize = view.blockSize;
+        return -1;
+    }
+    *dataSize = view.blockSize;
+
+    while (offset < view.blockSize) {
+        uint32_t length = 1 + (uint32_t)rand_r(&pieceSeed) % (view.blockSize - offset);
+
+        if (ReadBlockView(&view, offset, (uint8_t *)dest + offset, length) == -1) {
+            return -1;
+        }
+        offset += length;
+    }
+
+    return ReleaseData(outbound, bufSize, &view);
+}
+
+/***********************************************************************************************
+ * The check.
+ **********************************************************************************************/
+
+static int Enqueue(RING_API api, RING *ring, uint32_t bufSize, uint32_t dataSize)
+{
+    BufferHeader *outbound = (BufferHeader *)ring->outbound;
+    BufferHeader *inbound = (BufferHeader *)ring->inbound;
+
+    switch (api) {
+    case API_REFERENCE:
+        return ReferenceEnqueueData(inbound, outbound, bufSize, message, dataSize);
+    case API_WRAPPERS:
+        return EnqueueData(inbound, outbound, bufSize, message, dataSize);
+    default:
+        return ViewEnqueueData(inbound, outbound, bufSize, message, dataSize);
+    }
+}
+
+static int Dequeue(RING_API api, RING *ring, uint32_t bufSize, uint32_t *dataSize)
+{
+    // The reader's view, buffers swapped.
+    BufferHeader *outbound = (BufferHeader *)ring->inbound;
+    BufferHeader *inbound = (BufferHeader *)ring->outbound;
+
+    switch (api) {
+    case API_REFERENCE:
+        return ReferenceDequeueData(outbound, inbound, bufSize, received[api], dataSize);
+    case API_WRAPPERS:
+        return DequeueData(outbound, inbound, bufSize, received[api], dataSize);
+    default:
+        return ViewDequeueData(outbound, inbound, bufSize, received[api], dataSize);
+    }
+}
+
+/// <summary>
+/// Replay count random operations through every API.
+/// </summary>
+/// <returns>The operation the rings first differ at, or count if they never do.</returns>
+static uint32_t run_one(uint32_t capabilities, uint32_t bufSize, uint32_t count, unsigned seed,
+                        uint32_t *enqueued, uint32_t *dequeued)
+{
+    size_t ringSize = sizeof(BufferHeader) + bufSize;
+
+    // Bytes the ring never writes, such as the gaps between blocks, must match too.
+    srand(seed);
+    for (size_t i = 0; i < ringSize; i++) {
+        rings[API_REFERENCE].outbound[i] = (uint8_t)rand();
+        rings[API_REFERENCE].inbound[i] = (uint8_t)rand();
+    }
+    memset(rings[API_REFERENCE].outbound, 0, sizeof(BufferHeader));
+    memset(rings[API_REFERENCE].inbound, 0, sizeof(BufferHeader));
+    for (int api = 1; api < API_COUNT; api++) {
+        rings[api] = rings[API_REFERENCE];
+    }
+
+    SetIntercoreCapabilities(capabilities);
+    pieceSeed = seed;
+    *enqueued = 0;
+    *dequeued = 0;
+
+    for (uint32_t op = 0; op < count; op++) {
+        bool enqueue = rand() % 2 == 0;
+        // Mostly messages that fit, some that never can.
+        uint32_t size = (uint32_t)rand() % (rand() % 16 == 0 ? bufSize + 64 : bufSize / 4 + 1);
+        int results[API_COUNT];
+        uint32_t sizes[API_COUNT];
+
+        for (uint32_t i = 0; i < size; i++) {
+            message[i] = (uint8_t)rand();
+        }
+
+        for (int api = 0; api < API_COUNT; api++) {
+            if (enqueue) {
+                results[api] = Enqueue((RING_API)api, &rings[api], bufSize, size);
+            } else {
+                sizes[api] = size;
+                results[api] = Dequeue((RING_API)api, &rings[api], bufSize, &sizes[api]);
+            }
+        }
+
+        for (int api = 1; api < API_COUNT; api++) {
+            if (results[api] != results[API_REFERENCE] ||
+                memcmp(rings[api].outbound, rings[API_REFERENCE].outbound, ringSize) != 0 ||
+                memcmp(rings[api].inbound, rings[API_REFERENCE].inbound, ringSize) != 0) {
+                return op;
+            }
+            if (!enqueue && (sizes[api] != sizes[API_REFERENCE] ||
+                             (results[api] == 0 &&
+                              memcmp(received[api], received[API_REFERENCE], sizes[api]) != 0))) {
+                return op;
+            }
+        }
+
+        if (results[API_REFERENCE] == 0) {
+            if (enqueue) {
+                (*enqueued)++;
+            } else {
+                (*dequeued)++;
+            }
+        }
+    }
+
+    return count;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-n operations] [-b buffer sizes] [-r seed]\n"
+            "  -n  random enqueues and dequeues per run (default 200000)\n"
+            "  -b  comma separated data area sizes, multiples of %d up to %d (default "
+            "192,960,4032)\n"
+            "  -r  random seed (default 1)\n",
+            name, RINGBUFFER_ALIGNMENT, MAX_BUFFER_SIZE);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        uint32_t capabilities;
+    } modes[] = {
+        {"memcpy", 0},
+        {"aligned", INTERCORE_CAP_ALIGNED_COPY},
+    };
+    uint32_t count = 200000;
+    uint32_t bufSizes[MAX_SWEEP] = {192, 960, 4032};
+    int bufCount = 3;
+    unsigned seed = 1;
+    int failures = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:r:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            bufCount = parse_list(optarg, bufSizes);
+            break;
+        case 'r':
+            seed = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (int b = 0; b < bufCount; b++) {
+        if (bufSizes[b] == 0 || bufSizes[b] > MAX_BUFFER_SIZE ||
+            bufSizes[b] % RINGBUFFER_ALIGNMENT != 0) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (count == 0 || bufCount == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-10s %8s %10s %10s %10s %10s\n", "copy", "buffer", "ops", "enqueued", "dequeued",
+           "wraps");
+
+    for (int b = 0; b < bufCount; b++) {
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            IntercoreStats before = *GetIntercoreStats();
+            uint32_t enqueued;
+            uint32_t dequeued;
+            uint32_t ops = run_one(modes[m].capabilities, bufSizes[b], count, seed, &enqueued,
+                                   &dequeued);
+            // Both APIs that commit count, half the wraps are each one's.
+            uint32_t wraps = (GetIntercoreStats()->wraps - before.wraps) / 2;
+
+            if (ops != count) {
+                printf("%-10s %8u %10u %10s  FAILED, the rings differ at this operation\n",
+                       modes[m].name, bufSizes[b], ops, "-");
+                failures++;
+                continue;
+            }
+
+            printf("%-10s %8u %10u %10u %10u %10u  ok\n", modes[m].name, bufSizes[b], ops,
+                   enqueued, dequeued, wraps);
+        }
+    }
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
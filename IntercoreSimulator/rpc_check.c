@@ -0,0 +1,339 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// The high-level app's request/response calls to the real-time app, see intercore_rpc.h.
+//
+// A simulated real-time app takes each request off the wire and answers it in random order, after
+// a random delay, or never. Replies come back as compact records, or as the legacy statistics,
+// load and memory structs. Stale replies to requests already answered or timed out, replies to ids
+// never sent and unsolicited readings are mixed in. The clock moves in random steps, with
+// intercore_rpc_expire called after each, and some sends fail.
+//
+// A model of the outstanding requests checks the window, the id matching and the expiry. A call
+// must fail exactly when the window is full or the send fails, and must never reuse 0 or an id
+// still outstanding, including after the ids wrap. Each request must complete exactly once, with
+// the reply carrying its id, or with a timeout no earlier than its deadline. Callbacks sometimes
+// make the next call from inside the callback.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intercore_rpc.h"
+
+// Requests the simulated real-time app can hold, and replies it can send again
+#define PEER_QUEUE 64
+#define MODEL_CALLS (4 * INTERCORE_RPC_WINDOW)
+
+// A request the model expects to complete
+typedef struct {
+    bool active;
+    uint16_t id;
+    INTERCORE_CMD cmd;
+    int64_t deadline_ms;
+} CALL;
+
+typedef struct {
+    uint16_t id;
+    INTERCORE_CMD cmd;
+} PEER_REQUEST;
+
+static CALL calls[MODEL_CALLS];
+static PEER_REQUEST received[PEER_QUEUE];
+static int received_count;
+static PEER_REQUEST answered[PEER_QUEUE];   // sent again later as stale replies
+static int answered_count;
+
+static int64_t now_ms;
+static bool send_fails;
+static bool never_answer;
+static uint32_t errors;
+
+static uint32_t made;
+static uint32_t window_full;
+static uint32_t send_failed;
+static uint32_t replied;
+static uint32_t timed_out;
+static uint32_t stale;
+static uint32_t nested;
+static uint32_t wraps;
+static int last_id;
+
+static const INTERCORE_CMD commands[] = {IC_READ_SENSOR, IC_TARGET_TEMPERATURE, IC_UNSUBSCRIBE_SENSOR, IC_READ_STATS,
+                                         IC_READ_LOAD, IC_READ_MEMORY};
+
+static void fail(const char *what, uint16_t id)
+{
+    if (errors++ < 10) {
+        printf("at %lld ms, request %u: %s\n", (long long)now_ms, id, what);
+    }
+}
+
+static int outstanding(void)
+{
+    int count = 0;
+
+    for (int i = 0; i < MODEL_CALLS; i++) {
+        count += calls[i].active;
+    }
+    return count;
+}
+
+static CALL *find_call(uint16_t id)
+{
+    for (int i = 0; i < MODEL_CALLS; i++) {
+        if (calls[i].active && calls[i].id == id) {
+            return &calls[i];
+        }
+    }
+    return NULL;
+}
+
+// The real-time app's end of the wire
+static bool peer_receive(const void *message, size_t length)
+{
+    INTERCORE_RECORD request;
+
+    if (send_fails) {
+        return false;
+    }
+
+    if (intercore_decode(message, length, &request) != (int)length || !(request.fields & IC_FIELD_REQUEST_ID) ||
+        request.request_id == 0) {
+        fail("sent without a request id", 0);
+        return true;
+    }
+
+    // Some requests are never answered
+    if (!never_answer && rand() % 10 != 0 && received_count < PEER_QUEUE) {
+        received[received_count++] = (PEER_REQUEST){request.request_id, request.cmd};
+    }
+    return true;
+}
+
+static void completed(const INTERCORE_RPC_REPLY *reply, void *context);
+
+static bool make_call(int timeout_ms)
+{
+    INTERCORE_RECORD request = {.cmd = commands[rand() % (sizeof(commands) / sizeof(commands[0]))]};
+    bool full = outstanding() == INTERCORE_RPC_WINDOW;
+    CALL *slot = NULL;
+    int id;
+
+    for (int i = 0; i < MODEL_CALLS && !slot; i++) {
+        if (!calls[i].active) {
+            slot = &calls[i];
+        }
+    }
+
+    send_fails = rand() % 20 == 0;
+    id = intercore_rpc_call(&request, now_ms, timeout_ms, completed, slot);
+
+    if (full || send_fails) {
+        if (id != -1) {
+            fail(full ? "accepted with the window full" : "accepted though the send failed", (uint16_t)id);
+        }
+        window_full += full;
+        send_failed += !full;
+        return false;
+    }
+
+    if (id <= 0 || id > UINT16_MAX) {
+        fail("refused with room in the window", 0);
+        return false;
+    }
+    if (find_call((uint16_t)id)) {
+        fail("id already outstanding", (uint16_t)id);
+    }
+
+    wraps += id < last_id;
+    last_id = id;
+    *slot = (CALL){.active = true, .id = (uint16_t)id, .cmd = request.cmd, .deadline_ms = now_ms + timeout_ms};
+    made++;
+    return true;
+}
+
+static void completed(const INTERCORE_RPC_REPLY *reply, void *context)
+{
+    CALL *call = context;
+
+    if (!call->active) {
+        fail("completed twice", call->id);
+        return;
+    }
+    if (reply->cmd != call->cmd) {
+        fail("completed with another request's command", call->id);
+    }
+
+    if (reply->status == INTERCORE_RPC_TIMEOUT) {
+        if (now_ms < call->deadline_ms) {
+            fail("timed out early", call->id);
+        }
+        timed_out++;
+    } else {
+        if (reply->record.request_id != call->id || reply->record.cmd != call->cmd) {
+            fail("completed with another request's reply", call->id);
+        }
+        if ((reply->stats != NULL) != (call->cmd == IC_READ_STATS) || (reply->load != NULL) != (call->cmd == IC_READ_LOAD) ||
+            (reply->memory != NULL) != (call->cmd == IC_READ_MEMORY)) {
+            fail("legacy reply missing or misplaced", call->id);
+        }
+        replied++;
+    }
+    call->active = false;
+
+    // The window has room again by now
+    if (rand() % 4 == 0) {
+        nested += make_call(50 + rand() % 450);
+    }
+}
+
+// Send a reply the way the real-time app would for the command, true if the library took it
+static bool peer_reply(const PEER_REQUEST *request)
+{
+    switch (request->cmd) {
+    case IC_READ_STATS: {
+        INTERCORE_STATS stats = {.cmd = IC_READ_STATS, .request_id = request->id};
+        return intercore_rpc_complete_stats(&stats);
+    }
+    case IC_READ_LOAD: {
+        INTERCORE_LOAD load = {.cmd = IC_READ_LOAD, .request_id = request->id};
+        return intercore_rpc_complete_load(&load);
+    }
+    case IC_READ_MEMORY: {
+        INTERCORE_MEMORY memory = {.cmd = IC_READ_MEMORY, .request_id = request->id};
+        return intercore_rpc_complete_memory(&memory);
+    }
+    default: {
+        INTERCORE_RECORD reply = {.cmd = request->cmd, .fields = IC_FIELD_REQUEST_ID, .request_id = request->id};
+        return intercore_rpc_complete(&reply);
+    }
+    }
+}
+
+static void step(void)
+{
+    int op = rand() % 100;
+
+    if (op < 30) {
+        make_call(50 + rand() % 450);
+    } else if (op < 60 && received_count > 0) {
+        // Answer any held request, not the oldest
+        int i = rand() % received_count;
+        PEER_REQUEST request = received[i];
+        bool expected = find_call(request.id) != NULL;
+
+        received[i] = received[--received_count];
+        if (answered_count < PEER_QUEUE) {
+            answered[answered_count++] = request;
+        } else {
+            answered[rand() % PEER_QUEUE] = request;
+        }
+
+        if (peer_reply(&request) != expected) {
+            fail(expected ? "reply not matched" : "late reply matched", request.id);
+        }
+    } else if (op < 70 && answered_count > 0) {
+        // A reply again, its request is done, unless the id has since been reused
+        PEER_REQUEST request = answered[rand() % answered_count];
+        CALL *call = find_call(request.id);
+
+        if (call == NULL || call->cmd == request.cmd) {
+            bool expected = call != NULL;
+
+            stale += !expected;
+            if (peer_reply(&request) != expected) {
+                fail(expected ? "reply not matched" : "stale reply matched", request.id);
+            }
+        }
+    } else if (op < 75) {
+        // An id that is not outstanding, or a pushed reading without one
+        uint16_t id = (uint16_t)rand();
+        INTERCORE_RECORD reading = {.cmd = IC_READ_SENSOR};
+
+        if (rand() % 2 && !find_call(id)) {
+            reading.fields = IC_FIELD_REQUEST_ID;
+            reading.request_id = id;
+        }
+        if (intercore_rpc_complete(&reading)) {
+            fail("unknown reply matched", id);
+        }
+    } else {
+        now_ms += rand() % 60;
+        intercore_rpc_expire(now_ms);
+
+        for (int i = 0; i < MODEL_CALLS; i++) {
+            if (calls[i].active && now_ms >= calls[i].deadline_ms) {
+                fail("not timed out at its deadline", calls[i].id);
+                calls[i].active = false;
+            }
+        }
+    }
+
+    if (intercore_rpc_outstanding() != outstanding()) {
+        fail("outstanding count differs", 0);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-n steps] [-r seed]\n"
+            "  -n  random calls, replies and clock steps (default 1000000)\n"
+            "  -r  random seed (default 1)\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t steps = 1000000;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            steps = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            seed = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (steps == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    srand(seed);
+    intercore_rpc_init(peer_receive);
+
+    // Outstanding for the whole run, the ids must wrap around it
+    never_answer = true;
+    while (!make_call(INT32_MAX)) {
+    }
+    never_answer = false;
+
+    for (uint32_t i = 0; i < steps; i++) {
+        step();
+    }
+
+    printf("%-24s %10u\n", "calls", made);
+    printf("%-24s %10u\n", "  made from a callback", nested);
+    printf("%-24s %10u\n", "  ids wrapped", wraps);
+    printf("%-24s %10u\n", "refused, window full", window_full);
+    printf("%-24s %10u\n", "refused, send failed", send_failed);
+    printf("%-24s %10u\n", "replied", replied);
+    printf("%-24s %10u\n", "timed out", timed_out);
+    printf("%-24s %10u\n", "stale replies refused", stale);
+    printf("%-24s %10u  %s\n", "errors", errors, errors == 0 ? "ok" : "FAILED");
+
+    return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,232 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// The bare-metal app's job scheduler on a simulated clock, see scheduler.h.
+//
+// Time only moves while the scheduler waits for an interrupt, so every job should run exactly on
+// its deadline and every event should be handled on the wakeup it arrives in. The run fails if a
+// job runs late, early or the wrong number of times. It also counts the wakeups the scheduler
+// needed, against the 1000 a second the 1 ms scheduler tick used to take.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "scheduler.h"
+
+#define EVENT_MESSAGE (1u << 0)
+#define EVENT_SAMPLE (1u << 2)
+
+#define SAMPLE_PERIOD_MS 2000
+#define FAST_PERIOD_MS 100
+#define BATCH_WAIT_MS 20
+
+// Starts just before the millisecond clock wraps, so deadlines straddle the wrap
+static uint32_t sim_now = UINT32_MAX - 5000;
+static uint32_t timer_due;
+static bool timer_armed;
+static bool interrupts_enabled = true;
+static uint32_t next_message;
+static uint32_t mean_message_gap_ms;
+
+static uint32_t wakeups, timer_wakeups, message_wakeups;
+static uint32_t failures;
+
+typedef struct {
+    SCHEDULER_JOB job;
+    uint32_t expected_ms; // when the job should next run
+    uint32_t runs;
+} CHECKED_JOB;
+
+static void sample_run(void);
+static void fast_run(void);
+static void message_run(void);
+static void batch_run(void);
+
+static CHECKED_JOB sample = {{.run = sample_run, .events = EVENT_SAMPLE}};
+static CHECKED_JOB fast = {{.run = fast_run}};
+static CHECKED_JOB message = {{.run = message_run, .events = EVENT_MESSAGE}};
+static CHECKED_JOB batch = {{.run = batch_run}};
+static bool batch_open;
+static uint32_t messages_posted;
+
+static uint32_t sim_now_ms(void)
+{
+    return sim_now;
+}
+
+static void sim_arm_timer(uint32_t delay_ms)
+{
+    timer_armed = delay_ms != SCHEDULER_FOREVER;
+    timer_due = sim_now + delay_ms;
+}
+
+static void sim_disable_interrupts(void)
+{
+    interrupts_enabled = false;
+}
+
+static void sim_enable_interrupts(void)
+{
+    interrupts_enabled = true;
+}
+
+// Jump to whichever interrupt comes first, a message from the high-level app or the timer
+static void sim_wait_for_interrupt(void)
+{
+    wakeups++;
+
+    if (interrupts_enabled) {
+        printf("wait_for_interrupt with interrupts enabled\n");
+        failures++;
+    }
+
+    if (timer_armed && (int32_t)(timer_due - next_message) <= 0) {
+        sim_now = timer_due;
+        timer_armed = false;
+        timer_wakeups++;
+    } else {
+        sim_now = next_message;
+        next_message = sim_now + 1 + (uint32_t)rand() % (2 * mean_message_gap_ms);
+        message_wakeups++;
+        messages_posted++;
+
+        // The mailbox interrupt handler
+        scheduler_post(EVENT_MESSAGE);
+    }
+}
+
+static const SCHEDULER_PLATFORM sim_platform = {
+    .now_ms = sim_now_ms,
+    .arm_timer = sim_arm_timer,
+    .disable_interrupts = sim_disable_interrupts,
+    .enable_interrupts = sim_enable_interrupts,
+    .wait_for_interrupt = sim_wait_for_interrupt,
+};
+
+static void check_on_time(CHECKED_JOB *checked, const char *name)
+{
+    if (sim_now != checked->expected_ms) {
+        printf("%s ran at %u, expected %u\n", name, sim_now, checked->expected_ms);
+        failures++;
+    }
+    checked->runs++;
+}
+
+static void sample_run(void)
+{
+    // A posted sample runs off schedule, the periodic runs must still keep their phase
+    if ((int32_t)(sim_now - sample.expected_ms) < 0) {
+        sample.runs++;
+        return;
+    }
+    check_on_time(&sample, "sample");
+    sample.expected_ms += SAMPLE_PERIOD_MS;
+}
+
+static void fast_run(void)
+{
+    check_on_time(&fast, "fast");
+    fast.expected_ms += FAST_PERIOD_MS;
+}
+
+// Each message is answered in a batch frame that waits BATCH_WAIT_MS for company, and every
+// tenth one asks for a fresh sample
+static void message_run(void)
+{
+    message.runs++;
+
+    if (!batch_open) {
+        batch_open = true;
+        batch.expected_ms = sim_now + BATCH_WAIT_MS;
+        scheduler_at(&batch.job, batch.expected_ms);
+    }
+
+    if (message.runs % 10 == 0) {
+        scheduler_post(EVENT_SAMPLE);
+    }
+}
+
+static void batch_run(void)
+{
+    check_on_time(&batch, "batch");
+    batch_open = false;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-s seconds] [-m mean message gap ms]\n"
+            "  -s  simulated seconds (default 600)\n"
+            "  -m  mean time between messages from the high-level app (default 500)\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t seconds = 600;
+    uint32_t start;
+    int opt;
+
+    mean_message_gap_ms = 500;
+
+    while ((opt = getopt(argc, argv, "s:m:h")) != -1) {
+        switch (opt) {
+        case 's':
+            seconds = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            mean_message_gap_ms = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (seconds == 0 || mean_message_gap_ms == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+    start = sim_now;
+    next_message = sim_now + mean_message_gap_ms;
+
+    scheduler_init(&sim_platform);
+    scheduler_add(&message.job);
+    scheduler_add(&sample.job);
+    scheduler_add(&fast.job);
+    scheduler_add(&batch.job);
+
+    scheduler_every(&sample.job, SAMPLE_PERIOD_MS);
+    scheduler_every(&fast.job, FAST_PERIOD_MS);
+    sample.expected_ms = start + SAMPLE_PERIOD_MS;
+    fast.expected_ms = start + FAST_PERIOD_MS;
+
+    while (sim_now - start < seconds * 1000) {
+        scheduler_run_once();
+    }
+
+    // The last message may arrive on the wakeup that ends the run
+    if (messages_posted - message.runs > 1) {
+        printf("%u messages posted, %u handled\n", messages_posted, message.runs);
+        failures++;
+    }
+    if (fast.runs + 1 < seconds * 1000 / FAST_PERIOD_MS) {
+        printf("fast ran %u times in %u s\n", fast.runs, seconds);
+        failures++;
+    }
+
+    printf("simulated      %10u s\n", seconds);
+    printf("wakeups        %10u  %8.1f/s\n", wakeups, (double)wakeups / seconds);
+    printf("  timer        %10u  %8.1f/s\n", timer_wakeups, (double)timer_wakeups / seconds);
+    printf("  message      %10u  %8.1f/s\n", message_wakeups, (double)message_wakeups / seconds);
+    printf("1 ms tick      %10u  %8.1f/s\n", seconds * 1000, 1000.0);
+    printf("job runs       sample %u, fast %u, message %u, batch %u\n", sample.runs, fast.runs,
+           message.runs, batch.runs);
+    printf("%s\n", failures == 0 ? "all jobs on time" : "FAILED");
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,218 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Lab 5's LSM6DSO FIFO reads on a simulated clock, woken by a simulated INT1, see sensor_wake.h.
+//
+// The sensor batches words into its FIFO at 312 a second, and INT1 is high while the FIFO holds at
+// least the watermark. Its rising edge stands in for the EINT handler notifying the task. A read
+// takes as long as the I2C transfer would at 50 kHz, and words keep arriving during it. Each
+// scenario fails if the FIFO overflows or the task wakes the wrong way for the state of the line.
+// When the line drops out, the task must fall back to polling within SENSOR_WAKE_MISSED_LIMIT
+// timeouts, and go back to the interrupt within a few periods of it returning.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sensor_wake.h"
+
+// Lab 5's settings, see main.cpp and lsm6dso_driver.h
+#define FIFO_SAMPLE_HZ 104
+#define FIFO_WATERMARK_WORDS 48
+#define FIFO_READ_PERIOD_MS (16 * 1000 / FIFO_SAMPLE_HZ)
+#define FIFO_BURST_WORDS 64
+#define FIFO_WORD_SIZE 7
+#define FIFO_CAPACITY_WORDS 512
+#define I2C_BITS_PER_SECOND 50000
+#define STEP_US 100
+
+typedef enum {
+    LINE_WIRED,
+    LINE_UNWIRED,
+    LINE_DROPS_OUT, // stops for the middle third of the run
+} LINE;
+
+static uint64_t sim_us;
+static double sensor_words_per_us;
+static double fifo_level;
+static bool line_high;
+static bool notified;
+static LINE line;
+static uint64_t run_us;
+
+static uint64_t above_watermark_since_us;
+static uint64_t worst_wait_us; // longest the FIFO sat at the watermark unread
+static uint32_t overflows;
+
+static bool line_working(void)
+{
+    return line == LINE_WIRED || (line == LINE_DROPS_OUT && (sim_us < run_us / 3 || sim_us >= 2 * run_us / 3));
+}
+
+static void advance(uint64_t us)
+{
+    for (uint64_t end = sim_us + us; sim_us < end; sim_us += STEP_US) {
+        bool was_high = line_high;
+
+        fifo_level += sensor_words_per_us * STEP_US;
+        if (fifo_level > FIFO_CAPACITY_WORDS) {
+            fifo_level = FIFO_CAPACITY_WORDS;
+            overflows++;
+        }
+
+        line_high = fifo_level >= FIFO_WATERMARK_WORDS;
+        if (line_high && !was_high) {
+            above_watermark_since_us = sim_us;
+            if (line_working()) {
+                // The EINT handler's vTaskNotifyGiveFromISR
+                notified = true;
+            }
+        }
+    }
+}
+
+// ulTaskNotifyTake, the task sleeps until notified or the timeout
+static bool sim_wait(uint32_t timeout_ms)
+{
+    uint64_t deadline = sim_us + (uint64_t)timeout_ms * 1000;
+
+    while (!notified && sim_us < deadline) {
+        advance(STEP_US);
+    }
+
+    bool woken = notified;
+    notified = false;
+    return woken;
+}
+
+static const SENSOR_WAKE_PLATFORM sim_platform = {.wait = sim_wait};
+
+// Address and register byte, then the data, 9 bits a byte with the acknowledge
+static uint64_t read_us(int words)
+{
+    return (uint64_t)(4 + 2 + 4 + words * FIFO_WORD_SIZE) * 9 * 1000000 / I2C_BITS_PER_SECOND;
+}
+
+// lsm6dso_fifo_read, the status registers then up to a burst of words, true if the burst was full
+static bool read_burst(void)
+{
+    if (line_high) {
+        uint64_t waited = sim_us - above_watermark_since_us;
+        if (waited > worst_wait_us) {
+            worst_wait_us = waited;
+        }
+    }
+
+    int words = (int)fifo_level;
+    if (words > FIFO_BURST_WORDS) {
+        words = FIFO_BURST_WORDS;
+    }
+
+    advance(read_us(words));
+    fifo_level -= words;
+
+    line_high = fifo_level >= FIFO_WATERMARK_WORDS;
+    return words == FIFO_BURST_WORDS;
+}
+
+static bool run(const char *name, LINE scenario, uint32_t seconds, double clock_error)
+{
+    SENSOR_WAKE wake;
+    uint32_t polls_while_wired = 0;
+    uint64_t fell_back_us = 0, came_back_us = 0;
+
+    sim_us = 0;
+    run_us = (uint64_t)seconds * 1000000;
+    sensor_words_per_us = 3.0 * FIFO_SAMPLE_HZ * (1.0 + clock_error) / 1000000;
+    fifo_level = 0;
+    line_high = notified = false;
+    line = scenario;
+    worst_wait_us = 0;
+    overflows = 0;
+
+    sensor_wake_init(&wake, &sim_platform, FIFO_READ_PERIOD_MS, scenario != LINE_UNWIRED);
+
+    while (sim_us < run_us) {
+        uint32_t fallbacks = wake.fallbacks;
+
+        SENSOR_WAKE_REASON reason = sensor_wake_wait(&wake);
+        if (reason == SENSOR_WAKE_POLL && scenario == LINE_WIRED) {
+            polls_while_wired++;
+        }
+        if (wake.fallbacks != fallbacks && fell_back_us == 0) {
+            fell_back_us = sim_us;
+        }
+        if (reason == SENSOR_WAKE_INTERRUPT && fell_back_us != 0 && came_back_us == 0) {
+            came_back_us = sim_us;
+        }
+
+        while (read_burst()) {
+        }
+    }
+
+    bool ok = overflows == 0 && polls_while_wired == 0;
+    if (scenario == LINE_UNWIRED) {
+        ok = ok && wake.interrupt_wakes == 0;
+    }
+    if (scenario == LINE_DROPS_OUT) {
+        uint64_t period_us = FIFO_READ_PERIOD_MS * 1000;
+
+        // Taken as dead once, after the missed interrupts and the two bursts read after each, then
+        // back on the interrupt once the FIFO next reaches the watermark
+        ok = ok && wake.fallbacks == 1 && came_back_us != 0 &&
+             fell_back_us - run_us / 3 <= (SENSOR_WAKE_MISSED_LIMIT + 1) * (2 * period_us + 2 * read_us(FIFO_BURST_WORDS)) &&
+             came_back_us - 2 * run_us / 3 <= 3 * period_us;
+    }
+
+    printf("%-10s %8.1f %8.1f %9u %10.1f %9u  %s\n", name, wake.interrupt_wakes / (double)seconds,
+           wake.poll_wakes / (double)seconds, wake.fallbacks, worst_wait_us / 1000.0, overflows, ok ? "ok" : "FAILED");
+    if (scenario == LINE_DROPS_OUT && came_back_us != 0) {
+        printf("%-10s polling %.0f ms after the line dropped out, back on the interrupt %.0f ms after it returned\n", "",
+               (fell_back_us - run_us / 3) / 1000.0, (came_back_us - 2 * run_us / 3) / 1000.0);
+    }
+    return ok;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-s seconds] [-e clock error]\n"
+            "  -s  simulated seconds per scenario, at least 10 (default 600)\n"
+            "  -e  sensor clock error, -0.02 runs 2%% slow (default -0.02)\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t seconds = 600;
+    double clock_error = -0.02;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:e:h")) != -1) {
+        switch (opt) {
+        case 's':
+            seconds = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            clock_error = strtod(optarg, NULL);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (seconds < 10 || clock_error <= -0.5 || clock_error >= 0.5) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-10s %8s %8s %9s %10s %9s\n", "line", "irq/s", "poll/s", "fallbacks", "worst ms", "overflows");
+
+    bool ok = run("wired", LINE_WIRED, seconds, clock_error);
+    ok = run("unwired", LINE_UNWIRED, seconds, clock_error) && ok;
+    ok = run("drops out", LINE_DROPS_OUT, seconds, clock_error) && ok;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,140 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Torn read stress for the environment snapshot shared by the real-time apps.
+//
+// A writer thread publishes readings as fast as it can, every field derived from one counter,
+// while a reader thread copies them and checks the fields still agree. With -u the writer
+// updates a plain INTERCORE_BLOCK field by field instead, the way the real-time apps used to,
+// to show the check does catch torn readings.
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "intercore_snapshot.h"
+
+static INTERCORE_SNAPSHOT snapshot;
+static volatile INTERCORE_BLOCK unprotected;
+static atomic_bool running = true;
+static bool useSnapshot = true;
+
+static uint64_t publishCount;
+
+static void make_reading(uint32_t n, INTERCORE_BLOCK *block)
+{
+    block->cmd = IC_READ_SENSOR;
+    block->temperature = (int)n;
+    block->pressure = (int)~n;
+    block->humidity = (int)(n * 3u);
+    block->operating_mode = (HVAC_OPERATING_MODE)(n & 3);
+}
+
+static bool is_whole(const INTERCORE_BLOCK *block)
+{
+    INTERCORE_BLOCK expected;
+
+    make_reading((uint32_t)block->temperature, &expected);
+    return memcmp(block, &expected, sizeof(expected)) == 0;
+}
+
+static void *writer(void *arg)
+{
+    INTERCORE_BLOCK reading;
+    uint32_t n = 0;
+
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        n++;
+        make_reading(n, &reading);
+
+        if (useSnapshot) {
+            intercore_snapshot_publish(&snapshot, &reading);
+        } else {
+            unprotected.cmd = reading.cmd;
+            unprotected.temperature = reading.temperature;
+            unprotected.pressure = reading.pressure;
+            unprotected.humidity = reading.humidity;
+            unprotected.operating_mode = reading.operating_mode;
+        }
+    }
+
+    publishCount = n;
+    return NULL;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-s seconds] [-u]\n"
+            "  -s  run time, default 5\n"
+            "  -u  share an unprotected INTERCORE_BLOCK instead of the snapshot\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    INTERCORE_BLOCK reading;
+    struct timespec start, now;
+    pthread_t writerThread;
+    uint64_t reads = 0;
+    uint64_t torn = 0;
+    int seconds = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:uh")) != -1) {
+        switch (opt) {
+        case 's':
+            seconds = atoi(optarg);
+            break;
+        case 'u':
+            useSnapshot = false;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    make_reading(0, &reading);
+    intercore_snapshot_publish(&snapshot, &reading);
+    memcpy((void *)&unprotected, &reading, sizeof(reading));
+
+    if (pthread_create(&writerThread, NULL, writer, NULL) != 0) {
+        perror("snapshot_bench: pthread_create");
+        return EXIT_FAILURE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    do {
+        // Check the clock every so often, not on every read
+        for (int i = 0; i < 4096; i++) {
+            if (useSnapshot) {
+                intercore_snapshot_read(&snapshot, &reading);
+            } else {
+                memcpy(&reading, (const void *)&unprotected, sizeof(reading));
+            }
+
+            if (!is_whole(&reading)) {
+                torn++;
+            }
+        }
+        reads += 4096;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (now.tv_sec - start.tv_sec < seconds);
+
+    atomic_store(&running, false);
+    pthread_join(writerThread, NULL);
+
+    printf("%s: %llu publishes, %llu reads, %llu torn\n", useSnapshot ? "snapshot" : "unprotected",
+           (unsigned long long)publishCount, (unsigned long long)reads, (unsigned long long)torn);
+
+    // Torn readings are expected, and the point, with -u
+    return (useSnapshot && torn != 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
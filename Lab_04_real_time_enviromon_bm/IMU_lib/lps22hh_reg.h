@@ -74,6 +74,8 @@ typedef struct {
   stmdev_read_ptr   read_reg;
   /** Customizable optional pointer **/
   void *handle;
+  /** Optional register shadow, NULL for none, see reg_shadow.h **/
+  struct stmdev_shadow *shadow;
 } stmdev_ctx_t;
 
 /**
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Write-through shadow of a sensor's configuration registers, for lsm6dso_reg.c and lps22hh_reg.c.
+//
+// The drivers' setters read a register, change some bits and write it back. With a shadow on the
+// context, that read comes from the shadow once the register has been read or written, and a
+// write that changes nothing is dropped. Between stmdev_shadow_defer and stmdev_shadow_flush,
+// writes are held and sent as one burst per run of neighbouring registers. Held writes go out in
+// register order, before any other access or bank switch, so defer only where their order does
+// not matter, like the configuration after a reset. Bursts rely on the register address
+// incrementing, which is on after reset on both sensors.
+//
+// Only registers that just the host changes are shadowed, as listed in the sensor's map. Each
+// register bank has its own. A write that resets the sensor empties the shadow.
+//
+// Include after lsm6dso_reg.h or lps22hh_reg.h, which define stmdev_ctx_t.
+
+#define STMDEV_SHADOW_REGS 128
+#define STMDEV_SHADOW_BANKS 3
+
+typedef struct
+{
+	uint8_t bank;	// as selected by the map's bank register, 0 for sensors without banks
+	uint8_t first;
+	uint8_t last;
+} stmdev_shadow_range_t;
+
+typedef struct
+{
+	const stmdev_shadow_range_t* ranges;
+	uint8_t range_count;
+	uint8_t bank_reg;	 // selects the bank, the same register in every bank
+	uint8_t bank_mask;	 // bank_reg bits holding the bank, 0 for sensors without banks
+	uint8_t bank_shift;
+	uint8_t reset_reg;
+	uint8_t reset_mask;	   // reset_reg bits that reload every register, and clear themselves
+} stmdev_shadow_map_t;
+
+typedef struct stmdev_shadow
+{
+	const stmdev_shadow_map_t* map;
+	uint16_t burst_max;	   // longest write the bus takes, 0 for no limit
+	bool deferred;
+	bool bank_valid;	// bank_value is what the sensor holds
+	uint8_t bank_value;
+	uint8_t valid[STMDEV_SHADOW_BANKS][STMDEV_SHADOW_REGS / 8];
+	uint8_t dirty[STMDEV_SHADOW_REGS / 8];	  // held writes, all in the selected bank
+	uint8_t value[STMDEV_SHADOW_BANKS][STMDEV_SHADOW_REGS];
+} stmdev_shadow_t;
+
+extern const stmdev_shadow_map_t lsm6dso_shadow_map;
+extern const stmdev_shadow_map_t lps22hh_shadow_map;
+
+/// <summary>
+/// Start with nothing shadowed, set the context's shadow to use it
+/// </summary>
+void stmdev_shadow_init(stmdev_shadow_t* shadow, const stmdev_shadow_map_t* map, uint16_t burst_max);
+
+/// <summary>
+/// lsm6dso_read_reg and lps22hh_read_reg with a shadow on the context
+/// </summary>
+int32_t stmdev_shadow_read(stmdev_ctx_t* ctx, uint8_t reg, uint8_t* data, uint16_t len);
+
+/// <summary>
+/// lsm6dso_write_reg and lps22hh_write_reg with a shadow on the context
+/// </summary>
+int32_t stmdev_shadow_write(stmdev_ctx_t* ctx, uint8_t reg, uint8_t* data, uint16_t len);
+
+/// <summary>
+/// Hold shadowed writes until stmdev_shadow_flush. Does nothing without a shadow.
+/// </summary>
+void stmdev_shadow_defer(stmdev_ctx_t* ctx);
+
+/// <summary>
+/// Send the held writes and stop holding them. Does nothing without a shadow.
+/// </summary>
+/// <returns>0, or the first write's error</returns>
+int32_t stmdev_shadow_flush(stmdev_ctx_t* ctx);
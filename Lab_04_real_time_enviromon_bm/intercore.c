@@ -1,5 +1,50 @@
 #include "intercore.h"
 
+static IntercoreStats stats;
+/* Outbound space the bulk lane must leave free for the control lane. */
+static u32 control_lane_reserve;
+/* Remote read position seen by the last ReserveData, for the high-water mark. */
+static u32 reserved_remote_read_position;
+
+static uint8_t* data_area_offset(BufferHeader* header, u32 offset) {
+	/* Data storage area following header in buffer. */
+	return (uint8_t*)(header + 1) + offset;
+}
+
+static u32 round_up(u32 value, u32 alignment) {
+	/* alignment must be a power of two. */
+	return (value + (alignment - 1)) & ~(alignment - 1);
+}
+
+static u32 next_block_position(u32 position, u32 blockSize, u32 bufSize) {
+	/* Round to the next aligned block, wrapping around the end of the buffer. */
+	position = round_up(position + sizeof(u32) + blockSize, RINGBUFFER_ALIGNMENT);
+	if (position >= bufSize)
+		position -= bufSize;
+	return position;
+}
+
+/* Block payloads start 4 bytes past an aligned boundary, so the common case is whole words. The
+ * word loop goes through volatile pointers so it is not turned back into a byte-granular memcpy,
+ * each access to uncached shared SRAM is a bus transaction. */
+static void copy_span(uint8_t* dest, const uint8_t* src, u32 length) {
+	if ((((uintptr_t)dest | (uintptr_t)src | length) & (sizeof(u32) - 1)) == 0) {
+		volatile u32* dest32 = (volatile u32*)dest;
+		const volatile u32* src32 = (const volatile u32*)src;
+
+		for (length /= sizeof(u32); length > 0; length--)
+			*dest32++ = *src32++;
+		return;
+	}
+
+	memcpy(dest, src, length);
+}
+
+static void signal_hl_app(u32 sw_trig_int) {
+	/* SW_TX_INT_PORT[0] = 1 -> message sent, SW_TX_INT_PORT[1] = 1 -> message received. */
+	mtk_os_hal_mbox_ioctl(OS_HAL_MBOX_CH0, MBOX_IOSET_SWINT_TRIG, &sw_trig_int);
+}
+
 /******************************************************************************/
 /* Functions */
 /******************************************************************************/
@@ -29,8 +74,12 @@ void mbox_fifo_cb(struct mtk_os_hal_mbox_cb_data* data) {
 */
 void mbox_swint_cb(struct mtk_os_hal_mbox_cb_data* data) {
 	if (data->swint.channel == OS_HAL_MBOX_CH0) {
-		if (data->swint.swint_sts & (1 << 1))
+		if (data->swint.swint_sts & (1 << 0))
+			scheduler_post(INTERCORE_EVENT_READ);
+		if (data->swint.swint_sts & (1 << 1)) {
 			blockDeqSema++;
+			scheduler_post(INTERCORE_EVENT_RECEIVED);
+		}
 	}
 }
 
@@ -58,4 +107,260 @@ void initialise_intercore_comms(void) {
 		printf("GetIntercoreBuffers failed\n");
 		return;
 	}
-}
\ No newline at end of file
+
+	if (ConfigureIntercoreLanes(mbox_shared_buf_size, INTERCORE_CONTROL_LANE_SIZE) == -1)
+		printf("Shared buffer too small for a control lane\n");
+}
+
+const IntercoreStats* GetIntercoreStats(void) {
+	return &stats;
+}
+
+int ConfigureIntercoreLanes(u32 bufSize, u32 controlLaneSize) {
+	if (controlLaneSize > bufSize / 2)
+		return -1;
+
+	control_lane_reserve = controlLaneSize;
+	return 0;
+}
+
+int ReserveData(BufferHeader* inbound, BufferHeader* outbound, u32 bufSize, u32 dataSize, IntercoreBlockView* view) {
+	return ReserveLaneData(inbound, outbound, bufSize, INTERCORE_LANE_CONTROL, dataSize, view);
+}
+
+int ReserveLaneData(BufferHeader* inbound, BufferHeader* outbound, u32 bufSize, IntercoreLane lane, u32 dataSize, IntercoreBlockView* view) {
+	u32 laneReserve = (lane == INTERCORE_LANE_BULK) ? control_lane_reserve : 0;
+	u32 remoteReadPosition = inbound->readPosition;
+	u32 localWritePosition = outbound->writePosition;
+	u32 availSpace;
+
+	if (remoteReadPosition >= bufSize)
+		return -1;
+
+	/* If the read pointer is behind the write pointer, then the free space wraps around. */
+	if (remoteReadPosition <= localWritePosition)
+		availSpace = remoteReadPosition - localWritePosition + bufSize;
+	else
+		availSpace = remoteReadPosition - localWritePosition;
+
+	if (availSpace < sizeof(u32) + dataSize + RINGBUFFER_ALIGNMENT + laneReserve) {
+		if (sizeof(u32) + dataSize + RINGBUFFER_ALIGNMENT + laneReserve > bufSize)
+			stats.oversize++;
+		return -1;
+	}
+
+	/* The block size must be stored as a contiguous 4-byte value, the payload can wrap. */
+	u32 dataToEnd = bufSize - localWritePosition;
+	if (dataToEnd < sizeof(u32))
+		return -1;
+
+	u32 writeToEnd = dataToEnd - sizeof(u32);
+	if (dataSize < writeToEnd)
+		writeToEnd = dataSize;
+
+	reserved_remote_read_position = remoteReadPosition;
+
+	/* Not visible to the A7 until CommitData advances the write position. */
+	*(u32*)data_area_offset(outbound, localWritePosition) = dataSize;
+
+	view->position = localWritePosition;
+	view->blockSize = dataSize;
+	view->data[0] = data_area_offset(outbound, localWritePosition + sizeof(u32));
+	view->size[0] = writeToEnd;
+	view->data[1] = (dataSize > writeToEnd) ? data_area_offset(outbound, 0) : NULL;
+	view->size[1] = dataSize - writeToEnd;
+
+	return 0;
+}
+
+int CommitData(BufferHeader* outbound, u32 bufSize, const IntercoreBlockView* view) {
+	u32 localWritePosition = outbound->writePosition;
+
+	if (view->position != localWritePosition)
+		return -1;
+
+	localWritePosition = next_block_position(localWritePosition, view->blockSize, bufSize);
+
+	/* The block contents must land before the new write position does. */
+	__sync_synchronize();
+	outbound->writePosition = localWritePosition;
+
+	stats.committed++;
+	if (view->size[1] != 0)
+		stats.wraps++;
+
+	/* Bytes the A7 had still to read when the block was reserved, plus the block. */
+	u32 pending = localWritePosition - reserved_remote_read_position;
+	if (localWritePosition < reserved_remote_read_position)
+		pending += bufSize;
+	if (pending > stats.highWater)
+		stats.highWater = pending;
+
+	signal_hl_app(0);
+	return 0;
+}
+
+/* Shorten a reserved block before it is committed, so a producer can reserve the
+ * largest frame it might build and publish only the part it filled.
+ */
+int TrimReservedData(BufferHeader* outbound, IntercoreBlockView* view, u32 dataSize) {
+	if (dataSize > view->blockSize)
+		return -1;
+
+	*(u32*)data_area_offset(outbound, view->position) = dataSize;
+
+	view->blockSize = dataSize;
+	if (dataSize <= view->size[0]) {
+		view->size[0] = dataSize;
+		view->data[1] = NULL;
+		view->size[1] = 0;
+	} else {
+		view->size[1] = dataSize - view->size[0];
+	}
+
+	return 0;
+}
+
+static int view_block_at(BufferHeader* inbound, u32 bufSize, u32 localReadPosition, u32 remoteWritePosition, IntercoreBlockView* view) {
+	u32 availData;
+
+	/* Contiguous data, or data which wraps around the end of the buffer. */
+	if (remoteWritePosition >= localReadPosition)
+		availData = remoteWritePosition - localReadPosition;
+	else
+		availData = remoteWritePosition - localReadPosition + bufSize;
+
+	if (availData < sizeof(u32))
+		return -1;
+
+	u32 dataToEnd = bufSize - localReadPosition;
+	if (dataToEnd < sizeof(u32))
+		return -1;
+
+	u32 blockSize = *(u32*)data_area_offset(inbound, localReadPosition);
+
+	if (blockSize + sizeof(u32) > availData)
+		return -1;
+
+	u32 readFromEnd = dataToEnd - sizeof(u32);
+	if (blockSize < readFromEnd)
+		readFromEnd = blockSize;
+
+	view->position = localReadPosition;
+	view->blockSize = blockSize;
+	view->data[0] = data_area_offset(inbound, localReadPosition + sizeof(u32));
+	view->size[0] = readFromEnd;
+	view->data[1] = (blockSize > readFromEnd) ? data_area_offset(inbound, 0) : NULL;
+	view->size[1] = blockSize - readFromEnd;
+
+	return 0;
+}
+
+int PeekData(BufferHeader* outbound, BufferHeader* inbound, u32 bufSize, IntercoreBlockView* view) {
+	u32 remoteWritePosition = inbound->writePosition;
+
+	if (remoteWritePosition >= bufSize)
+		return -1;
+
+	__sync_synchronize();
+	return view_block_at(inbound, bufSize, outbound->readPosition, remoteWritePosition, view);
+}
+
+/* Walk every block the A7 has published, reading its write position once. The blocks
+ * stay in the buffer until ReleaseBatch.
+ */
+int DequeueBatch(BufferHeader* outbound, BufferHeader* inbound, u32 bufSize, IntercoreBlockView* views, u32 maxViews) {
+	u32 remoteWritePosition = inbound->writePosition;
+	u32 localReadPosition = outbound->readPosition;
+	u32 count = 0;
+
+	if (remoteWritePosition >= bufSize)
+		return 0;
+
+	__sync_synchronize();
+
+	while (count < maxViews && view_block_at(inbound, bufSize, localReadPosition, remoteWritePosition, &views[count]) == 0) {
+		localReadPosition = next_block_position(localReadPosition, views[count].blockSize, bufSize);
+		count++;
+	}
+
+	return (int)count;
+}
+
+int ReleaseData(BufferHeader* outbound, u32 bufSize, const IntercoreBlockView* view) {
+	u32 localReadPosition = outbound->readPosition;
+
+	if (view->position != localReadPosition)
+		return -1;
+
+	localReadPosition = next_block_position(localReadPosition, view->blockSize, bufSize);
+
+	/* Finish reading the block before handing the space back to the A7. */
+	__sync_synchronize();
+	outbound->readPosition = localReadPosition;
+
+	signal_hl_app(1);
+	return 0;
+}
+
+/* Consume every block from DequeueBatch with one read position update and one doorbell. */
+int ReleaseBatch(BufferHeader* outbound, u32 bufSize, const IntercoreBlockView* views, u32 count) {
+	if (count == 0)
+		return 0;
+
+	if (views[0].position != outbound->readPosition)
+		return -1;
+
+	/* The views are consecutive, only the end of the last one matters. */
+	__sync_synchronize();
+	outbound->readPosition = next_block_position(views[count - 1].position, views[count - 1].blockSize, bufSize);
+
+	signal_hl_app(1);
+	return 0;
+}
+
+int WriteBlockView(const IntercoreBlockView* view, u32 offset, const void* src, u32 length) {
+	const uint8_t* src8 = src;
+	u32 firstLength = 0;
+
+	if (offset > view->blockSize || length > view->blockSize - offset)
+		return -1;
+
+	if (offset < view->size[0]) {
+		firstLength = view->size[0] - offset;
+		if (length < firstLength)
+			firstLength = length;
+		copy_span(view->data[0] + offset, src8, firstLength);
+		offset = 0;
+	} else {
+		offset -= view->size[0];
+	}
+
+	if (length > firstLength)
+		copy_span(view->data[1] + offset, src8 + firstLength, length - firstLength);
+
+	return 0;
+}
+
+int ReadBlockView(const IntercoreBlockView* view, u32 offset, void* dest, u32 length) {
+	uint8_t* dest8 = dest;
+	u32 firstLength = 0;
+
+	if (offset > view->blockSize || length > view->blockSize - offset)
+		return -1;
+
+	if (offset < view->size[0]) {
+		firstLength = view->size[0] - offset;
+		if (length < firstLength)
+			firstLength = length;
+		copy_span(dest8, view->data[0] + offset, firstLength);
+		offset = 0;
+	} else {
+		offset -= view->size[0];
+	}
+
+	if (length > firstLength)
+		copy_span(dest8 + firstLength, view->data[1] + offset, length - firstLength);
+
+	return 0;
+}
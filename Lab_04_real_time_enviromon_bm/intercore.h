@@ -3,6 +3,7 @@
 #include "intercore_contract.h"
 #include "os_hal_mbox.h"
 #include "os_hal_mbox_shared_mem.h"
+#include "scheduler.h"
 #include <string.h>
 #include "mhal_osai.h"
 
@@ -15,10 +16,16 @@
 
 #define MBOX_BUFFER_LEN_MAX 1044
 
+/* Outbound bytes bulk data leaves free for control messages, see IntercoreLane. */
+#define INTERCORE_CONTROL_LANE_SIZE 256
+
+/* scheduler_post events raised by the mailbox SW interrupt handler. */
+#define INTERCORE_EVENT_RECEIVED (1u << 0) /* the high-level app wrote to the inbound buffer */
+#define INTERCORE_EVENT_READ (1u << 1)     /* the high-level app read from the outbound buffer */
+
 // extern INTERCORE_DISK_DATA_BLOCK_T disk_ic_data;
 extern u32 mbox_shared_buf_size;
 extern uint32_t mbox_irq_status;
-extern uint8_t mbox_local_buf[MBOX_BUFFER_LEN_MAX];
 extern BufferHeader* outbound, * inbound;
 extern volatile u8  blockDeqSema;
 extern volatile u8  blockFifoSema;
@@ -47,6 +54,67 @@ static const ComponentId hlAppId = { .data1 = 0x25025d2c,
 									.data4 = {0xba, 0xe1, 0xac, 0x26, 0xfc, 0xdd, 0x36, 0x27},
 									.reserved_word = 0 };
 
+/// <summary>
+///     Describes a block inside a shared buffer so it can be written or read in place.
+///     A block that wraps around the end of the data area is described by two spans,
+///     otherwise size[1] is zero and data[0] can be used directly.
+/// </summary>
+typedef struct {
+	uint8_t* data[2];
+	u32 size[2];
+	/// <summary>Offset of the block size word within the data area</summary>
+	u32 position;
+	/// <summary>Length of the block payload, the sum of both spans</summary>
+	u32 blockSize;
+} IntercoreBlockView;
+
+/// <summary>
+///     Logical lanes multiplexed over the outbound buffer. Bulk blocks may not take the space
+///     set aside for the control lane, so control messages can always be sent even when the
+///     A7 has fallen behind on bulk data.
+/// </summary>
+typedef enum {
+	INTERCORE_LANE_CONTROL,
+	INTERCORE_LANE_BULK
+} IntercoreLane;
+
+/// <summary>
+///     Counters kept by the outbound functions, totals since startup.
+/// </summary>
+typedef struct {
+	u32 committed;	/* blocks published by CommitData */
+	u32 oversize;	/* reservations larger than the buffer can ever hold */
+	u32 wraps;		/* committed blocks split around the end of the data area */
+	u32 highWater;	/* most bytes waiting for the A7, measured at each commit */
+} IntercoreStats;
+
 void initialise_intercore_comms(void);
+const IntercoreStats* GetIntercoreStats(void);
+
+/* Zero-copy counterparts of EnqueueData and DequeueData.
+ * ReserveData/CommitData produce exactly the buffer contents EnqueueData would, and
+ * PeekData/ReleaseData consume exactly what DequeueData would, without staging the
+ * message in a local buffer first.
+ */
+int ReserveData(BufferHeader* inbound, BufferHeader* outbound, u32 bufSize, u32 dataSize, IntercoreBlockView* view);
+
+/* Set aside controlLaneSize bytes of the outbound buffer for the control lane, call after
+ * GetIntercoreBuffers. ReserveLaneData on the bulk lane leaves that space free, ReserveData
+ * uses the control lane.
+ */
+int ConfigureIntercoreLanes(u32 bufSize, u32 controlLaneSize);
+int ReserveLaneData(BufferHeader* inbound, BufferHeader* outbound, u32 bufSize, IntercoreLane lane, u32 dataSize, IntercoreBlockView* view);
+int CommitData(BufferHeader* outbound, u32 bufSize, const IntercoreBlockView* view);
+int TrimReservedData(BufferHeader* outbound, IntercoreBlockView* view, u32 dataSize);
+int PeekData(BufferHeader* outbound, BufferHeader* inbound, u32 bufSize, IntercoreBlockView* view);
+int ReleaseData(BufferHeader* outbound, u32 bufSize, const IntercoreBlockView* view);
+
+/* Bulk form of PeekData/ReleaseData for bursts of messages: one read of the A7 write position,
+ * one read position update and one doorbell for up to maxViews blocks.
+ */
+int DequeueBatch(BufferHeader* outbound, BufferHeader* inbound, u32 bufSize, IntercoreBlockView* views, u32 maxViews);
+int ReleaseBatch(BufferHeader* outbound, u32 bufSize, const IntercoreBlockView* views, u32 count);
+int WriteBlockView(const IntercoreBlockView* view, u32 offset, const void* src, u32 length);
+int ReadBlockView(const IntercoreBlockView* view, u32 offset, void* dest, u32 length);
 // void send_intercode_data_msg(const char* message);
 // void send_intercore_msg(INTERCORE_DISK_DATA_BLOCK_T* ic_data_block, size_t length);
@@ -1,11 +1,18 @@
 #include "intercore.h"
+#include "intercore_codec.h"
 #include "intercore_contract.h"
+#include "intercore_flow.h"
+#include "intercore_load.h"
+#include "intercore_memory.h"
+#include "intercore_pack.h"
+#include "intercore_snapshot.h"
 
 #if defined(OEM_AVNET)
 #include "IMU_lib/imu_temp_pressure.h"
 #endif
 
 #include "hw/azure_sphere_learning_path.h"
+#include "scheduler.h"
 #include "utils.h"
 
 #include "os_hal_uart.h"
@@ -15,20 +22,39 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <malloc.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 #include <math.h>
 
 #define IN_RANGE(number, low, high) (low <= number && high >= number)
 
+// Range of sample rates a high-level app may subscribe at
+#define MIN_SUBSCRIBE_RATE_MS 100
+#define MAX_SUBSCRIBE_RATE_MS (60 * 60 * 1000)
+
+// Inbound messages handled per read position update and doorbell
+#define INBOUND_BATCH_MAX 8
+
+// Sample period until a subscriber asks for another rate
+#define SENSOR_PERIOD_MS 2000
+
+// scheduler_post events of this app, the INTERCORE_EVENT_* bits are raised by intercore.c
+#define EVENT_SAMPLE (1u << 2) // take a sample now
+
+// Committed frames whose latency is being timed, older ones go untimed if more are outstanding
+#define LATENCY_TRACK_MAX 16
+
 os_hal_gpio_pin ledRgb[] = {LED_RED, LED_GREEN, LED_BLUE};
 
-INTERCORE_BLOCK ic_outbound_data;
-INTERCORE_BLOCK *ic_inbound_data;
+INTERCORE_BLOCK ic_inbound_data;
+
+// Latest reading, published by refresh_data and copied whole whenever a reading is sent
+static INTERCORE_SNAPSHOT environment_snapshot;
 
 typedef struct {
-    int last_temperature;
     int target_temperature;
     bool target_temperature_set;
     int previous_led;
@@ -37,11 +63,35 @@ typedef struct {
 
 HVAC_MODE hvac_mode;
 
-uint8_t mbox_local_buf[MBOX_BUFFER_LEN_MAX];
 BufferHeader *outbound, *inbound;
 volatile u8 blockDeqSema;
 volatile u8 blockFifoSema;
-volatile bool refresh_data_trigger;
+bool refresh_data_trigger; // sample on the next EVENT_SAMPLE even if sampling is paused
+static bool sample_deferred; // a sample fell due while a BLOCK subscriber had no credit
+bool sensor_streaming; // push readings as they are sampled, set by IC_SUBSCRIBE_SENSOR
+static INTERCORE_FLOW sensor_flow; // subscriber credit
+
+// Jobs run by scheduler_run_once, in this order when several are ready
+static void process_inbound_message(void);
+static void sample_job_run(void);
+static void batch_flush_job_run(void);
+static void latency_collect(void);
+
+static SCHEDULER_JOB intercore_job = {.run = process_inbound_message, .name = "intercore", .events = INTERCORE_EVENT_RECEIVED};
+static SCHEDULER_JOB sample_job = {.run = sample_job_run, .name = "sample", .events = EVENT_SAMPLE};
+static SCHEDULER_JOB batch_flush_job = {.run = batch_flush_job_run, .name = "batch flush"};
+static SCHEDULER_JOB latency_job = {.run = latency_collect, .name = "latency", .events = INTERCORE_EVENT_READ | INTERCORE_EVENT_RECEIVED};
+
+// CPU time outside any job and outside wfi is charged to the scheduler loop itself
+static const char scheduler_owner[] = "scheduler";
+
+// Free TCM above the bss, malloc grows its heap up from end and the stack grows down from StackTop,
+// see linker.ld
+extern uint32_t end, StackTop;
+// Stack in use when RTCoreMain paints the rest, and a margin for the paint call itself
+#define STACK_PAINT_MARGIN 256
+// Least heap free whenever memory use is read
+static unsigned int heap_min_free = UINT32_MAX;
 
 struct os_gpt_int gpt0_int;
 struct os_gpt_int gpt3_int;
@@ -57,8 +107,9 @@ static const uint8_t uart_port_num = OS_HAL_UART_ISU3;
 /******************************************************************************/
 /* Timers */
 /******************************************************************************/
-static const uint8_t gpt_task_scheduler = OS_HAL_GPT0;
-static const uint32_t gpt_task_scheduler_timer_val = 1; /* 1ms */
+static const uint8_t gpt_wake_timer = OS_HAL_GPT0; /* one-shot at 1KHz, wakes the core for the next deadline */
+static const uint8_t gpt_clock = OS_HAL_GPT2;      /* free-running at 32KHz, the scheduler clock */
+#define GPT_CLOCK_HZ 32768
 
 /******************************************************************************/
 /* Applicaiton Hooks */
@@ -99,8 +150,12 @@ bool initialize_hardware(void)
             Gpt3_WaitUs(100000);
         }
 
-        ic_outbound_data.temperature = round(lp_get_temperature_lps22h());
-        ic_outbound_data.pressure = round(lp_get_pressure());
+        INTERCORE_BLOCK reading = {
+            .cmd = IC_READ_SENSOR,
+            .temperature = round(lp_get_temperature_lps22h()),
+            .pressure = round(lp_get_pressure()),
+        };
+        intercore_snapshot_publish(&environment_snapshot, &reading);
     }
     return status;
 }
@@ -109,13 +164,332 @@ bool initialize_hardware(void)
 }
 #endif
 
-static void send_intercore_msg(void *data, size_t length)
+// Outbound records are packed into batch frames so several readings share one mailbox doorbell.
+// A frame is sent when it is full or when the most impatient record in it reaches its deadline.
+// Legacy frames are an INTERCORE_BATCH_HEADER followed by INTERCORE_BLOCK records, compact frames
+// are intercore_codec records back to back. Packed frames are built from records kept here at
+// flush, until then the reservation holds room for their largest possible size.
+typedef struct {
+    IntercoreBlockView view;
+    int count;
+    uint32_t used;     // record bytes written to the frame, worst case for a packed frame
+    uint32_t capacity; // record bytes the frame can hold
+    uint32_t deadline;
+    bool open;
+    bool compact;
+    bool packed;
+    INTERCORE_RECORD records[INTERCORE_BATCH_MAX_RECORDS]; // records of a packed frame
+} INTERCORE_BATCH;
+
+static INTERCORE_BATCH outbound_batch;
+static uint8_t packed_frame[INTERCORE_BATCH_MAX_RECORDS * sizeof(INTERCORE_BLOCK)];
+static bool peer_compact; // reply in the compact format once the high-level app uses it
+static bool peer_packed;  // send batches as packed frames, asked for on IC_SUBSCRIBE_SENSOR
+static uint16_t request_id; // request being served, echoed in its replies, 0 for none
+
+// Transport statistics reported by IC_READ_STATS, the ring counters are kept by intercore.c
+typedef struct {
+    uint32_t position;
+    uint32_t committed_ms;
+} INFLIGHT_FRAME;
+
+static uint32_t records_sent;
+static uint32_t records_dropped;
+static uint32_t latency_histogram[INTERCORE_LATENCY_BUCKETS];
+static INFLIGHT_FRAME inflight[LATENCY_TRACK_MAX];
+static uint32_t inflight_head, inflight_count;
+
+/// <summary>
+/// Start timing a frame just committed at position in the outbound buffer.
+/// </summary>
+static void latency_track(uint32_t position)
+{
+    if (inflight_count == LATENCY_TRACK_MAX) {
+        inflight_head = (inflight_head + 1) % LATENCY_TRACK_MAX;
+        inflight_count--;
+    }
+
+    inflight[(inflight_head + inflight_count) % LATENCY_TRACK_MAX] = (INFLIGHT_FRAME){.position = position, .committed_ms = scheduler_now()};
+    inflight_count++;
+}
+
+/// <summary>
+/// Add every timed frame the high-level app has read since the last call to the latency histogram.
+/// Frames are read in order, a frame is read once the remote read position has moved past it.
+/// </summary>
+static void latency_collect(void)
+{
+    uint32_t read_position, pending, elapsed_ms;
+    int bucket;
+
+    if (inflight_count == 0) {
+        return;
+    }
+
+    read_position = inbound->readPosition;
+    pending = (outbound->writePosition - read_position + mbox_shared_buf_size) % mbox_shared_buf_size;
+
+    while (inflight_count > 0 && (inflight[inflight_head].position - read_position + mbox_shared_buf_size) % mbox_shared_buf_size >= pending) {
+        elapsed_ms = scheduler_now() - inflight[inflight_head].committed_ms;
+
+        for (bucket = 0; bucket < INTERCORE_LATENCY_BUCKETS - 1 && elapsed_ms >= (1u << bucket); bucket++) {
+        }
+        latency_histogram[bucket]++;
+
+        inflight_head = (inflight_head + 1) % LATENCY_TRACK_MAX;
+        inflight_count--;
+    }
+}
+
+static uint32_t batch_frame_size(int count)
+{
+    return payloadStart + INTERCORE_BATCH_FRAME_SIZE(count);
+}
+
+static uint32_t batch_records_start(INTERCORE_BATCH *batch)
+{
+    return payloadStart + (batch->compact ? 0 : sizeof(INTERCORE_BATCH_HEADER));
+}
+
+/// <summary>
+/// Publish the open batch frame with a single doorbell.
+/// A legacy frame holding one record is sent as a plain INTERCORE_BLOCK.
+/// </summary>
+static void batch_flush(INTERCORE_BATCH *batch)
+{
+    INTERCORE_BATCH_HEADER header = {.cmd = IC_BATCH, .count = batch->count};
+    INTERCORE_BLOCK record;
+    int length;
+
+    if (!batch->open) {
+        return;
+    }
+
+    if (batch->packed) {
+        // Fits, the reservation was sized for the worst case
+        length = intercore_pack_records(batch->records, batch->count, packed_frame, batch->used);
+        WriteBlockView(&batch->view, payloadStart, packed_frame, (uint32_t)length);
+        TrimReservedData(outbound, &batch->view, payloadStart + (uint32_t)length);
+    } else if (!batch->compact && batch->count == 1) {
+        ReadBlockView(&batch->view, batch_frame_size(0), &record, sizeof(record));
+        WriteBlockView(&batch->view, payloadStart, &record, sizeof(record));
+        TrimReservedData(outbound, &batch->view, payloadStart + sizeof(record));
+    } else {
+        if (!batch->compact) {
+            WriteBlockView(&batch->view, payloadStart, &header, sizeof(header));
+        }
+        TrimReservedData(outbound, &batch->view, batch_records_start(batch) + batch->used);
+    }
+
+    CommitData(outbound, mbox_shared_buf_size, &batch->view);
+    latency_track(batch->view.position);
+    batch->open = false;
+}
+
+static void batch_flush_if_due(INTERCORE_BATCH *batch)
+{
+    if (batch->open && (int32_t)(scheduler_now() - batch->deadline) >= 0) {
+        batch_flush(batch);
+    }
+}
+
+/// <summary>
+/// Append a record to the open batch frame, opening a new frame in the shared buffer if needed.
+/// Records are written straight into the reserved frame, the frame is flushed when full.
+/// </summary>
+/// <param name="record">The record as a legacy struct</param>
+/// <param name="compact_record">The same record in the compact format, which can carry more fields</param>
+/// <param name="max_wait_ms">Time the record may wait for more records to share its frame</param>
+/// <returns>false if the shared buffer has no room, the record is dropped</returns>
+static bool batch_append(INTERCORE_BATCH *batch, const INTERCORE_BLOCK *record, const INTERCORE_RECORD *compact_record, uint32_t max_wait_ms)
+{
+    uint32_t deadline = scheduler_now() + max_wait_ms;
+    uint8_t encoded[INTERCORE_WIRE_MAX_RECORD_SIZE];
+    const void *data = record;
+    uint32_t length = sizeof(*record);
+    uint32_t start = 0;
+    bool packed = peer_compact && peer_packed;
+
+    if (packed) {
+        // Column bytes one more record can add, the frame header is counted once
+        start = INTERCORE_PACK_HEADER_SIZE;
+        length = intercore_pack_bound(compact_record->fields, 1) - start;
+    } else if (peer_compact) {
+        length = intercore_encode(compact_record, encoded, sizeof(encoded));
+        data = encoded;
+    }
+
+    // A frame holds records of one format only, a packed frame records with the same fields
+    if (batch->open && (batch->compact != peer_compact || batch->packed != packed ||
+                        (packed && (batch->records[0].cmd != compact_record->cmd || batch->records[0].fields != compact_record->fields)))) {
+        batch_flush(batch);
+    }
+
+    if (!batch->open) {
+        batch->compact = peer_compact;
+        batch->packed = packed;
+
+        // Reserve the largest frame the shared buffer can take right now
+        for (batch->capacity = INTERCORE_BATCH_MAX_RECORDS * sizeof(INTERCORE_BLOCK); batch->capacity >= start + length; batch->capacity /= 2) {
+            if (ReserveLaneData(inbound, outbound, mbox_shared_buf_size, INTERCORE_LANE_BULK, batch_records_start(batch) + batch->capacity, &batch->view) == 0) {
+                break;
+            }
+        }
+
+        if (batch->capacity < start + length) {
+            records_dropped++;
+            return false;
+        }
+
+        WriteBlockView(&batch->view, 0, &hlAppId, sizeof(hlAppId)); // copy high level appid to first 20 bytes
+        batch->count = 0;
+        batch->used = start;
+        batch->deadline = deadline;
+        batch->open = true;
+    } else if ((int32_t)(deadline - batch->deadline) < 0) {
+        batch->deadline = deadline;
+    }
+
+    // batch_flush_job sends the frame at its deadline unless it fills first
+    scheduler_at(&batch_flush_job, batch->deadline);
+
+    if (packed) {
+        batch->records[batch->count] = *compact_record;
+    } else {
+        WriteBlockView(&batch->view, batch_records_start(batch) + batch->used, data, length);
+    }
+    batch->used += length;
+    batch->count++;
+    records_sent++;
+
+    // Full once another record of this size would not fit
+    if (batch->used + length > batch->capacity || batch->count == INTERCORE_BATCH_MAX_RECORDS) {
+        batch_flush(batch);
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Send the latest reading. Compact records carry its version, so the high-level app can keep the
+/// latest value without asking for it and tell a new reading from one it already has.
+/// </summary>
+static void send_intercore_msg(void)
+{
+    INTERCORE_BLOCK reading;
+    INTERCORE_RECORD compact_record;
+    uint32_t version = intercore_snapshot_read(&environment_snapshot, &reading);
+
+    intercore_record_from_block(&reading, &compact_record);
+    compact_record.fields |= IC_FIELD_VERSION;
+    compact_record.version = (uint16_t)version;
+
+    if (request_id != 0) {
+        compact_record.fields |= IC_FIELD_REQUEST_ID;
+        compact_record.request_id = request_id;
+    }
+
+    // Replies are sent once the current batch of inbound messages has been processed
+    batch_append(&outbound_batch, &reading, &compact_record, 0);
+}
+
+/// <summary>
+/// Send a message on the control lane straight away, after any records already waiting to be sent.
+/// </summary>
+static void send_control_message(const void *data, uint32_t length)
+{
+    IntercoreBlockView view;
+
+    batch_flush(&outbound_batch);
+
+    if (ReserveData(inbound, outbound, mbox_shared_buf_size, payloadStart + length, &view) != 0) {
+        return;
+    }
+
+    WriteBlockView(&view, 0, &hlAppId, sizeof(hlAppId));
+    WriteBlockView(&view, payloadStart, data, length);
+    CommitData(outbound, mbox_shared_buf_size, &view);
+    latency_track(view.position);
+}
+
+/// <summary>
+/// Reply to IC_READ_STATS. The reply is always a legacy INTERCORE_STATS struct, the compact format
+/// has no fields for it, and goes after any records already waiting to be sent.
+/// </summary>
+static void send_intercore_stats(void)
+{
+    const IntercoreStats *ring = GetIntercoreStats();
+    INTERCORE_STATS reply = {
+        .cmd = IC_READ_STATS,
+        .records = records_sent,
+        .frames = ring->committed,
+        .dropped = records_dropped,
+        .oversize = ring->oversize,
+        .wraps = ring->wraps,
+        .high_water = ring->highWater,
+        .buffer_size = mbox_shared_buf_size,
+        .request_id = request_id,
+        .throttled = sensor_flow.throttled,
+    };
+
+    memcpy(reply.latency_ms, latency_histogram, sizeof(reply.latency_ms));
+    send_control_message(&reply, sizeof(reply));
+}
+
+/// <summary>
+/// Reply to IC_READ_LOAD, always a legacy INTERCORE_LOAD struct like the statistics reply.
+/// </summary>
+static void send_intercore_load(void)
+{
+    INTERCORE_LOAD reply = {0};
+
+    intercore_load_read(&reply);
+    reply.request_id = request_id;
+    send_control_message(&reply, sizeof(reply));
+}
+
+/// <summary>
+/// Reply to IC_READ_MEMORY, always a legacy INTERCORE_MEMORY struct like the statistics reply.
+/// The stack is whatever lies between the heap and StackTop, it was painted at startup.
+/// </summary>
+static void send_intercore_memory(void)
+{
+    INTERCORE_MEMORY reply = {.cmd = IC_READ_MEMORY, .request_id = request_id};
+    struct mallinfo heap = mallinfo();
+    uint8_t *heap_end = sbrk(0);
+
+    intercore_memory_add_stack(&reply, "main", heap_end, (size_t)((uint8_t *)&StackTop - heap_end));
+
+    if ((unsigned int)heap.fordblks < heap_min_free) {
+        heap_min_free = (unsigned int)heap.fordblks;
+    }
+    reply.heap_size = (unsigned int)heap.arena;
+    reply.heap_free = (unsigned int)heap.fordblks;
+    reply.heap_min_free = heap_min_free;
+
+    send_control_message(&reply, sizeof(reply));
+}
+
+/// <summary>
+/// Acknowledge a compact request that has no other reply, so the high-level app can complete it.
+/// </summary>
+static void send_ack(const INTERCORE_BLOCK *block)
 {
-    uint32_t dataSize;
-    memcpy((void *)mbox_local_buf, &hlAppId, sizeof(hlAppId)); // copy high level appid to first 20 bytes
-    memcpy(mbox_local_buf + payloadStart, data, length);
-    dataSize = payloadStart + length;
-    EnqueueData(inbound, outbound, mbox_shared_buf_size, mbox_local_buf, dataSize);
+    uint8_t encoded[INTERCORE_WIRE_MAX_RECORD_SIZE];
+    INTERCORE_RECORD ack;
+    int length;
+
+    if (request_id == 0) {
+        return;
+    }
+
+    intercore_record_from_block(block, &ack);
+    ack.fields |= IC_FIELD_REQUEST_ID;
+    ack.request_id = request_id;
+
+    if ((length = intercore_encode(&ack, encoded, sizeof(encoded))) > 0) {
+        send_control_message(encoded, (uint32_t)length);
+    }
 }
 
 /// <summary>
@@ -140,124 +514,414 @@ void set_hvac_operating_mode(int temperature)
         hvac_mode.previous_led = hvac_mode.current_led;
     }
 
-    ic_outbound_data.operating_mode = hvac_mode.current_led;
     // minus one as first item is HVAC_MODE_UNKNOWN
     mtk_os_hal_gpio_set_output(ledRgb[hvac_mode.current_led - 1], false);
 }
 
-static void process_inbound_message()
+/// <summary>
+/// Push the latest reading to the subscriber, if its flow control policy lets it go now.
+/// </summary>
+static void push_sensor_reading(void)
+{
+    if (intercore_flow_offer(&sensor_flow)) {
+        send_intercore_msg();
+    }
+}
+
+/// <summary>
+/// Credit from the subscriber, send the reading held back for it if there is one.
+/// </summary>
+static void grant_sensor_credit(uint32_t credits)
+{
+    if (intercore_flow_grant(&sensor_flow, credits) && sensor_streaming) {
+        push_sensor_reading();
+    }
+
+    // Take the sample that fell due while sampling was paused
+    if (sample_deferred && !intercore_flow_paused(&sensor_flow)) {
+        scheduler_post(EVENT_SAMPLE);
+    }
+}
+
+/// <summary>
+/// Start pushing readings to the high-level app at the requested sample rate.
+/// The current reading is sent straight away so the subscriber does not wait a full period.
+/// </summary>
+static void subscribe_sensor_stream(INTERCORE_SUBSCRIBE *subscribe)
 {
-    u32 mbox_local_buf_len;
-    int result;
+    if (!IN_RANGE(subscribe->sample_rate_ms, MIN_SUBSCRIBE_RATE_MS, MAX_SUBSCRIBE_RATE_MS)) {
+        return;
+    }
+
+    scheduler_every(&sample_job, subscribe->sample_rate_ms);
+    intercore_flow_start(&sensor_flow, subscribe->flow_policy, subscribe->credits < 0 ? 0 : subscribe->credits);
+    peer_packed = subscribe->packed_frames != 0;
+    sensor_streaming = true;
+    push_sensor_reading();
+}
+
+static void process_control_block(void)
+{
+    switch (ic_inbound_data.cmd) {
+    case IC_READ_SENSOR:
+        send_intercore_msg();
+        break;
+    case IC_SUBSCRIBE_SENSOR:
+        subscribe_sensor_stream((INTERCORE_SUBSCRIBE *)&ic_inbound_data);
+        break;
+    case IC_UNSUBSCRIBE_SENSOR:
+        sensor_streaming = false;
+        intercore_flow_start(&sensor_flow, INTERCORE_FLOW_NONE, 0);
+        peer_packed = false;
+        send_ack(&ic_inbound_data);
+        break;
+    case IC_GRANT_CREDIT: {
+        int credits = ((INTERCORE_CREDIT *)&ic_inbound_data)->credits;
+        grant_sensor_credit(credits < 0 ? 0 : credits);
+        break;
+    }
+    case IC_READ_STATS:
+        send_intercore_stats();
+        break;
+    case IC_READ_LOAD:
+        send_intercore_load();
+        break;
+    case IC_READ_MEMORY:
+        send_intercore_memory();
+        break;
+    case IC_TARGET_TEMPERATURE:
+        if (IN_RANGE(ic_inbound_data.temperature, -20, 80)) {
+            hvac_mode.target_temperature = ic_inbound_data.temperature;
+            hvac_mode.target_temperature_set = true;
+            // refresh_data is the only writer of the reading and the LEDs, take a fresh sample to
+            // apply the new target
+            refresh_data_trigger = true;
+            scheduler_post(EVENT_SAMPLE);
+            send_ack(&ic_inbound_data);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void process_compact_record(INTERCORE_RECORD *record)
+{
+    INTERCORE_SUBSCRIBE subscribe;
+
+    // Several requests may be outstanding, each reply carries the id of the request it answers
+    request_id = (record->fields & IC_FIELD_REQUEST_ID) ? record->request_id : 0;
+
+    if (record->cmd == IC_SUBSCRIBE_SENSOR) {
+        intercore_record_to_subscribe(record, &subscribe);
+        subscribe_sensor_stream(&subscribe);
+    } else {
+        // Credit can ride on any other command, IC_GRANT_CREDIT carries nothing else
+        if (record->fields & IC_FIELD_CREDITS) {
+            grant_sensor_credit(record->credits);
+        }
+        if (record->cmd != IC_GRANT_CREDIT) {
+            intercore_record_to_block(record, &ic_inbound_data);
+            process_control_block();
+        }
+    }
+
+    request_id = 0;
+}
+
+/// <summary>
+/// Process every command in an inbound message, read in place from the shared buffer.
+/// The message is either compact intercore_codec records or a legacy INTERCORE_BLOCK / IC_BATCH frame,
+/// replies are sent in the same format.
+/// </summary>
+static void process_message(IntercoreBlockView *view)
+{
+    uint8_t wire[INTERCORE_WIRE_MAX_RECORD_SIZE];
+    INTERCORE_BATCH_HEADER header;
+    INTERCORE_RECORD record;
+    u32 offset = payloadStart;
+    u32 length;
+    int consumed;
+
+    if (view->blockSize < payloadStart + sizeof(INTERCORE_CMD)) {
+        return;
+    }
+
+    length = view->blockSize - payloadStart;
+    if (length > sizeof(wire)) {
+        length = sizeof(wire);
+    }
+    ReadBlockView(view, payloadStart, wire, length);
+
+    peer_compact = intercore_is_compact(wire, length);
+
+    if (peer_compact) {
+        // Compact records are back to back, each one says how long it is
+        while (offset < view->blockSize) {
+            length = view->blockSize - offset;
+            if (length > sizeof(wire)) {
+                length = sizeof(wire);
+            }
+            ReadBlockView(view, offset, wire, length);
+
+            if ((consumed = intercore_decode(wire, length, &record)) < 0) {
+                break;
+            }
+
+            process_compact_record(&record);
+            offset += consumed;
+        }
+        return;
+    }
+
+    // Commands can be shorter than an INTERCORE_BLOCK, eg INTERCORE_SUBSCRIBE
+    length = view->blockSize - payloadStart;
+    if (length > sizeof(INTERCORE_BLOCK)) {
+        length = sizeof(INTERCORE_BLOCK);
+    }
 
-    mbox_local_buf_len = MBOX_BUFFER_LEN_MAX;
-    result = DequeueData(outbound, inbound, mbox_shared_buf_size, mbox_local_buf, &mbox_local_buf_len);
+    memset(&ic_inbound_data, 0, sizeof(INTERCORE_BLOCK));
+    ReadBlockView(view, payloadStart, &ic_inbound_data, length);
 
-    if (result == 0 && mbox_local_buf_len > payloadStart) {
+    if (ic_inbound_data.cmd == IC_BATCH) {
+        // Unpack every record in the frame before releasing it
+        ReadBlockView(view, payloadStart, &header, sizeof(header));
 
-        ic_inbound_data = (INTERCORE_BLOCK *)(mbox_local_buf + payloadStart);
+        for (int i = 0; i < header.count; i++) {
+            if (ReadBlockView(view, batch_frame_size(i), &ic_inbound_data, sizeof(INTERCORE_BLOCK)) != 0) {
+                break;
+            }
+            process_control_block();
+        }
+    } else {
+        process_control_block();
+    }
+}
+
+static bool is_control_message(IntercoreBlockView *view)
+{
+    uint8_t head[INTERCORE_WIRE_HEADER_SIZE];
+    u32 length = view->blockSize - payloadStart;
 
-        switch (ic_inbound_data->cmd) {
-        case IC_READ_SENSOR:
-            send_intercore_msg(&ic_outbound_data, sizeof(INTERCORE_BLOCK));
-            break;
-        case IC_TARGET_TEMPERATURE:
-            if (IN_RANGE(ic_inbound_data->temperature, -20, 80)) {
-                hvac_mode.target_temperature_set = true;
-                hvac_mode.target_temperature = ic_inbound_data->temperature;
-                set_hvac_operating_mode(hvac_mode.last_temperature);
+    if (view->blockSize < payloadStart) {
+        return false;
+    }
+    if (length > sizeof(head)) {
+        length = sizeof(head);
+    }
+
+    ReadBlockView(view, payloadStart, head, length);
+    return intercore_is_control(head, length);
+}
+
+static void process_inbound_message(void)
+{
+    IntercoreBlockView views[INBOUND_BATCH_MAX];
+    bool control[INBOUND_BATCH_MAX];
+    int count;
+
+    // Read commands straight out of the inbound shared buffer, a burst is released with one doorbell
+    while ((count = DequeueBatch(outbound, inbound, mbox_shared_buf_size, views, INBOUND_BATCH_MAX)) > 0) {
+        // Control lane first, a setpoint change does not wait behind queued sensor polls
+        for (int i = 0; i < count; i++) {
+            if ((control[i] = is_control_message(&views[i]))) {
+                process_message(&views[i]);
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            if (!control[i]) {
+                process_message(&views[i]);
             }
-            break;
-        default:
-            break;
         }
+        ReleaseBatch(outbound, mbox_shared_buf_size, views, count);
     }
+
+    // One doorbell for all the replies generated by this wakeup
+    batch_flush_if_due(&outbound_batch);
 }
 
 // sensor read
 #if defined(OEM_AVNET)
 static void refresh_data(void)
 {
+    INTERCORE_BLOCK reading;
     int rand_number;
 
-    ic_outbound_data.cmd = IC_READ_SENSOR;
+    reading.cmd = IC_READ_SENSOR;
 
-    ic_outbound_data.temperature = round(lp_get_temperature_lps22h());
-    ic_outbound_data.pressure = round(lp_get_pressure());
+    reading.temperature = round(lp_get_temperature_lps22h());
+    reading.pressure = round(lp_get_pressure());
 
     rand_number = rand() % 20;
-    ic_outbound_data.humidity = 40.0 + rand_number;
+    reading.humidity = 40.0 + rand_number;
 
-    hvac_mode.last_temperature = ic_outbound_data.temperature;
+    set_hvac_operating_mode(reading.temperature);
+    reading.operating_mode = hvac_mode.current_led;
 
-    set_hvac_operating_mode(ic_outbound_data.temperature);
+    intercore_snapshot_publish(&environment_snapshot, &reading);
 }
 #else
 void refresh_data(void)
 {
+    INTERCORE_BLOCK reading;
     int rand_number;
 
-    ic_outbound_data.cmd = IC_READ_SENSOR;
+    reading.cmd = IC_READ_SENSOR;
 
     rand_number = (rand() % 10);
-    ic_outbound_data.temperature = (float)(15.0 + rand_number);
+    reading.temperature = (float)(15.0 + rand_number);
 
     rand_number = (rand() % 100);
-    ic_outbound_data.pressure = (float)(950.0 + rand_number);
+    reading.pressure = (float)(950.0 + rand_number);
 
     rand_number = rand() % 40;
-    ic_outbound_data.humidity = 40.0 + rand_number;
+    reading.humidity = 40.0 + rand_number;
 
-    hvac_mode.last_temperature = ic_outbound_data.temperature;
+    set_hvac_operating_mode(reading.temperature);
+    reading.operating_mode = hvac_mode.current_led;
 
-    set_hvac_operating_mode(ic_outbound_data.temperature);
+    intercore_snapshot_publish(&environment_snapshot, &reading);
 }
 #endif
 
-static void task_scheduler(void *cb_data)
+/// <summary>
+/// Sample the sensors and push the reading to the subscriber, every sample period and on EVENT_SAMPLE.
+/// A BLOCK subscriber out of credit pauses sampling, the next sample is taken once it catches up.
+/// </summary>
+static void sample_job_run(void)
 {
-    static size_t refresh_data_tick_counter = SIZE_MAX;
+    if (!refresh_data_trigger && intercore_flow_paused(&sensor_flow)) {
+        sample_deferred = true;
+        return;
+    }
+
+    refresh_data_trigger = false;
+    sample_deferred = false;
+    refresh_data();
 
-    if (refresh_data_tick_counter++ >= 2000) // 2 seconds
-    {
-        refresh_data_tick_counter = 0;
-        refresh_data_trigger = true;
+    // Push the fresh reading rather than waiting to be polled with IC_READ_SENSOR
+    if (sensor_streaming) {
+        push_sensor_reading();
     }
 }
 
+static void batch_flush_job_run(void)
+{
+    batch_flush_if_due(&outbound_batch);
+}
+
+/******************************************************************************/
+/* Scheduler platform */
+/******************************************************************************/
+static uint32_t clock_now_ms(void)
+{
+    static uint32_t last_count;
+    static uint64_t ticks;
+    uint32_t count = mtk_os_hal_gpt_get_cur_count(gpt_clock);
+
+    // Accumulated, so the millisecond clock runs on past the 32-bit counter wrapping
+    ticks += count - last_count;
+    last_count = count;
+    return (uint32_t)(ticks * 1000 / GPT_CLOCK_HZ);
+}
+
+static void wake_timer_arm(uint32_t delay_ms)
+{
+    mtk_os_hal_gpt_stop(gpt_wake_timer);
+
+    if (delay_ms != SCHEDULER_FOREVER) {
+        mtk_os_hal_gpt_reset_timer(gpt_wake_timer, delay_ms, false);
+        mtk_os_hal_gpt_start(gpt_wake_timer);
+    }
+}
+
+static void wake_timer_isr(void *cb_data)
+{
+    // Waking the core is all this interrupt is for, scheduler_run_once checks the deadlines
+}
+
+static void disable_interrupts(void)
+{
+    __disable_irq();
+}
+
+static void enable_interrupts(void)
+{
+    __enable_irq();
+}
+
+static void wait_for_interrupt(void)
+{
+    // Interrupts are still disabled, the handler that ends the wait runs on the scheduler's time
+    intercore_load_switch(NULL, NULL);
+    __WFI();
+    intercore_load_switch(scheduler_owner, scheduler_owner);
+}
+
+static void job_running(const SCHEDULER_JOB *job)
+{
+    if (job) {
+        intercore_load_switch(job, job->name);
+    } else {
+        intercore_load_switch(scheduler_owner, scheduler_owner);
+    }
+}
+
+static uint32_t load_clock(void)
+{
+    return mtk_os_hal_gpt_get_cur_count(gpt_clock);
+}
+
+static const SCHEDULER_PLATFORM scheduler_platform = {
+    .now_ms = clock_now_ms,
+    .arm_timer = wake_timer_arm,
+    .disable_interrupts = disable_interrupts,
+    .enable_interrupts = enable_interrupts,
+    .wait_for_interrupt = wait_for_interrupt,
+    .job_running = job_running,
+};
+
 _Noreturn void RTCoreMain(void)
 {
+    // Nothing has used the free TCM yet, paint it for the stack high-water mark
+    intercore_memory_paint(&end, __get_MSP() - STACK_PAINT_MARGIN - (uintptr_t)&end);
+
     /* Init Vector Table */
     NVIC_SetupVectorTable();
 
     srand((unsigned int)time(NULL)); // seed the random number generator for fake telemetry
 
     /* Init GPT */
-    gpt0_int.gpt_cb_hdl = task_scheduler;
+    gpt0_int.gpt_cb_hdl = wake_timer_isr;
     gpt0_int.gpt_cb_data = NULL;
     mtk_os_hal_gpt_init();
 
     /* configure GPT0 clock speed (as 1KHz) */
     /* and register GPT0 user interrupt callback handle and user data. */
-    mtk_os_hal_gpt_config(gpt_task_scheduler, false, &gpt0_int);
-
-    /* configure GPT0 timeout as 1ms and repeat mode. */
-    mtk_os_hal_gpt_reset_timer(gpt_task_scheduler, gpt_task_scheduler_timer_val, true);
+    /* It runs one-shot, armed by the scheduler for its next deadline. */
+    mtk_os_hal_gpt_config(gpt_wake_timer, false, &gpt0_int);
+
+    /* configure GPT2 clock speed (as 32KHz), free-running with no interrupt. */
+    mtk_os_hal_gpt_config(gpt_clock, true, NULL);
+    mtk_os_hal_gpt_start(gpt_clock);
+    intercore_load_init(load_clock, GPT_CLOCK_HZ);
+    intercore_load_switch(scheduler_owner, scheduler_owner);
+
+    // Before the mailbox interrupt handlers, they post scheduler events
+    scheduler_init(&scheduler_platform);
+    scheduler_add(&intercore_job);
+    scheduler_add(&sample_job);
+    scheduler_add(&batch_flush_job);
+    scheduler_add(&latency_job);
 
     initialise_intercore_comms();
     initialize_hardware();
 
-    /* start timer */
-    mtk_os_hal_gpt_start(gpt_task_scheduler);
+    // Sample straight away, and read anything the high-level app sent before we started
+    scheduler_every(&sample_job, SENSOR_PERIOD_MS);
+    scheduler_post(EVENT_SAMPLE | INTERCORE_EVENT_RECEIVED);
 
     for (;;) {
-        if (blockDeqSema > 0) {
-            process_inbound_message();
-        }
-
-        if (refresh_data_trigger) {
-            refresh_data_trigger = false;
-            refresh_data();
-        }
+        scheduler_run_once();
     }
 }
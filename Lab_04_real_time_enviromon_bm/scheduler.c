@@ -0,0 +1,118 @@
+#include "scheduler.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+static const SCHEDULER_PLATFORM *platform;
+static SCHEDULER_JOB *jobs;
+static _Atomic uint32_t pending_events;
+
+void scheduler_init(const SCHEDULER_PLATFORM *scheduler_platform)
+{
+    platform = scheduler_platform;
+    jobs = NULL;
+    atomic_store(&pending_events, 0);
+}
+
+void scheduler_add(SCHEDULER_JOB *job)
+{
+    SCHEDULER_JOB **last = &jobs;
+
+    while (*last != NULL) {
+        last = &(*last)->next;
+    }
+
+    job->next = NULL;
+    *last = job;
+}
+
+void scheduler_every(SCHEDULER_JOB *job, uint32_t period_ms)
+{
+    job->period_ms = period_ms;
+    job->due_ms = platform->now_ms() + period_ms;
+    job->armed = period_ms > 0;
+}
+
+void scheduler_at(SCHEDULER_JOB *job, uint32_t due_ms)
+{
+    job->period_ms = 0;
+    job->due_ms = due_ms;
+    job->armed = true;
+}
+
+void scheduler_cancel(SCHEDULER_JOB *job)
+{
+    job->period_ms = 0;
+    job->armed = false;
+}
+
+void scheduler_post(uint32_t events)
+{
+    atomic_fetch_or(&pending_events, events);
+}
+
+uint32_t scheduler_now(void)
+{
+    return platform->now_ms();
+}
+
+void scheduler_run_once(void)
+{
+    uint32_t events = atomic_exchange(&pending_events, 0);
+    uint32_t now = platform->now_ms();
+    uint32_t delay = SCHEDULER_FOREVER;
+
+    for (SCHEDULER_JOB *job = jobs; job != NULL; job = job->next) {
+        bool due = job->armed && (int32_t)(now - job->due_ms) >= 0;
+
+        if (due && job->period_ms > 0) {
+            // Step from the last deadline so a late run does not shift the ones after it, a job
+            // more than a period late skips the runs it missed
+            job->due_ms += job->period_ms;
+            if ((int32_t)(now - job->due_ms) >= 0) {
+                job->due_ms = now + job->period_ms;
+            }
+        } else if (due) {
+            job->armed = false;
+        }
+
+        if (due || (events & job->events) != 0) {
+            if (platform->job_running) {
+                platform->job_running(job);
+            }
+            job->run();
+            if (platform->job_running) {
+                platform->job_running(NULL);
+            }
+        }
+    }
+
+    // Jobs may have moved deadlines, including their own
+    now = platform->now_ms();
+
+    for (SCHEDULER_JOB *job = jobs; job != NULL; job = job->next) {
+        if (job->armed) {
+            int32_t remaining = (int32_t)(job->due_ms - now);
+            uint32_t job_delay = remaining > 0 ? (uint32_t)remaining : 0;
+
+            if (job_delay < delay) {
+                delay = job_delay;
+            }
+        }
+    }
+
+    if (delay == 0) {
+        return;
+    }
+
+    // An event posted after the check still ends the wait, wfi wakes for a pending interrupt with
+    // interrupts disabled and its handler runs once they are enabled again
+    platform->disable_interrupts();
+
+    if (atomic_load(&pending_events) == 0) {
+        platform->arm_timer(delay);
+        platform->wait_for_interrupt();
+    }
+
+    platform->enable_interrupts();
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Run-to-completion job scheduler for the bare-metal app.
+//
+// Jobs run one at a time from scheduler_run_once in the main loop, never from an interrupt handler.
+// A job runs when one of its events is posted, usually by an interrupt handler, or when its
+// deadline passes. With nothing ready the core sleeps in wfi, and the timer is programmed for the
+// next deadline only, so an idle core takes no timer interrupts between deadlines.
+//
+// Hardware access goes through SCHEDULER_PLATFORM, so the scheduler also runs on a host with a
+// simulated clock, see IntercoreSimulator/scheduler_sim.c.
+
+#define SCHEDULER_FOREVER UINT32_MAX
+
+typedef struct scheduler_job {
+    void (*run)(void);
+    const char *name;   // for CPU time accounting, may be NULL
+    uint32_t events;    // scheduler_post bits that run the job, 0 for none
+    uint32_t period_ms; // set by scheduler_every, 0 for a job that runs once per scheduler_at
+    uint32_t due_ms;
+    bool armed;         // due_ms is set
+    struct scheduler_job *next;
+} SCHEDULER_JOB;
+
+typedef struct {
+    uint32_t (*now_ms)(void);             // free-running millisecond clock, wraps
+    void (*arm_timer)(uint32_t delay_ms); // interrupt once delay_ms has passed, SCHEDULER_FOREVER stops it
+    void (*disable_interrupts)(void);
+    void (*enable_interrupts)(void);
+    void (*wait_for_interrupt)(void); // returns once an interrupt is pending, even with them disabled
+    void (*job_running)(const SCHEDULER_JOB *job); // optional, the job about to run, NULL once it returns
+} SCHEDULER_PLATFORM;
+
+void scheduler_init(const SCHEDULER_PLATFORM *platform);
+
+/// <summary>
+/// Add a job, in the order jobs that are ready at the same time run in.
+/// </summary>
+void scheduler_add(SCHEDULER_JOB *job);
+
+/// <summary>
+/// Run the job every period_ms, the first time one period from now.
+/// </summary>
+void scheduler_every(SCHEDULER_JOB *job, uint32_t period_ms);
+
+/// <summary>
+/// Run the job once at due_ms, on the scheduler_now clock. Replaces any deadline the job had.
+/// </summary>
+void scheduler_at(SCHEDULER_JOB *job, uint32_t due_ms);
+
+/// <summary>
+/// Stop running the job on a deadline, it still runs for its events.
+/// </summary>
+void scheduler_cancel(SCHEDULER_JOB *job);
+
+/// <summary>
+/// Run the jobs waiting for any of these events. Safe to call from interrupt handlers.
+/// </summary>
+void scheduler_post(uint32_t events);
+
+uint32_t scheduler_now(void);
+
+/// <summary>
+/// Run every job that is ready, then sleep until an event is posted or the next deadline.
+/// </summary>
+void scheduler_run_once(void);
@@ -0,0 +1,184 @@
+#include "i2c_queue.h"
+
+#include <string.h>
+
+static i2c_num queue_bus;
+static I2C_BATCH* queue_head = NULL;	// running
+static I2C_BATCH* queue_tail = NULL;
+
+static TX_SEMAPHORE run_done;
+static TX_MUTEX run_lock;
+static bool created = false;
+
+static void transfer_done(void* user_data, int result);
+
+/// <summary>
+/// Take the head batch off the queue and tell its owner. Interrupts are disabled.
+/// </summary>
+static void finish_head(int result)
+{
+	I2C_BATCH* batch = queue_head;
+
+	queue_head = batch->link;
+	if (queue_head == NULL)
+	{
+		queue_tail = NULL;
+	}
+
+	batch->result = result;
+	if (batch->done)
+	{
+		batch->done(batch);
+	}
+}
+
+/// <summary>
+/// Start the head batch's next transaction, failing batches until one starts. Interrupts are disabled.
+/// </summary>
+static void start_next(void)
+{
+	while (queue_head != NULL)
+	{
+		I2C_BATCH* batch = queue_head;
+		I2C_TRANSACTION* transaction = &batch->transactions[batch->next];
+		int ret;
+
+		if (transaction->write)
+		{
+			ret = mtk_os_hal_i2c_transfer_async(queue_bus, batch->address, transaction->staged, (u16)(1 + transaction->length), NULL, 0,
+				transfer_done, NULL);
+		}
+		else
+		{
+			ret = mtk_os_hal_i2c_transfer_async(queue_bus, batch->address, transaction->staged, 1, transaction->data, transaction->length,
+				transfer_done, NULL);
+		}
+
+		if (ret == 0)
+		{
+			return;
+		}
+		finish_head(ret);
+	}
+}
+
+/// <summary>
+/// I2C interrupt, the head batch's transaction has finished
+/// </summary>
+static void transfer_done(void* user_data, int result)
+{
+	I2C_BATCH* batch = queue_head;
+
+	if (batch == NULL)
+	{
+		return;
+	}
+
+	if (result != 0 || ++batch->next == batch->count)
+	{
+		finish_head(result);
+	}
+	start_next();
+}
+
+bool i2c_queue_init(i2c_num bus)
+{
+	queue_bus = bus;
+
+	// lp_imu_initialize runs again after a failed attempt
+	if (!created)
+	{
+		created = tx_semaphore_create(&run_done, "i2c queue", 0) == TX_SUCCESS &&
+			tx_mutex_create(&run_lock, "i2c queue", TX_INHERIT) == TX_SUCCESS;
+	}
+	return created;
+}
+
+int i2c_queue_submit(I2C_BATCH* batch)
+{
+	if (batch == NULL || batch->transactions == NULL || batch->count <= 0)
+	{
+		return -I2C_EINVAL;
+	}
+
+	for (int i = 0; i < batch->count; i++)
+	{
+		I2C_TRANSACTION* transaction = &batch->transactions[i];
+
+		if (transaction->data == NULL || transaction->length == 0)
+		{
+			return -I2C_EINVAL;
+		}
+		if (transaction->write)
+		{
+			if (transaction->length > I2C_QUEUE_WRITE_MAX)
+			{
+				return -I2C_EINVAL;
+			}
+			memcpy(&transaction->staged[1], transaction->data, transaction->length);
+		}
+	}
+
+	batch->result = I2C_QUEUE_PENDING;
+	batch->next = 0;
+	batch->link = NULL;
+
+	// A batch on the queue always has a transaction in flight, so an empty queue means an idle bus
+	UINT interrupts = tx_interrupt_control(TX_INT_DISABLE);
+	if (queue_tail != NULL)
+	{
+		queue_tail->link = batch;
+		queue_tail = batch;
+	}
+	else
+	{
+		queue_head = queue_tail = batch;
+		start_next();
+	}
+	tx_interrupt_control(interrupts);
+
+	return 0;
+}
+
+static void wake_runner(I2C_BATCH* batch)
+{
+	tx_semaphore_put(&run_done);
+}
+
+int i2c_queue_run(I2C_BATCH* batch)
+{
+	int ret;
+
+	tx_mutex_get(&run_lock, TX_WAIT_FOREVER);
+
+	batch->done = wake_runner;
+	ret = i2c_queue_submit(batch);
+
+	if (ret == 0 &&
+		tx_semaphore_get(&run_done, (I2C_QUEUE_TIMEOUT_MS * TX_TIMER_TICKS_PER_SECOND + 999) / 1000) != TX_SUCCESS)
+	{
+		// The bus is stuck, reset it and fail everything queued, this batch last
+		UINT interrupts = tx_interrupt_control(TX_INT_DISABLE);
+		if (batch->result == I2C_QUEUE_PENDING)
+		{
+			mtk_os_hal_i2c_transfer_abort(queue_bus);
+			while (queue_head != NULL)
+			{
+				finish_head(-I2C_ETIMEDOUT);
+			}
+		}
+		tx_interrupt_control(interrupts);
+
+		// Either way wake_runner has run by now
+		tx_semaphore_get(&run_done, TX_NO_WAIT);
+	}
+
+	if (ret == 0)
+	{
+		ret = batch->result;
+	}
+
+	tx_mutex_put(&run_lock);
+
+	return ret;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "tx_api.h"
+#include "os_hal_i2c.h"
+
+// Queue of I2C register transactions, run one after another from the I2C interrupt.
+//
+// A batch is a list of register reads and writes to one device that run back to back. Submitting
+// one returns straight away, the next transaction starts from the interrupt that ends the last, and
+// the batch's done callback runs in interrupt context once all have finished or one has failed.
+// i2c_queue_run submits a batch and sleeps the calling thread until then. The blocking HAL calls
+// spin on the millisecond tick for the whole transfer instead, in a bare-metal build of the HAL.
+//
+// Reads land straight in the caller's buffer. Above the 8 byte I2C FIFO they need the app built
+// with OSAI_ENABLE_DMA, and the buffer and batch in SYSRAM, the only memory the DMA reaches.
+// Writes are copied in behind the register address when the batch is submitted.
+
+// The FIFO holds the register address and this much data
+#define I2C_QUEUE_WRITE_MAX 7
+
+// Batch result until it is done
+#define I2C_QUEUE_PENDING 1
+
+// Time i2c_queue_run waits before it resets the bus and fails everything queued
+#define I2C_QUEUE_TIMEOUT_MS 100
+
+typedef struct
+{
+	uint8_t* data;	  // read into, or written from
+	uint16_t length;
+	bool write;
+	uint8_t staged[1 + I2C_QUEUE_WRITE_MAX];	// the register, then for a write its data
+} I2C_TRANSACTION;
+
+typedef struct i2c_batch
+{
+	uint8_t address;	// 7-bit device address
+	I2C_TRANSACTION* transactions;
+	int count;
+	void (*done)(struct i2c_batch* batch);	  // interrupt context, may be NULL
+	void* context;
+	volatile int result;	// I2C_QUEUE_PENDING, then 0 or the first error
+	int next;				// transaction running
+	struct i2c_batch* link;
+} I2C_BATCH;
+
+static inline I2C_TRANSACTION i2c_queue_read(uint8_t reg, uint8_t* data, uint16_t length)
+{
+	I2C_TRANSACTION transaction = { .data = data, .length = length, .write = false, .staged = { reg } };
+	return transaction;
+}
+
+static inline I2C_TRANSACTION i2c_queue_write(uint8_t reg, uint8_t* data, uint16_t length)
+{
+	I2C_TRANSACTION transaction = { .data = data, .length = length, .write = true, .staged = { reg } };
+	return transaction;
+}
+
+/// <summary>
+/// Run batches on this bus, call once mtk_os_hal_i2c_ctrl_init has set it up.
+/// </summary>
+bool i2c_queue_init(i2c_num bus);
+
+/// <summary>
+/// Queue the batch behind any others and return. Safe to call from a done callback.
+/// </summary>
+/// <returns>0, or negative if the batch is malformed and was not queued</returns>
+int i2c_queue_submit(I2C_BATCH* batch);
+
+/// <summary>
+/// Run the batch and sleep until it is done, replacing its done callback. Threads take turns.
+/// </summary>
+/// <returns>0, or the first error</returns>
+int i2c_queue_run(I2C_BATCH* batch);
@@ -1,4 +1,6 @@
 #include "imu_temp_pressure.h"
+#include "i2c_queue.h"
+#include "reg_shadow.h"
 
 /*
  ******************************************************************************
@@ -64,10 +66,6 @@ Acknowledgment: Built from ST Micro samples
 // 1 tick = 10ms. It is configurable.
 #define MS_TO_TICK(ms)  ((ms) * (TX_TIMER_TICKS_PER_SECOND) / 1000)
 
-#define I2C_MAX_LEN 64
-static uint8_t i2c_tx_buf[I2C_MAX_LEN];
-static uint8_t i2c_rx_buf[I2C_MAX_LEN];
-
 static uint8_t i2cHandle = OS_HAL_I2C_ISU2;
 
 typedef union
@@ -106,9 +104,21 @@ static uint8_t whoamI, rst;
 // static int i2cHandle = -1;
 static stmdev_ctx_t dev_ctx;
 static stmdev_ctx_t pressure_ctx;
+static stmdev_shadow_t dev_shadow;
+static stmdev_shadow_t pressure_shadow;
 static bool lps22hhDetected;
+static bool lps22hhStreaming;	// the sensor hub reads the LPS22HH by itself, see start_lps22hh_stream
 static bool initialized = false;
 
+// LPS22HH registers the sensor hub copies each cycle, STATUS through TEMP_OUT_H
+#define LPS22HH_BLOCK_SIZE 6
+
+typedef struct
+{
+	uint32_t pressureRaw;	// 0 until the LPS22HH has finished its first conversion
+	int16_t temperatureRaw;
+} LPS22HH_READING;
+
 /* Extern variables ----------------------------------------------------------*/
 
 /* Private functions ---------------------------------------------------------*/
@@ -122,7 +132,7 @@ static bool initialized = false;
 static int32_t platform_write(void* handle, uint8_t reg, uint8_t* bufp, uint16_t len);
 static int32_t platform_read(void* handle, uint8_t reg, uint8_t* bufp, uint16_t len);
 static void platform_delay(uint32_t ms);
-static void platform_init(void);
+static bool platform_init(void);
 static int32_t lsm6dso_read_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, uint16_t len);
 static int32_t lsm6dso_write_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, uint16_t len);
 
@@ -139,21 +149,13 @@ static int32_t lsm6dso_write_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, u
  */
 static int32_t platform_write(void* handle, uint8_t reg, uint8_t* bufp, uint16_t len)
 {
-	if (bufp == NULL)
-		return -1;
+	I2C_TRANSACTION transaction = i2c_queue_write(reg, bufp, len);
+	I2C_BATCH batch = { .address = LSM6DSO_ADDRESS, .transactions = &transaction, .count = 1 };
 
-	if (len > (I2C_MAX_LEN))
+	if (bufp == NULL)
 		return -1;
 
-	i2c_tx_buf[0] = reg;
-
-	if (bufp && len) {
-		memcpy(&i2c_tx_buf[1], bufp, len);
-	}
-
-	mtk_os_hal_i2c_write(*(int*)handle, LSM6DSO_ADDRESS, i2c_tx_buf, len + 1);
-
-	return 0;
+	return i2c_queue_run(&batch);
 }
 
 
@@ -169,18 +171,14 @@ static int32_t platform_write(void* handle, uint8_t reg, uint8_t* bufp, uint16_t
  */
 static int32_t platform_read(void* handle, uint8_t reg, uint8_t* bufp, uint16_t len)
 {
-	if (bufp == NULL)
-		return -1;
+	I2C_TRANSACTION transaction = i2c_queue_read(reg, bufp, len);
+	I2C_BATCH batch = { .address = LSM6DSO_ADDRESS, .transactions = &transaction, .count = 1 };
 
-	if (len > (I2C_MAX_LEN))
+	if (bufp == NULL)
 		return -1;
 
-	mtk_os_hal_i2c_write_read(*(int*)handle, LSM6DSO_ADDRESS,
-		&reg, i2c_rx_buf, 1, len);
-
-	memcpy(bufp, i2c_rx_buf, len);
-
-	return 0;
+	// Straight into bufp, the calling thread sleeps until the I2C interrupt finishes the read
+	return i2c_queue_run(&batch);
 }
 
 
@@ -199,21 +197,14 @@ static void platform_delay(uint32_t ms)
 /*
  * @brief  platform specific initialization (platform dependent)
  */
-static void platform_init(void)
+static bool platform_init(void)
 {
-	// IMPLEMENT
-		/* Allocate I2C buffer */
-	//i2c_tx_buf = pvPortMalloc(I2C_MAX_LEN);
-	//i2c_rx_buf = pvPortMalloc(I2C_MAX_LEN);
-	// if (i2c_tx_buf == NULL || i2c_rx_buf == NULL) {
-	// 	printf("Failed to allocate I2C buffer!\n");
-	// 	return -1;
-	// }
-
 	/* MT3620 I2C Init */
 
 	mtk_os_hal_i2c_ctrl_init(i2cHandle);
 	mtk_os_hal_i2c_speed_init(i2cHandle, i2c_speed);
+
+	return i2c_queue_init(i2cHandle);
 }
 
 
@@ -326,17 +317,61 @@ AngularRateDegreesPerSecond lp_get_angular_rate(void)
 }
 
 
+/// <summary>
+///     The LPS22HH block the sensor hub copied on its last cycle, in one burst from the SENSOR_HUB
+///     registers. The bank is switched with plain writes, FUNC_CFG_ACCESS holds nothing else.
+/// </summary>
+static bool read_lps22hh_stream(LPS22HH_READING* reading)
+{
+	lsm6dso_func_cfg_access_t hub = { .reg_access = LSM6DSO_SENSOR_HUB_BANK };
+	lsm6dso_func_cfg_access_t user = { .reg_access = LSM6DSO_USER_BANK };
+	uint8_t block[LPS22HH_BLOCK_SIZE];
+
+	// Bank switch, read and switch back as one batch, so the bus goes straight from one to the next
+	I2C_TRANSACTION transactions[] = {
+		i2c_queue_write(LSM6DSO_FUNC_CFG_ACCESS, (uint8_t*)&hub, 1),
+		i2c_queue_read(LSM6DSO_SENSOR_HUB_1, block, sizeof(block)),
+		i2c_queue_write(LSM6DSO_FUNC_CFG_ACCESS, (uint8_t*)&user, 1)
+	};
+	I2C_BATCH batch = { .address = LSM6DSO_ADDRESS, .transactions = transactions, .count = 3 };
+
+	if (i2c_queue_run(&batch) != 0)
+	{
+		// The batch stops at the first failure, put the user bank back regardless. Past the
+		// shadow, which never saw the batch and still has the user bank selected.
+		platform_write(&i2cHandle, LSM6DSO_FUNC_CFG_ACCESS, (uint8_t*)&user, 1);
+		return false;
+	}
+
+	// block[0] is STATUS, its data available flags mostly read clear since the hub reads faster
+	// than the LPS22HH converts. Block data update keeps each value whole, so the latest value is
+	// always good once there has been one.
+	reading->pressureRaw = ((uint32_t)block[3] << 24) | ((uint32_t)block[2] << 16) | ((uint32_t)block[1] << 8);
+	reading->temperatureRaw = (int16_t)(block[4] | (block[5] << 8));
+	return reading->pressureRaw != 0;
+}
+
 float lp_get_temperature_lps22h(void)	// get_temperature() from lsm6dso is faster
 {
 	lps22hh_reg_t lps22hhReg;
 	int16_t i16bit;
 	static float lps22hhTemperature_degC = NAN;
+	LPS22HH_READING reading;
 
 	if (!initialized)
 	{
 		return NAN;
 	}
 
+	if (lps22hhStreaming)
+	{
+		if (read_lps22hh_stream(&reading))
+		{
+			lps22hhTemperature_degC = lps22hh_from_lsb_to_celsius(reading.temperatureRaw);
+		}
+		return lps22hhTemperature_degC;
+	}
+
 	if (lps22hhDetected)
 	{
 		i16bit = 0;
@@ -385,12 +420,22 @@ float lp_get_pressure(void)
 	lps22hh_reg_t lps22hhReg;
 	uint32_t ui32bit;
 	static float pressure_hPa = NAN;
+	LPS22HH_READING reading;
 
 	if (!initialized)
 	{
 		return NAN;
 	}
 
+	if (lps22hhStreaming)
+	{
+		if (read_lps22hh_stream(&reading))
+		{
+			pressure_hPa = lps22hh_from_lsb_to_hpa(reading.pressureRaw);
+		}
+		return pressure_hPa;
+	}
+
 	if (lps22hhDetected)
 	{
 		ui32bit = 0;
@@ -523,6 +568,36 @@ static void detect_lps22hh(void)
 }
 
 
+/// <summary>
+///     Have the sensor hub read the LPS22HH status, pressure and temperature registers by itself,
+///     triggered by the accelerometer and limited to about the LPS22HH's 10 Hz output rate. Each
+///     reading is then a burst from the SENSOR_HUB registers instead of a pass-through read per
+///     register. The pass-through functions reprogram slave 0, only configuration before this
+///     may use them.
+/// </summary>
+static void start_lps22hh_stream(void)
+{
+	lsm6dso_sh_cfg_read_t sh_cfg_read = {
+		.slv_add = (LPS22HH_I2C_ADD_L & 0xFEU) >> 1,	// 7bit I2C address
+		.slv_subadd = LPS22HH_STATUS,
+		.slv_len = LPS22HH_BLOCK_SIZE
+	};
+
+	// The accelerometer drives the hub, it is stopped while the hub is reconfigured
+	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_OFF);
+
+	if (lsm6dso_sh_slv0_cfg_read(&dev_ctx, &sh_cfg_read) == 0 &&
+		lsm6dso_sh_slave_connected_set(&dev_ctx, LSM6DSO_SLV_0) == 0 &&
+		lsm6dso_sh_data_rate_set(&dev_ctx, LSM6DSO_SH_ODR_13Hz) == 0 &&
+		lsm6dso_sh_master_set(&dev_ctx, PROPERTY_ENABLE) == 0)
+	{
+		lps22hhStreaming = true;
+	}
+
+	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_104Hz);
+}
+
+
 bool lp_imu_initialize(void)
 {
 	if (initialized) { return true; }
@@ -537,8 +612,18 @@ bool lp_imu_initialize(void)
 	pressure_ctx.write_reg = lsm6dso_write_lps22hh_cx;
 	pressure_ctx.handle = &i2cHandle;
 
+	// Shadow the configuration registers, so setters mostly skip their reads. The sensor hub
+	// writes the LPS22HH a register at a time.
+	stmdev_shadow_init(&dev_shadow, &lsm6dso_shadow_map, I2C_QUEUE_WRITE_MAX);
+	dev_ctx.shadow = &dev_shadow;
+	stmdev_shadow_init(&pressure_shadow, &lps22hh_shadow_map, 1);
+	pressure_ctx.shadow = &pressure_shadow;
+
 	/* Init test platform */
-	platform_init();
+	if (!platform_init())
+	{
+		return false;
+	}
 
 	/* Wait sensor boot time */
 	platform_delay(20);
@@ -559,6 +644,9 @@ bool lp_imu_initialize(void)
 		lsm6dso_reset_get(&dev_ctx, &rst);
 	} while (rst);
 
+	/* Hold the configuration writes, then send neighbouring registers in one burst */
+	stmdev_shadow_defer(&dev_ctx);
+
 	/* Disable I3C interface */
 	lsm6dso_i3c_disable_set(&dev_ctx, LSM6DSO_I3C_DISABLE);
 
@@ -579,10 +667,17 @@ bool lp_imu_initialize(void)
 	lsm6dso_xl_hp_path_on_out_set(&dev_ctx, LSM6DSO_LP_ODR_DIV_100);
 	lsm6dso_xl_filter_lp2_set(&dev_ctx, PROPERTY_ENABLE);
 
+	stmdev_shadow_flush(&dev_ctx);
+
 	//lp_calibrate_angular_rate();
 
 	detect_lps22hh();
 
+	if (lps22hhDetected)
+	{
+		start_lps22hh_stream();
+	}
+
 	initialized = true;
 
 	return true;
@@ -18,6 +18,7 @@
  */
 
 #include "lps22hh_reg.h"
+#include "reg_shadow.h"
 
 /**
   * @defgroup  LPS22HH
@@ -50,6 +51,9 @@ int32_t lps22hh_read_reg(stmdev_ctx_t* ctx, uint8_t reg, uint8_t* data,
                          uint16_t len)
 {
   int32_t ret;
+  if (ctx->shadow != NULL) {
+    return stmdev_shadow_read(ctx, reg, data, len);
+  }
   ret = ctx->read_reg(ctx->handle, reg, data, len);
   return ret;
 }
@@ -68,10 +72,34 @@ int32_t lps22hh_write_reg(stmdev_ctx_t* ctx, uint8_t reg, uint8_t* data,
                            uint16_t len)
 {
   int32_t ret;
+  if (ctx->shadow != NULL) {
+    return stmdev_shadow_write(ctx, reg, data, len);
+  }
   ret = ctx->write_reg(ctx->handle, reg, data, len);
   return ret;
 }
 
+/**
+  * @brief  Registers only the host changes, for the register shadow.
+  *         INTERRUPT_CFG has bits that clear themselves, CTRL_REG2 as well
+  *         as its one-shot trigger, so they are left out.
+  *
+  */
+static const stmdev_shadow_range_t lps22hh_shadow_ranges[] = {
+  { 0, LPS22HH_THS_P_L, LPS22HH_IF_CTRL },
+  { 0, LPS22HH_CTRL_REG1, LPS22HH_CTRL_REG1 },
+  { 0, LPS22HH_CTRL_REG3, LPS22HH_FIFO_WTM },
+  { 0, LPS22HH_RPDS_L, LPS22HH_RPDS_H },
+};
+
+/* No banks, CTRL_REG2 BOOT and SWRESET reload the registers */
+const stmdev_shadow_map_t lps22hh_shadow_map = {
+  .ranges = lps22hh_shadow_ranges,
+  .range_count = sizeof(lps22hh_shadow_ranges) / sizeof(lps22hh_shadow_ranges[0]),
+  .reset_reg = LPS22HH_CTRL_REG2,
+  .reset_mask = 0x84U,
+};
+
 /**
   * @}
   *
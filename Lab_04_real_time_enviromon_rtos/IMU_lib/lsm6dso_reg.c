@@ -18,6 +18,7 @@
  */
 
 #include "lsm6dso_reg.h"
+#include "reg_shadow.h"
 #include <unistd.h>
 
 /**
@@ -51,6 +52,9 @@ int32_t lsm6dso_read_reg(stmdev_ctx_t* ctx, uint8_t reg, uint8_t* data,
                          uint16_t len)
 {
   int32_t ret;
+  if (ctx->shadow != NULL) {
+    return stmdev_shadow_read(ctx, reg, data, len);
+  }
   ret = ctx->read_reg(ctx->handle, reg, data, len);
   return ret;
 }
@@ -69,10 +73,49 @@ int32_t lsm6dso_write_reg(stmdev_ctx_t* ctx, uint8_t reg, uint8_t* data,
                           uint16_t len)
 {
   int32_t ret;
+  if (ctx->shadow != NULL) {
+    return stmdev_shadow_write(ctx, reg, data, len);
+  }
   ret = ctx->write_reg(ctx->handle, reg, data, len);
   return ret;
 }
 
+/**
+  * @brief  Registers only the host changes, for the register shadow.
+  *         COUNTER_BDR_REG1 and the embedded functions' page and counter
+  *         registers have bits that clear themselves, the OIS registers
+  *         can be written over the auxiliary SPI, so they are left out.
+  *
+  */
+static const stmdev_shadow_range_t lsm6dso_shadow_ranges[] = {
+  { LSM6DSO_USER_BANK, LSM6DSO_PIN_CTRL, LSM6DSO_PIN_CTRL },
+  { LSM6DSO_USER_BANK, LSM6DSO_FIFO_CTRL1, LSM6DSO_FIFO_CTRL4 },
+  { LSM6DSO_USER_BANK, LSM6DSO_COUNTER_BDR_REG2, LSM6DSO_INT2_CTRL },
+  { LSM6DSO_USER_BANK, LSM6DSO_CTRL1_XL, LSM6DSO_CTRL10_C },
+  { LSM6DSO_USER_BANK, LSM6DSO_TAP_CFG0, LSM6DSO_MD2_CFG },
+  { LSM6DSO_USER_BANK, LSM6DSO_I3C_BUS_AVB, LSM6DSO_I3C_BUS_AVB },
+  { LSM6DSO_USER_BANK, LSM6DSO_X_OFS_USR, LSM6DSO_Z_OFS_USR },
+  { LSM6DSO_EMBEDDED_FUNC_BANK, LSM6DSO_EMB_FUNC_EN_A, LSM6DSO_EMB_FUNC_EN_B },
+  { LSM6DSO_EMBEDDED_FUNC_BANK, LSM6DSO_EMB_FUNC_INT1, LSM6DSO_FSM_INT1_B },
+  { LSM6DSO_EMBEDDED_FUNC_BANK, LSM6DSO_EMB_FUNC_INT2, LSM6DSO_FSM_INT2_B },
+  { LSM6DSO_EMBEDDED_FUNC_BANK, LSM6DSO_EMB_FUNC_FIFO_CFG, LSM6DSO_EMB_FUNC_FIFO_CFG },
+  { LSM6DSO_EMBEDDED_FUNC_BANK, LSM6DSO_FSM_ENABLE_A, LSM6DSO_FSM_ENABLE_B },
+  { LSM6DSO_EMBEDDED_FUNC_BANK, LSM6DSO_EMB_FUNC_ODR_CFG_B, LSM6DSO_EMB_FUNC_ODR_CFG_B },
+};
+
+/* FUNC_CFG_ACCESS reg_access selects the bank, CTRL3_C BOOT and SW_RESET
+ * reload the registers
+ */
+const stmdev_shadow_map_t lsm6dso_shadow_map = {
+  .ranges = lsm6dso_shadow_ranges,
+  .range_count = sizeof(lsm6dso_shadow_ranges) / sizeof(lsm6dso_shadow_ranges[0]),
+  .bank_reg = LSM6DSO_FUNC_CFG_ACCESS,
+  .bank_mask = 0xC0U,
+  .bank_shift = 6U,
+  .reset_reg = LSM6DSO_CTRL3_C,
+  .reset_mask = 0x81U,
+};
+
 /**
   * @}
   *
@@ -0,0 +1,328 @@
+#include "lsm6dso_reg.h"
+#include "reg_shadow.h"
+
+#include <string.h>
+
+#define BANK_UNKNOWN 0xFF
+
+static bool test_bit(const uint8_t* bits, uint16_t reg)
+{
+	return (bits[reg / 8] & (1U << (reg % 8))) != 0;
+}
+
+static void set_bit(uint8_t* bits, uint16_t reg)
+{
+	bits[reg / 8] |= (uint8_t)(1U << (reg % 8));
+}
+
+static void clear_bit(uint8_t* bits, uint16_t reg)
+{
+	bits[reg / 8] &= (uint8_t)~(1U << (reg % 8));
+}
+
+/// <summary>
+/// Bank the sensor has selected, BANK_UNKNOWN until the bank register has been read or written
+/// </summary>
+static uint8_t selected_bank(const stmdev_shadow_t* shadow)
+{
+	const stmdev_shadow_map_t* map = shadow->map;
+
+	if (map->bank_mask == 0)
+	{
+		return 0;
+	}
+	if (!shadow->bank_valid)
+	{
+		return BANK_UNKNOWN;
+	}
+	return (uint8_t)((shadow->bank_value & map->bank_mask) >> map->bank_shift);
+}
+
+static bool is_bank_reg(const stmdev_shadow_t* shadow, uint16_t reg)
+{
+	return shadow->map->bank_mask != 0 && reg == shadow->map->bank_reg;
+}
+
+/// <summary>
+/// In the map for the selected bank
+/// </summary>
+static bool shadowed(const stmdev_shadow_t* shadow, uint16_t reg)
+{
+	const stmdev_shadow_map_t* map = shadow->map;
+	uint8_t bank = selected_bank(shadow);
+
+	if (bank >= STMDEV_SHADOW_BANKS)
+	{
+		return false;
+	}
+
+	for (uint8_t i = 0; i < map->range_count; i++)
+	{
+		const stmdev_shadow_range_t* range = &map->ranges[i];
+
+		if (range->bank == bank && reg >= range->first && reg <= range->last)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/// <summary>
+/// The value the sensor holds, the bank register is kept apart as it is in every bank
+/// </summary>
+static bool cached(const stmdev_shadow_t* shadow, uint16_t reg, uint8_t* value)
+{
+	if (is_bank_reg(shadow, reg))
+	{
+		*value = shadow->bank_value;
+		return shadow->bank_valid;
+	}
+
+	if (!shadowed(shadow, reg) || !test_bit(shadow->valid[selected_bank(shadow)], reg))
+	{
+		return false;
+	}
+	*value = shadow->value[selected_bank(shadow)][reg];
+	return true;
+}
+
+/// <summary>
+/// The reset bits, which are another register outside the first bank
+/// </summary>
+static bool resets(const stmdev_shadow_t* shadow, uint16_t reg, uint8_t value)
+{
+	const stmdev_shadow_map_t* map = shadow->map;
+	uint8_t bank = selected_bank(shadow);
+
+	return reg == map->reset_reg && (value & map->reset_mask) != 0 && (bank == 0 || bank == BANK_UNKNOWN);
+}
+
+/// <summary>
+/// Note a value read from the sensor or written to it
+/// </summary>
+static void store(stmdev_shadow_t* shadow, uint16_t reg, uint8_t value)
+{
+	if (is_bank_reg(shadow, reg))
+	{
+		shadow->bank_value = value;
+		shadow->bank_valid = true;
+	}
+	else if (shadowed(shadow, reg))
+	{
+		uint8_t bank = selected_bank(shadow);
+
+		shadow->value[bank][reg] = value;
+		set_bit(shadow->valid[bank], reg);
+	}
+}
+
+/// <summary>
+/// After a failed write the sensor may hold the new values, the old ones, or part of each
+/// </summary>
+static void forget(stmdev_shadow_t* shadow, uint16_t reg, uint16_t len)
+{
+	uint8_t bank = selected_bank(shadow);
+
+	for (uint16_t r = reg; r < reg + len; r++)
+	{
+		if (is_bank_reg(shadow, r))
+		{
+			shadow->bank_valid = false;
+		}
+		else if (bank < STMDEV_SHADOW_BANKS && r < STMDEV_SHADOW_REGS)
+		{
+			clear_bit(shadow->valid[bank], r);
+			clear_bit(shadow->dirty, r);
+		}
+	}
+}
+
+/// <summary>
+/// After writing the reset bits the sensor reloads every register
+/// </summary>
+static void reset(stmdev_shadow_t* shadow)
+{
+	uint8_t bank = selected_bank(shadow);
+
+	memset(shadow->valid, 0, sizeof(shadow->valid));
+	memset(shadow->dirty, 0, sizeof(shadow->dirty));
+
+	// It comes back up in the first bank. In an unknown bank it may not have reset at all.
+	shadow->bank_value = 0;
+	shadow->bank_valid = bank == 0;
+}
+
+/// <summary>
+/// Write the held registers, a burst per run of neighbours
+/// </summary>
+static int32_t send_held(stmdev_ctx_t* ctx)
+{
+	stmdev_shadow_t* shadow = ctx->shadow;
+	uint8_t bank = selected_bank(shadow);
+	uint16_t reg = 0;
+
+	while (reg < STMDEV_SHADOW_REGS)
+	{
+		uint16_t first = reg;
+		int32_t ret;
+
+		if (!test_bit(shadow->dirty, reg))
+		{
+			reg++;
+			continue;
+		}
+
+		while (reg < STMDEV_SHADOW_REGS && test_bit(shadow->dirty, reg) && (shadow->burst_max == 0 || reg - first < shadow->burst_max))
+		{
+			clear_bit(shadow->dirty, reg);
+			reg++;
+		}
+
+		ret = ctx->write_reg(ctx->handle, (uint8_t)first, &shadow->value[bank][first], reg - first);
+		if (ret != 0)
+		{
+			// Neither this burst nor the ones after it are what the sensor holds
+			for (uint16_t r = first; r < STMDEV_SHADOW_REGS; r++)
+			{
+				if (r < reg || test_bit(shadow->dirty, r))
+				{
+					clear_bit(shadow->valid[bank], r);
+					clear_bit(shadow->dirty, r);
+				}
+			}
+			return ret;
+		}
+	}
+	return 0;
+}
+
+void stmdev_shadow_init(stmdev_shadow_t* shadow, const stmdev_shadow_map_t* map, uint16_t burst_max)
+{
+	memset(shadow, 0, sizeof(*shadow));
+	shadow->map = map;
+	shadow->burst_max = burst_max;
+}
+
+int32_t stmdev_shadow_read(stmdev_ctx_t* ctx, uint8_t reg, uint8_t* data, uint16_t len)
+{
+	stmdev_shadow_t* shadow = ctx->shadow;
+	uint16_t i;
+	int32_t ret;
+
+	for (i = 0; i < len && cached(shadow, reg + i, &data[i]); i++)
+	{
+	}
+	if (i == len)
+	{
+		return 0;
+	}
+
+	ret = send_held(ctx);
+	if (ret == 0)
+	{
+		ret = ctx->read_reg(ctx->handle, reg, data, len);
+	}
+	if (ret != 0)
+	{
+		return ret;
+	}
+
+	for (i = 0; i < len; i++)
+	{
+		// Still resetting, the flags will clear themselves
+		if (resets(shadow, reg + i, data[i]))
+		{
+			continue;
+		}
+		store(shadow, reg + i, data[i]);
+	}
+	return 0;
+}
+
+int32_t stmdev_shadow_write(stmdev_ctx_t* ctx, uint8_t reg, uint8_t* data, uint16_t len)
+{
+	stmdev_shadow_t* shadow = ctx->shadow;
+	bool changed = false;
+	bool hold = shadow->deferred;
+	uint8_t value;
+	uint16_t i;
+	int32_t ret;
+
+	for (i = 0; i < len; i++)
+	{
+		uint16_t r = reg + i;
+		bool reset_bits = resets(shadow, r, data[i]);
+
+		// Bank switches and resets go straight out, so later accesses land where they should
+		if (reset_bits || is_bank_reg(shadow, r) || !shadowed(shadow, r))
+		{
+			hold = false;
+		}
+		if (reset_bits || !cached(shadow, r, &value) || value != data[i])
+		{
+			changed = true;
+		}
+	}
+
+	if (!changed)
+	{
+		return 0;
+	}
+
+	if (hold)
+	{
+		uint8_t bank = selected_bank(shadow);
+
+		for (i = 0; i < len; i++)
+		{
+			shadow->value[bank][reg + i] = data[i];
+			set_bit(shadow->valid[bank], reg + i);
+			set_bit(shadow->dirty, reg + i);
+		}
+		return 0;
+	}
+
+	ret = send_held(ctx);
+	if (ret == 0)
+	{
+		ret = ctx->write_reg(ctx->handle, reg, data, len);
+	}
+	if (ret != 0)
+	{
+		forget(shadow, reg, len);
+		return ret;
+	}
+
+	for (i = 0; i < len; i++)
+	{
+		if (resets(shadow, reg + i, data[i]))
+		{
+			reset(shadow);
+		}
+		else
+		{
+			store(shadow, reg + i, data[i]);
+		}
+	}
+	return 0;
+}
+
+void stmdev_shadow_defer(stmdev_ctx_t* ctx)
+{
+	if (ctx->shadow != NULL)
+	{
+		ctx->shadow->deferred = true;
+	}
+}
+
+int32_t stmdev_shadow_flush(stmdev_ctx_t* ctx)
+{
+	if (ctx->shadow == NULL)
+	{
+		return 0;
+	}
+
+	ctx->shadow->deferred = false;
+	return send_held(ctx);
+}
@@ -93,6 +93,12 @@
 			    u8 device_addr, u8 *wr_buf, u8 *rd_buf,
 			    u16 wr_len, u16 rd_len)
  *
+ *	-Start a master transfer without waiting for it
+ *	 -Call mtk_os_hal_i2c_transfer_async(i2c_num bus_num,
+			    u8 device_addr, u8 *wr_buf, u16 wr_len,
+			    u8 *rd_buf, u16 rd_len,
+			    i2c_async_callback callback, void *user_data)
+ *
  *	-Set I2C controler slave address
  *	 -Call mtk_os_hal_i2c_set_slave_addr(i2c_num bus_num,
 			    u8 slv_addr)
@@ -143,6 +149,11 @@ typedef enum {
 	OS_HAL_I2C_ISU_MAX
 } i2c_num;
 
+/** @brief Completion of an asynchronous master transfer, called in
+ *  interrupt context with 0 or the negative error of the transfer.
+ */
+typedef void (*i2c_async_callback)(void *user_data, int result);
+
 /**
   * @}
   */
@@ -253,6 +264,50 @@ int mtk_os_hal_i2c_write(i2c_num bus_num, u8 device_addr, u8 *buffer, u16 len);
 int mtk_os_hal_i2c_write_read(i2c_num bus_num, u8 device_addr,
 			      u8 *wr_buf, u8 *rd_buf, u16 wr_len, u16 rd_len);
 
+/**
+ *  @brief Start an I2C master write, or write then read, and return
+ *  without waiting for it. The callback runs from the I2C or DMA
+ *  interrupt once the transfer has finished, and may start the next one.
+ *  The buffers must stay valid until then. Above the FIFO size the data
+ *  moves by DMA straight to or from them, which needs SYSRAM.
+ *
+ *  @param [in] bus_num : I2C ISU Port number,
+ *  it can be OS_HAL_I2C_ISU0~OS_HAL_I2C_ISU4.
+ *
+ *  @param [in] device_addr : slave device address.
+ *
+ *  @param [in] wr_buf : write data buffer.
+ *
+ *  @param [in] wr_len : write data length.
+ *
+ *  @param [in] rd_buf : read data buffer, NULL for a write only.
+ *
+ *  @param [in] rd_len : read data length, 0 for a write only.
+ *
+ *  @param [in] callback : called with the result of the transfer.
+ *
+ *  @param [in] user_data : passed to the callback.
+ *
+ *  @return negative value means the transfer did not start, and the
+ *  callback will not be called.
+ *
+ *  @return "0" if the transfer started.
+ */
+int mtk_os_hal_i2c_transfer_async(i2c_num bus_num, u8 device_addr,
+				  u8 *wr_buf, u16 wr_len, u8 *rd_buf, u16 rd_len,
+				  i2c_async_callback callback, void *user_data);
+
+/**
+ *  @brief Give up on an asynchronous transfer that has not completed,
+ *  reset the controller and drop its callback.
+ *
+ *  @param [in] bus_num : I2C ISU Port number,
+ *  it can be OS_HAL_I2C_ISU0~OS_HAL_I2C_ISU4.
+ *
+ *  @return "0" if the controller was reset.
+ */
+int mtk_os_hal_i2c_transfer_abort(i2c_num bus_num);
+
 /**
  *  @brief Set I2C slave address before transfer when I2C hardware
  *  controller is set as a slave role, it which means does not call
@@ -95,12 +95,34 @@ struct mtk_i2c_ctrl_rtos {
 #else
 	volatile u8 xfer_completion;
 #endif
+
+	/* transfer started by mtk_os_hal_i2c_transfer_async, callback is
+	 * NULL while none is in flight
+	 */
+	struct i2c_msg async_msgs[2];
+	i2c_async_callback async_callback;
+	void *async_user_data;
 };
 
 static struct mtk_i2c_ctrl_rtos g_i2c_ctrl_rtos[OS_HAL_I2C_ISU_MAX];
 struct mtk_i2c_controller g_i2c_ctrl[OS_HAL_I2C_ISU_MAX];
 struct mtk_i2c_private g_i2c_mdata[OS_HAL_I2C_ISU_MAX];
 
+static void _mtk_os_hal_i2c_async_done(struct mtk_i2c_ctrl_rtos *ctrl_rtos)
+{
+	i2c_async_callback callback = ctrl_rtos->async_callback;
+	struct mtk_i2c_controller *i2c = ctrl_rtos->i2c;
+	int ret;
+
+	ret = mtk_mhal_i2c_result_handle(i2c);
+	if (ret)
+		mtk_mhal_i2c_init_hw(i2c);
+
+	/* cleared first, the callback may start the next transfer */
+	ctrl_rtos->async_callback = NULL;
+	callback(ctrl_rtos->async_user_data, ret);
+}
+
 static void _mtk_os_hal_i2c_irq_handler(int bus_num)
 {
 	u8 ret = 0;
@@ -114,7 +136,9 @@ static void _mtk_os_hal_i2c_irq_handler(int bus_num)
 	/* 1. FIFO mode: return completion done in I2C irq handler
 	 * 2. DMA mode: return completion done in DMA irq handler
 	 */
-	if (!ret) {
+	if (!ret && ctrl_rtos->async_callback) {
+		_mtk_os_hal_i2c_async_done(ctrl_rtos);
+	} else if (!ret) {
 #ifdef OSAI_FREERTOS
 		xSemaphoreGiveFromISR(ctrl_rtos->xfer_completion,
 				      &x_higher_priority_task_woken);
@@ -204,6 +228,11 @@ static void _mtk_os_hal_i2c_free_irq(int bus_num)
 
 static int _mtk_os_hal_i2c_dma_done_callback(void *data)
 {
+	if (((struct mtk_i2c_ctrl_rtos *)data)->async_callback) {
+		_mtk_os_hal_i2c_async_done(data);
+		return 0;
+	}
+
 #ifdef OSAI_FREERTOS
 	BaseType_t x_higher_priority_task_woken = pdFALSE;
 	struct mtk_i2c_ctrl_rtos *ctrl_rtos;
@@ -404,6 +433,9 @@ int mtk_os_hal_i2c_read(i2c_num bus_num, u8 device_addr, u8 *buffer, u16 len)
 		return -I2C_EPTR;
 	}
 
+	if (ctrl_rtos->async_callback)
+		return -I2C_EBUSY;
+
 	i2c->msg_num = 1;
 	i2c->dma_en = false;
 	i2c->i2c_mode = I2C_MASTER_MODE;
@@ -449,6 +481,9 @@ int   mtk_os_hal_i2c_write(i2c_num bus_num, u8 device_addr, u8 *buffer, u16 len)
 		return -I2C_EPTR;
 	}
 
+	if (ctrl_rtos->async_callback)
+		return -I2C_EBUSY;
+
 	i2c->msg_num = 1;
 	i2c->dma_en = false;
 	i2c->i2c_mode = I2C_MASTER_MODE;
@@ -495,6 +530,9 @@ int mtk_os_hal_i2c_write_read(i2c_num bus_num, u8 device_addr,
 		return -I2C_EPTR;
 	}
 
+	if (ctrl_rtos->async_callback)
+		return -I2C_EBUSY;
+
 	i2c->msg_num = 2;
 	i2c->dma_en = false;
 	i2c->i2c_mode = I2C_MASTER_MODE;
@@ -520,6 +558,96 @@ int mtk_os_hal_i2c_write_read(i2c_num bus_num, u8 device_addr,
 	return ret;
 }
 
+int mtk_os_hal_i2c_transfer_async(i2c_num bus_num, u8 device_addr,
+				  u8 *wr_buf, u16 wr_len, u8 *rd_buf, u16 rd_len,
+				  i2c_async_callback callback, void *user_data)
+{
+	struct mtk_i2c_ctrl_rtos *ctrl_rtos;
+	struct mtk_i2c_controller *i2c;
+	int ret = I2C_OK;
+
+	if (bus_num >= OS_HAL_I2C_ISU_MAX || !callback)
+		return -I2C_EINVAL;
+
+#ifndef OSAI_ENABLE_DMA
+	if (wr_len > PIO_I2C_MAX_LEN || rd_len > PIO_I2C_MAX_LEN) {
+		printf("Error! buf length should be less than or equal to %d\n", PIO_I2C_MAX_LEN);
+		return -I2C_EINVAL;
+	}
+#endif
+
+	ctrl_rtos = &g_i2c_ctrl_rtos[bus_num];
+	i2c = ctrl_rtos->i2c;
+	if (!i2c) {
+		printf("i2c%d *i2c is NULL Pointer\n", bus_num);
+		return -I2C_EPTR;
+	}
+
+	if (ctrl_rtos->async_callback)
+		return -I2C_EBUSY;
+
+	i2c->msg_num = rd_len ? 2 : 1;
+	i2c->dma_en = false;
+	i2c->i2c_mode = I2C_MASTER_MODE;
+	i2c->irq_stat = 0;
+
+	ctrl_rtos->async_msgs[0].addr = device_addr;
+	ctrl_rtos->async_msgs[0].flags = I2C_MASTER_WR;
+	ctrl_rtos->async_msgs[0].len = wr_len;
+	ctrl_rtos->async_msgs[0].buf = wr_buf;
+
+	ctrl_rtos->async_msgs[1].addr = device_addr;
+	ctrl_rtos->async_msgs[1].flags = I2C_MASTER_RD;
+	ctrl_rtos->async_msgs[1].len = rd_len;
+	ctrl_rtos->async_msgs[1].buf = rd_buf;
+
+	i2c->msg = &ctrl_rtos->async_msgs[0];
+
+	/* set before the transfer starts, it can finish before this returns */
+	ctrl_rtos->async_user_data = user_data;
+	ctrl_rtos->async_callback = callback;
+
+	ret = mtk_mhal_i2c_trigger_transfer(i2c);
+	if (ret) {
+		printf("i2c%d trigger transfer fail\n", bus_num);
+		ctrl_rtos->async_callback = NULL;
+		mtk_mhal_i2c_init_hw(i2c);
+	}
+
+	return ret;
+}
+
+int mtk_os_hal_i2c_transfer_abort(i2c_num bus_num)
+{
+	struct mtk_i2c_ctrl_rtos *ctrl_rtos;
+	struct mtk_i2c_controller *i2c;
+
+	if (bus_num >= OS_HAL_I2C_ISU_MAX)
+		return -I2C_EINVAL;
+
+	ctrl_rtos = &g_i2c_ctrl_rtos[bus_num];
+	i2c = ctrl_rtos->i2c;
+	if (!i2c) {
+		printf("i2c%d *i2c is NULL Pointer\n", bus_num);
+		return -I2C_EPTR;
+	}
+
+	ctrl_rtos->async_callback = NULL;
+	mtk_mhal_i2c_dump_register(i2c);
+	mtk_mhal_i2c_init_hw(i2c);
+
+	/* a completion that raced the reset must not finish the next
+	 * blocking transfer
+	 */
+#ifdef OSAI_FREERTOS
+	xSemaphoreTake(ctrl_rtos->xfer_completion, 0);
+#else
+	ctrl_rtos->xfer_completion = 0;
+#endif
+
+	return 0;
+}
+
 int mtk_os_hal_i2c_set_slave_addr(i2c_num bus_num, u8 slv_addr)
 {
 	int ret = I2C_OK;
@@ -571,6 +699,9 @@ int mtk_os_hal_i2c_slave_tx(i2c_num bus_num, u8 *buffer, u16 len, u32 time_out)
 		return -I2C_EPTR;
 	}
 
+	if (ctrl_rtos->async_callback)
+		return -I2C_EBUSY;
+
 	i2c->msg_num = 1;
 	i2c->dma_en = false;
 	i2c->i2c_mode = I2C_SLAVE_MODE;
@@ -616,6 +747,9 @@ int mtk_os_hal_i2c_slave_rx(i2c_num bus_num, u8 *buffer, u16 len, u32 time_out)
 		return -I2C_EPTR;
 	}
 
+	if (ctrl_rtos->async_callback)
+		return -I2C_EBUSY;
+
 	i2c->msg_num = 1;
 	i2c->dma_en = false;
 	i2c->i2c_mode = I2C_SLAVE_MODE;
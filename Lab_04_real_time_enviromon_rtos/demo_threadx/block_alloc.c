@@ -0,0 +1,101 @@
+#include "block_alloc.h"
+
+static uint32_t aligned_block_size(uint32_t size) {
+	return (size + BLOCK_ALLOC_ALIGNMENT - 1) & ~(uint32_t)(BLOCK_ALLOC_ALIGNMENT - 1);
+}
+
+size_t block_alloc_size(const BLOCK_CLASS* classes, int classCount) {
+	size_t size = 0;
+
+	for (int i = 0; i < classCount; i++) {
+		size += (size_t)aligned_block_size(classes[i].blockSize) * classes[i].blockCount;
+	}
+
+	return size;
+}
+
+bool block_alloc_init(BLOCK_ALLOC* alloc, BLOCK_CLASS* classes, int classCount, void* memory, size_t size) {
+	uintptr_t start = ((uintptr_t)memory + BLOCK_ALLOC_ALIGNMENT - 1) & ~(uintptr_t)(BLOCK_ALLOC_ALIGNMENT - 1);
+	uint8_t* next = (uint8_t*)start;
+
+	alloc->classes = classes;
+	alloc->classCount = 0;
+	alloc->bytesInUse = alloc->peakBytes = 0;
+
+	if (start - (uintptr_t)memory + block_alloc_size(classes, classCount) > size) {
+		return false;
+	}
+
+	for (int i = 0; i < classCount; i++) {
+		BLOCK_CLASS* blockClass = &classes[i];
+
+		blockClass->blockSize = aligned_block_size(blockClass->blockSize);
+		blockClass->region = next;
+		blockClass->freeList = NULL;
+		blockClass->inUse = blockClass->peak = blockClass->failures = 0;
+
+		// Linked back to front so blocks are handed out in address order
+		for (uint32_t block = blockClass->blockCount; block-- > 0;) {
+			void** link = (void**)(next + block * blockClass->blockSize);
+			*link = blockClass->freeList;
+			blockClass->freeList = link;
+		}
+
+		next += blockClass->blockSize * blockClass->blockCount;
+	}
+
+	alloc->classCount = classCount;
+	return true;
+}
+
+void* block_alloc(BLOCK_ALLOC* alloc, size_t size) {
+	BLOCK_CLASS* blockClass = NULL;
+	void** block;
+
+	if (size == 0) { return NULL; }
+
+	for (int i = 0; i < alloc->classCount; i++) {
+		if (size <= alloc->classes[i].blockSize) {
+			blockClass = &alloc->classes[i];
+			break;
+		}
+	}
+
+	if (blockClass == NULL) { return NULL; }
+
+	if ((block = blockClass->freeList) == NULL) {
+		blockClass->failures++;
+		return NULL;
+	}
+
+	blockClass->freeList = *block;
+	if (++blockClass->inUse > blockClass->peak) {
+		blockClass->peak = blockClass->inUse;
+	}
+	if ((alloc->bytesInUse += blockClass->blockSize) > alloc->peakBytes) {
+		alloc->peakBytes = alloc->bytesInUse;
+	}
+
+	return block;
+}
+
+bool block_free(BLOCK_ALLOC* alloc, void* ptr) {
+	uint8_t* address = ptr;
+
+	for (int i = 0; i < alloc->classCount; i++) {
+		BLOCK_CLASS* blockClass = &alloc->classes[i];
+		size_t offset = (size_t)(address - blockClass->region);
+
+		if (address >= blockClass->region && offset < (size_t)blockClass->blockSize * blockClass->blockCount) {
+			if (offset % blockClass->blockSize != 0) { return false; }
+
+			*(void**)ptr = blockClass->freeList;
+			blockClass->freeList = ptr;
+			blockClass->inUse--;
+			alloc->bytesInUse -= blockClass->blockSize;
+			return true;
+		}
+	}
+
+	return false;
+}
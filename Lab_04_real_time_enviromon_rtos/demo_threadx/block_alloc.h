@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-block allocator with a few size classes, backing malloc and free in the ThreadX app.
+//
+// Each class is a free list of equal blocks carved from one region at init. An allocation takes
+// the head of the smallest class that fits and a free pushes the block back, so both take the same
+// few steps whatever the heap has been through, with no search and no fragmentation. A class that
+// is empty fails the allocation straight away rather than waiting or borrowing from a larger class,
+// its failures count shows it needs more blocks.
+//
+// The allocator does no locking and never touches ThreadX, the caller serializes access. This also
+// lets it run on a host, see IntercoreSimulator/alloc_bench.c.
+
+// Blocks are aligned for any type malloc may be asked for
+#define BLOCK_ALLOC_ALIGNMENT 8
+
+typedef struct {
+	uint32_t blockSize;		// rounded up to BLOCK_ALLOC_ALIGNMENT by block_alloc_init
+	uint32_t blockCount;
+	uint8_t* region;		// blockCount blocks, set by block_alloc_init
+	void* freeList;
+	uint32_t inUse;
+	uint32_t peak;			// most blocks in use at once
+	uint32_t failures;		// allocations this class was the best fit for and had no block for
+} BLOCK_CLASS;
+
+typedef struct {
+	BLOCK_CLASS* classes;	// ascending blockSize
+	int classCount;
+	uint32_t bytesInUse;	// whole blocks, however little of each was asked for
+	uint32_t peakBytes;		// most bytesInUse at once
+} BLOCK_ALLOC;
+
+/// <summary>
+/// Carve memory into the blocks of each class.
+/// </summary>
+/// <returns>false if memory is too small for every class, nothing can be allocated then</returns>
+bool block_alloc_init(BLOCK_ALLOC* alloc, BLOCK_CLASS* classes, int classCount, void* memory, size_t size);
+
+/// <summary>
+/// A block of at least size bytes, NULL for 0 bytes, a size larger than every class or an empty class.
+/// </summary>
+void* block_alloc(BLOCK_ALLOC* alloc, size_t size);
+
+/// <summary>
+/// Return a block to its class.
+/// </summary>
+/// <returns>false if ptr is not a block of this allocator, it is left alone</returns>
+bool block_free(BLOCK_ALLOC* alloc, void* ptr);
+
+/// <summary>
+/// Memory block_alloc_init needs for these classes.
+/// </summary>
+size_t block_alloc_size(const BLOCK_CLASS* classes, int classCount);
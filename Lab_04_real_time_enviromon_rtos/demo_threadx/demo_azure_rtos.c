@@ -39,43 +39,118 @@
 *************************************************************************************************************************************/
 
 #include "../IMU_lib/imu_temp_pressure.h"
+#include "block_alloc.h"
 //#include "hw/azure_sphere_learning_path.h"
+#include "intercore_codec.h"
 #include "intercore_contract.h"
+#include "intercore_flow.h"
+#include "intercore_load.h"
+#include "intercore_memory.h"
+#include "intercore_pack.h"
+#include "intercore_snapshot.h"
 #include "mt3620-intercore.h"
+#include "periodic_job.h"
 #include "os_hal_gpio.h"
+#include "os_hal_gpt.h"
+#include "os_hal_mbox.h"
 #include "os_hal_uart.h"
 #include "printf.h"
 #include "tx_api.h"
 #include <math.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
 
 #define DEMO_STACK_SIZE 1024
-#define DEMO_BYTE_POOL_SIZE 9120
+// The byte pool only holds the thread stacks, each allocation costs ThreadX two pointers
+#define DEMO_BYTE_POOL_SIZE (3 * (DEMO_STACK_SIZE + 16) + 64)
 #define DEMO_BLOCK_POOL_SIZE 100
 #define DEMO_QUEUE_SIZE 100
 
 // 1 tick = 10ms. It is configurable.
 #define MS_TO_TICK(ms)  ((ms) * (TX_TIMER_TICKS_PER_SECOND) / 1000)
 
+// Free-running GPT2 the CPU time accounting counts, see intercore_load.h
+#define LOAD_CLOCK_GPT OS_HAL_GPT2
+#define LOAD_CLOCK_HZ 32768
+
+// Intercore_event_flags_0 flags
+#define INTERCORE_EVENT_MESSAGE 0x1       // mailbox SW interrupt, the high-level app wrote a message
+#define INTERCORE_EVENT_SENSOR_READY 0x2  // read_sensor_thread has a reading for a subscriber
+#define INTERCORE_EVENT_CONSUMED 0x4      // mailbox SW interrupt, the high-level app read a message
+
+// Range of sample rates a high-level app may subscribe at
+#define MIN_SUBSCRIBE_RATE_MS 100
+#define MAX_SUBSCRIBE_RATE_MS (60 * 60 * 1000)
+
+// Inbound messages handled per read position update and doorbell
+#define INBOUND_BATCH_MAX 8
+
+// Outbound bytes bulk records leave free for control replies, see IntercoreLane
+#define INTERCORE_CONTROL_LANE_SIZE 256
+
+// Committed frames whose latency is being timed, older ones go untimed if more are outstanding
+#define LATENCY_TRACK_MAX 16
+
 // forward signatures
 void set_hvac_operating_mode(int temperature);
 
 // resources for inter core messaging
-static uint8_t buf[256];
-static uint32_t dataSize;
+// Messages are built and parsed in place in the shared buffers, only the component id header of
+// the last inbound message is kept so replies are routed back to the sending high-level app.
+static uint8_t hlComponentId[20];
 static BufferHeader* outbound, * inbound;
 static uint32_t sharedBufSize = 0;
-static const size_t payloadStart = 20;
-static int sensorSampleRateInSeconds = 500; // initialize to 5 seconds 500 ticks at 10ms a tick
+static const size_t payloadStart = sizeof(hlComponentId);
+static ULONG sensorPeriodTicks = MS_TO_TICK(5000); // sample period, changed by IC_SUBSCRIBE_SENSOR
+static PERIODIC_JOB sensorJob;
+static volatile bool sampleDeferred = false;       // a sample fell due while a BLOCK subscriber was out of credit
+static volatile bool sensorStreaming = false; // push readings as they are sampled, set by IC_SUBSCRIBE_SENSOR
+static INTERCORE_FLOW sensorFlow;             // subscriber credit, used by the intercore thread
+
+// Outbound records are packed into batch frames so several readings share one mailbox doorbell.
+// A frame is sent when it is full or when the most impatient record in it reaches its deadline.
+// Legacy frames are an INTERCORE_BATCH_HEADER followed by INTERCORE_BLOCK records, compact frames
+// are intercore_codec records back to back. Packed frames are built from records kept here at
+// flush, until then the reservation holds room for their largest possible size.
+typedef struct {
+	IntercoreBlockView view;
+	int count;
+	uint32_t used;		// record bytes written to the frame, worst case for a packed frame
+	uint32_t capacity;	// record bytes the frame can hold
+	ULONG deadline;
+	bool open;
+	bool compact;
+	bool packed;
+	INTERCORE_RECORD records[INTERCORE_BATCH_MAX_RECORDS];	// records of a packed frame
+} INTERCORE_BATCH;
+
+static INTERCORE_BATCH outbound_batch;
+static uint8_t packedFrame[INTERCORE_BATCH_MAX_RECORDS * sizeof(INTERCORE_BLOCK)];
+static bool peerCompact = false; // reply in the compact format once the high-level app uses it
+static bool peerPacked = false;  // send batches as packed frames, asked for on IC_SUBSCRIBE_SENSOR
+static uint16_t requestId;        // request being served, echoed in its replies, 0 for none
+
+// Transport statistics reported by IC_READ_STATS, the ring counters are kept by mt3620-intercore.c
+typedef struct {
+	uint32_t position;
+	ULONG committed;
+} INFLIGHT_FRAME;
+
+static uint32_t recordsSent;
+static uint32_t recordsDropped;
+static uint32_t latencyHistogram[INTERCORE_LATENCY_BUCKETS];
+static INFLIGHT_FRAME inflight[LATENCY_TRACK_MAX];
+static uint32_t inflightHead, inflightCount;
 
 INTERCORE_BLOCK ic_control_block;
-INTERCORE_BLOCK enviroment_control_block;
+
+// Latest reading, published by read_sensor_thread and copied whole by the intercore thread
+static INTERCORE_SNAPSHOT environment_snapshot;
 
 enum LEDS { RED, GREEN, BLUE };
 
 typedef struct {
-	int last_temperature;
 	int target_temperature;
 	bool target_temperature_set;
 	int previous_led;
@@ -97,40 +172,84 @@ TX_EVENT_FLAGS_GROUP    event_flags_0;
 TX_BYTE_POOL            byte_pool_0;
 TX_BLOCK_POOL           block_pool_0;
 
-TX_TIMER                msTimer;
 TX_EVENT_FLAGS_GROUP    hardware_event_flags_0;
 TX_EVENT_FLAGS_GROUP    Intercore_event_flags_0;
 
 UCHAR memory_area[DEMO_BYTE_POOL_SIZE];
 
+// malloc and free, see block_alloc.h. Sized for the C library's occasional small allocations,
+// a class running out shows in its failures count.
+static BLOCK_CLASS heapClasses[] = {
+	{ .blockSize = 16, .blockCount = 16 },
+	{ .blockSize = 32, .blockCount = 16 },
+	{ .blockSize = 64, .blockCount = 8 },
+	{ .blockSize = 128, .blockCount = 8 },
+	{ .blockSize = 512, .blockCount = 4 },
+};
+static BLOCK_ALLOC heap;
+static uint64_t heapMemory[(16 * 16 + 32 * 16 + 64 * 8 + 128 * 8 + 512 * 4) / sizeof(uint64_t)];
+
+// Least of byte_pool_0 free whenever memory use is read
+static ULONG poolMinFree = DEMO_BYTE_POOL_SIZE;
+
 static volatile bool hardwareInitOK = false;
 
 // Define thread prototypes.
 void hardware_init_thread(ULONG thread_input);
 void intercore_thread(ULONG thread_input);
 void read_sensor_thread(ULONG thread_input);
-void timer_scheduler(ULONG input);
+bool sensor_job_expired(PERIODIC_JOB* job);
 
 
 int main() {
 	tx_kernel_enter(); // Enter the Azure RTOS kernel.
 }
 
+static uint32_t load_clock(void) {
+	return mtk_os_hal_gpt_get_cur_count(LOAD_CLOCK_GPT);
+}
+
+// ThreadX calls these from the context switch, built with TX_ENABLE_EXECUTION_CHANGE_NOTIFY.
+// The thread exit runs first on every switch, time until the next thread enters is idle.
+VOID _tx_execution_thread_enter(VOID) {
+	TX_THREAD* thread = tx_thread_identify();
+	intercore_load_switch(thread, thread ? thread->tx_thread_name : NULL);
+}
+
+VOID _tx_execution_thread_exit(VOID) {
+	intercore_load_switch(NULL, NULL);
+}
+
+// Interrupt time is charged to the thread it interrupts
+VOID _tx_execution_isr_enter(VOID) {}
+
+VOID _tx_execution_isr_exit(VOID) {}
+
 // Define what the initial system looks like.
 void tx_application_define(void* first_unused_memory) {
 	CHAR* pointer;
 	UINT status = TX_SUCCESS;
 
+	// Account CPU time from before the first thread runs
+	mtk_os_hal_gpt_init();
+	mtk_os_hal_gpt_config(LOAD_CLOCK_GPT, true, NULL);
+	mtk_os_hal_gpt_start(LOAD_CLOCK_GPT);
+	intercore_load_init(load_clock, LOAD_CLOCK_HZ);
+
 	/* Create a byte memory pool from which to allocate the thread stacks.  */
 	tx_byte_pool_create(&byte_pool_0, "byte pool 0", memory_area, DEMO_BYTE_POOL_SIZE);
 
+	if (!block_alloc_init(&heap, heapClasses, sizeof(heapClasses) / sizeof(heapClasses[0]), heapMemory, sizeof(heapMemory))) {
+		printf("heap too small for its block classes\r\n");
+	}
+
 	// create event flags
 	status = tx_event_flags_create(&hardware_event_flags_0, "Hardware Event");                   // Hardware events fire every 5 ms
 	if (status != TX_SUCCESS) {
 		printf("failed to create hardware_event_flags\r\n");
 	}
 
-	status = tx_event_flags_create(&Intercore_event_flags_0, "Intercore Event");                     // Intercore events fire every 10 ms
+	status = tx_event_flags_create(&Intercore_event_flags_0, "Intercore Event");                     // Intercore events fire from the mailbox interrupt
 	if (status != TX_SUCCESS) {
 		printf("failed to create Intercore_event_flags\r\n");
 	}
@@ -152,28 +271,22 @@ void tx_application_define(void* first_unused_memory) {
 		pointer, DEMO_STACK_SIZE, 1, 1, TX_NO_TIME_SLICE, TX_AUTO_START);
 }
 
-// https://embeddedartistry.com/blog/2017/02/17/implementing-malloc-with-threadx/
 // overrides for malloc and free required for srand and rand
+// Allocation never waits, a request no block class can serve returns NULL straight away. The
+// critical section is a bounded handful of instructions, so it is safe from any thread.
 void* malloc(size_t size) {
-	void* ptr = NULL;
-
-	if (size > 0) {
-		// We simply wrap the threadX call into a standard form
-		uint8_t r = tx_byte_allocate(&byte_pool_0, &ptr, size, TX_WAIT_FOREVER);
-
-		if (r != TX_SUCCESS) {
-			ptr = NULL;
-		}
-	}
-	//else NULL if there was no size
+	UINT interrupts = tx_interrupt_control(TX_INT_DISABLE);
+	void* ptr = block_alloc(&heap, size);
+	tx_interrupt_control(interrupts);
 
 	return ptr;
 }
 
 void free(void* ptr) {
 	if (ptr) {
-		//We simply wrap the threadX call into a standard form
-		tx_byte_release(ptr);
+		UINT interrupts = tx_interrupt_control(TX_INT_DISABLE);
+		block_free(&heap, ptr);
+		tx_interrupt_control(interrupts);
 	}
 }
 
@@ -193,8 +306,12 @@ bool initialize_hardware(void) {
 			tx_thread_sleep(MS_TO_TICK(100));
 		}
 
-		enviroment_control_block.temperature = round(lp_get_temperature_lps22h());
-		enviroment_control_block.pressure = round(lp_get_pressure());
+		INTERCORE_BLOCK reading = {
+			.cmd = IC_READ_SENSOR,
+			.temperature = round(lp_get_temperature_lps22h()),
+			.pressure = round(lp_get_pressure())
+		};
+		intercore_snapshot_publish(&environment_snapshot, &reading);
 	}
 
 	// Open the red, green, and blue gpio ledRgb
@@ -213,39 +330,514 @@ bool initialize_hardware(void) {
 #endif
 
 
-// Using default threadX 10ms tick period
-void timer_scheduler(ULONG input) {
-	static size_t intercoreTickCounter = 0;
-	static size_t readSensorTickCounter = SIZE_MAX;
-	ULONG status = TX_SUCCESS;
+/// <summary>
+/// Sensor sample period expired, runs in the ThreadX timer thread.
+/// A BLOCK subscriber out of credit pauses sampling, the sample is taken once credit arrives.
+/// </summary>
+bool sensor_job_expired(PERIODIC_JOB* job) {
+	if (intercore_flow_paused(&sensorFlow)) {
+		sampleDeferred = true;
+		return false;
+	}
 
-	if (hardwareInitOK == true) {
-		readSensorTickCounter++;
-		if (readSensorTickCounter >= sensorSampleRateInSeconds) {
-			readSensorTickCounter = 0;
-			status = tx_event_flags_set(&hardware_event_flags_0, 0x1, TX_OR);
-			if (status != TX_SUCCESS) {
-				printf("failed to set hardware event flags\r\n");
-			}
+	if (tx_event_flags_set(&hardware_event_flags_0, 0x1, TX_OR) != TX_SUCCESS) {
+		printf("failed to set hardware event flags\r\n");
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Mailbox SW interrupt handler, runs in interrupt context.
+/// SW interrupt bit 1 is raised when the high-level app writes a message to the shared buffer,
+/// wake the intercore thread straight away rather than on a polling tick.
+/// </summary>
+void mbox_swint_cb(struct mtk_os_hal_mbox_cb_data* data) {
+	if (data->swint.channel != OS_HAL_MBOX_CH0) { return; }
+
+	if (data->swint.swint_sts & (1 << 1)) {
+		tx_event_flags_set(&Intercore_event_flags_0, INTERCORE_EVENT_MESSAGE, TX_OR);
+	}
+	// Bit 0 is raised when the high-level app has read from the outbound buffer
+	if (data->swint.swint_sts & (1 << 0)) {
+		tx_event_flags_set(&Intercore_event_flags_0, INTERCORE_EVENT_CONSUMED, TX_OR);
+	}
+}
+
+/// <summary>
+/// Start timing a frame just committed at position in the outbound buffer.
+/// </summary>
+void latency_track(uint32_t position) {
+	if (inflightCount == LATENCY_TRACK_MAX) {
+		inflightHead = (inflightHead + 1) % LATENCY_TRACK_MAX;
+		inflightCount--;
+	}
+
+	inflight[(inflightHead + inflightCount) % LATENCY_TRACK_MAX] = (INFLIGHT_FRAME){ .position = position, .committed = tx_time_get() };
+	inflightCount++;
+}
+
+/// <summary>
+/// Add every timed frame the high-level app has read since the last call to the latency histogram.
+/// Frames are read in order, a frame is read once the remote read position has moved past it.
+/// </summary>
+void latency_collect(void) {
+	uint32_t readPosition, pending, elapsed_ms;
+	int bucket;
+
+	if (inflightCount == 0) { return; }
+
+	readPosition = inbound->readPosition;
+	pending = (outbound->writePosition - readPosition + sharedBufSize) % sharedBufSize;
+
+	while (inflightCount > 0 && (inflight[inflightHead].position - readPosition + sharedBufSize) % sharedBufSize >= pending) {
+		elapsed_ms = (tx_time_get() - inflight[inflightHead].committed) * 1000 / TX_TIMER_TICKS_PER_SECOND;
+
+		for (bucket = 0; bucket < INTERCORE_LATENCY_BUCKETS - 1 && elapsed_ms >= (1u << bucket); bucket++) {}
+		latencyHistogram[bucket]++;
+
+		inflightHead = (inflightHead + 1) % LATENCY_TRACK_MAX;
+		inflightCount--;
+	}
+}
+
+static uint32_t batch_frame_size(int count) {
+	return payloadStart + INTERCORE_BATCH_FRAME_SIZE(count);
+}
+
+static uint32_t batch_records_start(INTERCORE_BATCH* batch) {
+	return payloadStart + (batch->compact ? 0 : sizeof(INTERCORE_BATCH_HEADER));
+}
+
+/// <summary>
+/// Publish the open batch frame with a single doorbell.
+/// A legacy frame holding one record is sent as a plain INTERCORE_BLOCK.
+/// </summary>
+void batch_flush(INTERCORE_BATCH* batch) {
+	INTERCORE_BATCH_HEADER header = { .cmd = IC_BATCH, .count = batch->count };
+	INTERCORE_BLOCK record;
+	int length;
+
+	if (!batch->open) { return; }
+
+	if (batch->packed) {
+		// Fits, the reservation was sized for the worst case
+		length = intercore_pack_records(batch->records, batch->count, packedFrame, batch->used);
+		WriteBlockView(&batch->view, payloadStart, packedFrame, (uint32_t)length);
+		TrimReservedData(outbound, &batch->view, payloadStart + (uint32_t)length);
+	} else if (!batch->compact && batch->count == 1) {
+		ReadBlockView(&batch->view, batch_frame_size(0), &record, sizeof(record));
+		WriteBlockView(&batch->view, payloadStart, &record, sizeof(record));
+		TrimReservedData(outbound, &batch->view, payloadStart + sizeof(record));
+	} else {
+		if (!batch->compact) {
+			WriteBlockView(&batch->view, payloadStart, &header, sizeof(header));
 		}
+		TrimReservedData(outbound, &batch->view, batch_records_start(batch) + batch->used);
+	}
+
+	CommitData(outbound, sharedBufSize, &batch->view);
+	latency_track(batch->view.position);
+	batch->open = false;
+}
+
+/// <summary>
+/// Ticks until the open batch frame must be flushed, the intercore thread sleeps no longer than this.
+/// </summary>
+ULONG batch_wait_ticks(INTERCORE_BATCH* batch) {
+	LONG remaining;
+
+	if (!batch->open) { return TX_WAIT_FOREVER; }
+
+	remaining = (LONG)(batch->deadline - tx_time_get());
+	return remaining > 0 ? (ULONG)remaining : TX_NO_WAIT;
+}
+
+/// <summary>
+/// Flush the open batch frame once its deadline has passed.
+/// </summary>
+void batch_flush_if_due(INTERCORE_BATCH* batch) {
+	if (batch->open && (LONG)(tx_time_get() - batch->deadline) >= 0) {
+		batch_flush(batch);
+	}
+}
+
+/// <summary>
+/// Append a record to the open batch frame, opening a new frame in the shared buffer if needed.
+/// Records are written straight into the reserved frame, the frame is flushed when full.
+/// </summary>
+/// <param name="record">The record as a legacy struct</param>
+/// <param name="compact_record">The same record in the compact format, which can carry more fields</param>
+/// <param name="max_wait">Ticks the record may wait for more records to share its frame</param>
+/// <returns>false if the shared buffer has no room, the record is dropped</returns>
+bool batch_append(INTERCORE_BATCH* batch, const INTERCORE_BLOCK* record, const INTERCORE_RECORD* compact_record, ULONG max_wait) {
+	ULONG deadline = tx_time_get() + max_wait;
+	uint8_t encoded[INTERCORE_WIRE_MAX_RECORD_SIZE];
+	const void* data = record;
+	uint32_t length = sizeof(*record);
+	uint32_t start = 0;
+	bool packed = peerCompact && peerPacked;
+
+	if (packed) {
+		// Column bytes one more record can add, the frame header is counted once
+		start = INTERCORE_PACK_HEADER_SIZE;
+		length = intercore_pack_bound(compact_record->fields, 1) - start;
+	} else if (peerCompact) {
+		length = intercore_encode(compact_record, encoded, sizeof(encoded));
+		data = encoded;
+	}
+
+	// A frame holds records of one format only, a packed frame records with the same fields
+	if (batch->open && (batch->compact != peerCompact || batch->packed != packed ||
+		(packed && (batch->records[0].cmd != compact_record->cmd || batch->records[0].fields != compact_record->fields)))) {
+		batch_flush(batch);
+	}
 
-		intercoreTickCounter++;
-		if (intercoreTickCounter >= 25)  // 250ms = 0.25 seconds.
-		{
-			intercoreTickCounter = 0;
-			status = tx_event_flags_set(&Intercore_event_flags_0, 0x1, TX_OR);
-			if (status != TX_SUCCESS) {
-				printf("failed to set Intercore event flags\r\n");
+	if (!batch->open) {
+		batch->compact = peerCompact;
+		batch->packed = packed;
+
+		// Reserve the largest frame the shared buffer can take right now
+		for (batch->capacity = INTERCORE_BATCH_MAX_RECORDS * sizeof(INTERCORE_BLOCK); batch->capacity >= start + length; batch->capacity /= 2) {
+			if (ReserveLaneData(inbound, outbound, sharedBufSize, INTERCORE_LANE_BULK, batch_records_start(batch) + batch->capacity, &batch->view) == 0) {
+				break;
 			}
 		}
+
+		if (batch->capacity < start + length) {
+			recordsDropped++;
+			return false;
+		}
+
+		WriteBlockView(&batch->view, 0, hlComponentId, payloadStart);
+		batch->count = 0;
+		batch->used = start;
+		batch->deadline = deadline;
+		batch->open = true;
+	} else if ((LONG)(deadline - batch->deadline) < 0) {
+		batch->deadline = deadline;
+	}
+
+	if (packed) {
+		batch->records[batch->count] = *compact_record;
+	} else {
+		WriteBlockView(&batch->view, batch_records_start(batch) + batch->used, data, length);
+	}
+	batch->used += length;
+	batch->count++;
+	recordsSent++;
+
+	// Full once another record of this size would not fit
+	if (batch->used + length > batch->capacity || batch->count == INTERCORE_BATCH_MAX_RECORDS) {
+		batch_flush(batch);
 	}
+
+	return true;
 }
 
+/// <summary>
+/// Send the latest reading. Compact records carry its version, so the high-level app can keep the
+/// latest value without asking for it and tell a new reading from one it already has.
+/// </summary>
 void send_intercore_msg(void) {
-	memcpy((void*)&buf[payloadStart], (void*)&enviroment_control_block, sizeof(enviroment_control_block));
-	dataSize = payloadStart + sizeof(enviroment_control_block);
+	INTERCORE_BLOCK reading;
+	INTERCORE_RECORD compact_record;
+	uint32_t version = intercore_snapshot_read(&environment_snapshot, &reading);
+
+	intercore_record_from_block(&reading, &compact_record);
+	compact_record.fields |= IC_FIELD_VERSION;
+	compact_record.version = (uint16_t)version;
+
+	if (requestId != 0) {
+		compact_record.fields |= IC_FIELD_REQUEST_ID;
+		compact_record.request_id = requestId;
+	}
 
-	EnqueueData(inbound, outbound, sharedBufSize, buf, dataSize);
+	// Replies are sent at the end of the current intercore wakeup
+	batch_append(&outbound_batch, &reading, &compact_record, 0);
+}
+
+/// <summary>
+/// Send a message on the control lane straight away, after any records already waiting to be sent.
+/// </summary>
+void send_control_message(const void* data, uint32_t length) {
+	IntercoreBlockView view;
+
+	batch_flush(&outbound_batch);
+
+	if (ReserveData(inbound, outbound, sharedBufSize, payloadStart + length, &view) != 0) { return; }
+
+	WriteBlockView(&view, 0, hlComponentId, payloadStart);
+	WriteBlockView(&view, payloadStart, data, length);
+	CommitData(outbound, sharedBufSize, &view);
+	latency_track(view.position);
+}
+
+/// <summary>
+/// Reply to IC_READ_STATS. The reply is always a legacy INTERCORE_STATS struct, the compact format
+/// has no fields for it, and goes after any records already waiting to be sent.
+/// </summary>
+void send_intercore_stats(void) {
+	const IntercoreStats* ring = GetIntercoreStats();
+	INTERCORE_STATS reply = {
+		.cmd = IC_READ_STATS,
+		.records = recordsSent,
+		.frames = ring->committed,
+		.dropped = recordsDropped,
+		.oversize = ring->oversize,
+		.wraps = ring->wraps,
+		.high_water = ring->highWater,
+		.buffer_size = sharedBufSize,
+		.request_id = requestId,
+		.throttled = sensorFlow.throttled,
+		.sample_latency_avg_us = periodic_job_latency_avg_us(&sensorJob),
+		.sample_jitter_us = periodic_job_jitter_us(&sensorJob)
+	};
+
+	memcpy(reply.latency_ms, latencyHistogram, sizeof(reply.latency_ms));
+	send_control_message(&reply, sizeof(reply));
+}
+
+/// <summary>
+/// Reply to IC_READ_LOAD, always a legacy INTERCORE_LOAD struct like the statistics reply.
+/// </summary>
+void send_intercore_load(void) {
+	INTERCORE_LOAD reply = { 0 };
+	UINT interrupts = tx_interrupt_control(TX_INT_DISABLE);
+
+	intercore_load_read(&reply);
+	tx_interrupt_control(interrupts);
+
+	reply.request_id = requestId;
+	send_control_message(&reply, sizeof(reply));
+}
+
+/// <summary>
+/// Reply to IC_READ_MEMORY, always a legacy INTERCORE_MEMORY struct like the statistics reply.
+/// ThreadX fills every thread stack with TX_STACK_FILL when it creates the thread, so the stacks are
+/// already painted.
+/// </summary>
+void send_intercore_memory(void) {
+	TX_THREAD* threads[] = { &tx_hardware_Thread, &tx_Intercore_Thread, &tx_hardware_init_thread };
+	INTERCORE_MEMORY reply = { .cmd = IC_READ_MEMORY, .request_id = requestId };
+	size_t heapSize = block_alloc_size(heapClasses, heap.classCount);
+	ULONG poolFree = 0;
+	UINT interrupts;
+
+	for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+		intercore_memory_add_stack(&reply, threads[i]->tx_thread_name, threads[i]->tx_thread_stack_start, threads[i]->tx_thread_stack_size);
+	}
+
+	if (tx_byte_pool_info_get(&byte_pool_0, TX_NULL, &poolFree, TX_NULL, TX_NULL, TX_NULL, TX_NULL) == TX_SUCCESS && poolFree < poolMinFree) {
+		poolMinFree = poolFree;
+	}
+	reply.pool_size = DEMO_BYTE_POOL_SIZE;
+	reply.pool_free = poolFree;
+	reply.pool_min_free = poolMinFree;
+
+	interrupts = tx_interrupt_control(TX_INT_DISABLE);
+	reply.heap_size = heapSize;
+	reply.heap_free = heapSize - heap.bytesInUse;
+	reply.heap_min_free = heapSize - heap.peakBytes;
+	for (int i = 0; i < heap.classCount; i++) {
+		reply.heap_failures += heapClasses[i].failures;
+	}
+	tx_interrupt_control(interrupts);
+
+	send_control_message(&reply, sizeof(reply));
+}
+
+/// <summary>
+/// Acknowledge a compact request that has no other reply, so the high-level app can complete it.
+/// </summary>
+void send_ack(INTERCORE_BLOCK* block) {
+	uint8_t encoded[INTERCORE_WIRE_MAX_RECORD_SIZE];
+	INTERCORE_RECORD ack;
+	int length;
+
+	if (requestId == 0) { return; }
+
+	intercore_record_from_block(block, &ack);
+	ack.fields |= IC_FIELD_REQUEST_ID;
+	ack.request_id = requestId;
+
+	if ((length = intercore_encode(&ack, encoded, sizeof(encoded))) > 0) {
+		send_control_message(encoded, length);
+	}
+}
+
+/// <summary>
+/// Push the latest reading to the subscriber, if its flow control policy lets it go now.
+/// </summary>
+void push_sensor_reading(void) {
+	if (intercore_flow_offer(&sensorFlow)) {
+		send_intercore_msg();
+	}
+}
+
+/// <summary>
+/// Credit from the subscriber, send the reading held back for it if there is one.
+/// </summary>
+void grant_sensor_credit(uint32_t credits) {
+	if (intercore_flow_grant(&sensorFlow, credits) && sensorStreaming) {
+		push_sensor_reading();
+	}
+
+	if (sampleDeferred && !intercore_flow_paused(&sensorFlow)) {
+		sampleDeferred = false;
+		tx_event_flags_set(&hardware_event_flags_0, 0x1, TX_OR);
+	}
+}
+
+/// <summary>
+/// Start pushing readings to the high-level app at the requested sample rate.
+/// The current reading is sent straight away so the subscriber does not wait a full period.
+/// </summary>
+void subscribe_sensor_stream(INTERCORE_SUBSCRIBE* subscribe) {
+	if (subscribe->sample_rate_ms < MIN_SUBSCRIBE_RATE_MS || subscribe->sample_rate_ms > MAX_SUBSCRIBE_RATE_MS) { return; }
+
+	// The timer only exists once the hardware is up, it starts with the latest period
+	sensorPeriodTicks = MS_TO_TICK(subscribe->sample_rate_ms);
+	if (hardwareInitOK) {
+		periodic_job_set_period(&sensorJob, sensorPeriodTicks);
+	}
+	intercore_flow_start(&sensorFlow, subscribe->flow_policy, subscribe->credits < 0 ? 0 : subscribe->credits);
+	peerPacked = subscribe->packed_frames != 0;
+	sensorStreaming = true;
+	push_sensor_reading();
+}
+
+void process_control_block(INTERCORE_BLOCK* block) {
+	switch (block->cmd) {
+	case IC_READ_SENSOR:
+		send_intercore_msg();
+		break;
+	case IC_SUBSCRIBE_SENSOR:
+		subscribe_sensor_stream((INTERCORE_SUBSCRIBE*)block);
+		break;
+	case IC_UNSUBSCRIBE_SENSOR:
+		sensorStreaming = false;
+		intercore_flow_start(&sensorFlow, INTERCORE_FLOW_NONE, 0);
+		peerPacked = false;
+		send_ack(block);
+		break;
+	case IC_GRANT_CREDIT: {
+		int credits = ((INTERCORE_CREDIT*)block)->credits;
+		grant_sensor_credit(credits < 0 ? 0 : credits);
+		break;
+	}
+	case IC_READ_STATS:
+		send_intercore_stats();
+		break;
+	case IC_READ_LOAD:
+		send_intercore_load();
+		break;
+	case IC_READ_MEMORY:
+		send_intercore_memory();
+		break;
+	case IC_TARGET_TEMPERATURE:
+		hvac_mode.target_temperature = block->temperature;
+		hvac_mode.target_temperature_set = true;
+		// read_sensor_thread is the only writer of the reading and the LEDs, have it take a fresh
+		// sample to apply the new target
+		tx_event_flags_set(&hardware_event_flags_0, 0x1, TX_OR);
+		send_ack(block);
+		break;
+	default:
+		break;
+	}
+}
+
+void process_compact_record(INTERCORE_RECORD* record) {
+	INTERCORE_SUBSCRIBE subscribe;
+
+	// Several requests may be outstanding, each reply carries the id of the request it answers
+	requestId = (record->fields & IC_FIELD_REQUEST_ID) ? record->request_id : 0;
+
+	if (record->cmd == IC_SUBSCRIBE_SENSOR) {
+		intercore_record_to_subscribe(record, &subscribe);
+		subscribe_sensor_stream(&subscribe);
+	} else {
+		// Credit can ride on any other command, IC_GRANT_CREDIT carries nothing else
+		if (record->fields & IC_FIELD_CREDITS) {
+			grant_sensor_credit(record->credits);
+		}
+		if (record->cmd != IC_GRANT_CREDIT) {
+			intercore_record_to_block(record, &ic_control_block);
+			process_control_block(&ic_control_block);
+		}
+	}
+
+	requestId = 0;
+}
+
+/// <summary>
+/// Process every command in an inbound message, read in place from the shared buffer.
+/// The message is either compact intercore_codec records or a legacy INTERCORE_BLOCK / IC_BATCH frame,
+/// replies are sent in the same format.
+/// </summary>
+void process_inbound_message(IntercoreBlockView* view) {
+	uint8_t wire[INTERCORE_WIRE_MAX_RECORD_SIZE];
+	INTERCORE_RECORD record;
+	uint32_t offset = payloadStart;
+	uint32_t length;
+	int consumed;
+
+	if (view->blockSize < payloadStart + sizeof(INTERCORE_CMD)) { return; }
+
+	ReadBlockView(view, 0, hlComponentId, payloadStart);
+
+	length = view->blockSize - payloadStart;
+	if (length > sizeof(wire)) { length = sizeof(wire); }
+	ReadBlockView(view, payloadStart, wire, length);
+
+	peerCompact = intercore_is_compact(wire, length);
+
+	if (peerCompact) {
+		// Compact records are back to back, each one says how long it is
+		while (offset < view->blockSize) {
+			length = view->blockSize - offset;
+			if (length > sizeof(wire)) { length = sizeof(wire); }
+			ReadBlockView(view, offset, wire, length);
+
+			if ((consumed = intercore_decode(wire, length, &record)) < 0) { break; }
+
+			process_compact_record(&record);
+			offset += consumed;
+		}
+		return;
+	}
+
+	// Commands can be shorter than an INTERCORE_BLOCK, eg INTERCORE_SUBSCRIBE
+	length = view->blockSize - payloadStart;
+	if (length > sizeof(ic_control_block)) { length = sizeof(ic_control_block); }
+
+	ic_control_block = (INTERCORE_BLOCK){ 0 };
+	ReadBlockView(view, payloadStart, &ic_control_block, length);
+
+	if (ic_control_block.cmd == IC_BATCH) {
+		// Unpack every record in the frame before releasing it
+		INTERCORE_BATCH_HEADER header;
+		ReadBlockView(view, payloadStart, &header, sizeof(header));
+
+		for (int i = 0; i < header.count; i++) {
+			if (ReadBlockView(view, batch_frame_size(i), &ic_control_block, sizeof(ic_control_block)) != 0) { break; }
+			process_control_block(&ic_control_block);
+		}
+	} else {
+		process_control_block(&ic_control_block);
+	}
+}
+
+bool is_control_message(IntercoreBlockView* view) {
+	uint8_t head[INTERCORE_WIRE_HEADER_SIZE];
+	uint32_t length = view->blockSize - payloadStart;
+
+	if (view->blockSize < payloadStart) { return false; }
+	if (length > sizeof(head)) { length = sizeof(head); }
+
+	ReadBlockView(view, payloadStart, head, length);
+	return intercore_is_control(head, length);
 }
 
 /*************************************************************************************************************************************
@@ -257,44 +849,59 @@ void send_intercore_msg(void) {
 void intercore_thread(ULONG thread_input) {
 	UINT status = TX_SUCCESS;
 	ULONG actual_flags;
-	bool queuedMessages = true;
+	IntercoreBlockView views[INBOUND_BATCH_MAX];
+	bool control[INBOUND_BATCH_MAX];
+	int count;
+
+	// Open the A7 <-> M4 mailbox channel and have the SW interrupt wake this thread.
+	// Bit 1 (high-level app wrote a message) wakes it to process commands, bit 0 (high-level app
+	// read a message) to time outbound frames.
+	mtk_os_hal_mbox_open_channel(OS_HAL_MBOX_CH0);
+	mtk_os_hal_mbox_sw_int_register_cb(OS_HAL_MBOX_CH0, mbox_swint_cb, (1 << 0) | (1 << 1));
 
 	if (GetIntercoreBuffers(&outbound, &inbound, &sharedBufSize) == -1) {
 		return; // kill the thread
 	}
 
-	while (true) {
-		status = tx_event_flags_get(&Intercore_event_flags_0, 0x1, TX_OR_CLEAR, &actual_flags, TX_WAIT_FOREVER);
-
-		if ((status != TX_SUCCESS) || (actual_flags != 0x1)) { break; }
-
-		queuedMessages = true;
-
-		while (queuedMessages) {
-
-			dataSize = sizeof(buf);
+	if (ConfigureIntercoreLanes(sharedBufSize, INTERCORE_CONTROL_LANE_SIZE) == -1) {
+		printf("Shared buffer too small for a control lane\r\n");
+	}
 
-			int r = DequeueData(outbound, inbound, sharedBufSize, buf, &dataSize);
+	while (true) {
+		// Sleep until a message arrives, a reading is ready, or an open batch frame is due
+		status = tx_event_flags_get(&Intercore_event_flags_0, INTERCORE_EVENT_MESSAGE | INTERCORE_EVENT_SENSOR_READY | INTERCORE_EVENT_CONSUMED, TX_OR_CLEAR, &actual_flags, batch_wait_ticks(&outbound_batch));
 
-			if (r == 0 && dataSize > payloadStart) {
-				memcpy((void*)&ic_control_block, (void*)&buf[payloadStart], sizeof(ic_control_block));
+		if (status == TX_NO_EVENTS) {
+			actual_flags = 0;
+		} else if (status != TX_SUCCESS) {
+			break;
+		}
 
-				switch (ic_control_block.cmd) {
-				case IC_READ_SENSOR:
-					send_intercore_msg();
-					break;
-				case IC_TARGET_TEMPERATURE:
-					hvac_mode.target_temperature_set = true;
-					hvac_mode.target_temperature = ic_control_block.temperature;
-					set_hvac_operating_mode(hvac_mode.last_temperature);					
-					break;
-				default:
-					break;
+		// A burst of messages, eg twin updates after a reconnect, is released with one doorbell
+		while ((count = DequeueBatch(outbound, inbound, sharedBufSize, views, INBOUND_BATCH_MAX)) > 0) {
+			// Control lane first, a setpoint change does not wait behind queued sensor polls
+			for (int i = 0; i < count; i++) {
+				if ((control[i] = is_control_message(&views[i]))) {
+					process_inbound_message(&views[i]);
 				}
-			} else {
-				queuedMessages = false;
 			}
+			for (int i = 0; i < count; i++) {
+				if (!control[i]) {
+					process_inbound_message(&views[i]);
+				}
+			}
+			ReleaseBatch(outbound, sharedBufSize, views, count);
+		}
+
+		// Push the reading read_sensor_thread has just produced
+		if ((actual_flags & INTERCORE_EVENT_SENSOR_READY) && sensorStreaming) {
+			push_sensor_reading();
 		}
+
+		// One doorbell for all the replies generated by this wakeup
+		batch_flush_if_due(&outbound_batch);
+
+		latency_collect();
 	}
 }
 
@@ -318,14 +925,23 @@ void set_hvac_operating_mode(int temperature) {
 		hvac_mode.previous_led = hvac_mode.current_led;
 	}
 
-	enviroment_control_block.operating_mode = hvac_mode.current_led;
 	// minus one as first item is HVAC_MODE_UNKNOWN
 	mtk_os_hal_gpio_set_output(ledRgb[hvac_mode.current_led - 1], false);
 }
 
+/// <summary>
+/// Wake the intercore thread to push a fresh reading if the high-level app has subscribed.
+/// </summary>
+void notify_sensor_subscriber(void) {
+	if (sensorStreaming && tx_event_flags_set(&Intercore_event_flags_0, INTERCORE_EVENT_SENSOR_READY, TX_OR) != TX_SUCCESS) {
+		printf("failed to set Intercore event flags\r\n");
+	}
+}
+
 // sensor read
 #if defined(OEM_AVNET)
 void read_sensor_thread(ULONG thread_input) {
+	INTERCORE_BLOCK reading;
 	ULONG actual_flags;
 	int rand_number;
 	UINT status;
@@ -337,21 +953,26 @@ void read_sensor_thread(ULONG thread_input) {
 
 		if ((status != TX_SUCCESS) || (actual_flags != 0x1)) { break; }
 
-		enviroment_control_block.cmd = IC_READ_SENSOR;
+		periodic_job_started(&sensorJob);
+
+		reading.cmd = IC_READ_SENSOR;
 
-		enviroment_control_block.temperature = round(lp_get_temperature_lps22h());
-		enviroment_control_block.pressure = round(lp_get_pressure());
+		reading.temperature = round(lp_get_temperature_lps22h());
+		reading.pressure = round(lp_get_pressure());
 
 		rand_number = rand() % 20;
-		enviroment_control_block.humidity = 40.0 + rand_number;
+		reading.humidity = 40.0 + rand_number;
 
-		hvac_mode.last_temperature = enviroment_control_block.temperature;
+		set_hvac_operating_mode(reading.temperature);
+		reading.operating_mode = hvac_mode.current_led;
 
-		set_hvac_operating_mode(enviroment_control_block.temperature);
+		intercore_snapshot_publish(&environment_snapshot, &reading);
+		notify_sensor_subscriber();
 	}
 }
 #else
 void read_sensor_thread(ULONG thread_input) {
+	INTERCORE_BLOCK reading;
 	ULONG actual_flags;
 	int rand_number;
 	UINT status;
@@ -364,20 +985,24 @@ void read_sensor_thread(ULONG thread_input) {
 
 		if ((status != TX_SUCCESS) || (actual_flags != 0x1)) { break; }
 
-		enviroment_control_block.cmd = IC_READ_SENSOR;
+		periodic_job_started(&sensorJob);
+
+		reading.cmd = IC_READ_SENSOR;
 
 		rand_number = (rand() % 10);
-		enviroment_control_block.temperature = (float)(15.0 + rand_number);
+		reading.temperature = (float)(15.0 + rand_number);
 
 		rand_number = (rand() % 100);
-		enviroment_control_block.pressure = (float)(950.0 + rand_number);
+		reading.pressure = (float)(950.0 + rand_number);
 
 		rand_number = (rand() % 20);
-		enviroment_control_block.humidity = (float)(40.0 + rand_number);
+		reading.humidity = (float)(40.0 + rand_number);
 
-		hvac_mode.last_temperature = enviroment_control_block.temperature;
+		set_hvac_operating_mode(reading.temperature);
+		reading.operating_mode = hvac_mode.current_led;
 
-		set_hvac_operating_mode(enviroment_control_block.temperature);
+		intercore_snapshot_publish(&environment_snapshot, &reading);
+		notify_sensor_subscriber();
 	}
 }
 #endif
@@ -392,13 +1017,13 @@ void hardware_init_thread(ULONG thread_input) {
 	// hardwareInitOK = initialize_hardware();
 
 	if (initialize_hardware()) {
-		// start the timer.
+		// start sampling.
+		status = periodic_job_create(&sensorJob, "sensor job", sensor_job_expired, sensorPeriodTicks);
 		hardwareInitOK = true;
-		status = tx_timer_create(&msTimer, "10ms Timer", timer_scheduler, 0, 1, 1, TX_AUTO_ACTIVATE);
 		if (status != TX_SUCCESS) {
-			printf("failed to create timer\r\n");
+			printf("failed to create sensor job\r\n");
 		} else {
-			printf("timer created ok\r\n");
+			printf("sensor job created ok\r\n");
 		}
 	}
 
@@ -3,18 +3,36 @@
 
 #include <stdbool.h>
 
+#if defined(INTERCORE_HOST_SIM)
+// Mailbox registers are emulated by the host simulator, see IntercoreSimulator.
+#include "intercore_sim.h"
+#else
 #include "mt3620-baremetal.h"
+#endif
 #include "mt3620-intercore.h"
 //#include "mt3620-uart-poll.h"
 
 static const uintptr_t MAILBOX_BASE = 0x21050000;
 
+static IntercoreStats stats;
+static uint32_t capabilities = INTERCORE_CAP_ALIGNED_COPY;
+// Outbound space the bulk lane must leave free for the control lane.
+static uint32_t controlLaneReserve;
+// Remote read position seen by the last ReserveData, for the high-water mark.
+static uint32_t reservedRemoteReadPosition;
+// The last ReserveData wrote a padding block and placed the reservation at the start.
+static bool reservedAfterPadding;
+
 static void ReceiveMessage(uint32_t *command, uint32_t *data);
 static uint32_t GetBufferSize(uint32_t bufferBase);
 static BufferHeader *GetBufferHeader(uint32_t bufferBase);
 static uint8_t *DataAreaOffset8(BufferHeader *header, size_t offset);
 static uint32_t *DataAreaOffset32(BufferHeader *header, size_t offset);
 static uint32_t RoundUp(uint32_t value, uint32_t alignment);
+static uint32_t NextBlockPosition(uint32_t position, uint32_t blockSize, uint32_t bufSize);
+static void CopySpan(uint8_t *dest, const uint8_t *src, uint32_t length);
+static int ViewBlockAt(BufferHeader *inbound, uint32_t bufSize, uint32_t localReadPosition,
+                       uint32_t remoteWritePosition, IntercoreBlockView *view);
 
 static void ReceiveMessage(uint32_t *command, uint32_t *data)
 {
@@ -96,9 +114,68 @@ static uint32_t RoundUp(uint32_t value, uint32_t alignment)
     return (value + (alignment - 1)) & ~(alignment - 1);
 }
 
-int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize, const void *src,
-                uint32_t dataSize)
+static uint32_t NextBlockPosition(uint32_t position, uint32_t blockSize, uint32_t bufSize)
+{
+    // Round to next aligned block, and wraparound end of buffer if required.
+    position = RoundUp(position + sizeof(uint32_t) + blockSize, RINGBUFFER_ALIGNMENT);
+    if (position >= bufSize) {
+        position -= bufSize;
+    }
+    return position;
+}
+
+static void CopySpan(uint8_t *dest, const uint8_t *src, uint32_t length)
+{
+    // Block payloads start 4 bytes past an aligned boundary, so the common case is whole words.
+    // The word loop goes through volatile pointers so the compiler does not turn it back into a
+    // byte-granular memcpy call, each access to uncached shared SRAM is a bus transaction.
+    if ((capabilities & INTERCORE_CAP_ALIGNED_COPY) &&
+        (((uintptr_t)dest | (uintptr_t)src | length) & (sizeof(uint32_t) - 1)) == 0) {
+        volatile uint32_t *dest32 = (volatile uint32_t *)dest;
+        const volatile uint32_t *src32 = (const volatile uint32_t *)src;
+
+        for (length /= sizeof(uint32_t); length >= 4; length -= 4) {
+            dest32[0] = src32[0];
+            dest32[1] = src32[1];
+            dest32[2] = src32[2];
+            dest32[3] = src32[3];
+            dest32 += 4;
+            src32 += 4;
+        }
+        while (length-- > 0) {
+            *dest32++ = *src32++;
+        }
+        return;
+    }
+
+    __builtin_memcpy(dest, src, length);
+}
+
+void SetIntercoreCapabilities(uint32_t newCapabilities)
+{
+    capabilities = newCapabilities;
+}
+
+int ConfigureIntercoreLanes(uint32_t bufSize, uint32_t controlLaneSize)
+{
+    if (controlLaneSize > bufSize / 2) {
+        return -1;
+    }
+
+    controlLaneReserve = controlLaneSize;
+    return 0;
+}
+
+int ReserveData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
+                uint32_t dataSize, IntercoreBlockView *view)
 {
+    return ReserveLaneData(inbound, outbound, bufSize, INTERCORE_LANE_CONTROL, dataSize, view);
+}
+
+int ReserveLaneData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
+                    IntercoreLane lane, uint32_t dataSize, IntercoreBlockView *view)
+{
+    uint32_t laneReserve = (lane == INTERCORE_LANE_BULK) ? controlLaneReserve : 0;
     uint32_t remoteReadPosition = inbound->readPosition;
     uint32_t localWritePosition = outbound->writePosition;
 
@@ -116,7 +193,10 @@ int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
     }
 
     // If there isn't enough space to enqueue a block, then abort the operation.
-    if (availSpace < sizeof(uint32_t) + dataSize + RINGBUFFER_ALIGNMENT) {
+    if (availSpace < sizeof(uint32_t) + dataSize + RINGBUFFER_ALIGNMENT + laneReserve) {
+        if (sizeof(uint32_t) + dataSize + RINGBUFFER_ALIGNMENT + laneReserve > bufSize) {
+            stats.oversize++;
+        }
         //Uart_WriteStringPoll("EnqueueData: not enough space to enqueue block\r\n");
         return -1;
     }
@@ -132,45 +212,118 @@ int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
         return -1;
     }
 
-    uint32_t writeToEnd = sizeof(uint32_t) + dataSize;
-    if (dataToEnd < writeToEnd) {
-        writeToEnd = dataToEnd;
+    reservedRemoteReadPosition = remoteReadPosition;
+    reservedAfterPadding = false;
+
+    // Rather than split the block, pad out the end of the data area and start the block at the
+    // beginning, as long as the padding does not leave the block short of space. The padding is
+    // always smaller than the block, and one copy into a contiguous block is cheaper than two.
+    uint32_t blockLength = sizeof(uint32_t) + dataSize;
+    if ((capabilities & INTERCORE_CAP_WRAP_PADDING) && blockLength > dataToEnd &&
+        availSpace >= dataToEnd + blockLength + RINGBUFFER_ALIGNMENT + laneReserve) {
+        // Invisible to the remote side until CommitData moves the write position past the block.
+        *DataAreaOffset32(outbound, localWritePosition) =
+            INTERCORE_PADDING_BLOCK | (dataToEnd - sizeof(uint32_t));
+        reservedAfterPadding = true;
+        localWritePosition = 0;
+        dataToEnd = bufSize;
+    }
+
+    uint32_t writeToEnd = dataToEnd - sizeof(uint32_t);
+    if (dataSize < writeToEnd) {
+        writeToEnd = dataSize;
     }
 
-    // Write block size to first word in block.
+    // Write block size to first word in block. The remote side cannot see it until the write
+    // position is advanced by CommitData.
     *DataAreaOffset32(outbound, localWritePosition) = dataSize;
-    writeToEnd -= sizeof(uint32_t);
 
-    const uint8_t *src8 = src;
-    uint8_t *dest8 = DataAreaOffset8(outbound, localWritePosition + sizeof(uint32_t));
+    view->position = localWritePosition;
+    view->blockSize = dataSize;
+    view->data[0] = DataAreaOffset8(outbound, localWritePosition + sizeof(uint32_t));
+    view->size[0] = writeToEnd;
+    view->data[1] = (dataSize > writeToEnd) ? DataAreaOffset8(outbound, 0) : NULL;
+    view->size[1] = dataSize - writeToEnd;
+
+    return 0;
+}
 
-    __builtin_memcpy(dest8, src8, writeToEnd);
-    __builtin_memcpy(DataAreaOffset8(outbound, 0), src8 + writeToEnd, dataSize - writeToEnd);
+int CommitData(BufferHeader *outbound, uint32_t bufSize, const IntercoreBlockView *view)
+{
+    uint32_t localWritePosition = outbound->writePosition;
 
-    // Advance write position.
-    localWritePosition =
-        RoundUp(localWritePosition + sizeof(uint32_t) + dataSize, RINGBUFFER_ALIGNMENT);
-    if (localWritePosition >= bufSize) {
-        localWritePosition -= bufSize;
+    // A block placed behind a padding block starts at the beginning of the data area.
+    if (view->position != localWritePosition && !(reservedAfterPadding && view->position == 0)) {
+        return -1;
     }
+
+    // Advance write position, past the padding too.
+    localWritePosition = NextBlockPosition(view->position, view->blockSize, bufSize);
+
+    // The block contents must be in the shared buffer before the new write position is.
+    __sync_synchronize();
     outbound->writePosition = localWritePosition;
 
+    stats.committed++;
+    if (view->size[1] != 0) {
+        stats.wraps++;
+    }
+    if (reservedAfterPadding) {
+        stats.padded++;
+        reservedAfterPadding = false;
+    }
+
+    // Bytes the remote side had still to read when the block was reserved, plus the block.
+    uint32_t pending = localWritePosition - reservedRemoteReadPosition;
+    if (localWritePosition < reservedRemoteReadPosition) {
+        pending += bufSize;
+    }
+    if (pending > stats.highWater) {
+        stats.highWater = pending;
+    }
+
     // SW_TX_INT_PORT[0] = 1 -> indicate message sent.
     WriteReg32(MAILBOX_BASE, 0x14, 1U << 0);
     return 0;
 }
 
-int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize, void *dest,
-                uint32_t *dataSize)
+int TrimReservedData(BufferHeader *outbound, IntercoreBlockView *view, uint32_t dataSize)
 {
-    uint32_t remoteWritePosition = inbound->writePosition;
-    uint32_t localReadPosition = outbound->readPosition;
+    if (dataSize > view->blockSize) {
+        return -1;
+    }
 
-    if (remoteWritePosition >= bufSize) {
-        //Uart_WriteStringPoll("DequeueData: remoteWritePosition invalid\r\n");
+    *DataAreaOffset32(outbound, view->position) = dataSize;
+
+    view->blockSize = dataSize;
+    if (dataSize <= view->size[0]) {
+        view->size[0] = dataSize;
+        view->data[1] = NULL;
+        view->size[1] = 0;
+    } else {
+        view->size[1] = dataSize - view->size[0];
+    }
+
+    return 0;
+}
+
+int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize, const void *src,
+                uint32_t dataSize)
+{
+    IntercoreBlockView view;
+
+    if (ReserveData(inbound, outbound, bufSize, dataSize, &view) == -1) {
         return -1;
     }
 
+    WriteBlockView(&view, 0, src, dataSize);
+
+    return CommitData(outbound, bufSize, &view);
+}
+
+static int ViewBlockAt(BufferHeader *inbound, uint32_t bufSize, uint32_t localReadPosition,
+                       uint32_t remoteWritePosition, IntercoreBlockView *view)
+{
     size_t availData;
     // If data is contiguous in buffer then difference between write and read positions...
     if (remoteWritePosition >= localReadPosition) {
@@ -198,22 +351,21 @@ int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
 
     uint32_t blockSize = *DataAreaOffset32(inbound, localReadPosition);
 
+    // Padding runs to the end of the data area, the block after it starts at the beginning.
+    // The view then starts at 0, the caller hands the padding back with the read position.
+    if ((capabilities & INTERCORE_CAP_WRAP_PADDING) && (blockSize & INTERCORE_PADDING_BLOCK)) {
+        if (localReadPosition == 0) {
+            return -1;
+        }
+        return ViewBlockAt(inbound, bufSize, 0, remoteWritePosition, view);
+    }
+
     // Ensure the block size is no greater than the available data.
     if (blockSize + sizeof(uint32_t) > availData) {
         //Uart_WriteStringPoll("DequeueData: message size greater than available data\r\n");
         return -1;
     }
 
-    // Abort if the caller-supplied buffer is not large enough to hold the message.
-    if (blockSize > *dataSize) {
-        //Uart_WriteStringPoll("DequeueData: message too large for buffer\r\n");
-        *dataSize = blockSize;
-        return -1;
-    }
-
-    // Tell the caller the actual block size.
-    *dataSize = blockSize;
-
     // Read up to the end of the buffer. If the block ends before then, only read up to the end
     // of the block.
     uint32_t readFromEnd = dataToEnd - sizeof(uint32_t);
@@ -221,19 +373,81 @@ int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
         readFromEnd = blockSize;
     }
 
-    const uint8_t *src8 = DataAreaOffset8(inbound, localReadPosition + sizeof(uint32_t));
-    uint8_t *dest8 = dest;
-    __builtin_memcpy(dest8, src8, readFromEnd);
-    // If block wrapped around the end of the buffer, then read remainder from start.
-    __builtin_memcpy(dest8 + readFromEnd, DataAreaOffset8(inbound, 0), blockSize - readFromEnd);
+    view->position = localReadPosition;
+    view->blockSize = blockSize;
+    view->data[0] = DataAreaOffset8(inbound, localReadPosition + sizeof(uint32_t));
+    view->size[0] = readFromEnd;
+    // If block wrapped around the end of the buffer, then the remainder is at the start.
+    view->data[1] = (blockSize > readFromEnd) ? DataAreaOffset8(inbound, 0) : NULL;
+    view->size[1] = blockSize - readFromEnd;
+
+    return 0;
+}
 
-    // Round read position to next aligned block, and wraparound end of buffer if required.
-    localReadPosition =
-        RoundUp(localReadPosition + sizeof(uint32_t) + blockSize, RINGBUFFER_ALIGNMENT);
-    if (localReadPosition >= bufSize) {
-        localReadPosition -= bufSize;
+int PeekData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
+             IntercoreBlockView *view)
+{
+    uint32_t remoteWritePosition = inbound->writePosition;
+    uint32_t localReadPosition = outbound->readPosition;
+
+    if (remoteWritePosition >= bufSize) {
+        //Uart_WriteStringPoll("DequeueData: remoteWritePosition invalid\r\n");
+        return -1;
     }
 
+    // Read the block only after the remote write position which published it.
+    __sync_synchronize();
+    if (ViewBlockAt(inbound, bufSize, localReadPosition, remoteWritePosition, view) == -1) {
+        return -1;
+    }
+
+    // Skipped a padding block, there is nothing in it to read so release it now.
+    if (view->position != localReadPosition) {
+        outbound->readPosition = view->position;
+    }
+    return 0;
+}
+
+int DequeueBatch(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
+                 IntercoreBlockView *views, uint32_t maxViews)
+{
+    uint32_t remoteWritePosition = inbound->writePosition;
+    uint32_t localReadPosition = outbound->readPosition;
+    uint32_t count = 0;
+
+    if (remoteWritePosition >= bufSize) {
+        return 0;
+    }
+
+    // One barrier covers every block published up to this write position.
+    __sync_synchronize();
+
+    while (count < maxViews && ViewBlockAt(inbound, bufSize, localReadPosition,
+                                           remoteWritePosition, &views[count]) == 0) {
+        // Skipped a padding block at the front, there is nothing in it to read so release it now.
+        // ReleaseBatch only moves past the last view, padding between views needs no handling.
+        if (count == 0 && views[0].position != localReadPosition) {
+            outbound->readPosition = views[0].position;
+        }
+        localReadPosition = NextBlockPosition(views[count].position, views[count].blockSize, bufSize);
+        count++;
+    }
+
+    return (int)count;
+}
+
+int ReleaseData(BufferHeader *outbound, uint32_t bufSize, const IntercoreBlockView *view)
+{
+    uint32_t localReadPosition = outbound->readPosition;
+
+    if (view->position != localReadPosition) {
+        return -1;
+    }
+
+    localReadPosition = NextBlockPosition(localReadPosition, view->blockSize, bufSize);
+
+    // Finish reading the block before handing the space back to the remote side.
+    __sync_synchronize();
     outbound->readPosition = localReadPosition;
 
     // SW_TX_INT_PORT[1] = 1 -> indicate message received.
@@ -241,3 +455,129 @@ int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
 
     return 0;
 }
+
+const IntercoreStats *GetIntercoreStats(void)
+{
+    return &stats;
+}
+
+int ReleaseBatch(BufferHeader *outbound, uint32_t bufSize, const IntercoreBlockView *views,
+                 uint32_t count)
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    if (views[0].position != outbound->readPosition) {
+        return -1;
+    }
+
+    // Views from DequeueBatch are consecutive, so the read position only has to move past the last.
+    uint32_t localReadPosition =
+        NextBlockPosition(views[count - 1].position, views[count - 1].blockSize, bufSize);
+
+    // Finish reading the blocks before handing the space back to the remote side.
+    __sync_synchronize();
+    outbound->readPosition = localReadPosition;
+
+    // SW_TX_INT_PORT[1] = 1 -> indicate message received, once for the whole batch.
+    WriteReg32(MAILBOX_BASE, 0x14, 1U << 1);
+
+    return 0;
+}
+
+int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize, void *dest,
+                uint32_t *dataSize)
+{
+    IntercoreBlockView view;
+
+    if (PeekData(outbound, inbound, bufSize, &view) == -1) {
+        return -1;
+    }
+
+    // Abort if the caller-supplied buffer is not large enough to hold the message.
+    if (view.blockSize > *dataSize) {
+        //Uart_WriteStringPoll("DequeueData: message too large for buffer\r\n");
+        *dataSize = view.blockSize;
+        return -1;
+    }
+
+    // Tell the caller the actual block size.
+    *dataSize = view.blockSize;
+
+    ReadBlockView(&view, 0, dest, view.blockSize);
+
+    return ReleaseData(outbound, bufSize, &view);
+}
+
+int WriteBlockView(const IntercoreBlockView *view, uint32_t offset, const void *src,
+                   uint32_t length)
+{
+    if (offset > view->blockSize || length > view->blockSize - offset) {
+        return -1;
+    }
+
+    const uint8_t *src8 = src;
+    uint32_t firstLength = 0;
+
+    if (offset < view->size[0]) {
+        firstLength = view->size[0] - offset;
+        if (length < firstLength) {
+            firstLength = length;
+        }
+        CopySpan(view->data[0] + offset, src8, firstLength);
+        offset = 0;
+    } else {
+        offset -= view->size[0];
+    }
+
+    if (length > firstLength) {
+        // The rest of the range wrapped around to the start of the buffer.
+        CopySpan(view->data[1] + offset, src8 + firstLength, length - firstLength);
+    }
+    return 0;
+}
+
+int ReadBlockView(const IntercoreBlockView *view, uint32_t offset, void *dest, uint32_t length)
+{
+    if (offset > view->blockSize || length > view->blockSize - offset) {
+        return -1;
+    }
+
+    uint8_t *dest8 = dest;
+    uint32_t firstLength = 0;
+
+    if (offset < view->size[0]) {
+        firstLength = view->size[0] - offset;
+        if (length < firstLength) {
+            firstLength = length;
+        }
+        CopySpan(dest8, view->data[0] + offset, firstLength);
+        offset = 0;
+    } else {
+        offset -= view->size[0];
+    }
+
+    if (length > firstLength) {
+        // The rest of the range wrapped around to the start of the buffer.
+        CopySpan(dest8 + firstLength, view->data[1] + offset, length - firstLength);
+    }
+    return 0;
+}
+
+void *BlockViewPointer(const IntercoreBlockView *view, uint32_t offset, uint32_t length)
+{
+    if (offset > view->blockSize || length > view->blockSize - offset) {
+        return NULL;
+    }
+
+    if (offset + length <= view->size[0]) {
+        return view->data[0] + offset;
+    }
+
+    if (offset >= view->size[0]) {
+        return view->data[1] + (offset - view->size[0]);
+    }
+
+    return NULL;
+}
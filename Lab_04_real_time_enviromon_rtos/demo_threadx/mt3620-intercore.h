@@ -27,8 +27,81 @@ typedef struct {
     uint32_t reserved[14];
 } BufferHeader;
 
-/// <summary>Blocks inside the shared buffer have this alignment.</summary>
+/// <summary>
+/// <para>Blocks inside the shared buffer have this alignment.</para>
+/// <para>The high-level side of the ring expects 16; other values are only meaningful when
+/// both ends are built from this file, as in the host simulator.</para>
+/// </summary>
+#ifndef RINGBUFFER_ALIGNMENT
 #define RINGBUFFER_ALIGNMENT 16
+#endif
+
+/// <summary>
+/// <para>Describes a block which lives inside a shared buffer, so it can be written or read
+/// in place without copying it through a staging buffer.</para>
+/// <para>A block which wraps around the end of the data area is described by two spans.
+/// When the block is contiguous, <c>size[1]</c> is zero and <c>data[0]</c> can be used
+/// directly.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Start of each span inside the shared buffer.</summary>
+    uint8_t *data[2];
+    /// <summary>Length of each span in bytes.</summary>
+    uint32_t size[2];
+    /// <summary>Offset of the block size word within the data area.</summary>
+    uint32_t position;
+    /// <summary>Length of the block payload in bytes (the sum of both spans).</summary>
+    uint32_t blockSize;
+} IntercoreBlockView;
+
+/// <summary>
+/// <para>Logical lanes multiplexed over the outbound buffer.</para>
+/// <para>Bulk blocks may not take the space set aside for the control lane, so control messages
+/// can always be sent even when the high-level application has fallen behind on bulk data.</para>
+/// </summary>
+typedef enum {
+    INTERCORE_LANE_CONTROL,
+    INTERCORE_LANE_BULK
+} IntercoreLane;
+
+/// <summary>
+/// <para>Optional transport features, see <see cref="SetIntercoreCapabilities" />.</para>
+/// </summary>
+typedef enum {
+    /// <summary>Copy 4-byte aligned spans a word at a time. Only changes how the local side
+    /// copies, the buffer contents are the same. On by default.</summary>
+    INTERCORE_CAP_ALIGNED_COPY = 1U << 0,
+    /// <summary><para>Pad out the end of the data area instead of splitting a block around it,
+    /// when the padding costs no more than the block. Off by default.</para>
+    /// <para>Both ends must enable it, a reader without it would take the padding for a
+    /// message. The Azure Sphere OS end of the ring does not support it, so only enable it
+    /// when both ends are built from this file, as in the host simulator.</para></summary>
+    INTERCORE_CAP_WRAP_PADDING = 1U << 1
+} IntercoreCapability;
+
+/// <summary>
+/// <para>Set in the size word of a padding block, which runs to the end of the data area. See
+/// <see cref="INTERCORE_CAP_WRAP_PADDING" />.</para>
+/// </summary>
+#define INTERCORE_PADDING_BLOCK 0x80000000U
+
+/// <summary>
+/// Counters kept by the outbound functions, totals since startup.
+/// </summary>
+typedef struct {
+    /// <summary>Blocks published by <see cref="CommitData" />.</summary>
+    uint32_t committed;
+    /// <summary>Reservations larger than the buffer can ever hold.</summary>
+    uint32_t oversize;
+    /// <summary>Committed blocks split around the end of the data area.</summary>
+    uint32_t wraps;
+    /// <summary>Committed blocks moved to the start of the data area behind a padding block.
+    /// </summary>
+    uint32_t padded;
+    /// <summary>Most bytes waiting for the high-level application, measured at each commit.
+    /// </summary>
+    uint32_t highWater;
+} IntercoreStats;
 
 /// <summary>
 /// <para>Gets the inbound and outbound buffers used to communicate with the high-level
@@ -44,6 +117,24 @@ typedef struct {
 /// <returns>0 on success, -1 on failure.</returns>
 int GetIntercoreBuffers(BufferHeader **outbound, BufferHeader **inbound, uint32_t *bufSize);
 
+/// <summary>
+/// <para>Set aside part of the outbound buffer for the control lane. Call after
+/// <see cref="GetIntercoreBuffers" />; until then no space is set aside.</para>
+/// </summary>
+/// <param name="bufSize">
+/// The total buffer size, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="controlLaneSize">Bytes the bulk lane must always leave free.</param>
+/// <returns>0 on success, -1 if the bulk lane would be left less than half the buffer.</returns>
+int ConfigureIntercoreLanes(uint32_t bufSize, uint32_t controlLaneSize);
+
+/// <summary>
+/// Choose the optional transport features in use, a combination of
+/// <see cref="IntercoreCapability" /> flags. Call before any data is exchanged.
+/// </summary>
+/// <param name="capabilities">Flags to enable, every other feature is disabled.</param>
+void SetIntercoreCapabilities(uint32_t capabilities);
+
 /// <summary>
 /// Add data to the shared buffer, to be read by the high-level application.
 /// </summary>
@@ -76,4 +167,152 @@ int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
 int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize, void *dest,
                 uint32_t *dataSize);
 
+/// <summary>
+/// <para>Reserve space in the outbound shared buffer for a block of <paramref name="dataSize" />
+/// bytes. The caller builds the message directly in the returned view and then publishes it with
+/// <see cref="CommitData" />.</para>
+/// <para>Nothing is visible to the high-level application until the block is committed. Only one
+/// reservation may be outstanding at a time.</para>
+/// </summary>
+/// <param name="inbound">The inbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="bufSize">
+/// The total buffer size, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="dataSize">Length of the block to reserve in bytes.</param>
+/// <param name="view">On success, describes where the block payload must be written.</param>
+/// <returns>0 if the space was reserved, -1 otherwise.</returns>
+int ReserveData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
+                uint32_t dataSize, IntercoreBlockView *view);
+
+/// <summary>
+/// <see cref="ReserveData" /> on a given lane. <see cref="ReserveData" /> and
+/// <see cref="EnqueueData" /> use the control lane.
+/// </summary>
+/// <param name="lane">Lane the block belongs to.</param>
+/// <returns>0 if the space was reserved, -1 otherwise.</returns>
+int ReserveLaneData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
+                    IntercoreLane lane, uint32_t dataSize, IntercoreBlockView *view);
+
+/// <summary>
+/// Publish a block previously obtained from <see cref="ReserveData" /> and notify the high-level
+/// application. The resulting buffer contents are identical to those written by
+/// <see cref="EnqueueData" />.
+/// </summary>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="bufSize">Total size of shared buffer in bytes.</param>
+/// <param name="view">The view returned by <see cref="ReserveData" />.</param>
+/// <returns>0 on success, -1 if the view does not match the current write position.</returns>
+int CommitData(BufferHeader *outbound, uint32_t bufSize, const IntercoreBlockView *view);
+
+/// <summary>
+/// Shorten a reserved block before it is committed. This lets a producer reserve the largest
+/// message it might build, such as a batch frame, and publish only the part it filled.
+/// </summary>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="view">The view returned by <see cref="ReserveData" />, updated on success.</param>
+/// <param name="dataSize">New length of the block in bytes, no greater than the reserved length.
+/// </param>
+/// <returns>0 on success, -1 if the block would grow.</returns>
+int TrimReservedData(BufferHeader *outbound, IntercoreBlockView *view, uint32_t dataSize);
+
+/// <summary>
+/// <para>Get a view of the next block written by the high-level application without copying it
+/// out of the shared buffer. The block stays in the buffer until <see cref="ReleaseData" /> is
+/// called.</para>
+/// </summary>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="inbound">The inbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="bufSize">Total size of shared buffer in bytes.</param>
+/// <param name="view">On success, describes where the block payload can be read.</param>
+/// <returns>0 if a block is available, -1 otherwise.</returns>
+int PeekData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
+             IntercoreBlockView *view);
+
+/// <summary>
+/// Consume a block previously obtained from <see cref="PeekData" /> and notify the high-level
+/// application that space has been freed.
+/// </summary>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="bufSize">Total size of shared buffer in bytes.</param>
+/// <param name="view">The view returned by <see cref="PeekData" />.</param>
+/// <returns>0 on success, -1 if the view does not match the current read position.</returns>
+int ReleaseData(BufferHeader *outbound, uint32_t bufSize, const IntercoreBlockView *view);
+
+/// <summary>
+/// <para>Get views of every block written by the high-level application, up to
+/// <paramref name="maxViews" />, without copying them out of the shared buffer. The remote write
+/// position is read once for the whole batch.</para>
+/// <para>The blocks stay in the buffer until <see cref="ReleaseBatch" /> is called.</para>
+/// </summary>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="inbound">The inbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="bufSize">Total size of shared buffer in bytes.</param>
+/// <param name="views">On return, describes each available block in the order it was written.
+/// </param>
+/// <param name="maxViews">Number of entries in <paramref name="views" />.</param>
+/// <returns>Number of views filled in, 0 if no block is available.</returns>
+int DequeueBatch(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
+                 IntercoreBlockView *views, uint32_t maxViews);
+
+/// <summary>
+/// Consume every block returned by <see cref="DequeueBatch" /> with a single read position update
+/// and a single notification to the high-level application.
+/// </summary>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="bufSize">Total size of shared buffer in bytes.</param>
+/// <param name="views">The views returned by <see cref="DequeueBatch" />.</param>
+/// <param name="count">The count returned by <see cref="DequeueBatch" />.</param>
+/// <returns>0 on success, -1 if the views do not start at the current read position.</returns>
+int ReleaseBatch(BufferHeader *outbound, uint32_t bufSize, const IntercoreBlockView *views,
+                 uint32_t count);
+
+/// <summary>
+/// Get the outbound counters.
+/// </summary>
+const IntercoreStats *GetIntercoreStats(void);
+
+/// <summary>
+/// Copy bytes into a reserved block, splitting the copy around the end of the data area if
+/// required.
+/// </summary>
+/// <param name="view">The view returned by <see cref="ReserveData" />.</param>
+/// <param name="offset">Offset within the block payload to start writing at.</param>
+/// <param name="src">Start of data to write.</param>
+/// <param name="length">Number of bytes to write.</param>
+/// <returns>0 on success, -1 if the write would overrun the block.</returns>
+int WriteBlockView(const IntercoreBlockView *view, uint32_t offset, const void *src,
+                   uint32_t length);
+
+/// <summary>
+/// Copy bytes out of a peeked block, joining the two spans if the block wraps.
+/// </summary>
+/// <param name="view">The view returned by <see cref="PeekData" />.</param>
+/// <param name="offset">Offset within the block payload to start reading from.</param>
+/// <param name="dest">Bytes are copied into this buffer.</param>
+/// <param name="length">Number of bytes to read.</param>
+/// <returns>0 on success, -1 if the read would overrun the block.</returns>
+int ReadBlockView(const IntercoreBlockView *view, uint32_t offset, void *dest, uint32_t length);
+
+/// <summary>
+/// Get a contiguous pointer to part of a block, if that part does not straddle the wrap point.
+/// </summary>
+/// <param name="view">A view returned by <see cref="ReserveData" /> or <see cref="PeekData" />.
+/// </param>
+/// <param name="offset">Offset within the block payload.</param>
+/// <param name="length">Number of bytes which must be contiguous.</param>
+/// <returns>Pointer into the shared buffer, or NULL if the range wraps or overruns the block.
+/// </returns>
+void *BlockViewPointer(const IntercoreBlockView *view, uint32_t offset, uint32_t length);
+
 #endif // #ifndef MT3620_INTERCORE_H
@@ -0,0 +1,74 @@
+#include "periodic_job.h"
+
+// tx_initialize_low_level.S starts the DWT cycle counter and runs the core at 200 MHz. The CMSIS
+// headers clash with the ThreadX types, so the counter is read by address.
+#define DWT_CYCCNT (*(volatile uint32_t*)0xE0001004)
+#define CYCLES_PER_US (200000000 / 1000000)
+
+static VOID periodic_job_expired(ULONG input) {
+	PERIODIC_JOB* job = (PERIODIC_JOB*)input;
+
+	// Keep the first expiry, the run that eventually starts is late from that one
+	if (job->pending) {
+		job->missed++;
+	} else {
+		job->expiredCycles = DWT_CYCCNT;
+		job->pending = true;
+	}
+
+	// A skipped run is not timed, whatever starts the work later is not late from this expiry
+	if (!job->expire(job)) {
+		job->pending = false;
+	}
+}
+
+UINT periodic_job_create(PERIODIC_JOB* job, CHAR* name, bool (*expire)(PERIODIC_JOB* job), ULONG period) {
+	job->expire = expire;
+	job->period = period;
+	job->pending = false;
+	job->runs = job->missed = 0;
+	job->latencyMinUs = UINT32_MAX;
+	job->latencyMaxUs = 0;
+	job->latencyTotalUs = 0;
+
+	// ThreadX will not create a timer with no initial ticks, a stopped job gets a placeholder
+	return tx_timer_create(&job->timer, name, periodic_job_expired, (ULONG)job, period ? period : 1, period,
+		period ? TX_AUTO_ACTIVATE : TX_NO_ACTIVATE);
+}
+
+UINT periodic_job_set_period(PERIODIC_JOB* job, ULONG period) {
+	UINT status;
+
+	if (period == job->period) { return TX_SUCCESS; }
+
+	job->period = period;
+	tx_timer_deactivate(&job->timer);
+
+	if (period == 0) { return TX_SUCCESS; }
+
+	status = tx_timer_change(&job->timer, period, period);
+	return status == TX_SUCCESS ? tx_timer_activate(&job->timer) : status;
+}
+
+void periodic_job_started(PERIODIC_JOB* job) {
+	uint32_t latencyUs;
+
+	if (!job->pending) { return; }
+
+	// Unsigned subtraction survives the counter wrapping, every 21 s at 200 MHz
+	latencyUs = (DWT_CYCCNT - job->expiredCycles) / CYCLES_PER_US;
+	job->pending = false;
+
+	job->runs++;
+	job->latencyTotalUs += latencyUs;
+	if (latencyUs < job->latencyMinUs) { job->latencyMinUs = latencyUs; }
+	if (latencyUs > job->latencyMaxUs) { job->latencyMaxUs = latencyUs; }
+}
+
+uint32_t periodic_job_latency_avg_us(const PERIODIC_JOB* job) {
+	return job->runs ? (uint32_t)(job->latencyTotalUs / job->runs) : 0;
+}
+
+uint32_t periodic_job_jitter_us(const PERIODIC_JOB* job) {
+	return job->runs ? job->latencyMaxUs - job->latencyMinUs : 0;
+}
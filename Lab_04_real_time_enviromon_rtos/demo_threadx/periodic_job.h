@@ -0,0 +1,51 @@
+#pragma once
+
+#include "tx_api.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Periodic jobs for the ThreadX app, each on its own tx_timer.
+//
+// ThreadX only runs the expiry of a job when it is due, so an idle app handles no timer callbacks
+// between runs whatever the mix of periods. The expiry runs in the ThreadX timer thread and should
+// only wake the thread that does the work, for example by setting an event flag, or return false
+// to skip the run. That thread calls periodic_job_started when it picks the run up, which times the
+// dispatch latency from the expiry with the DWT cycle counter. Expiries land on the 10 ms tick, so
+// the spread of the latency is the jitter the job sees.
+
+typedef struct periodic_job {
+	TX_TIMER timer;
+	bool (*expire)(struct periodic_job* job);	// timer thread context, false if it skipped the run
+	ULONG period;								// ticks, 0 while stopped
+	volatile uint32_t expiredCycles;			// DWT cycle count at the last expiry
+	volatile bool pending;						// expired and not started yet
+	uint32_t runs;
+	uint32_t missed;							// expiries that found the last run not started
+	uint32_t latencyMinUs;
+	uint32_t latencyMaxUs;
+	uint64_t latencyTotalUs;
+} PERIODIC_JOB;
+
+/// <summary>
+/// Create the job's timer, running every period ticks from now. A period of 0 creates it stopped.
+/// </summary>
+UINT periodic_job_create(PERIODIC_JOB* job, CHAR* name, bool (*expire)(PERIODIC_JOB* job), ULONG period);
+
+/// <summary>
+/// Change the period, the next run is one new period from now. 0 stops the job.
+/// An unchanged period is left alone so the job keeps its phase.
+/// </summary>
+UINT periodic_job_set_period(PERIODIC_JOB* job, ULONG period);
+
+/// <summary>
+/// Call from the thread doing the work as a run starts, records its dispatch latency.
+/// Runs started without an expiry, such as on demand samples, are not counted.
+/// </summary>
+void periodic_job_started(PERIODIC_JOB* job);
+
+uint32_t periodic_job_latency_avg_us(const PERIODIC_JOB* job);
+
+/// <summary>
+/// Spread of the dispatch latency, the most a run started later than the promptest one.
+/// </summary>
+uint32_t periodic_job_jitter_us(const PERIODIC_JOB* job);
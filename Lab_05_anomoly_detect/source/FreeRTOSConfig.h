@@ -67,11 +67,23 @@ errata. */
 #define configUSE_MALLOC_FAILED_HOOK			1
 #define configUSE_APPLICATION_TASK_TAG			1
 #define configUSE_COUNTING_SEMAPHORES			1
-#define configGENERATE_RUN_TIME_STATS			0
+#define configGENERATE_RUN_TIME_STATS			1
 #define configUSE_TIME_SLICING					0
 #define configHEAP_IN_SYSRAM					0
 
 /* Co-routine definitions. */
+/* Run time stats count the free-running 32KHz GPT2, set up in main.cpp. */
+#ifdef __cplusplus
+extern "C" {
+#endif
+void vConfigureRunTimeCounter(void);
+uint32_t ulGetRunTimeCounter(void);
+#ifdef __cplusplus
+}
+#endif
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()	vConfigureRunTimeCounter()
+#define portGET_RUN_TIME_COUNTER_VALUE()			ulGetRunTimeCounter()
+
 #define configUSE_CO_ROUTINES 			0
 #define configMAX_CO_ROUTINE_PRIORITIES 2
 
@@ -90,6 +102,7 @@ to exclude the API function. */
 #define INCLUDE_vTaskSuspend			1
 #define INCLUDE_vTaskDelayUntil			1
 #define INCLUDE_vTaskDelay				1
+#define INCLUDE_xTaskGetIdleTaskHandle	1
 
 /* Cortex-M specific definitions. */
 #ifdef __NVIC_PRIO_BITS
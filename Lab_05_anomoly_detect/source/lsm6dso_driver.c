@@ -33,6 +33,9 @@
  * MEDIATEK SOFTWARE AT ISSUE.
  */
 
+#include <stdbool.h>
+#include <string.h>
+
 #include "FreeRTOS.h"
 #include "task.h"
 #include "printf.h"
@@ -54,6 +57,14 @@ static float acceleration_mg[3];
 static float angular_rate_dps[3];
 static float lsm6dsoTemperature_degC;
 
+/* FIFO streaming, see lsm6dso_driver.h */
+#define LSM6DSO_TIMESTAMP_LSB_US 25
+/* In SYSRAM so the I2C DMA reads the burst straight in */
+static uint8_t fifo_words[LSM6DSO_FIFO_BURST_WORDS * LSM6DSO_FIFO_WORD_SIZE] __attribute__((section(".sysram")));
+static lsm6dso_sample_t fifo_pending;	/* sample whose words are still being read */
+static bool fifo_pending_data;			/* fifo_pending has a sensor word */
+static lsm6dso_fifo_stats_t fifo_stats;
+
 /******************************************************************************/
 /* Functions */
 /******************************************************************************/
@@ -125,6 +136,125 @@ void lsm6dso_show_result(void)
 	}
 }
 
+static int16_t fifo_axis(const uint8_t *word, int axis)
+{
+	return (int16_t)(word[1 + 2 * axis] | (word[2 + 2 * axis] << 8));
+}
+
+int lsm6dso_fifo_start(uint16_t watermark_words)
+{
+	/* Bypass first, which empties the FIFO of anything batched before */
+	if (lsm6dso_fifo_mode_set(&dev_ctx, LSM6DSO_BYPASS_MODE) ||
+		lsm6dso_fifo_watermark_set(&dev_ctx, watermark_words) ||
+		lsm6dso_fifo_xl_batch_set(&dev_ctx, LSM6DSO_XL_BATCHED_AT_104Hz) ||
+		lsm6dso_fifo_gy_batch_set(&dev_ctx, LSM6DSO_GY_BATCHED_AT_104Hz) ||
+		lsm6dso_timestamp_set(&dev_ctx, PROPERTY_ENABLE) ||
+		lsm6dso_fifo_timestamp_decimation_set(&dev_ctx, LSM6DSO_DEC_1) ||
+		lsm6dso_fifo_mode_set(&dev_ctx, LSM6DSO_STREAM_MODE)) {
+		printf("LSM6DSO: FIFO setup failed\n");
+		return -1;
+	}
+
+	memset(&fifo_pending, 0, sizeof(fifo_pending));
+	fifo_pending_data = false;
+	return 0;
+}
+
+int lsm6dso_fifo_interrupt_enable(void)
+{
+	lsm6dso_pin_int1_route_t route;
+
+	/* INT1 is high while the FIFO holds at least the watermark, push-pull so it needs no pull-up */
+	if (lsm6dso_pin_mode_set(&dev_ctx, LSM6DSO_PUSH_PULL) ||
+		lsm6dso_pin_polarity_set(&dev_ctx, LSM6DSO_ACTIVE_HIGH) ||
+		lsm6dso_pin_int1_route_get(&dev_ctx, &route)) {
+		printf("LSM6DSO: INT1 setup failed\n");
+		return -1;
+	}
+
+	route.int1_ctrl.int1_fifo_th = PROPERTY_ENABLE;
+	if (lsm6dso_pin_int1_route_set(&dev_ctx, &route)) {
+		printf("LSM6DSO: INT1 setup failed\n");
+		return -1;
+	}
+	return 0;
+}
+
+int lsm6dso_fifo_read(lsm6dso_sample_t *samples, int max_samples)
+{
+	uint8_t status[2];
+	uint16_t level;
+	int count = 0;
+
+	/* FIFO_STATUS1 and FIFO_STATUS2 in one read */
+	if (lsm6dso_read_reg(&dev_ctx, LSM6DSO_FIFO_STATUS1, status, sizeof(status))) {
+		return -1;
+	}
+	level = status[0] | ((((lsm6dso_fifo_status2_t *)&status[1])->diff_fifo) << 8);
+	if (((lsm6dso_fifo_status2_t *)&status[1])->fifo_ovr_ia) {
+		fifo_stats.overruns++;
+	}
+
+	/* Each sample takes a timestamp and at least an accelerometer word, so this many words fill
+	 * samples at most. The rest are left for the next read. */
+	if (level > LSM6DSO_FIFO_BURST_WORDS) {
+		level = LSM6DSO_FIFO_BURST_WORDS;
+	}
+	if (level > (uint16_t)max_samples * 2) {
+		level = (uint16_t)max_samples * 2;
+	}
+	if (level == 0) {
+		return 0;
+	}
+
+	/* The address rolls back from FIFO_DATA_OUT_Z_H to FIFO_DATA_OUT_TAG, so a single read returns
+	 * consecutive words */
+	if (lsm6dso_read_reg(&dev_ctx, LSM6DSO_FIFO_DATA_OUT_TAG, fifo_words, level * LSM6DSO_FIFO_WORD_SIZE)) {
+		return -1;
+	}
+	fifo_stats.bursts++;
+	fifo_stats.words += level;
+
+	for (uint16_t i = 0; i < level; i++) {
+		const uint8_t *word = &fifo_words[i * LSM6DSO_FIFO_WORD_SIZE];
+
+		switch ((lsm6dso_fifo_tag_t)(word[0] >> 3)) {
+		case LSM6DSO_TIMESTAMP_TAG:
+			/* A timestamp starts the words of the next sample, the pending one is complete */
+			if (fifo_pending_data && count < max_samples) {
+				samples[count++] = fifo_pending;
+			}
+			fifo_pending.timestamp_us = (uint32_t)(word[1] | (word[2] << 8) | (word[3] << 16) | ((uint32_t)word[4] << 24)) *
+				LSM6DSO_TIMESTAMP_LSB_US;
+			fifo_pending_data = false;
+			break;
+		case LSM6DSO_XL_NC_TAG:
+			/* Same conversion as lsm6dso_read, the model was trained on it */
+			for (int axis = 0; axis < 3; axis++) {
+				fifo_pending.acceleration_mg[axis] = lsm6dso_from_fs4_to_mg(fifo_axis(word, axis));
+			}
+			fifo_pending_data = true;
+			break;
+		case LSM6DSO_GYRO_NC_TAG:
+			for (int axis = 0; axis < 3; axis++) {
+				fifo_pending.angular_rate_dps[axis] = lsm6dso_from_fs2000_to_mdps(fifo_axis(word, axis) -
+					raw_angular_rate_calibration.i16bit[axis]) / 1000.0f;
+			}
+			break;
+		default:
+			/* Temperature and configuration change words, nothing batches them */
+			break;
+		}
+	}
+
+	return count;
+}
+
+void lsm6dso_fifo_stats(lsm6dso_fifo_stats_t *stats)
+{
+	*stats = fifo_stats;
+}
+
 int lsm6dso_init(void *i2c_write, void *i2c_read)
 {
 	uint8_t reg;
@@ -36,14 +36,55 @@
 #ifndef __LSM6DSO_DRIVER_H__
 #define __LSM6DSO_DRIVER_H__
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* FIFO streaming
+ * The sensor batches accelerometer, gyroscope and timestamp words into its FIFO at the output data
+ * rate, the application reads them back in bursts of up to LSM6DSO_FIFO_BURST_WORDS words, each
+ * burst one I2C transaction of LSM6DSO_FIFO_WORD_SIZE bytes a word. Samples carry the sensor's own
+ * timestamp, so when the burst is read does not change when the sample was taken.
+ */
+#define LSM6DSO_FIFO_WORD_SIZE 7	/* tag and 6 data bytes */
+#define LSM6DSO_FIFO_BURST_WORDS 64
+
+typedef struct {
+	uint32_t timestamp_us;	/* sensor clock, 25 us resolution, wraps */
+	float acceleration_mg[3];
+	float angular_rate_dps[3];	/* 0 until the first gyroscope word */
+} lsm6dso_sample_t;
+
+typedef struct {
+	uint32_t bursts;	/* I2C transactions reading FIFO words */
+	uint32_t words;
+	uint32_t overruns;	/* status reads that found the FIFO had overflowed, samples were lost */
+} lsm6dso_fifo_stats_t;
+
 void lsm6dso_read(float *x, float *y, float *z);
 void lsm6dso_show_result(void);
 int lsm6dso_init(void *i2c_write, void *i2c_read);
 
+/* Start batching into the FIFO, call after lsm6dso_init.
+ * watermark_words sets the FIFO watermark flag, the reader can sleep for that many words.
+ */
+int lsm6dso_fifo_start(uint16_t watermark_words);
+
+/* Raise INT1 while the FIFO holds at least the watermark, call after lsm6dso_init.
+ * The line stays high until a read takes the FIFO below the watermark, so the next rising edge is
+ * the next burst.
+ */
+int lsm6dso_fifo_interrupt_enable(void);
+
+/* Drain the FIFO into samples, oldest first, reading at most one burst.
+ * Returns the number of samples, or -1 if the sensor could not be read.
+ */
+int lsm6dso_fifo_read(lsm6dso_sample_t *samples, int max_samples);
+
+void lsm6dso_fifo_stats(lsm6dso_fifo_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
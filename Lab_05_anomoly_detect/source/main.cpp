@@ -6,12 +6,15 @@
 #include "printf.h"
 #include "mt3620.h"
 
+#include "os_hal_eint.h"
 #include "os_hal_gpio.h"
+#include "os_hal_gpt.h"
 #include "os_hal_uart.h"
 #include "os_hal_i2c.h"
 
 #include "lsm6dso_driver.h"
 #include "lsm6dso_reg.h"
+#include "sensor_wake.h"
 
 #include "ei_run_classifier.h"
 
@@ -39,12 +42,46 @@ static uint8_t *i2c_tx_buf;
 static uint8_t *i2c_rx_buf;
 
 #define I2C_MAX_LEN 64
+/* Reads are larger, a whole FIFO burst at once */
+#define I2C_RX_MAX_LEN (LSM6DSO_FIFO_BURST_WORDS * LSM6DSO_FIFO_WORD_SIZE)
+/* Reads over 8 bytes go by DMA, which only reaches SYSRAM, see the .sysram section in linker.ld */
+#define SYSRAM_START 0x22000000
+#define SYSRAM_END (SYSRAM_START + 64 * 1024)
 #define APP_STACK_SIZE_BYTES 1024
 
+/* CPU load and memory use */
+/* Task run time counts the free-running 32KHz GPT2, shares and memory use are printed every LOAD_REPORT_PERIOD_MS */
+static const enum gpt_num gpt_run_time = OS_HAL_GPT2;
+#define RUN_TIME_COUNTER_HZ 32768
+#define LOAD_REPORT_PERIOD_MS 10000
+#define LOAD_MAX_TASKS 8
+
+/* LSM6DSO FIFO */
+/* Samples batch at 104Hz as a timestamp, accelerometer and gyroscope word each. The watermark is
+   about 150ms of them, read in one burst, and FIFO_READ_PERIOD_MS is how long they take to arrive.
+   The watermark raises INT1, which wakes the I2C task through LSM6DSO_INT1_EINT. Set that to the
+   GPIO INT1 is wired to, GPIO0 to GPIO23, and add the GPIO to app_manifest.json. At -1, or if the
+   interrupts stop, the task polls instead, see sensor_wake.h */
+#define LSM6DSO_INT1_EINT -1
+#define FIFO_SAMPLE_HZ 104
+#define FIFO_WATERMARK_SAMPLES 16
+#define FIFO_WATERMARK_WORDS (FIFO_WATERMARK_SAMPLES * 3)
+#define FIFO_READ_PERIOD_MS (FIFO_WATERMARK_SAMPLES * 1000 / FIFO_SAMPLE_HZ)
+#define FIFO_MAX_SAMPLES (LSM6DSO_FIFO_BURST_WORDS / 2)
+/* Longer than this between samples, after an overrun say, and resampling starts again */
+#define FIFO_RESYNC_US 1000000
+
 // Edge Impulse
 static float buffer[EI_CLASSIFIER_DSP_INPUT_FRAME_SIZE] = { 0 };
 static float inference_buffer[EI_CLASSIFIER_DSP_INPUT_FRAME_SIZE] = { 0 };
 
+// Sensor
+static TaskHandle_t i2c_task_handle;
+static SENSOR_WAKE sensor_wake;
+static lsm6dso_sample_t samples[FIFO_MAX_SAMPLES];
+static uint32_t next_sample_us;
+static bool resampling;
+
 // To prevent false positives we smoothen the results, with readings=10 and time_between_readings=200
 // we look at 2 seconds of data + (length of window (e.g. also 2 seconds)) for the result
 
@@ -68,6 +105,19 @@ extern "C" void vApplicationMallocFailedHook(void)
     printf("%s\n", __func__);
 }
 
+/* Hooks for the run time stats counter, see FreeRTOSConfig.h. */
+extern "C" void vConfigureRunTimeCounter(void)
+{
+    mtk_os_hal_gpt_init();
+    mtk_os_hal_gpt_config(gpt_run_time, true, NULL);
+    mtk_os_hal_gpt_start(gpt_run_time);
+}
+
+extern "C" uint32_t ulGetRunTimeCounter(void)
+{
+    return mtk_os_hal_gpt_get_cur_count(gpt_run_time);
+}
+
 /* Hook for "printf". */
 extern "C" void _putchar(char character)
 {
@@ -99,13 +149,19 @@ int32_t i2c_read(int *fD, uint8_t reg, uint8_t *buf, uint16_t len)
     if (buf == NULL)
         return -1;
 
-    if (len > (I2C_MAX_LEN))
+    if (len > (I2C_RX_MAX_LEN))
         return -1;
 
-    mtk_os_hal_i2c_write_read(i2c_port_num, i2c_lsm6dso_addr,
+    /* Straight into buffers the DMA reaches, like the FIFO burst, others through i2c_rx_buf */
+    uintptr_t addr = (uintptr_t)buf;
+    if (addr >= SYSRAM_START && addr + len <= SYSRAM_END)
+        return mtk_os_hal_i2c_write_read(i2c_port_num, i2c_lsm6dso_addr,
+                        &reg, buf, 1, len);
+
+    int ret = mtk_os_hal_i2c_write_read(i2c_port_num, i2c_lsm6dso_addr,
                     &reg, i2c_rx_buf, 1, len);
     memcpy(buf, i2c_rx_buf, len);
-    return 0;
+    return ret;
 }
 
 void i2c_enum(void)
@@ -126,7 +182,7 @@ int i2c_init(void)
 {
     /* Allocate I2C buffer */
     i2c_tx_buf = (uint8_t*)pvPortMalloc(I2C_MAX_LEN);
-    i2c_rx_buf = (uint8_t*)pvPortMalloc(I2C_MAX_LEN);
+    i2c_rx_buf = (uint8_t*)pvPortMalloc(I2C_RX_MAX_LEN);
     if (i2c_tx_buf == NULL || i2c_rx_buf == NULL) {
         printf("Failed to allocate I2C buffer!\n");
         return -1;
@@ -200,6 +256,155 @@ void inference_task(void *pParameters)
     ei_classifier_smoothen_free(&smoothen);
 }
 
+// Print the heap free now and at its lowest, and the least stack each task has had left. FreeRTOS
+// fills each stack with a known value when it creates the task, the high-water mark is how much
+// of that is still untouched.
+static void print_memory_use(const TaskStatus_t *tasks, UBaseType_t count)
+{
+    printf("Memory: heap %lu free, %lu at least, of %lu; stack left at least:", (unsigned long)xPortGetFreeHeapSize(),
+           (unsigned long)xPortGetMinimumEverFreeHeapSize(), (unsigned long)configTOTAL_HEAP_SIZE);
+    for (UBaseType_t i = 0; i < count; i++) {
+        printf(" %s %lu bytes,", tasks[i].pcTaskName, (unsigned long)(tasks[i].usStackHighWaterMark * sizeof(StackType_t)));
+    }
+    printf("\n");
+}
+
+// Print each task's share of the CPU since the last report, and the load, the time the idle task
+// did not get, then memory use and the sensor FIFO counters. There is no high-level app to send it
+// to, so it goes to the debug UART.
+void load_task(void *pParameters)
+{
+    static TaskStatus_t tasks[LOAD_MAX_TASKS];
+    static TaskHandle_t previous_handles[LOAD_MAX_TASKS];
+    static uint32_t previous_run_time[LOAD_MAX_TASKS];
+    static UBaseType_t previous_count;
+    uint32_t total_run_time, previous_total = 0, idle_percent;
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(LOAD_REPORT_PERIOD_MS));
+
+        UBaseType_t count = uxTaskGetSystemState(tasks, LOAD_MAX_TASKS, &total_run_time);
+        uint32_t elapsed = total_run_time - previous_total;
+
+        if (count == 0) {
+            printf("CPU load: more than %d tasks\n", LOAD_MAX_TASKS);
+            continue;
+        }
+        print_memory_use(tasks, count);
+
+        lsm6dso_fifo_stats_t fifo;
+        lsm6dso_fifo_stats(&fifo);
+        printf("LSM6DSO FIFO: %lu bursts, %lu words, %lu overruns; woken by %lu interrupts, %lu polls, %lu fallbacks to polling\n",
+               (unsigned long)fifo.bursts, (unsigned long)fifo.words, (unsigned long)fifo.overruns,
+               (unsigned long)sensor_wake.interrupt_wakes, (unsigned long)sensor_wake.poll_wakes,
+               (unsigned long)sensor_wake.fallbacks);
+        if (elapsed == 0) {
+            continue;
+        }
+
+        idle_percent = 0;
+        printf("CPU time:");
+        for (UBaseType_t i = 0; i < count; i++) {
+            uint32_t previous = 0;
+
+            // Tasks created since the last report start from 0
+            for (UBaseType_t j = 0; j < previous_count; j++) {
+                if (previous_handles[j] == tasks[i].xHandle) {
+                    previous = previous_run_time[j];
+                }
+            }
+
+            uint32_t percent = (uint32_t)((uint64_t)(tasks[i].ulRunTimeCounter - previous) * 100 / elapsed);
+            if (tasks[i].xHandle == xTaskGetIdleTaskHandle()) {
+                idle_percent = percent;
+            }
+            printf(" %s %lu%%,", tasks[i].pcTaskName, (unsigned long)percent);
+        }
+        printf(" load %lu%% over %lu ms\n", 100 - (unsigned long)idle_percent,
+               (unsigned long)((uint64_t)elapsed * 1000 / RUN_TIME_COUNTER_HZ));
+
+        for (UBaseType_t i = 0; i < count; i++) {
+            previous_handles[i] = tasks[i].xHandle;
+            previous_run_time[i] = tasks[i].ulRunTimeCounter;
+        }
+        previous_count = count;
+        previous_total = total_run_time;
+    }
+}
+
+// Append a sample to the model's input, shifting out the oldest
+static void add_sample(const lsm6dso_sample_t *sample)
+{
+    // roll the buffer -3 points so we can overwrite the last one
+    numpy::roll(buffer, EI_CLASSIFIER_DSP_INPUT_FRAME_SIZE, -3);
+
+    buffer[EI_CLASSIFIER_DSP_INPUT_FRAME_SIZE - 3] = sample->acceleration_mg[0] / 100.0f;
+    buffer[EI_CLASSIFIER_DSP_INPUT_FRAME_SIZE - 2] = sample->acceleration_mg[1] / 100.0f;
+    buffer[EI_CLASSIFIER_DSP_INPUT_FRAME_SIZE - 1] = sample->acceleration_mg[2] / 100.0f;
+}
+
+// Samples are read from the LSM6DSO FIFO in bursts and resampled to the model's
+// EI_CLASSIFIER_INTERVAL_MS by their sensor timestamps, each interval takes the first sample at or
+// after it. When the task wakes does not change which samples the model sees.
+// Returns true if the burst was full, the FIFO may still be over the watermark.
+static bool read_fifo_burst(void)
+{
+    lsm6dso_fifo_stats_t before, after;
+
+    lsm6dso_fifo_stats(&before);
+    int count = lsm6dso_fifo_read(samples, FIFO_MAX_SAMPLES);
+    lsm6dso_fifo_stats(&after);
+
+    for (int i = 0; i < count; i++) {
+        int32_t late_us = (int32_t)(samples[i].timestamp_us - next_sample_us);
+
+        if (!resampling || late_us > FIFO_RESYNC_US || late_us < -FIFO_RESYNC_US) {
+            next_sample_us = samples[i].timestamp_us;
+            resampling = true;
+        }
+
+        while ((int32_t)(samples[i].timestamp_us - next_sample_us) >= 0) {
+            add_sample(&samples[i]);
+            next_sample_us += EI_CLASSIFIER_INTERVAL_MS * 1000;
+        }
+    }
+
+    return after.words - before.words == LSM6DSO_FIFO_BURST_WORDS;
+}
+
+// EINT handler, INT1 rose as the FIFO reached the watermark
+static void lsm6dso_int1_handler(void)
+{
+    BaseType_t woken = pdFALSE;
+
+    vTaskNotifyGiveFromISR(i2c_task_handle, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static bool wait_for_int1(uint32_t timeout_ms)
+{
+    return ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms)) > 0;
+}
+
+static const SENSOR_WAKE_PLATFORM sensor_wake_platform = { wait_for_int1 };
+
+// Route the FIFO watermark to INT1 and INT1's EINT to this task, false to poll instead
+static bool int1_init(void)
+{
+    if (LSM6DSO_INT1_EINT < 0)
+        return false;
+
+    mtk_os_hal_gpio_set_direction((os_hal_gpio_pin)LSM6DSO_INT1_EINT, OS_HAL_GPIO_DIR_INPUT);
+    if (lsm6dso_fifo_interrupt_enable())
+        return false;
+
+    if (mtk_os_hal_eint_register((eint_number)LSM6DSO_INT1_EINT, HAL_EINT_EDGE_RISING, lsm6dso_int1_handler) < 0) {
+        printf("EINT%d register failed, polling the LSM6DSO FIFO\n", LSM6DSO_INT1_EINT);
+        return false;
+    }
+    return true;
+}
+
 void i2c_task(void *pParameters)
 {
     /* Enumerate I2C Bus*/
@@ -213,20 +418,20 @@ void i2c_task(void *pParameters)
     if (lsm6dso_init((void*)i2c_write, (void*)i2c_read))
         return;
 
-    xTaskCreate(inference_task, "Inferencing Task", APP_STACK_SIZE_BYTES, NULL, 2, NULL);
+    // Before the FIFO starts, so INT1 is low and its first rising edge is the first watermark
+    sensor_wake_init(&sensor_wake, &sensor_wake_platform, FIFO_READ_PERIOD_MS, int1_init());
 
-    while (1) {
-        // roll the buffer -3 points so we can overwrite the last one
-        numpy::roll(buffer, EI_CLASSIFIER_DSP_INPUT_FRAME_SIZE, -3);
+    if (lsm6dso_fifo_start(FIFO_WATERMARK_WORDS))
+        return;
 
-        float x, y, z;
-        lsm6dso_read(&x, &y, &z);
+    xTaskCreate(inference_task, "Inferencing Task", APP_STACK_SIZE_BYTES, NULL, 2, NULL);
 
-        buffer[EI_CLASSIFIER_DSP_INPUT_FRAME_SIZE - 3] = x / 100.0f;
-        buffer[EI_CLASSIFIER_DSP_INPUT_FRAME_SIZE - 2] = y / 100.0f;
-        buffer[EI_CLASSIFIER_DSP_INPUT_FRAME_SIZE - 1] = z / 100.0f;
+    while (1) {
+        sensor_wake_wait(&sensor_wake);
 
-        vTaskDelay(pdMS_TO_TICKS(EI_CLASSIFIER_INTERVAL_MS));
+        // INT1 only rises again once the FIFO is below the watermark, after a backlog keep reading
+        while (read_fifo_burst()) {
+        }
     }
 }
 
@@ -251,7 +456,10 @@ extern "C" _Noreturn void RTCoreMain(void)
     mtk_os_hal_i2c_ctrl_init(i2c_port_num);
 
     /* Create I2C Master/Slave Task */
-    xTaskCreate(i2c_task, "I2C Task", APP_STACK_SIZE_BYTES / 4, NULL, 4, NULL);
+    xTaskCreate(i2c_task, "I2C Task", APP_STACK_SIZE_BYTES / 4, NULL, 4, &i2c_task_handle);
+
+    /* Create CPU load Task, above idle only */
+    xTaskCreate(load_task, "Load Task", APP_STACK_SIZE_BYTES / 4, NULL, 1, NULL);
 
     vTaskStartScheduler();
     for (;;)
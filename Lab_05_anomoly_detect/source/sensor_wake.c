@@ -0,0 +1,35 @@
+#include "sensor_wake.h"
+
+#include <string.h>
+
+void sensor_wake_init(SENSOR_WAKE *wake, const SENSOR_WAKE_PLATFORM *platform, uint32_t period_ms, bool interrupt_wired)
+{
+    memset(wake, 0, sizeof(*wake));
+    wake->platform = platform;
+    wake->period_ms = period_ms;
+    wake->interrupts = interrupt_wired;
+}
+
+SENSOR_WAKE_REASON sensor_wake_wait(SENSOR_WAKE *wake)
+{
+    // Waiting on the interrupt, allow a period of slack for the sensor clock running slow. Polling
+    // still returns early for an interrupt, which is how a line that starts working is noticed, so
+    // it waits long enough for the watermark to come first. Polling every period would read the
+    // FIFO just below it whenever the sensor clock runs slow, and the line would never rise.
+    uint32_t timeout_ms = wake->interrupts ? 2 * wake->period_ms : wake->period_ms * 3 / 2;
+
+    if (wake->platform->wait(timeout_ms)) {
+        wake->interrupts = true;
+        wake->missed = 0;
+        wake->interrupt_wakes++;
+        return SENSOR_WAKE_INTERRUPT;
+    }
+
+    wake->poll_wakes++;
+    if (wake->interrupts && ++wake->missed >= SENSOR_WAKE_MISSED_LIMIT) {
+        wake->interrupts = false;
+        wake->missed = 0;
+        wake->fallbacks++;
+    }
+    return SENSOR_WAKE_POLL;
+}
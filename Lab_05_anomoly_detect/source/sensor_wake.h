@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Decides when the sensor task next reads the LSM6DSO FIFO.
+//
+// With the sensor's INT1 wired to an MT3620 EINT, the FIFO watermark interrupt wakes the task as
+// soon as a burst is ready. Without it the task polls every one and a half FIFO periods instead.
+// The task also polls if no interrupt arrives for two periods, and after SENSOR_WAKE_MISSED_LIMIT
+// of those it takes the line as dead and polls until an interrupt arrives again.
+//
+// Waiting goes through SENSOR_WAKE_PLATFORM, so this also runs on a host with a simulated
+// interrupt source, see IntercoreSimulator/sensor_wake_sim.c.
+
+#define SENSOR_WAKE_MISSED_LIMIT 3
+
+typedef enum {
+    SENSOR_WAKE_INTERRUPT,
+    SENSOR_WAKE_POLL
+} SENSOR_WAKE_REASON;
+
+typedef struct {
+    bool (*wait)(uint32_t timeout_ms); // true if the interrupt handler woke it, false on timeout
+} SENSOR_WAKE_PLATFORM;
+
+typedef struct {
+    const SENSOR_WAKE_PLATFORM *platform;
+    uint32_t period_ms;  // time the sensor takes to fill the FIFO to the watermark
+    bool interrupts;     // waiting on the interrupt, false while polling
+    uint32_t missed;     // timeouts in a row while waiting on the interrupt
+    uint32_t interrupt_wakes;
+    uint32_t poll_wakes;
+    uint32_t fallbacks;  // times the line was taken as dead
+} SENSOR_WAKE;
+
+/// <summary>
+/// Start waiting on the interrupt if it is wired and registered, polling otherwise.
+/// </summary>
+void sensor_wake_init(SENSOR_WAKE *wake, const SENSOR_WAKE_PLATFORM *platform, uint32_t period_ms, bool interrupt_wired);
+
+/// <summary>
+/// Sleep until the FIFO should be read.
+/// </summary>
+SENSOR_WAKE_REASON sensor_wake_wait(SENSOR_WAKE *wake);
+
+#ifdef __cplusplus
+}
+#endif
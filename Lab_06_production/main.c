@@ -106,6 +106,27 @@ static void update_device_twins(ENVIRONMENT *env)
     }
 }
 
+/// <summary>
+/// Upper bound in milliseconds of the given percentile of the intercore latency histogram
+/// </summary>
+static int intercore_latency_percentile_ms(INTERCORE_STATS *stats, int percentile)
+{
+    unsigned int total = 0, seen = 0;
+
+    for (int i = 0; i < INTERCORE_LATENCY_BUCKETS; i++) {
+        total += stats->latency_ms[i];
+    }
+
+    for (int i = 0; i < INTERCORE_LATENCY_BUCKETS; i++) {
+        seen += stats->latency_ms[i];
+        if (total > 0 && seen * 100 >= total * (unsigned int)percentile) {
+            return 1 << i;
+        }
+    }
+
+    return 0;
+}
+
 // Validate sensor readings and publish HVAC telemetry
 static void publish_telemetry_handler(EventLoopTimer *eventLoopTimer)
 {
@@ -127,13 +148,22 @@ static void publish_telemetry_handler(EventLoopTimer *eventLoopTimer)
     } else {
         // Serialize telemetry as JSON
         // clang-format off
-        if (dx_jsonSerialize(msgBuffer, sizeof(msgBuffer), 6,                             
+        if (dx_jsonSerialize(msgBuffer, sizeof(msgBuffer), 15,                             
             DX_JSON_INT, "MsgId", msgId++, 
             DX_JSON_INT, "Temperature", env.latest.temperature, 
             DX_JSON_INT, "Pressure", env.latest.pressure,
             DX_JSON_INT, "Humidity", env.latest.humidity,
             DX_JSON_INT, "PeakUserMemoryKiB", (int)Applications_GetPeakUserModeMemoryUsageInKB(),
-            DX_JSON_INT, "TotalMemoryKiB", (int)Applications_GetTotalMemoryUsageInKB()))
+            DX_JSON_INT, "TotalMemoryKiB", (int)Applications_GetTotalMemoryUsageInKB(),
+            DX_JSON_INT, "IntercoreRecords", (int)intercore_stats.records,
+            DX_JSON_INT, "IntercoreDropped", (int)intercore_stats.dropped,
+            DX_JSON_INT, "IntercoreThrottled", (int)intercore_stats.throttled,
+            DX_JSON_INT, "IntercoreOversize", (int)intercore_stats.oversize,
+            DX_JSON_INT, "IntercoreHighWaterPct", intercore_stats.buffer_size ? (int)(intercore_stats.high_water * 100 / intercore_stats.buffer_size) : 0,
+            DX_JSON_INT, "IntercoreLatencyP50Ms", intercore_latency_percentile_ms(&intercore_stats, 50),
+            DX_JSON_INT, "IntercoreLatencyP99Ms", intercore_latency_percentile_ms(&intercore_stats, 99),
+            DX_JSON_INT, "IntercoreSampleJitterUs", (int)intercore_stats.sample_jitter_us,
+            DX_JSON_INT, "RtCpuLoadPct", rt_cpu_load_pct))
         // clang-format on
         {
             Log_Debug("%s\n", msgBuffer);
@@ -148,6 +178,172 @@ static void publish_telemetry_handler(EventLoopTimer *eventLoopTimer)
     }
 }
 
+/// <summary>
+/// Work out the real-time core's load since its previous CPU time reply and publish each thread's
+/// share. The thread names come from the real-time app, they are fixed strings in its code.
+/// </summary>
+static void process_load_reply(const INTERCORE_LOAD *load)
+{
+    size_t used;
+
+    intercore_load_previous = intercore_load;
+    intercore_load = *load;
+
+    // Nothing to compare against on the first reply, or after the real-time app restarts
+    if (intercore_load_previous.cmd != IC_READ_LOAD || intercore_load.elapsed_ms < intercore_load_previous.elapsed_ms) {
+        rt_cpu_load_pct = -1;
+        return;
+    }
+
+    rt_cpu_load_pct = intercore_load_percent(&intercore_load_previous, &intercore_load);
+
+    used = (size_t)snprintf(msgBuffer, sizeof(msgBuffer), "{\"RtCpuLoadPct\":%d,\"RtThreadLoadPct\":{", rt_cpu_load_pct);
+
+    for (unsigned int i = 0; i < intercore_load.thread_count && i < INTERCORE_LOAD_MAX_THREADS && used < sizeof(msgBuffer); i++) {
+        const char *name = intercore_load.threads[i].name;
+
+        if (name[INTERCORE_LOAD_NAME_SIZE - 1] != '\0' || !dx_isStringPrintable((char *)name) || strchr(name, '"')) {
+            continue;
+        }
+        used += (size_t)snprintf(msgBuffer + used, sizeof(msgBuffer) - used, "%s\"%s\":%d", msgBuffer[used - 1] == '{' ? "" : ",", name,
+                                 intercore_load_thread_percent(&intercore_load_previous, &intercore_load, name));
+    }
+
+    if (used + 3 > sizeof(msgBuffer)) {
+        Log_Debug("Real-time load too large to publish\n");
+        return;
+    }
+    strcpy(msgBuffer + used, "}}");
+
+    Log_Debug("%s\n", msgBuffer);
+    if (dx_isAzureConnected()) {
+        dx_azurePublish(msgBuffer, strlen(msgBuffer), messageProperties, NELEMS(messageProperties), &contentProperties);
+    }
+}
+
+/// <summary>
+/// Publish the real-time core's memory high-water marks, to size its stacks and heap from.
+/// </summary>
+static void process_memory_reply(const INTERCORE_MEMORY *memory)
+{
+    size_t used;
+
+    used = (size_t)snprintf(msgBuffer, sizeof(msgBuffer),
+                            "{\"RtHeapSize\":%u,\"RtHeapMinFree\":%u,\"RtHeapFailures\":%u,\"RtPoolSize\":%u,\"RtPoolMinFree\":%u,\"RtStacks\":{",
+                            memory->heap_size, memory->heap_min_free, memory->heap_failures, memory->pool_size, memory->pool_min_free);
+
+    for (unsigned int i = 0; i < memory->stack_count && i < INTERCORE_MEMORY_MAX_STACKS && used < sizeof(msgBuffer); i++) {
+        const INTERCORE_STACK_USAGE *stack = &memory->stacks[i];
+
+        if (stack->name[INTERCORE_MEMORY_NAME_SIZE - 1] != '\0' || !dx_isStringPrintable((char *)stack->name) || strchr(stack->name, '"')) {
+            continue;
+        }
+        used += (size_t)snprintf(msgBuffer + used, sizeof(msgBuffer) - used, "%s\"%s\":{\"Peak\":%u,\"Size\":%u}",
+                                 msgBuffer[used - 1] == '{' ? "" : ",", stack->name, stack->peak, stack->size);
+    }
+
+    if (used + 3 > sizeof(msgBuffer)) {
+        Log_Debug("Real-time memory use too large to publish\n");
+        return;
+    }
+    strcpy(msgBuffer + used, "}}");
+
+    Log_Debug("%s\n", msgBuffer);
+    if (dx_isAzureConnected()) {
+        dx_azurePublish(msgBuffer, strlen(msgBuffer), messageProperties, NELEMS(messageProperties), &contentProperties);
+    }
+}
+
+/// <summary>
+/// Send a command to the real-time core, compact encoded or as the legacy struct.
+/// Compact commands also carry any credit owed for readings taken so far.
+/// </summary>
+static void publish_intercore(INTERCORE_RECORD *record, void *legacy, size_t legacy_length)
+{
+    uint8_t wire[INTERCORE_WIRE_MAX_RECORD_SIZE];
+    int length;
+
+    if (intercore_compact) {
+        INTERCORE_RECORD compact = *record;
+
+        // A subscription's credit field is its window, not a grant
+        if (compact.cmd != IC_SUBSCRIBE_SENSOR && !(compact.fields & IC_FIELD_CREDITS) && sensor_credit.drained > 0) {
+            compact.fields |= IC_FIELD_CREDITS;
+            compact.credits = (uint16_t)sensor_credit.drained;
+        }
+
+        if ((length = intercore_encode(&compact, wire, sizeof(wire))) > 0) {
+            if (compact.fields != record->fields) {
+                intercore_flow_take(&sensor_credit);
+            }
+            dx_intercorePublish(&intercore_environment_ctx, wire, (size_t)length);
+            return;
+        }
+    }
+
+    dx_intercorePublish(&intercore_environment_ctx, legacy, legacy_length);
+}
+
+/// <summary>
+/// Grant the real-time core credit for the readings taken by this message, once enough are owed
+/// </summary>
+static void grant_sensor_credit(void)
+{
+    uint32_t credits = intercore_flow_drained(&sensor_credit, readings_drained);
+
+    readings_drained = 0;
+
+    if (credits > 0) {
+        INTERCORE_RECORD record = {.cmd = IC_GRANT_CREDIT, .fields = IC_FIELD_CREDITS, .credits = (uint16_t)credits};
+        INTERCORE_CREDIT legacy = {.cmd = IC_GRANT_CREDIT, .credits = (int)credits};
+        publish_intercore(&record, &legacy, sizeof(legacy));
+    }
+}
+
+/// <summary>
+/// Send an encoded request for intercore_rpc
+/// </summary>
+static bool intercore_rpc_send(const void *message, size_t length)
+{
+    return dx_intercorePublish(&intercore_environment_ctx, (void *)message, length);
+}
+
+/// <summary>
+/// Complete requests the real-time core has not answered in time
+/// </summary>
+static void intercore_rpc_timeout_handler(EventLoopTimer *eventLoopTimer)
+{
+    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0) {
+        dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
+        return;
+    }
+
+    intercore_rpc_expire(dx_getNowMilliseconds());
+}
+
+/// <summary>
+/// Ask the real-time core to push readings at intercore_subscribe.sample_rate_ms, replacing any
+/// earlier subscription
+/// </summary>
+static void subscribe_sensor_stream(void)
+{
+    INTERCORE_RECORD record;
+    intercore_record_from_subscribe(&intercore_subscribe, &record);
+    publish_intercore(&record, &intercore_subscribe, sizeof(intercore_subscribe));
+    intercore_flow_grant_start(&sensor_credit, (uint32_t)intercore_subscribe.credits);
+}
+
+/// <summary>
+/// Statistics, CPU time and memory use are stored as they arrive, only a missing reply needs handling here
+/// </summary>
+static void stats_reply_handler(const INTERCORE_RPC_REPLY *reply, void *context)
+{
+    if (reply->status == INTERCORE_RPC_TIMEOUT) {
+        Log_Debug("Intercore %s request timed out\n",
+                  reply->cmd == IC_READ_LOAD ? "CPU time" : reply->cmd == IC_READ_MEMORY ? "memory" : "statistics");
+    }
+}
+
 static void read_telemetry_handler(EventLoopTimer *eventLoopTimer)
 {
     if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0) {
@@ -157,8 +353,35 @@ static void read_telemetry_handler(EventLoopTimer *eventLoopTimer)
 
 #if (ENABLE_RT_ENVIROMON == 1)
 
-    intercore_block.cmd = IC_READ_SENSOR;
-    dx_intercorePublish(&intercore_environment_ctx, &intercore_block, sizeof(intercore_block));
+    // Readings are pushed by the real-time core into env.latest, so telemetry reads them without a
+    // message exchange. (Re)subscribe if no new reading has arrived recently, for example at
+    // startup or after the real-time app restarts
+    if (dx_getNowMilliseconds() - last_sensor_reading_ms > 2 * (int64_t)intercore_subscribe.sample_rate_ms) {
+        subscribe_sensor_stream();
+
+        // Alternate formats until readings arrive, older real-time apps ignore compact commands
+        intercore_compact = !intercore_compact;
+    } else {
+        // Refresh the transport statistics published with the telemetry, legacy real-time apps
+        // take no request id so the request is sent fire and forget
+        INTERCORE_RECORD record = {.cmd = IC_READ_STATS};
+        INTERCORE_BLOCK request = {.cmd = IC_READ_STATS};
+
+        if (!intercore_compact || intercore_rpc_call(&record, dx_getNowMilliseconds(), INTERCORE_RPC_TIMEOUT_MS, stats_reply_handler, NULL) < 0) {
+            publish_intercore(&record, &request, sizeof(request));
+        }
+
+        // CPU time and memory use come in their own replies, older real-time apps ignore the requests
+        record.cmd = request.cmd = IC_READ_LOAD;
+        if (!intercore_compact || intercore_rpc_call(&record, dx_getNowMilliseconds(), INTERCORE_RPC_TIMEOUT_MS, stats_reply_handler, NULL) < 0) {
+            publish_intercore(&record, &request, sizeof(request));
+        }
+
+        record.cmd = request.cmd = IC_READ_MEMORY;
+        if (!intercore_compact || intercore_rpc_call(&record, dx_getNowMilliseconds(), INTERCORE_RPC_TIMEOUT_MS, stats_reply_handler, NULL) < 0) {
+            publish_intercore(&record, &request, sizeof(request));
+        }
+    }
 
 #else
 
@@ -198,6 +421,16 @@ static void dt_set_publish_rate_handler(DX_DEVICE_TWIN_BINDING *deviceTwinBindin
     // validate data is sensible range before applying
     if (IN_RANGE(sample_rate_seconds, 0, 120)) {
         dx_timerChange(&tmr_publish_telemetry, &(struct timespec){sample_rate_seconds, 0});
+
+#if (ENABLE_RT_ENVIROMON == 1)
+        // Have the real-time core sample at the publish rate, it changes the period of its sample
+        // timer without a restart. 0 leaves the sample rate as it was
+        if (sample_rate_seconds > 0 && intercore_subscribe.sample_rate_ms != sample_rate_seconds * 1000) {
+            intercore_subscribe.sample_rate_ms = sample_rate_seconds * 1000;
+            subscribe_sensor_stream();
+        }
+#endif
+
         dx_deviceTwinAckDesiredValue(deviceTwinBinding, deviceTwinBinding->propertyValue, DX_DEVICE_TWIN_RESPONSE_COMPLETED);
     } else {
         dx_deviceTwinAckDesiredValue(deviceTwinBinding, deviceTwinBinding->propertyValue, DX_DEVICE_TWIN_RESPONSE_ERROR);
@@ -223,15 +456,29 @@ static void dt_set_panel_message_handler(DX_DEVICE_TWIN_BINDING *deviceTwinBindi
     }
 }
 
+static void target_temperature_reply_handler(const INTERCORE_RPC_REPLY *reply, void *context)
+{
+    if (reply->status == INTERCORE_RPC_OK) {
+        Log_Debug("Target temperature %d applied by the real-time core\n", reply->record.temperature_centi / 100);
+    } else {
+        Log_Debug("Target temperature not acknowledged by the real-time core\n");
+    }
+}
+
 static void dt_set_target_temperature_handler(DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
 {
     int _target_temperature = *(int *)deviceTwinBinding->propertyValue;
     if (IN_RANGE(_target_temperature, 0, 50)) {
         target_temperature = _target_temperature;
 
+        INTERCORE_RECORD record;
         intercore_block.cmd = IC_TARGET_TEMPERATURE;
         intercore_block.temperature = target_temperature;
-        dx_intercorePublish(&intercore_environment_ctx, &intercore_block, sizeof(intercore_block));
+        intercore_record_from_block(&intercore_block, &record);
+
+        if (!intercore_compact || intercore_rpc_call(&record, dx_getNowMilliseconds(), INTERCORE_RPC_TIMEOUT_MS, target_temperature_reply_handler, NULL) < 0) {
+            publish_intercore(&record, &intercore_block, sizeof(intercore_block));
+        }
 
         dx_deviceTwinAckDesiredValue(deviceTwinBinding, deviceTwinBinding->propertyValue, DX_DEVICE_TWIN_RESPONSE_COMPLETED);
     } else {
@@ -259,12 +506,16 @@ static DX_DIRECT_METHOD_RESPONSE_CODE hvac_off_handler(JSON_Value *json, DX_DIRE
  **********************************************************************************************************/
 
 /// <summary>
-/// Callback handler for Inter-Core Messaging
+/// Note a reading arrived, every one the real-time core sends takes a credit, duplicates too
 /// </summary>
-static void intercore_environment_receive_msg_handler(void *data_block, ssize_t message_length)
+static void count_environment_reading(void)
 {
-    INTERCORE_BLOCK *ic_data = (INTERCORE_BLOCK *)data_block;
+    last_sensor_reading_ms = dx_getNowMilliseconds();
+    readings_drained++;
+}
 
+static void update_environment(INTERCORE_BLOCK *ic_data)
+{
     switch (ic_data->cmd) {
     case IC_READ_SENSOR:
         env.latest.temperature = ic_data->temperature;
@@ -282,6 +533,115 @@ static void intercore_environment_receive_msg_handler(void *data_block, ssize_t
     }
 }
 
+static void process_environment_block(INTERCORE_BLOCK *ic_data)
+{
+    if (ic_data->cmd == IC_READ_SENSOR) {
+        count_environment_reading();
+    }
+    update_environment(ic_data);
+}
+
+/// <summary>
+/// Process a compact record from the real-time app, completing the request it answers
+/// </summary>
+static void process_environment_record(const INTERCORE_RECORD *record)
+{
+    INTERCORE_BLOCK block;
+
+    // Replies carry the id of the request they answer, readings are processed either way
+    intercore_rpc_complete(record);
+
+    if (record->cmd == IC_READ_SENSOR) {
+        count_environment_reading();
+    }
+
+    // env.latest mirrors the real-time core's latest reading. The same reading can arrive
+    // twice, pushed and as a reply, so apply each version once. The ring keeps order, any
+    // other version is newer, including the low versions sent after the real-time app restarts.
+    if (record->cmd == IC_READ_SENSOR && (record->fields & IC_FIELD_VERSION)) {
+        if (env.versioned && record->version == env.latest_version) {
+            return;
+        }
+        env.latest_version = record->version;
+        env.versioned = true;
+    }
+
+    intercore_record_to_block(record, &block);
+    update_environment(&block);
+}
+
+/// <summary>
+/// Callback handler for Inter-Core Messaging
+/// A batch frame carries several readings, they are all unpacked on this wakeup
+/// </summary>
+static void intercore_environment_receive_msg_handler(void *data_block, ssize_t message_length)
+{
+    INTERCORE_FRAME *frame = (INTERCORE_FRAME *)data_block;
+
+    if (message_length <= 0) {
+        return;
+    }
+
+    // Statistics replies are always legacy structs, they say nothing about the format in use
+    if (message_length >= (ssize_t)sizeof(INTERCORE_STATS) && frame->stats.cmd == IC_READ_STATS) {
+        intercore_stats = frame->stats;
+        intercore_rpc_complete_stats(&intercore_stats);
+        return;
+    }
+
+    if (message_length >= (ssize_t)sizeof(INTERCORE_LOAD) && frame->load.cmd == IC_READ_LOAD) {
+        intercore_rpc_complete_load(&frame->load);
+        process_load_reply(&frame->load);
+        return;
+    }
+
+    if (message_length >= (ssize_t)sizeof(INTERCORE_MEMORY) && frame->memory.cmd == IC_READ_MEMORY) {
+        intercore_rpc_complete_memory(&frame->memory);
+        process_memory_reply(&frame->memory);
+        return;
+    }
+
+    // Reply in whichever format the real-time app answers in, packed frames are sent only to
+    // compact peers
+    intercore_compact = intercore_is_compact(data_block, (size_t)message_length) ||
+                        intercore_is_packed(data_block, (size_t)message_length);
+
+    if (intercore_is_packed(data_block, (size_t)message_length)) {
+        static INTERCORE_RECORD records[INTERCORE_PACK_MAX_RECORDS];
+        int count = intercore_unpack_records(frame->frame, (size_t)message_length, records, INTERCORE_PACK_MAX_RECORDS);
+
+        for (int i = 0; i < count; i++) {
+            process_environment_record(&records[i]);
+        }
+    } else if (intercore_compact) {
+        // Compact records are back to back, each one says how long it is
+        INTERCORE_RECORD record;
+        int consumed;
+
+        for (size_t offset = 0; offset < (size_t)message_length; offset += (size_t)consumed) {
+            if ((consumed = intercore_decode(frame->frame + offset, (size_t)message_length - offset, &record)) < 0) {
+                break;
+            }
+            process_environment_record(&record);
+        }
+    } else if (message_length >= (ssize_t)sizeof(INTERCORE_BATCH_HEADER) && frame->batch.cmd == IC_BATCH) {
+        INTERCORE_BLOCK *records = (INTERCORE_BLOCK *)(frame->frame + sizeof(INTERCORE_BATCH_HEADER));
+        int count = (int)((size_t)message_length - sizeof(INTERCORE_BATCH_HEADER)) / (int)sizeof(INTERCORE_BLOCK);
+
+        if (frame->batch.count < count) {
+            count = frame->batch.count;
+        }
+
+        for (int i = 0; i < count; i++) {
+            process_environment_block(&records[i]);
+        }
+    } else if (message_length >= (ssize_t)sizeof(INTERCORE_BLOCK)) {
+        process_environment_block(&frame->block);
+    }
+
+    grant_sensor_credit();
+}
+
 
 /***********************************************************************************************************
  * PRODUCTION
@@ -404,6 +764,7 @@ static void InitPeripheralsAndHandlers(void)
     dx_directMethodSubscribe(direct_method_binding_sets, NELEMS(direct_method_binding_sets));
 
     dx_intercoreConnect(&intercore_environment_ctx);
+    intercore_rpc_init(intercore_rpc_send);
 
     dx_deferredUpdateRegistration(DeferredUpdateCalculate, NULL);
 
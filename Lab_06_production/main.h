@@ -9,7 +9,12 @@
 #include "dx_timer.h"
 #include "dx_utilities.h"
 #include "dx_version.h"
+#include "intercore_codec.h"
 #include "intercore_contract.h"
+#include "intercore_flow.h"
+#include "intercore_load.h"
+#include "intercore_pack.h"
+#include "intercore_rpc.h"
 
 #include <applibs/applications.h>
 #include <applibs/log.h>
@@ -23,6 +28,17 @@
 
 #define CORE_ENVIRONMENT_COMPONENT_ID "6583cf17-d321-4d72-8283-0b7c5b56442b"
 
+// Rate the real-time core pushes sensor readings at until the PublishRate twin sets one, the
+// subscription is renewed if they stop
+#define SENSOR_STREAM_RATE_MS 4000
+
+// Readings the real-time core may push ahead of this app draining them, see intercore_flow.h.
+// Out of credit it keeps only the latest reading, a stalled event loop does not overflow the ring.
+#define SENSOR_STREAM_CREDITS 8
+
+// Time the real-time core has to answer a request before it completes as timed out
+#define INTERCORE_RPC_TIMEOUT_MS 1000
+
 // Forward declarations
 static DX_DIRECT_METHOD_RESPONSE_CODE hvac_off_handler(JSON_Value *json, DX_DIRECT_METHOD_BINDING *directMethodBinding, char **responseMsg);
 static DX_DIRECT_METHOD_RESPONSE_CODE hvac_on_handler(JSON_Value *json, DX_DIRECT_METHOD_BINDING *directMethodBinding, char **responseMsg);
@@ -32,12 +48,13 @@ static void dt_set_publish_rate_handler(DX_DEVICE_TWIN_BINDING *deviceTwinBindin
 static void dt_set_target_temperature_handler(DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
 static void intercore_environment_receive_msg_handler(void *data_block, ssize_t message_length);
 static void publish_telemetry_handler(EventLoopTimer *eventLoopTimer);
+static void intercore_rpc_timeout_handler(EventLoopTimer *eventLoopTimer);
 static void read_telemetry_handler(EventLoopTimer *eventLoopTimer);
 static void watchdog_handler(EventLoopTimer *eventLoopTimer);
 
 
 // Number of bytes to allocate for the JSON telemetry message for IoT Hub/Central
-#define JSON_MESSAGE_BYTES 256
+#define JSON_MESSAGE_BYTES 512
 static char msgBuffer[JSON_MESSAGE_BYTES] = {0};
 static char display_panel_message[64];
 static int target_temperature = 0.0;
@@ -56,6 +73,8 @@ typedef struct {
     bool updated;
     HVAC_OPERATING_MODE latest_operating_mode;
     HVAC_OPERATING_MODE previous_operating_mode;
+    uint16_t latest_version; // version of the latest reading, compact readings only
+    bool versioned;
 } ENVIRONMENT;
 
 static ENVIRONMENT env;
@@ -109,6 +128,7 @@ static DX_GPIO_BINDING gpio_network_led = {.pin = NETWORK_CONNECTED_LED, .name =
 
 static DX_TIMER_BINDING tmr_read_telemetry = {.period = {4, 0}, .name = "tmr_read_telemetry", .handler = read_telemetry_handler};
 static DX_TIMER_BINDING tmr_publish_telemetry = {.period = {5, 0}, .name = "tmr_publish_telemetry", .handler = publish_telemetry_handler};
+static DX_TIMER_BINDING tmr_intercore_rpc = {.period = {0, 250000000}, .name = "tmr_intercore_rpc", .handler = intercore_rpc_timeout_handler};
 static DX_TIMER_BINDING tmr_watchdog = {.period = {30, 0}, .name = "tmr_publish_telemetry", .handler = watchdog_handler};
 // clang-format on
 
@@ -119,17 +139,34 @@ DX_DEVICE_TWIN_BINDING *device_twin_bindings[] = {&dt_utc_startup,    &dt_hvac_s
 
 DX_DIRECT_METHOD_BINDING *direct_method_binding_sets[] = {&dm_hvac_on, &dm_hvac_off, &dm_restart_hvac};
 DX_GPIO_BINDING *gpio_binding_sets[] = {&gpio_network_led, &gpio_operating_led};
-DX_TIMER_BINDING *timer_binding_sets[] = {&tmr_publish_telemetry, &tmr_read_telemetry, &tmr_watchdog};
+DX_TIMER_BINDING *timer_binding_sets[] = {&tmr_publish_telemetry, &tmr_read_telemetry, &tmr_intercore_rpc, &tmr_watchdog};
 
 
 INTERCORE_BLOCK intercore_block;
+INTERCORE_SUBSCRIBE intercore_subscribe = {
+    .cmd = IC_SUBSCRIBE_SENSOR, .sample_rate_ms = SENSOR_STREAM_RATE_MS, .flow_policy = INTERCORE_FLOW_COALESCE, .credits = SENSOR_STREAM_CREDITS,
+    .packed_frames = 1};
+// Credit owed to the real-time core for readings taken since the last grant
+static INTERCORE_FLOW_GRANT sensor_credit;
+static uint32_t readings_drained;
+static int64_t last_sensor_reading_ms = 0;
+// Send commands in the compact intercore_codec format, falls back to legacy structs if the
+// real-time app does not answer, and follows the format its readings arrive in
+static bool intercore_compact = true;
+// Large enough to receive a full batch frame from the real-time core
+INTERCORE_FRAME intercore_recv_frame;
+// Latest transport statistics from the real-time core, refreshed with IC_READ_STATS
+static INTERCORE_STATS intercore_stats;
+// Latest two CPU time replies from the real-time core, the load is the difference between them
+static INTERCORE_LOAD intercore_load, intercore_load_previous;
+static int rt_cpu_load_pct = -1;
 
 
 DX_INTERCORE_BINDING intercore_environment_ctx = {.sockFd = -1,
                                                   .nonblocking_io = true,
                                                   .rtAppComponentId = CORE_ENVIRONMENT_COMPONENT_ID,
                                                   .interCoreCallback = intercore_environment_receive_msg_handler,
-                                                  .intercore_recv_block = &intercore_block,
-                                                  .intercore_recv_block_length = sizeof(intercore_block)};
+                                                  .intercore_recv_block = &intercore_recv_frame,
+                                                  .intercore_recv_block_length = sizeof(intercore_recv_frame)};
 
 // clang-format on
\ No newline at end of file